@@ -0,0 +1,443 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runs the analyser sink of the firmware at the pace of the capture: a thread
+ * stands in for the I2S stream and the decimator and hands a period of 8 kHz
+ * samples to a queue of a few periods when it is due, a period that finds the
+ * queue full is lost like an overrun of the DMA buffers. The sink collects
+ * 25 ms frames from it and runs the detectors of the analyser on them: the
+ * energy gate, the Goertzel bank with a Hann window and the DTMF decoder.
+ *
+ * In real time no period may be lost and the sink must analyse every frame,
+ * none late or counted as dropped. The latency of a frame is the time from
+ * the end of the period with its last sample to the end of its analysis.
+ * When the analysis takes longer than a frame, the frames the sink counts as
+ * dropped must match the periods that were lost.
+ *
+ * Run it on an idle host: a thread that waits for a core for over a frame
+ * makes frames late and loses periods here just like it would on the ESP32.
+ */
+
+#include "analyser_sink.h"
+#include "dtmf_decoder.h"
+#include "energy_gate.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "goertzel_bank.h"
+#include "goertzel_window.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLE_RATE  8000
+#define FRAME_MS     25
+#define FRAME_LENGTH (FRAME_MS * SAMPLE_RATE / 1000)
+
+// The tone detector of the analyser, 10 log10 of the magnitude
+#define TONE_FREQ      200
+#define TONE_THRESHOLD 34.0f
+
+#define MAX_PERIOD 1024
+
+static int seconds    = 10;
+static int period     = 128;
+static int nr_periods = 3;
+static int overload   = 150;
+static const char *file;
+
+/* A period of the capture, stamped when its last sample arrived */
+struct period {
+	int64_t us;
+	int length; // 0 once the capture ended
+	int16_t samples[MAX_PERIOD];
+};
+
+struct capture {
+	const int16_t *samples;
+	int nr_samples;
+	QueueHandle_t queue;
+	int lost; // Periods that found the queue full
+	SemaphoreHandle_t done;
+};
+
+/* Reader of the sink, the capture side of the pipeline */
+struct reader {
+	struct capture *capture;
+	struct period current;
+	int used;        // Samples of current passed on
+	int64_t last_us; // Stamp of the period of the last sample passed on
+};
+
+static const int tone_freqs[] = { TONE_FREQ };
+
+static goertzel_weight_t window[FRAME_LENGTH];
+static goertzel_bank_t bank;
+static dtmf_decoder_t dtmf;
+static energy_gate_t gate;
+
+static struct reader reader;
+static int busy_us;         // Extra time the analysis of a frame takes
+static bool tone_on;        // The tone was detected in the last frame
+static int tone_onsets;     // Frames the tone was detected in after one it
+                            // was not
+static int nr_digits;
+static int64_t latency_sum; // Of all frames [us]
+static int64_t latency_max;
+
+static uint32_t seed = 1;
+
+static int64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(int64_t us) {
+	struct timespec ts = { us / 1000000, (long)(us % 1000000) * 1000 };
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+		;
+}
+
+static uint32_t random_next(void) {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static int16_t clip(double x) {
+	return (int16_t)(x > 32767 ? 32767 : x < -32768 ? -32768 : x);
+}
+
+/* Background noise with a 300 ms tone every second, from 0.5 s on */
+static int16_t *make_tones(int nr_samples, int *nr_tones) {
+	int16_t *samples = malloc(sizeof *samples * nr_samples);
+	if (!samples) return NULL;
+
+	*nr_tones = 0;
+	for (int s = 0; s < nr_samples; s++) {
+		int ms   = (int)((int64_t)s * 1000 / SAMPLE_RATE);
+		double x = 300.0 * (random_next() / (double)(1 << 24) - 0.5);
+		if (ms % 1000 >= 500 && ms % 1000 < 800)
+			x += 3000.0 * sin(2 * M_PI * TONE_FREQ * s / SAMPLE_RATE);
+		samples[s] = clip(x);
+	}
+	for (int ms = 500; ms + 300 <= nr_samples * 1000 / SAMPLE_RATE; ms += 1000)
+		(*nr_tones)++;
+	return samples;
+}
+
+/* Raw signed 16-bit mono samples at 8 kHz */
+static int16_t *read_file(const char *path, int *nr_samples) {
+	FILE *f = fopen(path, "rb");
+	if (!f) return NULL;
+	int16_t *samples = NULL;
+	if (!fseek(f, 0, SEEK_END)) {
+		long size   = ftell(f);
+		*nr_samples = size > 0 ? (int)(size / sizeof *samples) : 0;
+		samples     = malloc(sizeof *samples * (*nr_samples + 1));
+	}
+	if (samples) {
+		rewind(f);
+		*nr_samples = (int)fread(samples, sizeof *samples, *nr_samples, f);
+	}
+	fclose(f);
+	return samples;
+}
+
+/* The I2S stream and the decimator, a period whenever it is due */
+static void capture_task(void *args) {
+	struct capture *capture = args;
+	struct period p;
+
+	int64_t start = now_us();
+	int done      = 0;
+	while (done < capture->nr_samples) {
+		p.length = capture->nr_samples - done < period
+		               ? capture->nr_samples - done
+		               : period;
+		memcpy(p.samples, capture->samples + done,
+		       sizeof *p.samples * p.length);
+		done += p.length;
+
+		sleep_until_us(start + (int64_t)done * 1000000 / SAMPLE_RATE);
+		p.us = esp_timer_get_time();
+		if (xQueueSend(capture->queue, &p, 0) != pdTRUE) capture->lost++;
+	}
+	p.length = 0;
+	xQueueSend(capture->queue, &p, portMAX_DELAY);
+	xSemaphoreGive(capture->done);
+	vTaskDelete(NULL);
+}
+
+static audio_element_err_t reader_read(audio_element_handle_t self,
+                                       char *buffer, int length,
+                                       TickType_t ticks_to_wait,
+                                       void *context) {
+	struct reader *r = context;
+	(void)self;
+	if (r->used == r->current.length) {
+		if (xQueueReceive(r->capture->queue, &r->current, ticks_to_wait) !=
+		    pdTRUE)
+			return AEL_IO_TIMEOUT;
+		if (!r->current.length) return AEL_IO_DONE;
+		r->used = 0;
+	}
+
+	int run = length / (int)sizeof *r->current.samples;
+	if (run > r->current.length - r->used) run = r->current.length - r->used;
+	memcpy(buffer, r->current.samples + r->used, sizeof(int16_t) * run);
+	r->used    += run;
+	r->last_us  = r->current.us;
+	return run * sizeof(int16_t);
+}
+
+static void reset(void) {
+	dtmf_decoder_reset(&dtmf);
+}
+
+/* The detectors of the analyser, see analyse_frame() of audio_analyser.c */
+static esp_err_t analyse(int16_t *samples) {
+	int64_t start = esp_timer_get_time();
+
+	if (energy_gate_process(&gate, samples, FRAME_LENGTH)) {
+		float magnitude;
+		goertzel_bank_process(&bank, samples, FRAME_LENGTH);
+		if (goertzel_bank_new_magnitudes(&bank, &magnitude)) {
+			bool on = 10.0f * log10f(magnitude) > TONE_THRESHOLD;
+			if (on && !tone_on) tone_onsets++;
+			tone_on = on;
+		}
+
+		char digits[8];
+		nr_digits += dtmf_decoder_process(&dtmf, samples, FRAME_LENGTH, digits,
+		                                  sizeof digits);
+	} else {
+		tone_on = false;
+	}
+
+	while (esp_timer_get_time() - start < busy_us)
+		;
+
+	int64_t latency = esp_timer_get_time() - reader.last_us;
+	latency_sum    += latency;
+	if (latency > latency_max) latency_max = latency;
+	return ESP_OK;
+}
+
+static bool detectors_setup(void) {
+	goertzel_window_fill(GOERTZEL_WINDOW_HANN, window, FRAME_LENGTH);
+	goertzel_bank_cfg_t bank_cfg = {
+		.sample_rate   = SAMPLE_RATE,
+		.target_freqs  = tone_freqs,
+		.nr_freqs      = 1,
+		.buffer_length = FRAME_LENGTH,
+		.exact_freq    = true,
+		.window        = window,
+	};
+	if (goertzel_bank_setup(&bank, &bank_cfg) != ESP_OK) return false;
+	if (dtmf_decoder_init(&dtmf, SAMPLE_RATE) != ESP_OK) return false;
+	energy_gate_init(&gate);
+
+	tone_on     = false;
+	tone_onsets = 0;
+	nr_digits   = 0;
+	latency_sum = 0;
+	latency_max = 0;
+	return true;
+}
+
+/*
+ * Run the samples through the sink in real time with each frame analysed in
+ * at least work_us
+ */
+static bool simulate(const int16_t *samples, int nr_samples, int work_us,
+                     struct capture *capture,
+                     struct audio_analyser_stats *stats) {
+	analyser_sink_cfg_t cfg = {
+		.frame_length  = FRAME_LENGTH,
+		.frame_ms      = FRAME_MS,
+		.count_dropped = true,
+		.analyse       = analyse,
+		.reset         = reset,
+	};
+	audio_element_handle_t sink = analyser_sink_init(&cfg);
+	if (!sink || !detectors_setup()) return false;
+
+	capture->samples    = samples;
+	capture->nr_samples = nr_samples;
+	capture->lost       = 0;
+	capture->queue      = xQueueCreate(nr_periods, sizeof(struct period));
+	capture->done       = xSemaphoreCreateBinary();
+	if (!capture->queue || !capture->done) return false;
+
+	memset(&reader, 0, sizeof reader);
+	reader.capture = capture;
+	busy_us        = work_us;
+	audio_element_set_read_cb(sink, reader_read, &reader);
+
+	if (xTaskCreate(capture_task, "capture", 4096, capture, 5, NULL) != pdPASS)
+		return false;
+	while (audio_element_process(sink) > 0)
+		;
+	xSemaphoreTake(capture->done, portMAX_DELAY);
+
+	analyser_sink_get_stats(sink, stats);
+	stats->frames_skipped = gate.skipped;
+	audio_element_deinit(sink);
+	vQueueDelete(capture->queue);
+	vSemaphoreDelete(capture->done);
+	return true;
+}
+
+static int run_realtime(void) {
+	int nr_samples = seconds * SAMPLE_RATE;
+	int nr_tones   = -1;
+	int16_t *samples =
+	    file ? read_file(file, &nr_samples) : make_tones(nr_samples, &nr_tones);
+	if (!samples) {
+		if (file) fprintf(stderr, "Cannot read %s\n", file);
+		return 1;
+	}
+
+	struct capture capture;
+	struct audio_analyser_stats stats;
+	bool ran = simulate(samples, nr_samples, 0, &capture, &stats);
+	free(samples);
+	if (!ran) return 1;
+
+	bool ok = capture.lost == 0 &&
+	          (int)stats.frames == nr_samples / FRAME_LENGTH &&
+	          stats.frames_dropped == 0 && stats.frames_late == 0 &&
+	          (nr_tones < 0 || tone_onsets == nr_tones);
+	printf("realtime: %s, %u frames of %d, %u skipped, %u late, %u "
+	       "dropped, %d periods lost\n",
+	       ok ? "ok" : "FAILED", stats.frames, nr_samples / FRAME_LENGTH,
+	       stats.frames_skipped, stats.frames_late, stats.frames_dropped,
+	       capture.lost);
+	printf("  %d tones detected", tone_onsets);
+	if (nr_tones >= 0) printf(" of %d", nr_tones);
+	printf(", %d digits\n", nr_digits);
+	printf("  latency %lld us avg %lld us max, process %u us avg %u us max, "
+	       "max interval %u us\n",
+	       stats.frames ? (long long)(latency_sum / stats.frames) : 0,
+	       (long long)latency_max, stats.process_us_avg, stats.process_us_max,
+	       stats.interval_us_max);
+	return !ok;
+}
+
+/*
+ * The analysis takes overload percent of a frame, the capture overruns and
+ * the sink must count the frames that were lost as dropped
+ */
+static int run_overload(void) {
+	int nr_samples = 4 * SAMPLE_RATE;
+	int nr_tones;
+	int16_t *samples = make_tones(nr_samples, &nr_tones);
+	if (!samples) return 1;
+
+	struct capture capture;
+	struct audio_analyser_stats stats;
+	bool ran = simulate(samples, nr_samples, overload * FRAME_MS * 10,
+	                    &capture, &stats);
+	free(samples);
+	if (!ran) return 1;
+
+	// The sink estimates the dropped frames from the time between the frames
+	// it got, which the periods in the queue and the jitter of the host throw
+	// off by a few frames
+	int lost_frames = capture.lost * period / FRAME_LENGTH;
+	int slack       = 2 + nr_periods * period / FRAME_LENGTH + lost_frames / 10;
+	bool ok         = capture.lost > 0 &&
+	          abs((int)stats.frames_dropped - lost_frames) <= slack;
+	printf("overload: %s, analysis %d%% of a frame, %u frames, %u dropped, "
+	       "%d lost in %d periods\n",
+	       ok ? "ok" : "FAILED", overload, stats.frames, stats.frames_dropped,
+	       lost_frames, capture.lost);
+	return !ok;
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: analyserbench [options...]\n");
+	printf("  Runs the analyser sink of the firmware at the pace of the\n");
+	printf("  capture\n");
+	printf("  -h Show help\n");
+	printf("  -s Specify seconds of synthetic audio (default 10)\n");
+	printf("  -f Specify raw s16le mono 8 kHz file instead\n");
+	printf("  -p Specify samples per capture period (default 128)\n");
+	printf("  -n Specify periods the capture queue holds (default 3)\n");
+	printf("  -o Specify analysis time in %% of a frame for the overload "
+	       "(default 150)\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		int *value = NULL;
+		switch (argv[i][0] == '-' ? argv[i][1] : 0) {
+			case 's': value = &seconds; break;
+			case 'p': value = &period; break;
+			case 'n': value = &nr_periods; break;
+			case 'o': value = &overload; break;
+			case 'f':
+				if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+				file = argv[++i];
+				continue;
+			case 'h': help(); return EXIT_SUCCESS;
+			default:
+				fprintf(stderr, "Unknown option: %s\n", argv[i]);
+				return EXIT_FAILURE;
+		}
+		if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+		*value = atoi(argv[++i]);
+	}
+	if (seconds < 1) seconds = 1;
+	if (period < 1) period = 1;
+	if (period > MAX_PERIOD) period = MAX_PERIOD;
+	if (nr_periods < 1) nr_periods = 1;
+	if (overload < 110) overload = 110;
+
+	int failed = run_realtime();
+	failed    |= run_overload();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
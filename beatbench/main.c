@@ -0,0 +1,345 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runs the beat tracker of the firmware on synthetic tracks at 8 kHz, the
+ * rate the beat filter decimates playback to: clicks, drum patterns at
+ * several tempos and noise without a beat. Once the tracker had time to find
+ * the tempo, its beats are matched to the true beats within a tolerance. The
+ * F-measure of the matches and the tempo estimate must be right for every
+ * track with a beat, and noise must give hardly any beats.
+ *
+ * A kick and snare alternating at 160 BPM is as much 80 BPM, so the tracker
+ * may follow half or twice the tempo: its beats are then matched to the true
+ * beats of that level, and the result says which one it followed.
+ *
+ * The time the tracker takes per second of audio is scaled by how much slower
+ * the ESP32 is than the host, which must leave it below 5% of one core.
+ */
+
+#include "beat_tracker.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLE_RATE 8000
+
+// Samples the beat filter hands over at once, 512 frames at 44.1 kHz
+#define CHUNK 93
+
+// Beats are matched after the tracker listened this long
+#define SETTLE_MS 8000
+
+// Least F-measure and largest tempo error of a track with a beat
+#define MIN_F_MEASURE 0.9
+#define MAX_BPM_ERROR 0.04
+
+// Largest share of the expected beats a track without a beat may give
+#define MAX_FALSE_BEATS 0.1
+
+#define MAX_BEATS 1024
+
+static int seconds   = 30;
+static int tolerance = 70;
+static int slowdown  = 30;
+
+static uint32_t seed = 1;
+
+struct track {
+	const char *name;
+	float bpm;        // 0 for no beat
+	int16_t *samples;
+	int nr_samples;
+};
+
+static int64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t random_next(void) {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static double random_noise(void) {
+	return random_next() / (double)(1 << 23) - 1.0;
+}
+
+static int16_t clip(double x) {
+	return (int16_t)(x > 32767 ? 32767 : x < -32768 ? -32768 : x);
+}
+
+/*
+ * Sound of a hit t seconds after it started: a click, a kick (a falling sine
+ * with a thump), a snare (noise and a tone) or a hi-hat (high noise)
+ */
+enum hit { CLICK, KICK, SNARE, HAT };
+
+static double hit(enum hit type, double t, double *hp) {
+	double noise = random_noise();
+	switch (type) {
+		case CLICK: return 12000 * noise * exp(-t / 0.005);
+		case KICK:
+			return 16000 * sin(2 * M_PI * (50 + 100 * exp(-t / 0.03)) * t) *
+			       exp(-t / 0.15);
+		case SNARE:
+			return (6000 * noise + 4000 * sin(2 * M_PI * 190 * t)) *
+			       exp(-t / 0.08);
+		case HAT: {
+			// A first difference leaves the top of the noise
+			double previous = *hp;
+			*hp             = noise;
+			return 2500 * (noise - previous) * exp(-t / 0.03);
+		}
+	}
+	return 0.0;
+}
+
+/*
+ * A track at bpm: clicks on every beat, or a drum pattern of a kick on beats
+ * 1 and 3, a snare on 2 and 4 and hi-hats on the eighths over a bass line,
+ * with some noise. Without a tempo the track is noise with hits at random.
+ */
+static bool make_track(struct track *track, const char *name, float bpm,
+                       bool drums) {
+	track->name       = name;
+	track->bpm        = bpm;
+	track->nr_samples = seconds * SAMPLE_RATE;
+	track->samples    = malloc(sizeof *track->samples * track->nr_samples);
+	if (!track->samples) return false;
+
+	double beat   = bpm > 0 ? 60.0 / bpm : 0.0;
+	double hp     = 0.0;
+	double random = 0.0; // Start of the last random hit
+	for (int s = 0; s < track->nr_samples; s++) {
+		double t = (double)s / SAMPLE_RATE;
+		double x = 300 * random_noise();
+		if (bpm <= 0) {
+			if (random_next() % (SAMPLE_RATE / 3) == 0) random = t;
+			x += hit(SNARE, t - random, &hp);
+		} else if (!drums) {
+			x += hit(CLICK, fmod(t, beat), &hp);
+		} else {
+			int n       = (int)(t / beat);
+			double into = t - n * beat;
+			x += hit(n % 2 ? SNARE : KICK, into, &hp);
+			x += hit(HAT, fmod(t, beat / 2), &hp);
+			// A bass note per bar, on the fundamental of a few chords
+			static const double notes[] = { 55.0, 73.4, 65.4, 49.0 };
+			x += 3000 * sin(2 * M_PI * notes[(n / 4) % 4] * t);
+		}
+		track->samples[s] = clip(x);
+	}
+	return true;
+}
+
+/*
+ * Count the true beats every period ms from phase after SETTLE_MS in truth and
+ * return how many of them a reported beat is within tolerance of
+ */
+static int match_beats(const struct beat *beats, int nr_beats, double period,
+                       double phase, int *truth) {
+	int matched = 0;
+	*truth      = 0;
+	for (double t = ceil((SETTLE_MS - phase) / period) * period + phase;
+	     t < seconds * 1000.0 - period; t += period) {
+		(*truth)++;
+		for (int b = 0; b < nr_beats; b++) {
+			if (fabs(beats[b].time_ms - t) <= tolerance) {
+				matched++;
+				break;
+			}
+		}
+	}
+	return matched;
+}
+
+/*
+ * Feed the track in chunks like the beat filter and match the beats after
+ * SETTLE_MS to the true beats
+ */
+static int run_track(struct track *track, bool made) {
+	beat_tracker_t tracker;
+	beat_tracker_cfg_t cfg = { .sample_rate = SAMPLE_RATE, .latency_ms = 0 };
+	if (!made || beat_tracker_setup(&tracker, &cfg) != ESP_OK) return 1;
+
+	static struct beat beats[MAX_BEATS];
+	int nr_beats = 0;
+	double delay = 0.0; // Sum of how late the beats were reported [ms]
+	for (int s = 0; s < track->nr_samples; s += CHUNK) {
+		int run = track->nr_samples - s < CHUNK ? track->nr_samples - s : CHUNK;
+		int n   = beat_tracker_process(&tracker, track->samples + s, run,
+		                               beats + nr_beats, MAX_BEATS - nr_beats);
+		for (int b = nr_beats; b < nr_beats + n; b++)
+			delay += (s + run) * 1000.0 / SAMPLE_RATE - beats[b].time_ms;
+		nr_beats += n;
+	}
+	float bpm = beat_tracker_bpm(&tracker);
+	beat_tracker_free(&tracker);
+	free(track->samples);
+
+	int reported = 0;
+	for (int b = 0; b < nr_beats; b++)
+		if (beats[b].time_ms >= SETTLE_MS) reported++;
+
+	if (track->bpm <= 0) {
+		int expected = (seconds * 1000 - SETTLE_MS) / 500;
+		bool ok      = reported <= MAX_FALSE_BEATS * expected;
+		printf("%s: %s, %d beats, tempo %.1f BPM\n", track->name,
+		       ok ? "ok" : "FAILED", reported, bpm);
+		return !ok;
+	}
+
+	// The metrical level the tracker followed, the beat or half or twice it
+	double level = 1.0;
+	double error = fabs(bpm - track->bpm) / track->bpm;
+	for (int i = 0; i < 2; i++) {
+		static const double levels[] = { 0.5, 2.0 };
+		double e = fabs(bpm / (levels[i] * track->bpm) - 1.0);
+		if (e < error) {
+			level = levels[i];
+			error = e;
+		}
+	}
+
+	// Match the beats of that level, on either beat of a half tempo
+	double period = 60000.0 / (level * track->bpm);
+	int truth     = 0;
+	int matched   = 0;
+	for (int phase = 0; phase < (level < 1.0 ? 2 : 1); phase++) {
+		int t_truth;
+		int t_matched = match_beats(beats, nr_beats, period,
+		                            phase * 60000.0 / track->bpm, &t_truth);
+		if (phase == 0 || t_matched > matched) {
+			truth   = t_truth;
+			matched = t_matched;
+		}
+	}
+	double precision = reported ? (double)matched / reported : 0.0;
+	double recall    = truth ? (double)matched / truth : 0.0;
+	double f = precision + recall > 0
+	               ? 2 * precision * recall / (precision + recall)
+	               : 0.0;
+
+	bool ok = f >= MIN_F_MEASURE && error <= MAX_BPM_ERROR;
+	printf("%s: %s, F-measure %.2f (%d of %d beats, %d reported), tempo "
+	       "%.1f BPM%s, reported %.0f ms late on average\n",
+	       track->name, ok ? "ok" : "FAILED", f, matched, truth, reported, bpm,
+	       level < 1.0 ? " (half)" : level > 1.0 ? " (double)" : "",
+	       nr_beats ? delay / nr_beats : 0.0);
+	return !ok;
+}
+
+/* Share of one core the tracker takes on the ESP32 */
+static int run_load(void) {
+	struct track track;
+	if (!make_track(&track, "load", 120, true)) return 1;
+
+	beat_tracker_t tracker;
+	beat_tracker_cfg_t cfg = { .sample_rate = SAMPLE_RATE, .latency_ms = 0 };
+	if (beat_tracker_setup(&tracker, &cfg) != ESP_OK) return 1;
+
+	struct beat beats[4];
+	int64_t start = now_us();
+	for (int s = 0; s < track.nr_samples; s += CHUNK) {
+		int run = track.nr_samples - s < CHUNK ? track.nr_samples - s : CHUNK;
+		beat_tracker_process(&tracker, track.samples + s, run, beats, 4);
+	}
+	double load = (now_us() - start) / 1e6 / seconds;
+	beat_tracker_free(&tracker);
+	free(track.samples);
+
+	// Only an optimised build runs like the firmware
+#ifdef NDEBUG
+	const char *result = load * slowdown < 0.05 ? "ok" : "FAILED";
+#else
+	const char *result = "not checked in a debug build";
+#endif
+	printf("load: %s, %.3f%% of a host core, %.2f%% on an ESP32 %dx as "
+	       "slow\n",
+	       result, load * 100, load * slowdown * 100, slowdown);
+	return !strcmp(result, "FAILED");
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: beatbench [options...]\n");
+	printf("  Runs the beat tracker of the firmware on synthetic tracks\n");
+	printf("  -h Show help\n");
+	printf("  -s Specify seconds per track (default 30)\n");
+	printf("  -w Specify tolerance of a beat in ms (default 70)\n");
+	printf("  -x Specify times the ESP32 is slower than the host (default "
+	       "30)\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		int *value = NULL;
+		switch (argv[i][0] == '-' ? argv[i][1] : 0) {
+			case 's': value = &seconds; break;
+			case 'w': value = &tolerance; break;
+			case 'x': value = &slowdown; break;
+			case 'h': help(); return EXIT_SUCCESS;
+			default:
+				fprintf(stderr, "Unknown option: %s\n", argv[i]);
+				return EXIT_FAILURE;
+		}
+		if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+		*value = atoi(argv[++i]);
+	}
+	if (seconds < SETTLE_MS / 1000 + 10) seconds = SETTLE_MS / 1000 + 10;
+	if (tolerance < 1) tolerance = 1;
+	if (slowdown < 1) slowdown = 1;
+
+	struct track track;
+	int failed =
+	    run_track(&track, make_track(&track, "clicks 120", 120, false));
+	failed    |= run_track(&track, make_track(&track, "drums 100", 100, true));
+	failed    |= run_track(&track, make_track(&track, "drums 128", 128, true));
+	failed    |= run_track(&track, make_track(&track, "drums 87", 87, true));
+	failed    |= run_track(&track, make_track(&track, "drums 160", 160, true));
+	failed    |= run_track(&track, make_track(&track, "noise", 0, false));
+	failed    |= run_load();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,445 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compares the decimator of the firmware, which downmixes and filters in one
+ * pass with precomputed polyphase taps, with the chain it replaces: a downmix
+ * into a buffer of its own and a generic resampler. The resampler takes any
+ * ratio, it interpolates its taps between the phases of a finely sampled
+ * windowed sinc for every output, in float like the stock resampler.
+ *
+ * For 44.1 and 48 kHz to 8 kHz both must pass tones in the band of the
+ * detectors with their level and a low distortion and attenuate tones that
+ * would alias into it. The
+ * decimator must be faster than the chain, the time per second of audio is
+ * scaled by how much slower the ESP32 is than the host.
+ */
+
+#include "decimator.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEST_RATE 8000
+
+// Taps and prototype of the generic resampler, like those of the decimator
+#define GENERIC_TAPS   DECIMATOR_TAPS
+#define GENERIC_PHASES 256
+#define GENERIC_BETA   5.0
+#define GENERIC_CUTOFF 0.45
+
+// Seconds of each test tone, the first 0.1 s fill the filters
+#define TONE_SECONDS 1
+
+// Largest change in level of a tone in the pass band
+#define MAX_GAIN_DB 0.1
+
+static int seconds    = 60;
+static int block      = 512;
+static int slowdown   = 30;
+static int min_snr    = 60;
+static int min_reject = 50;
+
+static const int src_rates[]  = { 44100, 48000 };
+// The band of the tone and DTMF detectors, the response falls by 1 dB at 3 kHz
+static const int pass_freqs[] = { 100, 300, 697, 1000, 1633, 2000 };
+// Alias to 2 kHz or below at 8 kHz, past the transition band of the filters
+static const int stop_freqs[] = { 6000, 7000, 10000, 14000, 18000 };
+
+/* Downmix and a resampler for any ratio, one pass each */
+struct generic {
+	double step;  // Input samples per output sample
+	double next;  // Position of the next output in mono
+	float *table; // GENERIC_PHASES + 1 rows of GENERIC_TAPS taps
+	float *mono;  // Downmixed block after GENERIC_TAPS samples of history
+	int nr_mono;  // Samples in mono, the history included
+};
+
+static int64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static double bessel_i0(double x) {
+	double sum  = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 64; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum  += term;
+	}
+	return sum;
+}
+
+static void generic_clear(struct generic *g) {
+	memset(g->mono, 0, sizeof *g->mono * GENERIC_TAPS);
+	g->next    = GENERIC_TAPS - 1;
+	g->nr_mono = GENERIC_TAPS;
+}
+
+/*
+ * Row p holds the taps for an output p / GENERIC_PHASES of an input sample
+ * past the newest sample, tap k multiplies the sample k before the newest
+ */
+static bool generic_setup(struct generic *g, int src_rate) {
+	g->step  = (double)src_rate / DEST_RATE;
+	g->table = malloc(sizeof *g->table * (GENERIC_PHASES + 1) * GENERIC_TAPS);
+	g->mono  = malloc(sizeof *g->mono * (GENERIC_TAPS + block));
+	if (!g->table || !g->mono) return false;
+	generic_clear(g);
+
+	double cutoff = GENERIC_CUTOFF * DEST_RATE / src_rate;
+	double centre = GENERIC_TAPS / 2.0;
+	for (int p = 0; p <= GENERIC_PHASES; p++) {
+		for (int k = 0; k < GENERIC_TAPS; k++) {
+			double t    = k + (double)p / GENERIC_PHASES - centre;
+			double x    = 2 * M_PI * cutoff * t;
+			double sinc = t == 0.0 ? 1.0 : sin(x) / x;
+			double r    = t / centre;
+			double w    = r * r < 1.0
+			                  ? bessel_i0(GENERIC_BETA * sqrt(1 - r * r)) /
+			                        bessel_i0(GENERIC_BETA)
+			                  : 0.0;
+			g->table[p * GENERIC_TAPS + k] = (float)(2 * cutoff * sinc * w);
+		}
+	}
+	return true;
+}
+
+static void generic_free(struct generic *g) {
+	free(g->table);
+	free(g->mono);
+}
+
+static int generic_process(struct generic *g, const int16_t *input,
+                           int nr_frames, int16_t *output) {
+	for (int i = 0; i < nr_frames; i++)
+		g->mono[g->nr_mono++] = 0.5f * ((float)input[2 * i] + input[2 * i + 1]);
+
+	int nr_output = 0;
+	for (; g->next < g->nr_mono - 1; g->next += g->step) {
+		int newest   = (int)g->next;
+		double phase = (g->next - newest) * GENERIC_PHASES;
+		int row      = (int)phase;
+		float frac   = (float)(phase - row);
+
+		const float *a = &g->table[row * GENERIC_TAPS];
+		const float *b = a + GENERIC_TAPS;
+		float acc      = 0.0f;
+		for (int k = 0; k < GENERIC_TAPS; k++)
+			acc += g->mono[newest - k] * (a[k] + frac * (b[k] - a[k]));
+
+		acc = acc > 32767.0f ? 32767.0f : acc < -32768.0f ? -32768.0f : acc;
+		output[nr_output++] = (int16_t)lrintf(acc);
+	}
+
+	// Keep the history the next outputs reach back into
+	int keep = GENERIC_TAPS;
+	memmove(g->mono, g->mono + g->nr_mono - keep, sizeof *g->mono * keep);
+	g->next   -= g->nr_mono - keep;
+	g->nr_mono = keep;
+	return nr_output;
+}
+
+/* A tone of amplitude 10000 in both channels */
+static int16_t *make_tone(int src_rate, double freq, int nr_frames) {
+	int16_t *input = malloc(sizeof *input * 2 * nr_frames);
+	if (!input) return NULL;
+	for (int i = 0; i < nr_frames; i++) {
+		double x         = 10000 * sin(2 * M_PI * freq * i / src_rate);
+		input[2 * i]     = (int16_t)lrint(x);
+		input[2 * i + 1] = (int16_t)lrint(x);
+	}
+	return input;
+}
+
+/*
+ * Run the input through the decimator or, without one, the chain in blocks
+ * @return number of output samples
+ */
+static int convert(decimator_t *decimator, struct generic *g,
+                   const int16_t *input, int nr_frames, int16_t *output) {
+	int nr_output = 0;
+	for (int i = 0; i < nr_frames; i += block) {
+		int run = nr_frames - i < block ? nr_frames - i : block;
+		if (decimator)
+			nr_output += decimator_process(decimator, input + 2 * i, run,
+			                               output + nr_output);
+		else
+			nr_output += generic_process(g, input + 2 * i, run,
+			                             output + nr_output);
+	}
+	return nr_output;
+}
+
+/*
+ * Level of the output against the input in dB and the distortion and noise
+ * below the tone in dB, both after the filters filled. A tone that aliases
+ * is measured at its alias.
+ */
+static void measure(const int16_t *output, int nr_output, double freq,
+                    double *gain_db, double *snr_db) {
+	double f = fmod(freq, DEST_RATE);
+	if (f > DEST_RATE / 2) f = DEST_RATE - f;
+
+	// Least squares fit of a cos + b sin
+	int first = DEST_RATE / 10;
+	double cc = 0.0, ss = 0.0, cs = 0.0, yc = 0.0, ys = 0.0;
+	for (int n = first; n < nr_output; n++) {
+		double c = cos(2 * M_PI * f * n / DEST_RATE);
+		double s = sin(2 * M_PI * f * n / DEST_RATE);
+		cc += c * c;
+		ss += s * s;
+		cs += c * s;
+		yc += output[n] * c;
+		ys += output[n] * s;
+	}
+	double det = cc * ss - cs * cs;
+	double a   = (yc * ss - ys * cs) / det;
+	double b   = (ys * cc - yc * cs) / det;
+
+	double tone = 0.0;
+	double rest = 0.0;
+	for (int n = first; n < nr_output; n++) {
+		double fit = a * cos(2 * M_PI * f * n / DEST_RATE) +
+		             b * sin(2 * M_PI * f * n / DEST_RATE);
+		tone += fit * fit;
+		rest += (output[n] - fit) * (output[n] - fit);
+	}
+	*gain_db = 20 * log10(sqrt(a * a + b * b) / 10000 + 1e-12);
+	*snr_db  = 10 * log10(tone / (rest > 1e-9 ? rest : 1e-9));
+}
+
+/*
+ * Pass band: least SNR and largest gain error. Stop band: least rejection of
+ * a tone that aliases.
+ */
+static int run_accuracy(int src_rate) {
+	decimator_t decimator;
+	struct generic g;
+	if (decimator_setup(&decimator, src_rate, DEST_RATE) != ESP_OK ||
+	    !generic_setup(&g, src_rate))
+		return 1;
+
+	int nr_frames   = TONE_SECONDS * src_rate;
+	int16_t *output = malloc(sizeof *output *
+	                         (decimator_max_output(&decimator, nr_frames) +
+	                          nr_frames / block + 1));
+	if (!output) return 1;
+
+	int failed = 0;
+	for (int c = 0; c < 2; c++) {
+		double snr    = INFINITY;
+		double gain   = 0.0;
+		double reject = INFINITY;
+		for (size_t t = 0; t < sizeof pass_freqs / sizeof *pass_freqs +
+		                       sizeof stop_freqs / sizeof *stop_freqs;
+		     t++) {
+			bool pass   = t < sizeof pass_freqs / sizeof *pass_freqs;
+			double freq = pass ? pass_freqs[t]
+			                   : stop_freqs[t - sizeof pass_freqs /
+			                                         sizeof *pass_freqs];
+			int16_t *input = make_tone(src_rate, freq, nr_frames);
+			if (!input) return 1;
+
+			decimator_clear(&decimator);
+			generic_clear(&g);
+			int nr_output = convert(c ? NULL : &decimator, &g, input,
+			                        nr_frames, output);
+			free(input);
+
+			double gain_db, snr_db;
+			measure(output, nr_output, freq, &gain_db, &snr_db);
+			if (pass) {
+				if (snr_db < snr) snr = snr_db;
+				if (fabs(gain_db) > fabs(gain)) gain = gain_db;
+			} else if (-gain_db < reject) {
+				reject = -gain_db;
+			}
+		}
+		bool ok = snr >= min_snr && fabs(gain) <= MAX_GAIN_DB &&
+		          reject >= min_reject;
+		printf("%s %d Hz: %s, pass band %.1f dB SNR, %+.2f dB gain, stop "
+		       "band %.1f dB rejected\n",
+		       c ? "chain" : "decimator", src_rate, ok ? "ok" : "FAILED",
+		       snr, gain, reject);
+		failed |= !ok;
+	}
+
+	free(output);
+	decimator_free(&decimator);
+	generic_free(&g);
+	return failed;
+}
+
+/*
+ * A tone in one channel must give the same output as the same tone in both
+ * channels of a stereo stream
+ */
+static int run_mono(int src_rate) {
+	decimator_t decimator;
+	if (decimator_setup(&decimator, src_rate, DEST_RATE) != ESP_OK) return 1;
+
+	int nr_frames  = TONE_SECONDS * src_rate;
+	int16_t *input = make_tone(src_rate, pass_freqs[0], nr_frames);
+	int16_t *mono  = malloc(sizeof *mono * nr_frames);
+	int max_output = decimator_max_output(&decimator, nr_frames) +
+	                 nr_frames / block + 1;
+	int16_t *stereo_output = malloc(sizeof *stereo_output * max_output);
+	int16_t *mono_output   = malloc(sizeof *mono_output * max_output);
+	if (!input || !mono || !stereo_output || !mono_output) return 1;
+
+	for (int i = 0; i < nr_frames; i++) mono[i] = input[2 * i];
+	int nr_stereo = convert(&decimator, NULL, input, nr_frames, stereo_output);
+	decimator_clear(&decimator);
+	int nr_mono = 0;
+	for (int i = 0; i < nr_frames; i += block) {
+		int run = nr_frames - i < block ? nr_frames - i : block;
+		nr_mono += decimator_process_mono(&decimator, mono + i, run,
+		                                  mono_output + nr_mono);
+	}
+
+	bool ok = nr_mono == nr_stereo &&
+	          memcmp(mono_output, stereo_output,
+	                 sizeof *mono_output * nr_mono) == 0;
+	printf("mono %d Hz: %s, %d samples, %d from the same tone in stereo\n",
+	       src_rate, ok ? "ok" : "FAILED", nr_mono, nr_stereo);
+
+	free(input);
+	free(mono);
+	free(stereo_output);
+	free(mono_output);
+	decimator_free(&decimator);
+	return !ok;
+}
+
+/* Microseconds per second of audio of the decimator or the chain */
+static double run_time(int src_rate, bool fused) {
+	decimator_t decimator;
+	struct generic g;
+	if (decimator_setup(&decimator, src_rate, DEST_RATE) != ESP_OK ||
+	    !generic_setup(&g, src_rate))
+		return -1;
+
+	int nr_frames   = 10 * src_rate;
+	int16_t *input  = make_tone(src_rate, 1000, nr_frames);
+	int16_t *output = malloc(sizeof *output *
+	                         (decimator_max_output(&decimator, nr_frames) +
+	                          nr_frames / block + 1));
+	double us       = -1;
+	if (input && output) {
+		int64_t start = now_us();
+		for (int s = 0; s < seconds; s += 10)
+			convert(fused ? &decimator : NULL, &g, input, nr_frames, output);
+		us = (now_us() - start) / (double)((seconds + 9) / 10 * 10);
+	}
+
+	free(input);
+	free(output);
+	decimator_free(&decimator);
+	generic_free(&g);
+	return us;
+}
+
+static int run_throughput(int src_rate) {
+	double fused = run_time(src_rate, true);
+	double chain = run_time(src_rate, false);
+	if (fused < 0 || chain < 0) return 1;
+
+#ifdef NDEBUG
+	bool ok            = fused < chain;
+	const char *result = ok ? "ok" : "FAILED";
+#else
+	bool ok            = true;
+	const char *result = "not checked in a debug build";
+#endif
+	printf("throughput %d Hz: %s, decimator %.0f us, chain %.0f us per "
+	       "second, %.1fx as fast\n",
+	       src_rate, result, fused, chain, chain / fused);
+	printf("  %.2f%% and %.2f%% on an ESP32 %dx as slow\n",
+	       fused * slowdown / 1e4, chain * slowdown / 1e4, slowdown);
+	return !ok;
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: decimatorbench [options...]\n");
+	printf("  Compares the decimator of the firmware with a downmix and a\n");
+	printf("  generic resampler\n");
+	printf("  -h Show help\n");
+	printf("  -s Specify seconds of audio for the throughput (default 60)\n");
+	printf("  -b Specify frames per block (default 512)\n");
+	printf("  -x Specify times the ESP32 is slower than the host (default "
+	       "30)\n");
+	printf("  -n Specify least pass band SNR in dB (default 60)\n");
+	printf("  -r Specify least stop band rejection in dB (default 50)\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		int *value = NULL;
+		switch (argv[i][0] == '-' ? argv[i][1] : 0) {
+			case 's': value = &seconds; break;
+			case 'b': value = &block; break;
+			case 'x': value = &slowdown; break;
+			case 'n': value = &min_snr; break;
+			case 'r': value = &min_reject; break;
+			case 'h': help(); return EXIT_SUCCESS;
+			default:
+				fprintf(stderr, "Unknown option: %s\n", argv[i]);
+				return EXIT_FAILURE;
+		}
+		if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+		*value = atoi(argv[++i]);
+	}
+	if (seconds < 10) seconds = 10;
+	if (block < 1) block = 1;
+	if (slowdown < 1) slowdown = 1;
+
+	int failed = 0;
+	for (size_t r = 0; r < sizeof src_rates / sizeof *src_rates; r++) {
+		failed |= run_accuracy(src_rates[r]);
+		failed |= run_mono(src_rates[r]);
+		failed |= run_throughput(src_rates[r]);
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,282 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runs the DTMF decoder of the firmware on synthetic recordings at 8 kHz:
+ * random keys with pauses of random length, so the key presses fall anywhere
+ * in the blocks of the decoder. Every key must be decoded once, in order,
+ * when the tones are clean, in noise and with twist. Noise and a voice, a
+ * pitch with its harmonics, must not give any digit.
+ *
+ * The time the decoder takes per second of audio is scaled by how much slower
+ * the ESP32 is than the host, which must leave it below 5% of one core.
+ */
+
+#include "dtmf_decoder.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLE_RATE 8000
+
+static int nr_keys  = 200;
+static int tone_ms  = 50;
+static int pause_ms = 50;
+static int snr_db   = 12;
+static int twist_db = 4;
+static int slowdown = 30;
+static int seconds  = 600;
+
+static const char keys[] = "123A456B789C*0#D";
+static const int rows[]  = { 697, 770, 852, 941 };
+static const int cols[]  = { 1209, 1336, 1477, 1633 };
+
+static uint32_t seed = 1;
+
+struct recording {
+	int16_t *samples;
+	int nr_samples;
+	char sent[1024];
+	int nr_sent;
+};
+
+static int64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t random_next(void) {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+/* Noise of about unit RMS, the sum of uniform values */
+static double random_noise(void) {
+	double sum = 0.0;
+	for (int i = 0; i < 3; i++) sum += random_next() / (double)(1 << 24) - 0.5;
+	return sum * 2.0;
+}
+
+static int16_t clip(double x) {
+	return (int16_t)(x > 32767 ? 32767 : x < -32768 ? -32768 : x);
+}
+
+/*
+ * Keys with a row tone of amplitude level and a column tone twist_db above
+ * it, in noise noise_db below the tones
+ */
+static bool make_keys(struct recording *rec, double level, int twist,
+                      int noise_db) {
+	int longest = (tone_ms + 2 * pause_ms) * SAMPLE_RATE / 1000;
+	rec->nr_sent =
+	    nr_keys < (int)sizeof rec->sent ? nr_keys : (int)sizeof rec->sent;
+	rec->samples =
+	    malloc(sizeof *rec->samples * longest * (rec->nr_sent + 1));
+	rec->nr_samples = 0;
+	if (!rec->samples) return false;
+
+	// Tones of amplitude A have a power of A^2 / 2 each
+	double column = level * pow(10.0, twist / 20.0);
+	double noise  = sqrt((level * level + column * column) / 2) *
+	               pow(10.0, -noise_db / 20.0);
+	for (int k = 0; k <= rec->nr_sent; k++) {
+		int pause = (pause_ms + (int)(random_next() % (pause_ms + 1))) *
+		            SAMPLE_RATE / 1000;
+		int tone  = k < rec->nr_sent ? tone_ms * SAMPLE_RATE / 1000 : 0;
+		int key   = random_next() % 16;
+
+		double row_phase = random_next() / (double)(1 << 24) * 2 * M_PI;
+		double col_phase = random_next() / (double)(1 << 24) * 2 * M_PI;
+		for (int s = 0; s < pause + tone; s++) {
+			double x = noise * random_noise();
+			if (s >= pause) {
+				double t = (double)(s - pause) / SAMPLE_RATE;
+				x += level * sin(2 * M_PI * rows[key / 4] * t + row_phase) +
+				     column * sin(2 * M_PI * cols[key % 4] * t + col_phase);
+			}
+			rec->samples[rec->nr_samples++] = clip(x);
+		}
+		if (k < rec->nr_sent) rec->sent[k] = keys[key];
+	}
+	return true;
+}
+
+/* A voice: a pitch that glides between 100 and 250 Hz with 20 harmonics */
+static bool make_voice(struct recording *rec, int length_s) {
+	rec->nr_sent    = 0;
+	rec->nr_samples = length_s * SAMPLE_RATE;
+	rec->samples    = malloc(sizeof *rec->samples * rec->nr_samples);
+	if (!rec->samples) return false;
+
+	double phase = 0.0;
+	for (int s = 0; s < rec->nr_samples; s++) {
+		double t     = (double)s / SAMPLE_RATE;
+		double pitch = 175 + 75 * sin(2 * M_PI * 0.7 * t);
+		double x     = 0.0;
+		phase       += 2 * M_PI * pitch / SAMPLE_RATE;
+		for (int h = 1; h <= 20 && h * pitch < SAMPLE_RATE / 2; h++)
+			x += 4000.0 / h * sin(h * phase);
+		rec->samples[s] = clip(x * (0.6 + 0.4 * sin(2 * M_PI * 3 * t)));
+	}
+	return true;
+}
+
+/* Noise only, at the level of the noisy keys */
+static bool make_noise(struct recording *rec, int length_s) {
+	rec->nr_sent    = 0;
+	rec->nr_samples = length_s * SAMPLE_RATE;
+	rec->samples    = malloc(sizeof *rec->samples * rec->nr_samples);
+	if (!rec->samples) return false;
+
+	for (int s = 0; s < rec->nr_samples; s++)
+		rec->samples[s] = clip(3000 * random_noise());
+	return true;
+}
+
+/* Decode in the frames of the analyser, 20 ms each */
+static int decode(const struct recording *rec, char *digits, int max_digits) {
+	dtmf_decoder_t decoder;
+	if (dtmf_decoder_init(&decoder, SAMPLE_RATE) != ESP_OK) return -1;
+
+	const int frame = 20 * SAMPLE_RATE / 1000;
+	int nr_digits   = 0;
+	for (int s = 0; s < rec->nr_samples; s += frame) {
+		int run = rec->nr_samples - s < frame ? rec->nr_samples - s : frame;
+		nr_digits += dtmf_decoder_process(&decoder, rec->samples + s, run,
+		                                  digits + nr_digits,
+		                                  max_digits - nr_digits);
+	}
+	return nr_digits;
+}
+
+static int check(const char *name, struct recording *rec, bool made) {
+	char digits[1024];
+	int nr_digits = made ? decode(rec, digits, sizeof digits) : -1;
+	bool ok       = nr_digits == rec->nr_sent &&
+	          !memcmp(digits, rec->sent, rec->nr_sent);
+	printf("%s: %s, %d keys, %d digits decoded\n", name, ok ? "ok" : "FAILED",
+	       rec->nr_sent, nr_digits);
+	free(rec->samples);
+	return !ok;
+}
+
+/* Share of one core the decoder takes on the ESP32 */
+static int run_load(void) {
+	struct recording rec;
+	if (!make_voice(&rec, 10)) return 1;
+
+	dtmf_decoder_t decoder;
+	dtmf_decoder_init(&decoder, SAMPLE_RATE);
+	int64_t start = now_us();
+	int64_t done  = 0;
+	char digits[16];
+	while (done < (int64_t)seconds * SAMPLE_RATE) {
+		dtmf_decoder_process(&decoder, rec.samples, rec.nr_samples, digits,
+		                     sizeof digits);
+		done += rec.nr_samples;
+	}
+	double load = (now_us() - start) / 1e6 / ((double)done / SAMPLE_RATE);
+	free(rec.samples);
+
+	// Only an optimised build runs like the firmware
+#ifdef NDEBUG
+	const char *result = load * slowdown < 0.05 ? "ok" : "FAILED";
+#else
+	const char *result = "not checked in a debug build";
+#endif
+	printf("load: %s, %.3f%% of a host core, %.2f%% on an ESP32 %dx as "
+	       "slow\n",
+	       result, load * 100, load * slowdown * 100, slowdown);
+	return !strcmp(result, "FAILED");
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: dtmfbench [options...]\n");
+	printf("  Runs the DTMF decoder of the firmware on synthetic key\n");
+	printf("  presses, noise and voice\n");
+	printf("  -h Show help\n");
+	printf("  -k Specify keys per recording (default 200)\n");
+	printf("  -d Specify duration of a key press in ms (default 50)\n");
+	printf("  -p Specify shortest pause between keys in ms (default 50)\n");
+	printf("  -n Specify tones above the noise in dB (default 12)\n");
+	printf("  -t Specify twist of the columns in dB (default 4)\n");
+	printf("  -x Specify times the ESP32 is slower than the host (default "
+	       "30)\n");
+	printf("  -s Specify seconds of audio for the load (default 600)\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		int *value = NULL;
+		switch (argv[i][0] == '-' ? argv[i][1] : 0) {
+			case 'k': value = &nr_keys; break;
+			case 'd': value = &tone_ms; break;
+			case 'p': value = &pause_ms; break;
+			case 'n': value = &snr_db; break;
+			case 't': value = &twist_db; break;
+			case 'x': value = &slowdown; break;
+			case 's': value = &seconds; break;
+			case 'h': help(); return EXIT_SUCCESS;
+			default:
+				fprintf(stderr, "Unknown option: %s\n", argv[i]);
+				return EXIT_FAILURE;
+		}
+		if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+		*value = atoi(argv[++i]);
+	}
+	if (nr_keys < 1) nr_keys = 1;
+	if (tone_ms < 1) tone_ms = 1;
+	if (pause_ms < 1) pause_ms = 1;
+	if (slowdown < 1) slowdown = 1;
+	if (seconds < 1) seconds = 1;
+
+	struct recording rec;
+	int failed = check("clean", &rec, make_keys(&rec, 6000, 0, 60));
+	failed    |= check("noisy", &rec, make_keys(&rec, 3000, 0, snr_db));
+	failed    |= check("twist", &rec, make_keys(&rec, 2000, twist_db, 30));
+	failed    |= check("noise", &rec, make_noise(&rec, 60));
+	failed    |= check("voice", &rec, make_voice(&rec, 60));
+	failed    |= run_load();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
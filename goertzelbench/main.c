@@ -0,0 +1,542 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runs the Goertzel filters of the firmware on a synthetic recording: a few
+ * tones and noise, at the sample rate of the analyser. The bank must give the
+ * magnitudes of the separate filters, and should process more samples per
+ * second than the separate filters do for the same frequencies.
+ *
+ * goertzelbench_fixed is built with CONFIG_GOERTZEL_FIXED_POINT. Both check
+ * the magnitudes of every block against a Goertzel filter in double precision,
+ * the fixed-point filters must stay within the error bound of
+ * goertzel_filter.h. Their throughput is compared by running both.
+ *
+ * The sliding filters are set up like the analyser does, with the Hann window
+ * of the bank. A tone starts at a random sample after noise, both must detect
+ * it and the sliding filter must do so sooner than the blocks of the bank.
+ *
+ * Last, a sweep of the telephone band for frame lengths of 10 to 50 ms and
+ * each window. With the exact bin a tone must keep its magnitude at any
+ * frequency, and Hann must leak less of the tones around it than no window.
+ */
+
+#include "goertzel_bank.h"
+#include "goertzel_sliding.h"
+#include "goertzel_window.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static int sample_rate   = 8000;
+static int buffer_length = 400;
+static int nr_freqs      = 16;
+static int seconds       = 600;
+static int trials        = 100;
+
+static int16_t *recording;
+static int nr_samples;
+
+#ifdef CONFIG_GOERTZEL_FIXED_POINT
+static const char *arithmetic = "fixed point";
+#else
+static const char *arithmetic = "float";
+#endif
+
+static int64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Watch frequencies spread over the telephone band */
+static int target_freq(int f) {
+	return 300 + f * 3100 / GOERTZEL_BANK_MAX_FREQS;
+}
+
+/* A few seconds of tones and noise, played repeatedly */
+static bool make_recording(void) {
+	nr_samples = 10 * sample_rate / buffer_length * buffer_length;
+	recording  = malloc(sizeof *recording * nr_samples);
+	if (!recording) return false;
+
+	uint32_t noise = 1;
+	for (int s = 0; s < nr_samples; s++) {
+		noise        = noise * 1103515245 + 12345;
+		double t     = (double)s / sample_rate;
+		double x     = 6000 * sin(2 * M_PI * target_freq(3) * t) +
+		               4000 * sin(2 * M_PI * 1234.5 * t) +
+		               (double)(int16_t)(noise >> 16) / 8;
+		recording[s] = (int16_t)x;
+	}
+	return true;
+}
+
+/* Samples per second of the separate filters, one pass per frequency */
+static double run_filters(float *magnitudes) {
+	goertzel_filter_data_t filters[GOERTZEL_BANK_MAX_FREQS];
+	for (int f = 0; f < nr_freqs; f++) {
+		goertzel_filter_cfg_t cfg = {
+			.sample_rate   = sample_rate,
+			.target_freq   = target_freq(f),
+			.buffer_length = buffer_length,
+		};
+		goertzel_filter_setup(&filters[f], &cfg);
+	}
+
+	int64_t start = now_us();
+	int64_t done  = 0;
+	while (done < (int64_t)seconds * sample_rate) {
+		for (int s = 0; s < nr_samples; s += buffer_length) {
+			for (int f = 0; f < nr_freqs; f++) {
+				goertzel_filter_process(&filters[f], recording + s,
+				                        buffer_length);
+				goertzel_filter_new_magnitude(&filters[f], &magnitudes[f]);
+			}
+		}
+		done += nr_samples;
+	}
+	return done * 1e6 / (double)(now_us() - start);
+}
+
+/* Samples per second of the bank, one pass for every frequency */
+static double run_bank(float *magnitudes) {
+	int freqs[GOERTZEL_BANK_MAX_FREQS];
+	for (int f = 0; f < nr_freqs; f++) freqs[f] = target_freq(f);
+	goertzel_bank_cfg_t cfg = {
+		.sample_rate   = sample_rate,
+		.target_freqs  = freqs,
+		.nr_freqs      = nr_freqs,
+		.buffer_length = buffer_length,
+	};
+	goertzel_bank_t bank;
+	if (goertzel_bank_setup(&bank, &cfg) != ESP_OK) return 0.0;
+
+	int64_t start = now_us();
+	int64_t done  = 0;
+	while (done < (int64_t)seconds * sample_rate) {
+		for (int s = 0; s < nr_samples; s += buffer_length) {
+			goertzel_bank_process(&bank, recording + s, buffer_length);
+			goertzel_bank_new_magnitudes(&bank, magnitudes);
+		}
+		done += nr_samples;
+	}
+	return done * 1e6 / (double)(now_us() - start);
+}
+
+static int run_throughput(void) {
+	float separate[GOERTZEL_BANK_MAX_FREQS];
+	float together[GOERTZEL_BANK_MAX_FREQS];
+	double filters_rate = run_filters(separate);
+	double bank_rate    = run_bank(together);
+
+	// Both run the same float recurrence, only the order of the sums differs
+	bool same = bank_rate > 0.0;
+	for (int f = 0; f < nr_freqs; f++)
+		same &= fabsf(together[f] - separate[f]) <=
+		        1e-4f * fmaxf(separate[f], 32767.0f);
+	printf("%s, %d frequencies, %d samples per block, %d s of audio\n",
+	       arithmetic, nr_freqs, buffer_length, seconds);
+	printf("  filters: %.2f Msamples/s\n", filters_rate / 1e6);
+	printf("  bank: %.2f Msamples/s, %.1fx\n", bank_rate / 1e6,
+	       bank_rate / filters_rate);
+	printf("  same magnitudes: %s\n", same ? "ok" : "FAILED");
+	return !same;
+}
+
+/* Magnitude of a block from the recurrence in double precision */
+static double reference_magnitude(const int16_t *samples, int freq) {
+	double bin         = (double)buffer_length * freq / sample_rate;
+	double coefficient = 2.0 * cos(2.0 * M_PI * (int)(0.5 + bin) /
+	                               buffer_length);
+
+	double q1 = 0.0, q2 = 0.0;
+	for (int s = 0; s < buffer_length; s++) {
+		double q0 = samples[s] + coefficient * q1 - q2;
+		q2        = q1;
+		q1        = q0;
+	}
+	return sqrt(q1 * q1 + q2 * q2 - q1 * q2 * coefficient);
+}
+
+/* Largest error of any block, relative to the magnitude of a full scale tone */
+static int run_accuracy(void) {
+	goertzel_filter_data_t filters[GOERTZEL_BANK_MAX_FREQS];
+	int freqs[GOERTZEL_BANK_MAX_FREQS];
+	for (int f = 0; f < nr_freqs; f++) {
+		freqs[f]                  = target_freq(f);
+		goertzel_filter_cfg_t cfg = {
+			.sample_rate   = sample_rate,
+			.target_freq   = freqs[f],
+			.buffer_length = buffer_length,
+		};
+		if (goertzel_filter_setup(&filters[f], &cfg) != ESP_OK) {
+			printf("%s accuracy: FAILED, %d Hz could overflow\n", arithmetic,
+			       freqs[f]);
+			return 1;
+		}
+	}
+	goertzel_bank_cfg_t cfg = {
+		.sample_rate   = sample_rate,
+		.target_freqs  = freqs,
+		.nr_freqs      = nr_freqs,
+		.buffer_length = buffer_length,
+	};
+	goertzel_bank_t bank;
+	if (goertzel_bank_setup(&bank, &cfg) != ESP_OK) return 1;
+
+	double full_scale   = 32767.0 * buffer_length / 2;
+	double filter_error = 0.0;
+	double bank_error   = 0.0;
+	for (int s = 0; s + buffer_length <= nr_samples; s += buffer_length) {
+		float magnitudes[GOERTZEL_BANK_MAX_FREQS];
+		goertzel_bank_process(&bank, recording + s, buffer_length);
+		goertzel_bank_new_magnitudes(&bank, magnitudes);
+		for (int f = 0; f < nr_freqs; f++) {
+			float magnitude;
+			goertzel_filter_process(&filters[f], recording + s,
+			                        buffer_length);
+			goertzel_filter_new_magnitude(&filters[f], &magnitude);
+
+			double reference = reference_magnitude(recording + s, freqs[f]);
+			filter_error = fmax(filter_error, fabs(magnitude - reference));
+			bank_error   = fmax(bank_error, fabs(magnitudes[f] - reference));
+		}
+	}
+	filter_error /= full_scale;
+	bank_error   /= full_scale;
+
+	// The bound of goertzel_filter.h for the fixed-point filters
+	bool ok = filter_error < 1e-3 && bank_error < 1e-3;
+	printf("%s accuracy: %s, largest error of the filters %.1e, of the bank "
+	       "%.1e of a full scale tone\n",
+	       arithmetic, ok ? "ok" : "FAILED", filter_error, bank_error);
+	return !ok;
+}
+
+/* Noise, then a tone that starts at onset and lasts two blocks */
+static int16_t *make_onset(int onset, int freq, uint32_t *noise) {
+	int length      = onset + 2 * buffer_length;
+	int16_t *signal = malloc(sizeof *signal * length);
+	if (!signal) return NULL;
+	for (int s = 0; s < length; s++) {
+		*noise   = *noise * 1103515245 + 12345;
+		double x = (double)(int16_t)(*noise >> 16) / 8;
+		if (s >= onset)
+			x += 8000 * sin(2 * M_PI * freq * (s - onset) / sample_rate);
+		signal[s] = (int16_t)x;
+	}
+	return signal;
+}
+
+/* Samples from the onset until the first block that ends above threshold */
+static int block_latency(goertzel_bank_t *bank, const int16_t *signal,
+                         int onset, float threshold) {
+	goertzel_bank_clear(bank);
+	for (int s = 0; s + buffer_length <= onset + 2 * buffer_length;
+	     s += buffer_length) {
+		float magnitude;
+		goertzel_bank_process(bank, signal + s, buffer_length);
+		if (goertzel_bank_new_magnitudes(bank, &magnitude) &&
+		    magnitude > threshold && s + buffer_length > onset)
+			return s + buffer_length - onset;
+	}
+	return -1;
+}
+
+/* Samples from the onset until the sliding filter detects the tone */
+static int sliding_latency(goertzel_sliding_t *sliding, const int16_t *signal,
+                           int onset) {
+	goertzel_sliding_clear(sliding);
+	int detected = goertzel_sliding_process(sliding, signal,
+	                                        onset + 2 * buffer_length);
+	return detected >= onset ? detected + 1 - onset : -1;
+}
+
+/* Time per second of audio to watch every frequency, in blocks or sliding */
+static void run_cpu(const goertzel_weight_t *window, float threshold,
+                    double *block_us, double *sliding_us) {
+	int freqs[GOERTZEL_BANK_MAX_FREQS];
+	goertzel_sliding_t sliding[GOERTZEL_BANK_MAX_FREQS];
+	for (int f = 0; f < nr_freqs; f++) {
+		freqs[f]                  = target_freq(f);
+		goertzel_sliding_cfg_t sc = {
+			.sample_rate   = sample_rate,
+			.target_freq   = freqs[f],
+			.buffer_length = buffer_length,
+			.threshold     = threshold,
+			.exact_freq    = true,
+			.window        = GOERTZEL_WINDOW_HANN,
+		};
+		goertzel_sliding_setup(&sliding[f], &sc);
+	}
+	goertzel_bank_cfg_t cfg = {
+		.sample_rate   = sample_rate,
+		.target_freqs  = freqs,
+		.nr_freqs      = nr_freqs,
+		.buffer_length = buffer_length,
+		.exact_freq    = true,
+		.window        = window,
+	};
+	goertzel_bank_t bank;
+	goertzel_bank_setup(&bank, &cfg);
+
+	int64_t start = now_us();
+	int64_t done  = 0;
+	while (done < (int64_t)seconds * sample_rate) {
+		float magnitudes[GOERTZEL_BANK_MAX_FREQS];
+		goertzel_bank_process(&bank, recording, nr_samples);
+		goertzel_bank_new_magnitudes(&bank, magnitudes);
+		done += nr_samples;
+	}
+	*block_us = (now_us() - start) * (double)sample_rate / done;
+
+	start = now_us();
+	done  = 0;
+	while (done < (int64_t)seconds * sample_rate) {
+		for (int f = 0; f < nr_freqs; f++)
+			goertzel_sliding_process(&sliding[f], recording, nr_samples);
+		done += nr_samples;
+	}
+	*sliding_us = (now_us() - start) * (double)sample_rate / done;
+
+	for (int f = 0; f < nr_freqs; f++) goertzel_sliding_free(&sliding[f]);
+}
+
+static int run_sliding(void) {
+	goertzel_weight_t *window = malloc(sizeof *window * buffer_length);
+	if (!window) return 1;
+	float gain = goertzel_window_fill(GOERTZEL_WINDOW_HANN, window,
+	                                  buffer_length);
+
+	// Detect the tone once it reaches half its magnitude
+	int freq        = target_freq(3);
+	float threshold = 0.5f * 8000 * buffer_length / 2 * gain;
+
+	goertzel_bank_cfg_t cfg = {
+		.sample_rate   = sample_rate,
+		.target_freqs  = &freq,
+		.nr_freqs      = 1,
+		.buffer_length = buffer_length,
+		.exact_freq    = true,
+		.window        = window,
+	};
+	goertzel_sliding_cfg_t sliding_cfg = {
+		.sample_rate   = sample_rate,
+		.target_freq   = freq,
+		.buffer_length = buffer_length,
+		.threshold     = threshold,
+		.exact_freq    = true,
+		.window        = GOERTZEL_WINDOW_HANN,
+	};
+	goertzel_bank_t bank;
+	goertzel_sliding_t sliding;
+	if (goertzel_bank_setup(&bank, &cfg) != ESP_OK ||
+	    goertzel_sliding_setup(&sliding, &sliding_cfg) != ESP_OK) {
+		free(window);
+		return 1;
+	}
+
+	uint32_t noise      = 2;
+	int missed          = 0;
+	int64_t block_total = 0, sliding_total = 0;
+	int block_max       = 0, sliding_max = 0;
+	for (int t = 0; t < trials; t++) {
+		noise           = noise * 1103515245 + 12345;
+		int onset       = 2 * buffer_length + (noise >> 16) % buffer_length;
+		int16_t *signal = make_onset(onset, freq, &noise);
+		if (!signal) break;
+		int block  = block_latency(&bank, signal, onset, threshold);
+		int slides = sliding_latency(&sliding, signal, onset);
+		free(signal);
+		if (block < 0 || slides < 0) {
+			missed++;
+			continue;
+		}
+		block_total   += block;
+		sliding_total += slides;
+		if (block > block_max) block_max = block;
+		if (slides > sliding_max) sliding_max = slides;
+	}
+	goertzel_sliding_free(&sliding);
+
+	double block_us, sliding_us;
+	run_cpu(window, threshold, &block_us, &sliding_us);
+	free(window);
+
+	double ms = 1000.0 / sample_rate;
+	int found = trials - missed;
+	bool ok   = !missed && sliding_total < block_total;
+	printf("sliding: %s, %d of %d onsets at %d Hz detected\n",
+	       ok ? "ok" : "FAILED", found, trials, freq);
+	printf("  blocks: latency %.1f ms on average, %.1f ms at most, %.0f us "
+	       "per s of audio\n",
+	       found ? block_total * ms / found : 0.0, block_max * ms, block_us);
+	printf("  sliding: latency %.1f ms on average, %.1f ms at most, %.0f us "
+	       "per s of audio\n",
+	       found ? sliding_total * ms / found : 0.0, sliding_max * ms,
+	       sliding_us);
+	return !ok;
+}
+
+/* Magnitude of a block of a tone at tone_freq in the bin of freq */
+static float tone_magnitude(int length, enum goertzel_window window,
+                            const goertzel_weight_t *table, bool exact_freq,
+                            int freq, int tone_freq) {
+	int16_t *tone = malloc(sizeof *tone * length);
+	if (!tone) return 0.0f;
+	for (int s = 0; s < length; s++)
+		tone[s] = (int16_t)(8000 * sin(2 * M_PI * tone_freq * s / sample_rate));
+
+	goertzel_bank_cfg_t cfg = {
+		.sample_rate   = sample_rate,
+		.target_freqs  = &freq,
+		.nr_freqs      = 1,
+		.buffer_length = length,
+		.exact_freq    = exact_freq,
+		.window        = window == GOERTZEL_WINDOW_RECTANGULAR ? NULL : table,
+	};
+	goertzel_bank_t bank;
+	float magnitude = 0.0f;
+	if (goertzel_bank_setup(&bank, &cfg) == ESP_OK) {
+		goertzel_bank_process(&bank, tone, length);
+		goertzel_bank_new_magnitudes(&bank, &magnitude);
+	}
+	free(tone);
+	return magnitude;
+}
+
+/*
+ * Sweep the telephone band for every frame length and window: the loss of a
+ * tone on the frequency, and the leakage of tones a few bins of the shortest
+ * frame above it, in dB of the magnitude the tone should have
+ */
+static int run_sweep(void) {
+	static const int frame_ms[] = { 10, 20, 25, 50 };
+	static const char *const names[] = { "rectangular", "hann", "blackman" };
+	const int nr_frames              = sizeof frame_ms / sizeof *frame_ms;
+	const int away                   = 250;
+	const int spread                 = 100;
+	int failed                       = 0;
+
+	printf("sweep of 300 to %d Hz, leakage of tones %d to %d Hz above\n",
+	       3400 - away - spread, away, away + spread);
+	for (int m = 0; m < nr_frames; m++) {
+		int length               = frame_ms[m] * sample_rate / 1000;
+		goertzel_weight_t *table = malloc(sizeof *table * length);
+		float leakage[3]         = { -INFINITY, -INFINITY, -INFINITY };
+		if (!table) return 1;
+		for (int w = 0; w < 3; w++) {
+			float gain    = goertzel_window_fill(w, table, length);
+			float expect  = 8000.0f * length / 2 * gain;
+			float loss[2] = { 0.0f, 0.0f };
+			for (int exact = 0; exact < 2; exact++) {
+				for (int f = 300; f <= 3400 - away - spread; f += 10) {
+					float on = tone_magnitude(length, w, table, exact, f, f);
+					loss[exact] = fminf(loss[exact], 20 * log10f(on / expect));
+					for (int a = away; exact && a <= away + spread; a += 10) {
+						float off = tone_magnitude(length, w, table, exact, f,
+						                           f + a);
+						leakage[w] = fmaxf(leakage[w],
+						                   20 * log10f(off / expect));
+					}
+				}
+			}
+			printf("  %d ms, %s: tone %.1f dB at worst, %.1f dB with the "
+			       "exact bin, leakage %.1f dB\n",
+			       frame_ms[m], names[w], loss[0], loss[1], leakage[w]);
+			// The exact bin keeps the tone, whatever the frame length
+			failed |= loss[1] < -0.5f || loss[1] < loss[0];
+		}
+		free(table);
+		// Hann trades a wider main lobe for lower side lobes
+		failed |= leakage[GOERTZEL_WINDOW_HANN] >=
+		          leakage[GOERTZEL_WINDOW_RECTANGULAR];
+	}
+	printf("sweep: %s\n", failed ? "FAILED" : "ok");
+	return failed;
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: goertzelbench [options...]\n");
+	printf("  Runs the Goertzel filters of the firmware on a synthetic\n");
+	printf("  recording of tones and noise\n");
+	printf("  -h Show help\n");
+	printf("  -r Specify sample rate (default 8000)\n");
+	printf("  -n Specify samples per block (default 400)\n");
+	printf("  -f Specify frequencies, at most 16 (default 16)\n");
+	printf("  -s Specify seconds of audio to process (default 600)\n");
+	printf("  -t Specify tone onsets to detect (default 100)\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		int *value = NULL;
+		switch (argv[i][0] == '-' ? argv[i][1] : 0) {
+			case 'r': value = &sample_rate; break;
+			case 'n': value = &buffer_length; break;
+			case 'f': value = &nr_freqs; break;
+			case 's': value = &seconds; break;
+			case 't': value = &trials; break;
+			case 'h': help(); return EXIT_SUCCESS;
+			default:
+				fprintf(stderr, "Unknown option: %s\n", argv[i]);
+				return EXIT_FAILURE;
+		}
+		if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+		*value = atoi(argv[++i]);
+	}
+	if (sample_rate < 8000) sample_rate = 8000;
+	if (buffer_length < 1) buffer_length = 1;
+	if (nr_freqs < 1) nr_freqs = 1;
+	if (nr_freqs > GOERTZEL_BANK_MAX_FREQS) nr_freqs = GOERTZEL_BANK_MAX_FREQS;
+	if (seconds < 1) seconds = 1;
+	if (trials < 1) trials = 1;
+
+	if (!make_recording()) return EXIT_FAILURE;
+	int failed = run_accuracy();
+	failed    |= run_throughput();
+	failed    |= run_sliding();
+	failed    |= run_sweep();
+	free(recording);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
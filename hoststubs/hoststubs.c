@@ -0,0 +1,346 @@
+/*
+ * Host stubs of the FreeRTOS queues, semaphores and tasks, the ESP timer and
+ * the ADF audio element, on top of POSIX threads.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "audio_element.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct host_queue {
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;
+	UBaseType_t length;
+	UBaseType_t item_size;
+	UBaseType_t count;
+	UBaseType_t head;
+	uint8_t *items;
+};
+
+struct audio_element {
+	audio_element_cfg_t cfg;
+	void *data;
+	audio_element_info_t info;
+	char *buffer;
+	bool is_open;
+	stream_func read;
+	void *read_context;
+	stream_func write;
+	void *write_context;
+};
+
+int64_t esp_timer_get_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void host_critical_enter(portMUX_TYPE *mux) {
+	while (__sync_lock_test_and_set(&mux->locked, 1)) sched_yield();
+}
+
+void host_critical_exit(portMUX_TYPE *mux) {
+	__sync_lock_release(&mux->locked);
+}
+
+/* Wait for the queue to change until the deadline, false once it passed */
+static bool host_queue_wait(struct host_queue *queue, TickType_t ticks,
+                            const struct timespec *deadline) {
+	if (ticks == 0) return false;
+	if (ticks == portMAX_DELAY)
+		return pthread_cond_wait(&queue->changed, &queue->mutex) == 0;
+	return pthread_cond_timedwait(&queue->changed, &queue->mutex,
+	                              deadline) != ETIMEDOUT;
+}
+
+static struct timespec host_deadline(TickType_t ticks) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (ticks == portMAX_DELAY) return ts;
+	ts.tv_sec  += ticks / 1000;
+	ts.tv_nsec += (long)(ticks % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	return ts;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+	struct host_queue *queue = calloc(1, sizeof *queue);
+	if (!queue) return NULL;
+	queue->items = malloc(length * item_size + 1);
+	if (!queue->items) {
+		free(queue);
+		return NULL;
+	}
+	queue->length    = length;
+	queue->item_size = item_size;
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->changed, NULL);
+	return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+	pthread_mutex_destroy(&queue->mutex);
+	pthread_cond_destroy(&queue->changed);
+	free(queue->items);
+	free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item,
+                      TickType_t ticks_to_wait) {
+	struct timespec deadline = host_deadline(ticks_to_wait);
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->count == queue->length) {
+		if (!host_queue_wait(queue, ticks_to_wait, &deadline)) {
+			pthread_mutex_unlock(&queue->mutex);
+			return pdFALSE;
+		}
+	}
+	UBaseType_t tail = (queue->head + queue->count) % queue->length;
+	if (queue->item_size)
+		memcpy(queue->items + tail * queue->item_size, item,
+		       queue->item_size);
+	queue->count++;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->mutex);
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item,
+                         TickType_t ticks_to_wait) {
+	struct timespec deadline = host_deadline(ticks_to_wait);
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->count == 0) {
+		if (!host_queue_wait(queue, ticks_to_wait, &deadline)) {
+			pthread_mutex_unlock(&queue->mutex);
+			return pdFALSE;
+		}
+	}
+	if (queue->item_size)
+		memcpy(item, queue->items + queue->head * queue->item_size,
+		       queue->item_size);
+	queue->head = (queue->head + 1) % queue->length;
+	queue->count--;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->mutex);
+	return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+	pthread_mutex_lock(&queue->mutex);
+	UBaseType_t count = queue->count;
+	pthread_mutex_unlock(&queue->mutex);
+	return count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+	pthread_mutex_lock(&queue->mutex);
+	queue->count = 0;
+	queue->head  = 0;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->mutex);
+	return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max,
+                                           UBaseType_t initial) {
+	SemaphoreHandle_t sem = xQueueCreate(max, 0);
+	if (sem) sem->count = initial;
+	return sem;
+}
+
+struct host_task_start {
+	TaskFunction_t function;
+	void *args;
+};
+
+static void *host_task_run(void *args) {
+	struct host_task_start start = *(struct host_task_start *)args;
+	free(args);
+	start.function(start.args);
+	return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name,
+                                   uint32_t stack, void *args,
+                                   UBaseType_t priority, TaskHandle_t *task,
+                                   BaseType_t core) {
+	struct host_task_start *start = malloc(sizeof *start);
+	pthread_t thread;
+	(void)name, (void)stack, (void)priority, (void)core;
+	if (!start) return pdFAIL;
+	start->function = function;
+	start->args     = args;
+	if (pthread_create(&thread, NULL, host_task_run, start)) {
+		free(start);
+		return pdFAIL;
+	}
+	pthread_detach(thread);
+	// Only compared against NULL by the firmware
+	if (task) *task = (TaskHandle_t)start;
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+	if (!task) pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+	struct timespec ts = { ticks / 1000, (long)(ticks % 1000) * 1000000 };
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+TickType_t xTaskGetTickCount(void) {
+	return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+audio_element_handle_t audio_element_init(audio_element_cfg_t *config) {
+	struct audio_element *el = calloc(1, sizeof *el);
+	if (!el) return NULL;
+	el->cfg   = *config;
+	el->data  = config->data;
+	el->read  = config->read;
+	el->write = config->write;
+	if (el->cfg.buffer_len <= 0) el->cfg.buffer_len = 1024;
+	el->buffer = malloc(el->cfg.buffer_len);
+	if (!el->buffer) {
+		free(el);
+		return NULL;
+	}
+	return el;
+}
+
+esp_err_t audio_element_deinit(audio_element_handle_t el) {
+	if (el->is_open && el->cfg.close) el->cfg.close(el);
+	if (el->cfg.destroy) el->cfg.destroy(el);
+	free(el->info.uri);
+	free(el->buffer);
+	free(el);
+	return ESP_OK;
+}
+
+void *audio_element_getdata(audio_element_handle_t el) { return el->data; }
+
+esp_err_t audio_element_setdata(audio_element_handle_t el, void *data) {
+	el->data = data;
+	return ESP_OK;
+}
+
+esp_err_t audio_element_getinfo(audio_element_handle_t el,
+                                audio_element_info_t *info) {
+	*info = el->info;
+	return ESP_OK;
+}
+
+esp_err_t audio_element_setinfo(audio_element_handle_t el,
+                                audio_element_info_t *info) {
+	char *uri = el->info.uri;
+	el->info  = *info;
+	el->info.uri = uri;
+	return ESP_OK;
+}
+
+esp_err_t audio_element_set_music_info(audio_element_handle_t el,
+                                       int sample_rates, int channels,
+                                       int bits) {
+	el->info.sample_rates = sample_rates;
+	el->info.channels     = channels;
+	el->info.bits         = bits;
+	return ESP_OK;
+}
+
+esp_err_t audio_element_set_byte_pos(audio_element_handle_t el, int64_t pos) {
+	el->info.byte_pos = pos;
+	return ESP_OK;
+}
+
+esp_err_t audio_element_update_byte_pos(audio_element_handle_t el,
+                                        int64_t pos) {
+	el->info.byte_pos += pos;
+	return ESP_OK;
+}
+
+esp_err_t audio_element_set_total_bytes(audio_element_handle_t el,
+                                        int64_t total_bytes) {
+	el->info.total_bytes = total_bytes;
+	return ESP_OK;
+}
+
+/* There is no pipeline to tell about the info */
+esp_err_t audio_element_report_info(audio_element_handle_t el) {
+	(void)el;
+	return ESP_OK;
+}
+
+char *audio_element_get_uri(audio_element_handle_t el) { return el->info.uri; }
+
+esp_err_t audio_element_set_uri(audio_element_handle_t el, const char *uri) {
+	char *copy = NULL;
+	if (uri) {
+		copy = malloc(strlen(uri) + 1);
+		if (!copy) return ESP_ERR_NO_MEM;
+		strcpy(copy, uri);
+	}
+	free(el->info.uri);
+	el->info.uri = copy;
+	return ESP_OK;
+}
+
+const char *audio_element_get_tag(audio_element_handle_t el) {
+	return el->cfg.tag;
+}
+
+esp_err_t audio_element_set_read_cb(audio_element_handle_t el,
+                                    stream_func function, void *context) {
+	el->read         = function;
+	el->read_context = context;
+	return ESP_OK;
+}
+
+esp_err_t audio_element_set_write_cb(audio_element_handle_t el,
+                                     stream_func function, void *context) {
+	el->write         = function;
+	el->write_context = context;
+	return ESP_OK;
+}
+
+audio_element_err_t audio_element_input(audio_element_handle_t el,
+                                        char *buffer, int length) {
+	if (!el->read) return AEL_IO_FAIL;
+	return el->read(el, buffer, length, portMAX_DELAY, el->read_context);
+}
+
+audio_element_err_t audio_element_output(audio_element_handle_t el,
+                                         char *buffer, int length) {
+	if (!el->write) return length;
+	return el->write(el, buffer, length, portMAX_DELAY, el->write_context);
+}
+
+audio_element_err_t audio_element_process(audio_element_handle_t el) {
+	if (!el->is_open) {
+		if (el->cfg.open && el->cfg.open(el) != ESP_OK) return AEL_IO_FAIL;
+		el->is_open = true;
+	}
+	audio_element_err_t ret =
+	    el->cfg.process(el, el->buffer, el->cfg.buffer_len);
+	if (ret == AEL_IO_DONE || ret == AEL_IO_FAIL || ret == AEL_IO_ABORT ||
+	    ret == AEL_PROCESS_FAIL) {
+		if (el->cfg.close) el->cfg.close(el);
+		el->is_open = false;
+	}
+	return ret;
+}
@@ -0,0 +1,109 @@
+#ifndef AUDIO_ELEMENT_H
+#define AUDIO_ELEMENT_H
+#pragma once
+
+/*
+ * The part of the ADF audio element the elements of the firmware use. There
+ * are no element tasks and no ringbuffers: a host tool runs an element with
+ * audio_element_process() in a thread of its own, the input and output of
+ * the element go to its read and write callbacks.
+ */
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct audio_element *audio_element_handle_t;
+
+typedef enum {
+	AEL_IO_OK        = ESP_OK,
+	AEL_IO_FAIL      = ESP_FAIL,
+	AEL_IO_DONE      = -2,
+	AEL_IO_ABORT     = -3,
+	AEL_IO_TIMEOUT   = -4,
+	AEL_PROCESS_FAIL = -5,
+} audio_element_err_t;
+
+typedef struct {
+	int sample_rates;
+	int channels;
+	int bits;
+	int bps;
+	int64_t byte_pos;
+	int64_t total_bytes;
+	int duration;
+	char *uri;
+} audio_element_info_t;
+
+typedef esp_err_t (*el_io_func)(audio_element_handle_t self);
+typedef audio_element_err_t (*process_func)(audio_element_handle_t self,
+                                            char *buffer, int length);
+typedef audio_element_err_t (*stream_func)(audio_element_handle_t self,
+                                           char *buffer, int length,
+                                           TickType_t ticks_to_wait,
+                                           void *context);
+
+typedef struct {
+	el_io_func open;
+	process_func process;
+	el_io_func close;
+	el_io_func destroy;
+	stream_func read;
+	stream_func write;
+	int buffer_len;
+	int task_stack;
+	int task_prio;
+	int task_core;
+	int out_rb_size;
+	void *data;
+	const char *tag;
+} audio_element_cfg_t;
+
+#define DEFAULT_AUDIO_ELEMENT_CONFIG()                                         \
+	{                                                                          \
+		.buffer_len = 1024, .task_stack = 3 * 1024, .task_prio = 5,            \
+		.task_core = 0, .out_rb_size = 8 * 1024,                               \
+	}
+
+audio_element_handle_t audio_element_init(audio_element_cfg_t *config);
+esp_err_t audio_element_deinit(audio_element_handle_t el);
+
+void *audio_element_getdata(audio_element_handle_t el);
+esp_err_t audio_element_setdata(audio_element_handle_t el, void *data);
+esp_err_t audio_element_getinfo(audio_element_handle_t el,
+                                audio_element_info_t *info);
+esp_err_t audio_element_setinfo(audio_element_handle_t el,
+                                audio_element_info_t *info);
+esp_err_t audio_element_set_music_info(audio_element_handle_t el,
+                                       int sample_rates, int channels,
+                                       int bits);
+esp_err_t audio_element_set_byte_pos(audio_element_handle_t el, int64_t pos);
+esp_err_t audio_element_update_byte_pos(audio_element_handle_t el,
+                                        int64_t pos);
+esp_err_t audio_element_set_total_bytes(audio_element_handle_t el,
+                                        int64_t total_bytes);
+esp_err_t audio_element_report_info(audio_element_handle_t el);
+char *audio_element_get_uri(audio_element_handle_t el);
+esp_err_t audio_element_set_uri(audio_element_handle_t el, const char *uri);
+const char *audio_element_get_tag(audio_element_handle_t el);
+
+esp_err_t audio_element_set_read_cb(audio_element_handle_t el,
+                                    stream_func function, void *context);
+esp_err_t audio_element_set_write_cb(audio_element_handle_t el,
+                                     stream_func function, void *context);
+audio_element_err_t audio_element_input(audio_element_handle_t el,
+                                        char *buffer, int length);
+audio_element_err_t audio_element_output(audio_element_handle_t el,
+                                         char *buffer, int length);
+
+/**
+ * @brief Open the element on the first call and process once into a buffer
+ * of its buffer_len, it is closed when the process returns AEL_IO_DONE or an
+ * error. Host stubs only.
+ * @return what the process function of the element returned
+ */
+audio_element_err_t audio_element_process(audio_element_handle_t el);
+
+#endif /* AUDIO_ELEMENT_H */
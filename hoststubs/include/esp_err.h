@@ -0,0 +1,21 @@
+#ifndef ESP_ERR_H
+#define ESP_ERR_H
+#pragma once
+
+/*
+ * Host stubs of ESP-IDF and ADF for the host tools, just enough to build the
+ * elements and buffers of the firmware and run them in threads.
+ */
+
+typedef int esp_err_t;
+
+#define ESP_OK                0
+#define ESP_FAIL              -1
+#define ESP_ERR_NO_MEM        0x101
+#define ESP_ERR_INVALID_ARG   0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE  0x104
+#define ESP_ERR_NOT_FOUND     0x105
+#define ESP_ERR_TIMEOUT       0x107
+
+#endif /* ESP_ERR_H */
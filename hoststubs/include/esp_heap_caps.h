@@ -0,0 +1,18 @@
+#ifndef ESP_HEAP_CAPS_H
+#define ESP_HEAP_CAPS_H
+#pragma once
+
+#include <stdlib.h>
+
+/* The host has one heap, the capabilities are ignored */
+#define MALLOC_CAP_DMA      (1 << 3)
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT  (1 << 12)
+
+#define heap_caps_malloc(size, caps)        malloc(size)
+#define heap_caps_calloc(n, size, caps)     calloc(n, size)
+#define heap_caps_realloc(ptr, size, caps)  realloc(ptr, size)
+#define heap_caps_free(ptr)                 free(ptr)
+
+#endif /* ESP_HEAP_CAPS_H */
@@ -0,0 +1,17 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+#pragma once
+
+#include <stdio.h>
+
+/* Errors and warnings go to stderr, the rest is left out */
+#define ESP_LOG_STUB(level, tag, ...)                                          \
+	(fprintf(stderr, level " (%s) ", tag), fprintf(stderr, __VA_ARGS__),      \
+	 fputc('\n', stderr))
+#define ESP_LOGE(tag, ...) ESP_LOG_STUB("E", tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) ESP_LOG_STUB("W", tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) ((void)(tag))
+#define ESP_LOGD(tag, ...) ((void)(tag))
+#define ESP_LOGV(tag, ...) ((void)(tag))
+
+#endif /* ESP_LOG_H */
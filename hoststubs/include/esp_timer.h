@@ -0,0 +1,10 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+#pragma once
+
+#include <stdint.h>
+
+/* Microseconds of the monotonic clock */
+int64_t esp_timer_get_time(void);
+
+#endif /* ESP_TIMER_H */
@@ -0,0 +1,33 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+#pragma once
+
+#include <stdint.h>
+
+/* A tick is a millisecond */
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE             0
+#define pdTRUE              1
+#define pdFAIL              pdFALSE
+#define pdPASS              pdTRUE
+#define portMAX_DELAY       ((TickType_t)0xffffffff)
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+
+/* A spinlock, the sections it guards are short on the host too */
+typedef struct {
+	volatile int locked;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define portMUX_INITIALIZE(mux)      ((mux)->locked = 0)
+#define portENTER_CRITICAL(mux)      host_critical_enter(mux)
+#define portEXIT_CRITICAL(mux)       host_critical_exit(mux)
+
+void host_critical_enter(portMUX_TYPE *mux);
+void host_critical_exit(portMUX_TYPE *mux);
+
+#endif /* FREERTOS_H */
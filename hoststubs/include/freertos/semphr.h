@@ -0,0 +1,19 @@
+#ifndef FREERTOS_SEMPHR_H
+#define FREERTOS_SEMPHR_H
+#pragma once
+
+#include "freertos/queue.h"
+
+/* Semaphores are queues of items without data, like in FreeRTOS */
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max,
+                                           UBaseType_t initial);
+
+#define xSemaphoreCreateBinary()     xSemaphoreCreateCounting(1, 0)
+#define xSemaphoreCreateMutex()      xSemaphoreCreateCounting(1, 1)
+#define xSemaphoreTake(sem, ticks)   xQueueReceive(sem, NULL, ticks)
+#define xSemaphoreGive(sem)          xQueueSend(sem, NULL, 0)
+#define vSemaphoreDelete(sem)        vQueueDelete(sem)
+
+#endif /* FREERTOS_SEMPHR_H */
@@ -0,0 +1,22 @@
+#ifndef FREERTOS_TASK_H
+#define FREERTOS_TASK_H
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+/* Tasks are detached threads, the stack size, priority and core are ignored */
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *args);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name,
+                                   uint32_t stack, void *args,
+                                   UBaseType_t priority, TaskHandle_t *task,
+                                   BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+
+#define xTaskCreate(function, name, stack, args, priority, task)              \
+	xTaskCreatePinnedToCore(function, name, stack, args, priority, task, 0)
+
+#endif /* FREERTOS_TASK_H */
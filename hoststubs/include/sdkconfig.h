@@ -0,0 +1,7 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+#pragma once
+
+/* The host tools set the CONFIG_ options they need on the command line */
+
+#endif /* SDKCONFIG_H */
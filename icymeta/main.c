@@ -0,0 +1,471 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks the ICY metadata parser of the radio and measures what it costs per
+ * MB of stream. Without recordings it generates a stream of MP3 frames with
+ * a block after every metaint bytes, most of them empty and some with titles
+ * that are hard to parse, and feeds it in pieces of random size. The audio
+ * that comes out must be the audio that went in and the titles must change
+ * as the blocks say, with the interval known and found from the stream, also
+ * when the first block is empty. While the interval is found the empty blocks
+ * may come out as a 0 in the audio.
+ *
+ * Recordings are the body of a stream, with or without the response before
+ * it, e.g. from
+ *   curl -si -H 'Icy-MetaData: 1' --max-time 60 <url> > recording.icy
+ * The interval of the icy-metaint header is checked against the one found,
+ * and the MP3 frames of the audio must follow each other.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "radio_icy.h"
+#include "radio_ring.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+static int metaint    = 16000;
+static int stream_mb  = 16;
+static int chunk_size = 1460;
+static int rounds     = 10;
+
+/* Titles of the generated blocks, with quotes, separators and one too long */
+static const char *titles[] = {
+	"Radio1Rock - Now playing",
+	"Guns N' Roses - Sweet Child O' Mine",
+	"",
+	"AC/DC - T.N.T.",
+	"Queen - Bohemian Rhapsody",
+	"Motorhead - Ace of Spades (live at Hammersmith Odeon, 1981, remastered "
+	"edition with a title that is much longer than the display and the "
+	"parser keep of it)",
+	"'Til Tuesday - Voices Carry",
+};
+
+struct buffer {
+	uint8_t *data;
+	size_t size;
+	size_t fill;
+};
+
+/*
+ * The audio that came out, and the titles in the order they changed to. A
+ * piece with several blocks only shows the title of the last one, the
+ * changes count all of them.
+ */
+struct output {
+	struct buffer audio;
+	char (*titles)[RADIO_ICY_TITLE_LENGTH];
+	size_t nr_titles;
+	size_t max_titles;
+	uint32_t changes;
+};
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint32_t next_random(uint32_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static int append(struct buffer *buffer, const void *data, size_t length) {
+	if (buffer->fill + length > buffer->size) {
+		size_t size = buffer->size ? buffer->size : 4096;
+		while (size < buffer->fill + length) size *= 2;
+		uint8_t *grown = realloc(buffer->data, size);
+		if (!grown) return 0;
+		buffer->data = grown;
+		buffer->size = size;
+	}
+	memcpy(buffer->data + buffer->fill, data, length);
+	buffer->fill += length;
+	return 1;
+}
+
+static int add_title(struct output *output, const char *title) {
+	if (output->nr_titles == output->max_titles) {
+		size_t max  = output->max_titles ? 2 * output->max_titles : 16;
+		void *grown = realloc(output->titles, max * sizeof *output->titles);
+		if (!grown) return 0;
+		output->titles     = grown;
+		output->max_titles = max;
+	}
+	snprintf(output->titles[output->nr_titles++], RADIO_ICY_TITLE_LENGTH,
+	         "%s", title);
+	return 1;
+}
+
+static void free_output(struct output *output) {
+	free(output->audio.data);
+	free(output->titles);
+	memset(output, 0, sizeof *output);
+}
+
+static void keep_audio(void *context, const uint8_t *data, size_t length) {
+	struct output *output = context;
+	if (!append(&output->audio, data, length)) abort();
+}
+
+static void count_audio(void *context, const uint8_t *data, size_t length) {
+	*(size_t *)context += length;
+	(void)data;
+}
+
+/*
+ * A stream of 128 kbps MPEG-1 Layer III frames with random contents, a block
+ * after each metaint bytes of audio. The blocks before the first title are
+ * empty, every seventh one after it changes the title.
+ */
+static int make_stream(struct buffer *stream, struct output *expected,
+                       bool blocks, int empty) {
+	uint32_t random = 12345;
+	size_t size     = (size_t)stream_mb * 1024 * 1024;
+	uint8_t frame[418];
+	int f = 0, block = 0;
+	size_t until = metaint;
+	char last[RADIO_ICY_TITLE_LENGTH] = "";
+
+	while (expected->audio.fill < size) {
+		/* 1152 samples at 44.1 kHz, padded to keep 128 kbps */
+		size_t length = 417 + (f * 417.959 - (int)(f * 417.959) > 0.959);
+		frame[0]      = 0xff;
+		frame[1]      = 0xfb;
+		frame[2]      = 9 << 4 | (length == 418) << 1;
+		frame[3]      = 0x44;
+		for (size_t i = 4; i < length; i++)
+			frame[i] = (uint8_t)next_random(&random);
+		f++;
+
+		for (size_t i = 0; i < length;) {
+			size_t part = length - i;
+			if (blocks && part > until) part = until;
+			if (!append(stream, frame + i, part) ||
+			    !append(&expected->audio, frame + i, part))
+				return 0;
+			i     += part;
+			until -= blocks ? part : 0;
+			if (!blocks || until) continue;
+
+			char text[4080];
+			int n = 0;
+			if (block >= empty && (block - empty) % 7 == 0) {
+				const char *title = titles[(block - empty) / 7 %
+				                           (sizeof titles / sizeof *titles)];
+				n = snprintf(text, sizeof text, "StreamTitle='%s';", title);
+				if (block % 2)
+					n += snprintf(text + n, sizeof text - n,
+					              "StreamUrl='http://radio.example/%d';",
+					              block);
+				char kept[RADIO_ICY_TITLE_LENGTH];
+				snprintf(kept, sizeof kept, "%s", title);
+				if (strcmp(kept, last)) {
+					strcpy(last, kept);
+					if (!add_title(expected, kept)) return 0;
+					expected->changes++;
+				}
+			}
+			uint8_t blocks16 = (uint8_t)((n + 15) / 16);
+			memset(text + n, 0, blocks16 * 16 - n);
+			if (!append(stream, &blocks16, 1) ||
+			    !append(stream, text, blocks16 * 16))
+				return 0;
+			block++;
+			until = metaint;
+		}
+	}
+	return 1;
+}
+
+/* Feed the stream in pieces of 1 to 2 * chunk_size bytes */
+static void parse(const struct buffer *stream, uint32_t known,
+                  struct output *output, uint32_t *found) {
+	struct radio_icy icy;
+	uint32_t random = 777;
+	radio_icy_init(&icy, known);
+	for (size_t offset = 0; offset < stream->fill;) {
+		size_t length = 1 + next_random(&random) % (2 * chunk_size);
+		if (length > stream->fill - offset) length = stream->fill - offset;
+		if (radio_icy_feed(&icy, stream->data + offset, length, keep_audio,
+		                   output))
+			add_title(output, icy.title);
+		offset += length;
+	}
+	output->changes = icy.titles;
+	*found          = icy.metaint;
+}
+
+/* The audio of a is that of b with up to zeros empty blocks left in it */
+static bool same_audio(const struct buffer *a, const struct buffer *b,
+                       size_t zeros) {
+	size_t j = 0;
+	for (size_t i = 0; i < a->fill; i++) {
+		if (j < b->fill && a->data[i] == b->data[j]) j++;
+		else if (a->data[i] || !zeros--) return false;
+	}
+	return j == b->fill;
+}
+
+/* The titles of a are those of b, or some of them for pieces with several */
+static bool same_output(const struct output *a, const struct output *b,
+                        size_t zeros) {
+	if (!same_audio(&a->audio, &b->audio, zeros) ||
+	    a->changes != b->changes || a->nr_titles > b->nr_titles ||
+	    (a->nr_titles && strcmp(a->titles[a->nr_titles - 1],
+	                            b->titles[b->nr_titles - 1])))
+		return false;
+	size_t t = 0;
+	for (size_t u = 0; u < b->nr_titles && t < a->nr_titles; u++)
+		if (!strcmp(a->titles[t], b->titles[u])) t++;
+	return t == a->nr_titles;
+}
+
+static int check(const char *what, const struct buffer *stream,
+                 const struct output *expected, uint32_t known,
+                 uint32_t interval, size_t zeros) {
+	struct output output = { 0 };
+	uint32_t found;
+	parse(stream, known, &output, &found);
+	bool ok = same_output(&output, expected, zeros) && found == interval;
+	printf("%s: %s, %zu KB of audio, %u titles, interval %u\n", what,
+	       ok ? "ok" : "FAILED", output.audio.fill / 1024,
+	       (unsigned)output.changes, (unsigned)found);
+	free_output(&output);
+	return ok;
+}
+
+/* Time the parser against copying the stream into a ring once */
+static void measure(const struct buffer *stream) {
+	uint8_t *copy = malloc(chunk_size);
+	double parse_us = 0, copy_us = 0;
+	size_t audio    = 0;
+	for (int r = 0; r < rounds && copy; r++) {
+		struct radio_icy icy;
+		radio_icy_init(&icy, 0);
+		double start = now_us();
+		for (size_t offset = 0; offset < stream->fill; offset += chunk_size) {
+			size_t length = stream->fill - offset < (size_t)chunk_size
+			                    ? stream->fill - offset
+			                    : (size_t)chunk_size;
+			radio_icy_feed(&icy, stream->data + offset, length, count_audio,
+			               &audio);
+		}
+		parse_us += now_us() - start;
+
+		start = now_us();
+		for (size_t offset = 0; offset < stream->fill; offset += chunk_size) {
+			size_t length = stream->fill - offset < (size_t)chunk_size
+			                    ? stream->fill - offset
+			                    : (size_t)chunk_size;
+			memcpy(copy, stream->data + offset, length);
+			audio += copy[length - 1];
+		}
+		copy_us += now_us() - start;
+	}
+	free(copy);
+
+	double mb = stream->fill / (1024.0 * 1024.0) * rounds;
+	printf("parser: %.1f us/MB in %d byte pieces, copying it once %.1f us/MB "
+	       "(%zu)\n",
+	       parse_us / mb, chunk_size, copy_us / mb, audio & 1);
+}
+
+static int run(void) {
+	struct buffer stream = { 0 }, late = { 0 }, plain = { 0 };
+	struct output expected = { 0 }, expected_late = { 0 },
+	              expected_plain = { 0 };
+	int failed = !make_stream(&stream, &expected, true, 0) ||
+	             !make_stream(&late, &expected_late, true, 1) ||
+	             !make_stream(&plain, &expected_plain, false, 0);
+	if (failed) {
+		fprintf(stderr, "out of memory\n");
+	} else {
+		printf("stream: %.1f MB, a block every %d bytes, %zu titles\n",
+		       stream.fill / (1024.0 * 1024.0), metaint, expected.nr_titles);
+		failed =
+		    !check("known interval", &stream, &expected, metaint, metaint,
+		           0) +
+		    !check("found interval", &stream, &expected, 0, metaint,
+		           RADIO_ICY_CONFIRMATIONS - 1) +
+		    !check("empty first block", &late, &expected_late, 0, metaint,
+		           RADIO_ICY_CONFIRMATIONS) +
+		    !check("no metadata", &plain, &expected_plain, 0, 0, 0);
+		measure(&stream);
+	}
+	free(stream.data);
+	free(late.data);
+	free(plain.data);
+	free_output(&expected);
+	free_output(&expected_late);
+	free_output(&expected_plain);
+	return failed;
+}
+
+/* Count the MP3 frames of the audio and how often they do not follow */
+static void walk_frames(const struct buffer *audio, size_t *frames,
+                        size_t *breaks) {
+	size_t offset;
+	*frames = *breaks = 0;
+	if (!radio_frame_find(RADIO_CODEC_MP3, audio->data, audio->fill, &offset))
+		return;
+	while (offset + 4 <= audio->fill) {
+		int length = radio_frame_mp3_length(audio->data + offset);
+		if (length) {
+			(*frames)++;
+			offset += length;
+			continue;
+		}
+		size_t skip;
+		(*breaks)++;
+		if (!radio_frame_find(RADIO_CODEC_MP3, audio->data + offset,
+		                      audio->fill - offset, &skip))
+			break;
+		offset += skip;
+	}
+}
+
+static int run_recording(const char *path) {
+	struct buffer stream = { 0 };
+	FILE *f              = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "cannot open %s\n", path);
+		return 1;
+	}
+	uint8_t block[65536];
+	size_t n;
+	while ((n = fread(block, 1, sizeof block, f)) > 0)
+		if (!append(&stream, block, n)) break;
+	fclose(f);
+
+	/* The response, if it was recorded */
+	uint32_t header = 0;
+	if (stream.fill > 5 && (!memcmp(stream.data, "ICY ", 4) ||
+	                        !memcmp(stream.data, "HTTP/", 5))) {
+		size_t end = 0;
+		for (size_t i = 0; i + 4 <= stream.fill && !end; i++)
+			if (!memcmp(stream.data + i, "\r\n\r\n", 4)) end = i + 4;
+		for (size_t i = 0; i + 12 < end; i++)
+			if ((i == 0 || stream.data[i - 1] == '\n') &&
+			    !strncasecmp((char *)stream.data + i, "icy-metaint:", 12))
+				header = strtoul((char *)stream.data + i + 12, NULL, 10);
+		memmove(stream.data, stream.data + end, stream.fill - end);
+		stream.fill -= end;
+	}
+
+	struct output found = { 0 }, known = { 0 };
+	uint32_t interval, unused;
+	parse(&stream, 0, &found, &interval);
+	printf("%s: %.1f KB, icy-metaint %u, found %u\n", path,
+	       stream.fill / 1024.0, (unsigned)header, (unsigned)interval);
+	for (size_t t = 0; t < found.nr_titles; t++)
+		printf("  title: %s\n", found.titles[t]);
+
+	size_t frames, breaks;
+	walk_frames(&found.audio, &frames, &breaks);
+	printf("  %zu MP3 frames, %zu times they did not follow\n", frames,
+	       breaks);
+	int failed = 0;
+	if (header) {
+		parse(&stream, header, &known, &unused);
+		size_t zeros = RADIO_ICY_SEARCH_SIZE / RADIO_ICY_MIN_INTERVAL +
+		               RADIO_ICY_CONFIRMATIONS;
+		failed = !same_output(&found, &known, zeros) || interval != header;
+		printf("  with the header: %s\n", failed ? "FAILED" : "same");
+	}
+	measure(&stream);
+
+	free_output(&found);
+	free_output(&known);
+	free(stream.data);
+	return failed;
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: icymeta [options...] [recording...]\n");
+	printf("  Checks the ICY metadata parser of the radio on a generated\n");
+	printf("  stream or recordings and measures it per MB\n");
+	printf("  -h Show help\n");
+	printf("  -m Specify interval of the generated stream (default 16000)\n");
+	printf("  -s Specify size of the generated stream in MB (default 16)\n");
+	printf("  -c Specify piece the stream arrives in (default 1460)\n");
+	printf("  -n Specify rounds to measure (default 10)\n");
+}
+
+int main(int argc, char **argv) {
+	int nr_paths = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (*argv[i] == '-') {
+			int *value = NULL;
+			switch (argv[i][1]) {
+				case 'm': value = &metaint; break;
+				case 's': value = &stream_mb; break;
+				case 'c': value = &chunk_size; break;
+				case 'n': value = &rounds; break;
+				case 'h': help(); return EXIT_SUCCESS;
+			}
+			if (value) {
+				if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+				*value = atoi(argv[++i]);
+			}
+			continue;
+		}
+		argv[nr_paths++] = argv[i];
+	}
+	if (metaint < 16) metaint = 16;
+	if (metaint > RADIO_ICY_SEARCH_SIZE) metaint = RADIO_ICY_SEARCH_SIZE;
+	if (stream_mb < 1) stream_mb = 1;
+	if (chunk_size < 1) chunk_size = 1;
+	if (rounds < 1) rounds = 1;
+
+	int failed = 0;
+	if (!nr_paths) failed = run();
+	for (int p = 0; p < nr_paths; p++) failed |= run_recording(argv[p]);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
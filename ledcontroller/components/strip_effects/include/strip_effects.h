@@ -15,6 +15,7 @@ enum strip_cmd {
 	SC_OFF = 0,
 	SC_SET_VOLUME,
 	SC_RAINBOW_FLASH,
+	SC_BEAT,
 };
 
 /*
@@ -5,6 +5,7 @@
 #include "led_strip.h"
 
 #include "freertos/queue.h"
+#include "freertos/task.h"
 
 #include "esp_check.h"
 
@@ -117,12 +118,30 @@ void strip_effects_init(void *params) {
 	enum strip_cmd cmd        = SC_OFF;
 	enum strip_cmd prev_cmd   = SC_OFF;
 	uint8_t volume            = 50;
+	TickType_t effect_start   = xTaskGetTickCount();
 	clear_strip();
 
 	while (1) {
 		struct queue_msg msg;
-		if (xQueueReceive(effect_queue, &msg, wait / portTICK_PERIOD_MS) ==
-		    pdTRUE) {
+		BaseType_t received =
+		    xQueueReceive(effect_queue, &msg, wait / portTICK_PERIOD_MS);
+
+		if (received == pdTRUE && msg.cmd == SC_BEAT) {
+			// A beat moves the rainbow on right away, the timer stays as a
+			// fallback for when the beats stop. Other effects keep their
+			// timing.
+			if (cmd == SC_RAINBOW_FLASH) {
+				wait = rb_flash_eff();
+			} else if (wait != portMAX_DELAY) {
+				int elapsed =
+				    (xTaskGetTickCount() - effect_start) * portTICK_PERIOD_MS;
+				wait = elapsed < wait ? wait - elapsed : 0;
+			}
+			effect_start = xTaskGetTickCount();
+			continue;
+		}
+
+		if (received == pdTRUE) {
 			// If a message was received before the next cycle of the currently
 			// active effect could take place.
 
@@ -152,5 +171,6 @@ void strip_effects_init(void *params) {
 			case SC_RAINBOW_FLASH: wait = rb_flash_eff(); break;
 			default: break;
 		}
+		effect_start = xTaskGetTickCount();
 	}
 }
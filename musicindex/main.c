@@ -0,0 +1,314 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Builds the index of the music folder of the sdcard with the scanner of the
+ * speaker, so a large library does not have to be scanned on the speaker.
+ * An existing index is updated, only the folders that changed are read.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "music_index.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+static int benchmark     = 0;
+static int rounds        = 1000;
+static char *root        = NULL;
+static char *index_path  = NULL;
+static unsigned int seed = 1;
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Portable and repeatable, rand() differs between C libraries */
+static uint32_t next_random(void) {
+	seed = seed * 1103515245u + 12345u;
+	return seed >> 8;
+}
+
+static void print_stats(const char *what, const struct music_index *index,
+                        const struct music_index_scan_stats *stats,
+                        double us) {
+	printf("%s: %u folders, %u tracks in %.1f ms, %u folders read, %u reused, "
+	       "%u tracks parsed, %u reused\n",
+	       what, index->nr_dirs, index->nr_tracks, us / 1e3, stats->dirs_read,
+	       stats->dirs_reused, stats->tracks_parsed, stats->tracks_reused);
+}
+
+static int update_index(void) {
+	struct music_index old, index;
+	struct music_index_scan_stats stats;
+	int has_old = music_index_load(&old, index_path);
+
+	double start = now_us();
+	if (!music_index_scan(&index, root, has_old ? &old : NULL, NULL, &stats)) {
+		fprintf(stderr, "cannot scan %s\n", root);
+		if (has_old) music_index_free(&old);
+		return 1;
+	}
+	print_stats(has_old ? "updated" : "scanned", &index, &stats,
+	            now_us() - start);
+
+	int failed = 0;
+	if (!has_old || stats.dirs_read) {
+		failed = !music_index_save(&index, index_path);
+		if (failed) fprintf(stderr, "cannot write %s\n", index_path);
+	}
+	if (has_old) music_index_free(&old);
+	music_index_free(&index);
+	return failed;
+}
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Find the n-th track without an index the way the speaker would have to:
+ * list every folder in order and count the mp3 files up to it.
+ */
+static int walk_to_track(const char *dir, uint32_t *n, char *path,
+                         size_t size) {
+	DIR *d = opendir(dir);
+	if (!d) return 0;
+
+	char **names = NULL;
+	size_t count = 0;
+	struct dirent *entry;
+	while ((entry = readdir(d))) {
+		if (entry->d_name[0] == '.') continue;
+		char **grown = realloc(names, (count + 1) * sizeof *names);
+		if (!grown) break;
+		names = grown;
+		names[count] = malloc(strlen(entry->d_name) + 1);
+		if (!names[count]) break;
+		strcpy(names[count++], entry->d_name);
+	}
+	closedir(d);
+	qsort(names, count, sizeof *names, compare_names);
+
+	/* Tracks of the folder first, then its subfolders, like the index */
+	int found = 0;
+	for (int pass = 0; pass < 2 && !found; ++pass) {
+		for (size_t i = 0; i < count && !found; ++i) {
+			struct stat st;
+			snprintf(path, size, "%s/%s", dir, names[i]);
+			if (stat(path, &st) != 0) continue;
+			if (pass == 0 && S_ISREG(st.st_mode)) {
+				size_t length = strlen(names[i]);
+				if (length > 4 && strcmp(names[i] + length - 4, ".mp3") == 0 &&
+				    (*n)-- == 0)
+					found = 1;
+			} else if (pass == 1 && S_ISDIR(st.st_mode)) {
+				char sub[MUSIC_INDEX_PATH_LENGTH + 64];
+				snprintf(sub, sizeof sub, "%s", path);
+				found = walk_to_track(sub, n, path, size);
+			}
+		}
+	}
+	for (size_t i = 0; i < count; ++i) free(names[i]);
+	free(names);
+	return found;
+}
+
+/*
+ * Compare a full scan with an update of an unchanged library, and finding a
+ * track in the index with listing the folders for it.
+ */
+static int run_benchmark(void) {
+	struct music_index full, updated, loaded;
+	struct music_index_scan_stats stats;
+
+	double start = now_us();
+	if (!music_index_scan(&full, root, NULL, NULL, &stats)) {
+		fprintf(stderr, "cannot scan %s\n", root);
+		return 1;
+	}
+	print_stats("full scan", &full, &stats, now_us() - start);
+	if (!full.nr_tracks) {
+		fprintf(stderr, "no mp3 files in %s\n", root);
+		music_index_free(&full);
+		return 1;
+	}
+
+	start = now_us();
+	if (!music_index_scan(&updated, root, &full, NULL, &stats)) {
+		music_index_free(&full);
+		return 1;
+	}
+	print_stats("update", &updated, &stats, now_us() - start);
+	music_index_free(&updated);
+
+	if (!music_index_save(&full, index_path)) {
+		fprintf(stderr, "cannot write %s\n", index_path);
+		music_index_free(&full);
+		return 1;
+	}
+	double load_us = 0;
+	for (int r = 0; r < 10; ++r) {
+		start = now_us();
+		if (!music_index_load(&loaded, index_path)) {
+			fprintf(stderr, "cannot read %s\n", index_path);
+			music_index_free(&full);
+			return 1;
+		}
+		load_us += now_us() - start;
+		if (r < 9) music_index_free(&loaded);
+	}
+	size_t bytes = sizeof(struct music_index_header) +
+	               loaded.nr_dirs * sizeof *loaded.dirs +
+	               loaded.nr_tracks * sizeof *loaded.tracks +
+	               loaded.strings_size;
+	printf("index: %zu bytes, %.1f bytes per track, load %.2f ms\n", bytes,
+	       (double)bytes / loaded.nr_tracks, load_us / 10 / 1e3);
+
+	/* Path and tags of a random track, what a skip in shuffle needs */
+	char path[MUSIC_INDEX_PATH_LENGTH + 64];
+	size_t checksum = 0;
+	start           = now_us();
+	for (int r = 0; r < rounds; ++r) {
+		uint32_t track = next_random() % loaded.nr_tracks;
+		music_index_track_path(&loaded, track, root, path, sizeof path);
+		checksum += strlen(path) +
+		            strlen(music_index_string(&loaded,
+		                                      loaded.tracks[track].title));
+	}
+	double lookup_us = (now_us() - start) / rounds;
+
+	uint32_t *order = malloc(loaded.nr_tracks * sizeof *order);
+	if (!order) {
+		music_index_free(&loaded);
+		music_index_free(&full);
+		return 1;
+	}
+	start = now_us();
+	for (uint32_t t = 0; t < loaded.nr_tracks; ++t) order[t] = t;
+	for (uint32_t t = loaded.nr_tracks - 1; t > 0; --t) {
+		uint32_t other = next_random() % (t + 1);
+		uint32_t swap  = order[t];
+		order[t]       = order[other];
+		order[other]   = swap;
+	}
+	double shuffle_us = now_us() - start;
+	free(order);
+
+	/* Listing the folders is slow, a tenth of the rounds */
+	int walks      = rounds / 10 > 0 ? rounds / 10 : 1;
+	double walk_us = 0;
+	int mismatches = 0;
+	for (int r = 0; r < walks; ++r) {
+		uint32_t track = next_random() % loaded.nr_tracks;
+		uint32_t n     = track;
+		char expected[MUSIC_INDEX_PATH_LENGTH + 64];
+		music_index_track_path(&loaded, track, root, expected,
+		                       sizeof expected);
+		start = now_us();
+		if (!walk_to_track(root, &n, path, sizeof path) ||
+		    strcmp(path, expected) != 0)
+			mismatches++;
+		walk_us += now_us() - start;
+	}
+
+	printf("lookup: index %.3f us, folder walk %.1f us per track "
+	       "(%d and %d lookups, checksum %zu)\n",
+	       lookup_us, walk_us / walks, rounds, walks, checksum);
+	printf("shuffle: %u tracks in %.1f us\n", loaded.nr_tracks, shuffle_us);
+
+	music_index_free(&loaded);
+	music_index_free(&full);
+	if (mismatches) {
+		fprintf(stderr, "%d tracks were found elsewhere by the walk\n",
+		        mismatches);
+		return 1;
+	}
+	return 0;
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: musicindex [options...] <music folder> <index>\n");
+	printf("  Indexes the mp3 files below a folder,\n");
+	printf("  e.g. musicindex sd/music sd/music.idx\n");
+	printf("  -h Show help\n");
+	printf("  -b Benchmark a full scan, an update and lookups in the index\n");
+	printf("     against listing the folders, run it on the mounted card\n");
+	printf("     image, the index is overwritten\n");
+	printf("  -r Specify benchmark lookups (default 1000)\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		if (*argv[i] == '-') {
+			switch (argv[i][1]) {
+				case 'b': benchmark = 1; break;
+				case 'r':
+					if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+					++i;
+					rounds = atoi(argv[i]);
+					if (rounds < 1) rounds = 1;
+					break;
+				case 'h': help(); return EXIT_SUCCESS;
+			}
+			continue;
+		}
+		if (!root)
+			root = argv[i];
+		else if (!index_path)
+			index_path = argv[i];
+	}
+
+	if (!root || !index_path) {
+		fprintf(stderr, "missing music folder or index\n");
+		help();
+		return EXIT_FAILURE;
+	}
+
+	int failed = benchmark ? run_benchmark() : update_index();
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
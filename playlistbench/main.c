@@ -0,0 +1,560 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Plays a sentence of clock clips through the playlist reader of the
+ * firmware, a stub MP3 decoder and the prompt recorder, chained like sd_play
+ * does: one run of the pipeline for the whole sentence. The clips are made up
+ * MP3 files in a temporary directory, Layer III frames with the clip and the
+ * frame number as payload behind an Info frame with the encoder delay and
+ * padding. One has an ID3v2 tag, one is in a prompt pack and one is missing.
+ * The card stub takes a while to open every file, the stub decoder turns
+ * each frame into the samples of its place in the clip.
+ *
+ * A sink plays the output in real time, holding no more than a short buffer
+ * like the DMA buffers of the I2S stream. The output must be the body of
+ * every clip back-to-back, sample for sample, and the decoder must only get
+ * audio frames. The sink must never run dry between clips, the prefetch task
+ * has to read the next clip while the current one plays. Afterwards every
+ * clip must be in the prompt cache as it was played.
+ */
+
+#include "esp_timer.h"
+#include "prompt_cache.h"
+#include "prompt_pack.h"
+#include "prompt_stream.h"
+#include "sd_storage.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SAMPLE_RATE 44100
+
+// MPEG-1 Layer III at 128 kbit/s, 44.1 kHz and mono
+#define FRAME_HEADER  0xfffb90c0u
+#define FRAME_LENGTH  417
+#define FRAME_SAMPLES 1152
+#define SIDE_INFO     21 // Offset of the Xing/Info tag in the frame
+
+// Delay and padding in the LAME tag of every clip [samples]
+#define ENCODER_DELAY   576
+#define ENCODER_PADDING 1000
+
+// Delay of the synthesis filter bank, see prompt_playlist.c
+#define DECODER_DELAY 529
+
+#define PACK_PATH "pack.bin"
+#define PACK_ID   59
+
+#define CACHE_BUDGET (1024 * 1024)
+
+// Bytes between two elements at most, more than one process call passes on
+#define PIPE_SIZE 8192
+
+static int frames   = 20;
+static int latency  = 100;
+static int buffered = 50;
+
+/* A clip of the sentence, number is its payload or -1 if it is missing */
+struct clip {
+	const char *path;
+	int number;
+	bool id3;
+};
+
+static const struct clip sentence[] = {
+	{ "cu.mp3", 0, true },
+	{ "14.mp3", 1, false },
+	{ "missing.mp3", -1, false },
+	{ PACK_PATH "#59", 2, false },
+};
+
+#define NR_CLIPS (int)(sizeof sentence / sizeof *sentence)
+
+/* Bytes one element wrote and the next one reads */
+struct pipe {
+	char data[PIPE_SIZE];
+	int fill;
+};
+
+/* The stub decoder, collects a frame at a time */
+struct decoder {
+	uint8_t frame[FRAME_LENGTH];
+	int fill;
+	int junk; // Bytes that were not in an audio frame
+	int16_t pcm[FRAME_SAMPLES];
+};
+
+/* The I2S stream, checks the samples and plays them in real time */
+struct sink {
+	int clip;          // Clip of the sentence being played
+	int position;      // Sample of the body of that clip
+	int64_t samples;   // Samples played
+	int64_t wrong;     // Samples that were not the next of the sentence
+	int64_t start_us;  // Time of the first sample, moved by every underrun
+	int underruns;
+	int64_t longest_us; // Longest underrun
+};
+
+struct sd_storage {
+	int opens;
+};
+
+static struct sd_storage card;
+static struct pipe encoded;
+static struct pipe decoded;
+static struct sink sink;
+
+static int64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(int64_t us) {
+	struct timespec ts = { us / 1000000, (long)(us % 1000000) * 1000 };
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+		;
+}
+
+/*
+ * The card of the firmware, files in the working directory that take latency
+ * ms to open
+ */
+esp_err_t sd_storage_acquire(sd_storage_handle_t *storage) {
+	*storage = &card;
+	return ESP_OK;
+}
+
+void sd_storage_release(sd_storage_handle_t storage) {
+	(void)storage;
+}
+
+FILE *sd_storage_open(sd_storage_handle_t storage, const char *path,
+                      size_t *size) {
+	sleep_until_us(now_us() + latency * 1000);
+	storage->opens++;
+	FILE *f = fopen(path, "rb");
+	if (!f) return NULL;
+	long length = fseek(f, 0, SEEK_END) ? -1 : ftell(f);
+	if (length < 0) {
+		fclose(f);
+		return NULL;
+	}
+	rewind(f);
+	*size = (size_t)length;
+	return f;
+}
+
+void sd_storage_close(sd_storage_handle_t storage, FILE *file) {
+	(void)storage;
+	fclose(file);
+}
+
+/* Sample n of the decoded audio of a clip */
+static int16_t sample_value(int number, int n) {
+	return (int16_t)((number * 10007 + n) % 32768);
+}
+
+static int body_samples(void) {
+	return frames * FRAME_SAMPLES - (ENCODER_DELAY + DECODER_DELAY) -
+	       (ENCODER_PADDING - DECODER_DELAY);
+}
+
+static void put_header(uint8_t *frame) {
+	frame[0] = FRAME_HEADER >> 24;
+	frame[1] = FRAME_HEADER >> 16 & 0xff;
+	frame[2] = FRAME_HEADER >> 8 & 0xff;
+	frame[3] = FRAME_HEADER & 0xff;
+}
+
+/*
+ * An MP3 file of the clip: an ID3v2 tag if asked for, an Info frame with a
+ * LAME tag and frames audio frames
+ */
+static uint8_t *make_mp3(const struct clip *clip, size_t *length) {
+	size_t tag = clip->id3 ? 10 + 100 : 0;
+	*length    = tag + (size_t)(frames + 1) * FRAME_LENGTH;
+	uint8_t *data = calloc(1, *length);
+	if (!data) return NULL;
+
+	if (clip->id3) {
+		memcpy(data, "ID3\x04", 4);
+		data[9] = 100; // Syncsafe size of the tag after the header
+	}
+
+	uint8_t *info = data + tag;
+	put_header(info);
+	memcpy(info + SIDE_INFO, "Info", 4);
+	uint8_t *lame = info + SIDE_INFO + 8;
+	memcpy(lame, "LAME", 4);
+	lame[21] = ENCODER_DELAY >> 4;
+	lame[22] = (ENCODER_DELAY & 0x0f) << 4 | ENCODER_PADDING >> 8;
+	lame[23] = ENCODER_PADDING & 0xff;
+
+	for (int f = 0; f < frames; f++) {
+		uint8_t *frame = info + (size_t)(f + 1) * FRAME_LENGTH;
+		put_header(frame);
+		frame[4] = (uint8_t)clip->number;
+		frame[5] = (uint8_t)(f >> 8);
+		frame[6] = (uint8_t)f;
+	}
+	return data;
+}
+
+static bool write_file(const char *path, const void *data, size_t length) {
+	FILE *f = fopen(path, "wb");
+	if (!f) return false;
+	bool ok = fwrite(data, 1, length, f) == length;
+	return fclose(f) == 0 && ok;
+}
+
+/* A pack with the clip as its only entry */
+static bool write_pack(const uint8_t *data, size_t length) {
+	struct prompt_pack_header header = {
+		.magic      = PROMPT_PACK_MAGIC,
+		.version    = PROMPT_PACK_VERSION,
+		.nr_entries = 1,
+		.alignment  = PROMPT_PACK_ALIGNMENT,
+	};
+	struct prompt_pack_entry entry = {
+		.id     = PACK_ID,
+		.offset = PROMPT_PACK_ALIGNMENT,
+		.length = (uint32_t)length,
+		.format = PROMPT_PACK_FORMAT_MP3,
+	};
+	size_t size = PROMPT_PACK_ALIGNMENT + length;
+	uint8_t *pack = calloc(1, size);
+	if (!pack) return false;
+	memcpy(pack, &header, sizeof header);
+	memcpy(pack + sizeof header, &entry, sizeof entry);
+	memcpy(pack + PROMPT_PACK_ALIGNMENT, data, length);
+	bool ok = write_file(PACK_PATH, pack, size);
+	free(pack);
+	return ok;
+}
+
+static bool make_files(void) {
+	for (int c = 0; c < NR_CLIPS; c++) {
+		const struct clip *clip = &sentence[c];
+		if (clip->number < 0) continue;
+
+		size_t length;
+		uint8_t *data = make_mp3(clip, &length);
+		if (!data) return false;
+		bool ok = strchr(clip->path, PROMPT_PACK_SEPARATOR)
+		              ? write_pack(data, length)
+		              : write_file(clip->path, data, length);
+		free(data);
+		if (!ok) return false;
+	}
+	return true;
+}
+
+static void remove_files(void) {
+	for (int c = 0; c < NR_CLIPS; c++)
+		if (!strchr(sentence[c].path, PROMPT_PACK_SEPARATOR))
+			remove(sentence[c].path);
+	remove(PACK_PATH);
+}
+
+static audio_element_err_t pipe_write(audio_element_handle_t self,
+                                      char *buffer, int length,
+                                      TickType_t ticks_to_wait,
+                                      void *context) {
+	struct pipe *pipe = context;
+	(void)self, (void)ticks_to_wait;
+	if (length > PIPE_SIZE - pipe->fill) return AEL_IO_FAIL;
+	memcpy(pipe->data + pipe->fill, buffer, length);
+	pipe->fill += length;
+	return length;
+}
+
+static audio_element_err_t pipe_read(audio_element_handle_t self,
+                                     char *buffer, int length,
+                                     TickType_t ticks_to_wait, void *context) {
+	struct pipe *pipe = context;
+	(void)self, (void)ticks_to_wait;
+	if (pipe->fill == 0) return AEL_IO_TIMEOUT;
+	if (length > pipe->fill) length = pipe->fill;
+	memcpy(buffer, pipe->data, length);
+	memmove(pipe->data, pipe->data + length, pipe->fill - length);
+	pipe->fill -= length;
+	return length;
+}
+
+/*
+ * Decode the next frame, a decoder would also play whatever else it finds
+ * after a frame header, any other byte counts as junk
+ */
+static audio_element_err_t decoder_process(audio_element_handle_t self,
+                                           char *buffer, int length) {
+	struct decoder *d = audio_element_getdata(self);
+	(void)buffer, (void)length;
+
+	int bytes = audio_element_input(self, (char *)d->frame + d->fill,
+	                                FRAME_LENGTH - d->fill);
+	if (bytes <= 0) return bytes;
+	d->fill += bytes;
+
+	// Find the header of the next frame
+	int sync = 0;
+	while (sync < d->fill && sync < 4 &&
+	       d->frame[sync] == (uint8_t)(FRAME_HEADER >> (24 - 8 * sync)))
+		sync++;
+	if (sync < d->fill && sync < 4) {
+		d->junk++;
+		d->fill--;
+		memmove(d->frame, d->frame + 1, d->fill);
+		return bytes;
+	}
+	if (d->fill < FRAME_LENGTH) return bytes;
+	d->fill = 0;
+
+	if (!memcmp(d->frame + SIDE_INFO, "Info", 4)) {
+		d->junk += FRAME_LENGTH;
+		return bytes;
+	}
+	int number = d->frame[4];
+	int first  = (d->frame[5] << 8 | d->frame[6]) * FRAME_SAMPLES;
+	for (int n = 0; n < FRAME_SAMPLES; n++)
+		d->pcm[n] = sample_value(number, first + n);
+	int ret = audio_element_output(self, (char *)d->pcm, sizeof d->pcm);
+	return ret < 0 ? ret : bytes;
+}
+
+static esp_err_t decoder_destroy(audio_element_handle_t self) {
+	free(audio_element_getdata(self));
+	return ESP_OK;
+}
+
+static audio_element_handle_t decoder_init(void) {
+	struct decoder *d = calloc(1, sizeof *d);
+	if (!d) return NULL;
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.process             = decoder_process;
+	cfg.destroy             = decoder_destroy;
+	cfg.buffer_len          = FRAME_LENGTH;
+	cfg.tag                 = "decoder";
+	audio_element_handle_t el = audio_element_init(&cfg);
+	if (!el) {
+		free(d);
+		return NULL;
+	}
+	audio_element_setdata(el, d);
+	return el;
+}
+
+/*
+ * Play the samples once the buffer has room: an underrun when they come after
+ * the buffer ran dry, the playback then slips by as much
+ */
+static audio_element_err_t sink_write(audio_element_handle_t self,
+                                      char *buffer, int length,
+                                      TickType_t ticks_to_wait,
+                                      void *context) {
+	struct sink *s  = context;
+	int64_t now     = now_us();
+	int64_t due     = s->start_us + s->samples * 1000000 / SAMPLE_RATE;
+	int nr_samples  = length / (int)sizeof(int16_t);
+	int16_t *sample = (int16_t *)buffer;
+	(void)self, (void)ticks_to_wait;
+
+	if (s->samples == 0) {
+		s->start_us = now;
+	} else if (now > due) {
+		s->underruns++;
+		if (now - due > s->longest_us) s->longest_us = now - due;
+		s->start_us += now - due;
+	}
+
+	for (int i = 0; i < nr_samples; i++) {
+		while (s->clip < NR_CLIPS &&
+		       (sentence[s->clip].number < 0 ||
+		        s->position == body_samples())) {
+			s->clip++;
+			s->position = 0;
+		}
+		int n = ENCODER_DELAY + DECODER_DELAY + s->position++;
+		if (s->clip == NR_CLIPS ||
+		    sample[i] != sample_value(sentence[s->clip].number, n))
+			s->wrong++;
+	}
+
+	s->samples += nr_samples;
+	sleep_until_us(s->start_us + s->samples * 1000000 / SAMPLE_RATE -
+	               buffered * 1000);
+	return length;
+}
+
+/* The clips the recorder put in the cache must be the bodies that played */
+static int check_cache(void) {
+	int cached = 0;
+	int played = 0;
+	for (int c = 0; c < NR_CLIPS; c++) {
+		if (sentence[c].number < 0) continue;
+		played++;
+
+		const prompt_t *prompt = prompt_cache_acquire(sentence[c].path);
+		if (!prompt) continue;
+		const int16_t *samples = (const int16_t *)prompt->data;
+		bool ok = prompt->length == body_samples() * sizeof *samples &&
+		          prompt->sample_rate == SAMPLE_RATE &&
+		          prompt->channels == 1;
+		for (int n = 0; ok && n < body_samples(); n++)
+			ok = samples[n] == sample_value(sentence[c].number,
+			                                ENCODER_DELAY + DECODER_DELAY + n);
+		prompt_cache_release(prompt);
+		if (ok) cached++;
+	}
+
+	bool ok = cached == played;
+	printf("cache: %s, %d of %d clips cached as they played\n",
+	       ok ? "ok" : "FAILED", cached, played);
+	return !ok;
+}
+
+static int run_sentence(void) {
+	audio_element_handle_t recorder = prompt_recorder_init();
+	audio_element_handle_t playlist = prompt_playlist_init(recorder);
+	audio_element_handle_t decoder  = decoder_init();
+	if (!recorder || !playlist || !decoder) return 1;
+
+	audio_element_set_write_cb(playlist, pipe_write, &encoded);
+	audio_element_set_read_cb(decoder, pipe_read, &encoded);
+	audio_element_set_write_cb(decoder, pipe_write, &decoded);
+	audio_element_set_read_cb(recorder, pipe_read, &decoded);
+	audio_element_set_write_cb(recorder, sink_write, &sink);
+
+	const char *paths[NR_CLIPS];
+	for (int c = 0; c < NR_CLIPS; c++) paths[c] = sentence[c].path;
+	prompt_playlist_set(playlist, paths, NR_CLIPS);
+
+	// The element tasks of the pipeline, one after the other. The playlist
+	// times out while it waits for a clip, the wait ends with the next call
+	// that does not.
+	int64_t longest_wait = 0;
+	int64_t wait_start   = 0;
+	audio_element_err_t ret;
+	do {
+		if (!wait_start) wait_start = now_us();
+		ret = audio_element_process(playlist);
+		if (ret != AEL_IO_TIMEOUT) {
+			if (sink.samples > 0 && now_us() - wait_start > longest_wait)
+				longest_wait = now_us() - wait_start;
+			wait_start = 0;
+		}
+		while (encoded.fill > 0 && audio_element_process(decoder) > 0)
+			while (decoded.fill > 0 && audio_element_process(recorder) > 0)
+				;
+	} while (ret > 0 || ret == AEL_IO_TIMEOUT);
+
+	int junk = ((struct decoder *)audio_element_getdata(decoder))->junk;
+	audio_element_deinit(playlist);
+	audio_element_deinit(decoder);
+	audio_element_deinit(recorder);
+
+	int64_t expected = 0;
+	for (int c = 0; c < NR_CLIPS; c++)
+		if (sentence[c].number >= 0) expected += body_samples();
+	bool ok = ret == AEL_IO_DONE && sink.wrong == 0 &&
+	          sink.samples == expected && junk == 0;
+	printf("sentence: %s, %lld of %lld samples in one run, %lld wrong, %d "
+	       "bytes to the decoder not in an audio frame\n",
+	       ok ? "ok" : "FAILED", (long long)sink.samples,
+	       (long long)expected, (long long)sink.wrong, junk);
+
+	bool gapless = sink.underruns == 0;
+	printf("gaps: %s, %d underruns of up to %.1f ms with %d ms buffered, "
+	       "waited up to %.1f ms for a clip with %d ms to open a file\n",
+	       gapless ? "ok" : "FAILED", sink.underruns, sink.longest_us / 1e3,
+	       buffered, longest_wait / 1e3, latency);
+	return !ok || !gapless;
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: playlistbench [options...]\n");
+	printf("  Plays a sentence of clips through the playlist of the "
+	       "firmware\n");
+	printf("  -h Show help\n");
+	printf("  -b Specify ms of audio the output buffers (default 50)\n");
+	printf("  -f Specify frames per clip (default 20)\n");
+	printf("  -l Specify ms to open a file on the card (default 100)\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		int *value = NULL;
+		switch (argv[i][0] == '-' ? argv[i][1] : 0) {
+			case 'b': value = &buffered; break;
+			case 'f': value = &frames; break;
+			case 'l': value = &latency; break;
+			case 'h': help(); return EXIT_SUCCESS;
+			default:
+				fprintf(stderr, "Unknown option: %s\n", argv[i]);
+				return EXIT_FAILURE;
+		}
+		if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+		*value = atoi(argv[++i]);
+	}
+	if (buffered < 1) buffered = 1;
+	// The delay and padding must fit, the frame number in two bytes
+	if (frames < 2) frames = 2;
+	if (frames > 200) frames = 200;
+	if (latency < 0) latency = 0;
+
+	char dir[] = "/tmp/playlistbench.XXXXXX";
+	if (!mkdtemp(dir) || chdir(dir) || !make_files() ||
+	    prompt_cache_init(CACHE_BUDGET) != ESP_OK) {
+		fprintf(stderr, "Cannot make the clips in %s\n", dir);
+		return EXIT_FAILURE;
+	}
+
+	int failed = run_sentence();
+	failed    |= check_cache();
+
+	remove_files();
+	if (chdir("/") == 0) rmdir(dir);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,417 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Packs the clips of one folder of the sdcard, e.g. the speaking clock of a
+ * language, into a prompt pack the speaker reads with one open and a seek
+ * per clip. See prompt_pack_format.h for the layout.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "prompt_pack_format.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define HEADER_SIZE 16
+#define ENTRY_SIZE  16
+
+struct clip {
+	char *path;
+	char *name; // File name without the extension, gives the id
+	uint32_t id;
+	uint32_t offset;
+	uint32_t length;
+};
+
+static struct clip *clips = NULL;
+static int nr_clips       = 0;
+static int benchmark      = 0;
+static int rounds         = 100;
+static char *folder       = NULL;
+static char *pack_path    = NULL;
+
+static void put_le16(unsigned char *p, uint16_t value) {
+	p[0] = value & 0xff;
+	p[1] = value >> 8;
+}
+
+static void put_le32(unsigned char *p, uint32_t value) {
+	put_le16(p, value & 0xffff);
+	put_le16(p + 2, value >> 16);
+}
+
+static uint16_t get_le16(const unsigned char *p) {
+	return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+	return get_le16(p) | (uint32_t)get_le16(p + 2) << 16;
+}
+
+static uint32_t align(uint32_t offset) {
+	return (offset + PROMPT_PACK_ALIGNMENT - 1) / PROMPT_PACK_ALIGNMENT *
+	       PROMPT_PACK_ALIGNMENT;
+}
+
+static int is_mp3(const char *name) {
+	size_t length = strlen(name);
+	if (length <= 4 || name[length - 4] != '.') return 0;
+	for (int i = 0; i < 3; ++i)
+		if (tolower((unsigned char)name[length - 3 + i]) != "mp3"[i])
+			return 0;
+	return 1;
+}
+
+static int compare_clips(const void *a, const void *b) {
+	uint32_t id_a = ((const struct clip *)a)->id;
+	uint32_t id_b = ((const struct clip *)b)->id;
+	return id_a < id_b ? -1 : id_a > id_b;
+}
+
+static int find_clips(void) {
+	DIR *dir = opendir(folder);
+	if (!dir) {
+		fprintf(stderr, "cannot open folder %s\n", folder);
+		return 1;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(dir))) {
+		if (!is_mp3(entry->d_name)) continue;
+		if (nr_clips == PROMPT_PACK_MAX_ENTRIES) {
+			fprintf(stderr, "more than %d clips in %s\n",
+			        PROMPT_PACK_MAX_ENTRIES, folder);
+			goto error;
+		}
+
+		struct clip *grown = realloc(clips, (nr_clips + 1) * sizeof *clips);
+		if (!grown) goto error;
+		clips = grown;
+
+		struct clip *clip = &clips[nr_clips++];
+		size_t length     = strlen(entry->d_name);
+		clip->name        = malloc(length - 3);
+		clip->path        = malloc(strlen(folder) + length + 2);
+		if (!clip->name || !clip->path) goto error;
+		memcpy(clip->name, entry->d_name, length - 4);
+		clip->name[length - 4] = '\0';
+		sprintf(clip->path, "%s/%s", folder, entry->d_name);
+		clip->id = prompt_pack_id(clip->name);
+
+		struct stat st;
+		if (stat(clip->path, &st) != 0 || st.st_size <= 0 ||
+		    st.st_size > 0x7fffffff) {
+			fprintf(stderr, "cannot pack %s\n", clip->path);
+			goto error;
+		}
+		clip->length = (uint32_t)st.st_size;
+	}
+	closedir(dir);
+
+	if (nr_clips == 0) {
+		fprintf(stderr, "no mp3 files in %s\n", folder);
+		return 1;
+	}
+	qsort(clips, nr_clips, sizeof *clips, compare_clips);
+	for (int i = 1; i < nr_clips; ++i) {
+		if (clips[i].id == clips[i - 1].id) {
+			fprintf(stderr, "%s and %s have the same id\n", clips[i - 1].path,
+			        clips[i].path);
+			return 1;
+		}
+	}
+	return 0;
+
+error:
+	closedir(dir);
+	return 1;
+}
+
+static void free_clips(void) {
+	for (int i = 0; i < nr_clips; ++i) {
+		free(clips[i].name);
+		free(clips[i].path);
+	}
+	free(clips);
+}
+
+static int copy_clip(FILE *out, const struct clip *clip) {
+	FILE *in = fopen(clip->path, "rb");
+	if (!in) {
+		fprintf(stderr, "cannot open %s\n", clip->path);
+		return 1;
+	}
+
+	char buffer[4096];
+	uint32_t copied = 0;
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof buffer, in)) > 0) {
+		if (fwrite(buffer, 1, n, out) != n) break;
+		copied += n;
+	}
+	fclose(in);
+
+	if (copied != clip->length) {
+		fprintf(stderr, "%s changed while packing\n", clip->path);
+		return 1;
+	}
+	return 0;
+}
+
+static int write_pack(void) {
+	// Lay the payloads out after the table
+	uint64_t offset = HEADER_SIZE + (uint64_t)nr_clips * ENTRY_SIZE;
+	for (int i = 0; i < nr_clips; ++i) {
+		offset          = align((uint32_t)offset);
+		clips[i].offset = (uint32_t)offset;
+		offset         += clips[i].length;
+		if (offset > UINT32_MAX - PROMPT_PACK_ALIGNMENT) {
+			fprintf(stderr, "pack is larger than 4 GB\n");
+			return 1;
+		}
+	}
+
+	size_t table_size    = HEADER_SIZE + (size_t)nr_clips * ENTRY_SIZE;
+	unsigned char *table = calloc(1, table_size);
+	if (!table) return 1;
+	memcpy(table, PROMPT_PACK_MAGIC, 4);
+	put_le16(table + 4, PROMPT_PACK_VERSION);
+	put_le16(table + 6, (uint16_t)nr_clips);
+	put_le32(table + 8, PROMPT_PACK_ALIGNMENT);
+	for (int i = 0; i < nr_clips; ++i) {
+		unsigned char *entry = table + HEADER_SIZE + i * ENTRY_SIZE;
+		put_le32(entry, clips[i].id);
+		put_le32(entry + 4, clips[i].offset);
+		put_le32(entry + 8, clips[i].length);
+		put_le16(entry + 12, PROMPT_PACK_FORMAT_MP3);
+	}
+
+	FILE *out = fopen(pack_path, "wb");
+	if (!out) {
+		fprintf(stderr, "cannot create %s\n", pack_path);
+		free(table);
+		return 1;
+	}
+	int failed = fwrite(table, 1, table_size, out) != table_size;
+	free(table);
+
+	static const char zeros[PROMPT_PACK_ALIGNMENT];
+	long position = (long)table_size;
+	for (int i = 0; i < nr_clips && !failed; ++i) {
+		size_t padding = clips[i].offset - position;
+		failed         = fwrite(zeros, 1, padding, out) != padding ||
+		         copy_clip(out, &clips[i]);
+		position = clips[i].offset + clips[i].length;
+		printf("%10u %-12s %7u bytes at %u\n", (unsigned)clips[i].id,
+		       clips[i].name, (unsigned)clips[i].length,
+		       (unsigned)clips[i].offset);
+	}
+	if (fclose(out) != 0) failed = 1;
+	if (failed) {
+		fprintf(stderr, "failed to write %s\n", pack_path);
+		remove(pack_path);
+		return 1;
+	}
+
+	printf("packed %d clips into %s, %ld bytes\n", nr_clips, pack_path,
+	       position);
+	return 0;
+}
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * Read every clip from the files and from the pack the way the speaker does:
+ * an open per file, or one open of the pack, a binary search of its table and
+ * a seek per clip.
+ */
+static int run_benchmark(void) {
+	uint32_t max_length = 0;
+	for (int i = 0; i < nr_clips; ++i)
+		if (clips[i].length > max_length) max_length = clips[i].length;
+	char *buffer = malloc(max_length);
+	if (!buffer) return 1;
+
+	double files_open = 0, files_total = 0;
+	for (int r = 0; r < rounds; ++r) {
+		for (int i = 0; i < nr_clips; ++i) {
+			double start = now_us();
+			FILE *f      = fopen(clips[i].path, "rb");
+			double open  = now_us();
+			if (!f || fread(buffer, 1, clips[i].length, f) != clips[i].length) {
+				fprintf(stderr, "cannot read %s\n", clips[i].path);
+				if (f) fclose(f);
+				free(buffer);
+				return 1;
+			}
+			fclose(f);
+			files_open  += open - start;
+			files_total += now_us() - start;
+		}
+	}
+
+	double start = now_us();
+	FILE *pack   = fopen(pack_path, "rb");
+	unsigned char header[HEADER_SIZE];
+	if (!pack || fread(header, 1, HEADER_SIZE, pack) != HEADER_SIZE ||
+	    memcmp(header, PROMPT_PACK_MAGIC, 4) != 0) {
+		fprintf(stderr, "%s is not a pack\n", pack_path);
+		if (pack) fclose(pack);
+		free(buffer);
+		return 1;
+	}
+	int nr_entries       = get_le16(header + 6);
+	unsigned char *table = malloc((size_t)nr_entries * ENTRY_SIZE);
+	if (!table || fread(table, ENTRY_SIZE, nr_entries, pack) !=
+	                  (size_t)nr_entries) {
+		fprintf(stderr, "cannot read the table of %s\n", pack_path);
+		fclose(pack);
+		free(table);
+		free(buffer);
+		return 1;
+	}
+	double pack_open = now_us() - start;
+
+	double pack_lookup = 0, pack_total = 0;
+	int missing        = 0;
+	for (int r = 0; r < rounds; ++r) {
+		for (int i = 0; i < nr_clips; ++i) {
+			double start = now_us();
+			int low = 0, high = nr_entries - 1, found = -1;
+			while (low <= high && found < 0) {
+				int middle  = low + (high - low) / 2;
+				uint32_t id = get_le32(table + middle * ENTRY_SIZE);
+				if (id == clips[i].id)
+					found = middle;
+				else if (id < clips[i].id)
+					low = middle + 1;
+				else
+					high = middle - 1;
+			}
+			double lookup = now_us();
+			if (found < 0) {
+				missing++;
+				continue;
+			}
+			const unsigned char *entry = table + found * ENTRY_SIZE;
+			uint32_t length            = get_le32(entry + 8);
+			if (length > max_length ||
+			    fseek(pack, (long)get_le32(entry + 4), SEEK_SET) != 0 ||
+			    fread(buffer, 1, length, pack) != length) {
+				fprintf(stderr, "cannot read %s from %s\n", clips[i].name,
+				        pack_path);
+				missing++;
+				continue;
+			}
+			pack_lookup += lookup - start;
+			pack_total  += now_us() - start;
+		}
+	}
+	fclose(pack);
+	free(table);
+	free(buffer);
+
+	double reads = (double)rounds * nr_clips;
+	printf("%d clips, %d rounds\n", nr_clips, rounds);
+	printf("files: open %8.2f us, open and read %8.2f us per clip\n",
+	       files_open / reads, files_total / reads);
+	printf("pack:  open %8.2f us once, lookup %8.3f us, "
+	       "lookup and read %8.2f us per clip\n",
+	       pack_open, pack_lookup / reads, pack_total / reads);
+	if (missing) {
+		fprintf(stderr, "%d clips are not in %s\n", missing / rounds,
+		        pack_path);
+		return 1;
+	}
+	return 0;
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: promptpack [options...] <folder> <pack>\n");
+	printf("  Packs the mp3 files of a folder, e.g. promptpack sd/0 sd/0.pak\n");
+	printf("  -h Show help\n");
+	printf("  -b Benchmark reading the clips of the folder from the files\n");
+	printf("     and from an existing pack, run it on the mounted card image\n");
+	printf("  -r Specify benchmark rounds (default 100)\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		if (*argv[i] == '-') {
+			switch (argv[i][1]) {
+				case 'b': benchmark = 1; break;
+				case 'r':
+					if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+					++i;
+					rounds = atoi(argv[i]);
+					if (rounds < 1) rounds = 1;
+					break;
+				case 'h': help(); return EXIT_SUCCESS;
+			}
+			continue;
+		}
+		if (!folder)
+			folder = argv[i];
+		else if (!pack_path)
+			pack_path = argv[i];
+	}
+
+	if (!folder || !pack_path) {
+		fprintf(stderr, "missing folder or pack\n");
+		help();
+		return EXIT_FAILURE;
+	}
+
+	int failed = find_clips();
+	if (!failed) failed = benchmark ? run_benchmark() : write_pack();
+	free_clips();
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
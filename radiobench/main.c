@@ -0,0 +1,953 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures how long the radio takes from tuning to the first frame it can
+ * decode, with a local stand-in for an Icecast/SHOUTcast server that serves
+ * an MP3 and an AAC stream, each with its Content-Type. A channel
+ * that is tuned cold connects, waits for the response and syncs on the
+ * stream. A channel that was prebuffered on standby only syncs on the ring
+ * that kept the newest part of its stream. Each stream has to be told from
+ * its Content-Type, or from its frames when -u leaves it out, like the radio
+ * picks its decoder.
+ *
+ * The stand-in answers after a delay like a server on the internet, sends a
+ * burst like Icecast does and then paces the stream at its bitrate. It
+ * starts each connection at a random byte of the stream, the middle of a
+ * frame most of the time.
+ *
+ * With -j it plays the stream instead, like the decoder reads the active
+ * station, from a stand-in that stalls and catches up like a stream over bad
+ * Wi-Fi and closes connections, refusing new ones for a while with -o. The
+ * stream appends to the ring, the decoder reads it and the stream connects
+ * again with the code of the firmware, radio_link.c, which waits for the
+ * target of the jitter buffer, backs off and resumes at a whole frame. It
+ * compares a fixed buffer that is dropped on a reconnect like the http
+ * stream of ADF does, the fixed buffer resumed and the adaptive one resumed.
+ * The player walks the frames like the decoder and counts how often it has
+ * to find them again.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "radio_jitter.h"
+#include "radio_link.h"
+#include "radio_ring.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Bytes the stand-in sends at a time after the burst */
+#define PACE_MS 20
+
+static int rounds       = 10;
+static int latency_ms   = 300;
+static int burst_kb     = 64;
+static int bitrate_kbps = 128;
+static int aac_kbps     = 64;
+static int standby_ms   = 2000;
+static int ring_kb      = 64;
+static int jitter_s     = 0;
+static int stall_pct    = 0;
+static int drop_s       = 0;
+static int outage_ms    = 0;
+static int jitter_ms    = 500;
+static int untyped      = 0;
+
+/* The streams the stand-in serves by codec, looped */
+struct stream {
+	const char *path; /* Of the file, NULL for silent frames */
+	const char *name;
+	const char *type;
+	int kbps;
+	uint8_t *data;
+	size_t size;
+};
+
+static struct stream streams[] = {
+	[RADIO_CODEC_MP3] = { NULL, "mp3", "audio/mpeg", 0, NULL, 0 },
+	[RADIO_CODEC_AAC] = { NULL, "aac", "audio/aacp", 0, NULL, 0 },
+};
+
+/* Connections the stand-in serves, they end when it stops */
+static volatile bool server_stop;
+static unsigned int serving;
+/* Seeds the connections, the same for each buffer that is compared */
+static unsigned int connections;
+/* Connections are refused until then after one was closed */
+static int64_t refuse_until_us;
+
+/* The active station and the decoder reading it */
+struct player {
+	int port;
+	pthread_t thread;
+	pthread_mutex_t lock; /* Protects link */
+	pthread_cond_t data;  /* Signalled when the stream appended */
+	struct radio_link link;
+	volatile bool stop;
+	bool drop; /* The ring is dropped and it connects again at once */
+	enum radio_codec want; /* Stream it asks for */
+
+	/* Owned by the stream, read once it stopped */
+	unsigned int seed;     /* Of the backoff */
+	double outage_ms;      /* Until a byte arrived, summed */
+	double recover_ms;     /* Until the stream continued, summed */
+};
+
+/* The frames the decoder walks, one that is not where the last one ended
+ * makes it find them again */
+struct decoder {
+	uint8_t data[8192];
+	size_t fill;
+	bool synced;
+	unsigned int resets;
+};
+
+struct standby {
+	int fd;
+	pthread_t thread;
+	pthread_mutex_t lock; /* Protects ring and the counters */
+	struct radio_ring ring;
+	volatile bool stop;
+	size_t bytes;
+	size_t dropped;
+};
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void sleep_ms(int ms) {
+	struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+	nanosleep(&ts, NULL);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Read a file the stand-in serves, its frames tell which stream it is */
+static int read_stream(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "cannot open %s\n", path);
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	long size     = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *data = size > 0 ? malloc(size) : NULL;
+	size_t length = data ? fread(data, 1, size, f) : 0;
+	fclose(f);
+	if (!length) {
+		fprintf(stderr, "cannot read %s\n", path);
+		free(data);
+		return 0;
+	}
+
+	enum radio_codec codec =
+	    radio_codec_find(data, length < 65536 ? length : 65536);
+	if (!codec || streams[codec].data) {
+		fprintf(stderr, "%s: %s\n", path,
+		        codec ? "second stream of its codec" : "no MP3 or ADTS frames");
+		free(data);
+		return 0;
+	}
+	streams[codec].path = path;
+	streams[codec].data = data;
+	streams[codec].size = length;
+	return 1;
+}
+
+/*
+ * Without a file the stand-in serves silent 44.1 kHz MPEG-1 Layer III frames
+ * at the bitrate, padded to keep it exact.
+ */
+static int make_mp3(struct stream *stream) {
+	static const int bitrates[] = { 32,  40,  48,  56,  64,  80,  96,
+		                            112, 128, 160, 192, 224, 256, 320 };
+	int index                   = -1;
+	for (int b = 0; b < 14; ++b)
+		if (bitrates[b] == stream->kbps) index = b + 1;
+	if (index < 0) {
+		fprintf(stderr, "no MPEG-1 Layer III bitrate %d\n", stream->kbps);
+		return 0;
+	}
+
+	/* 1152 samples of 44100 Hz a frame, ten seconds */
+	int frames   = 383;
+	double size  = 144.0 * stream->kbps * 1000 / 44100;
+	stream->data = calloc(1, (size_t)(frames * size) + frames);
+	if (!stream->data) return 0;
+	size_t offset = 0;
+	for (int f = 0; f < frames; ++f) {
+		size_t length = (size_t)((f + 1) * size) - (size_t)(f * size);
+		uint8_t *frame = stream->data + offset;
+		frame[0]       = 0xff;
+		frame[1]       = 0xfb; /* MPEG-1 Layer III without CRC */
+		frame[2]       = (uint8_t)(index << 4 | (length > (size_t)size) << 1);
+		frame[3]       = 0x44;
+		offset        += length;
+	}
+	stream->size = offset;
+	return 1;
+}
+
+/*
+ * And ADTS frames of 44.1 kHz stereo AAC-LC, any bitrate as the frames have
+ * no fixed sizes. HE-AAC streams look the same, at half the sample rate.
+ */
+static int make_aac(struct stream *stream) {
+	/* 1024 samples of 44100 Hz a frame, ten seconds */
+	int frames   = 431;
+	double size  = stream->kbps * 1000 / 8.0 * 1024 / 44100;
+	stream->data = calloc(1, (size_t)(frames * size) + frames);
+	if (!stream->data || size < 8) {
+		fprintf(stderr, "no ADTS frames at %d kbps\n", stream->kbps);
+		return 0;
+	}
+	size_t offset = 0;
+	for (int f = 0; f < frames; ++f) {
+		size_t length = (size_t)((f + 1) * size) - (size_t)(f * size);
+		uint8_t *frame = stream->data + offset;
+		frame[0]       = 0xff;
+		frame[1]       = 0xf1; /* MPEG-4 without CRC */
+		frame[2]       = 0x50; /* AAC-LC, 44100 Hz */
+		frame[3]       = (uint8_t)(0x80 | length >> 11); /* Stereo */
+		frame[4]       = (uint8_t)(length >> 3);
+		frame[5]       = (uint8_t)(length << 5 | 0x1f);
+		frame[6]       = 0xfc;
+		offset        += length;
+	}
+	stream->size = offset;
+	return 1;
+}
+
+static int make_streams(void) {
+	streams[RADIO_CODEC_MP3].kbps = bitrate_kbps;
+	streams[RADIO_CODEC_AAC].kbps = aac_kbps;
+	if (!streams[RADIO_CODEC_MP3].data && !make_mp3(&streams[RADIO_CODEC_MP3]))
+		return 0;
+	return streams[RADIO_CODEC_AAC].data || make_aac(&streams[RADIO_CODEC_AAC]);
+}
+
+static int send_all(int fd, const void *data, size_t length) {
+	while (length) {
+		ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+		if (n <= 0) return 0;
+		data    = (const uint8_t *)data + n;
+		length -= n;
+	}
+	return 1;
+}
+
+/* Send the stream from offset on, looped */
+static int send_stream(int fd, const struct stream *stream, size_t *offset,
+                       size_t length) {
+	while (length) {
+		size_t part = stream->size - *offset < length ? stream->size - *offset
+		                                              : length;
+		if (!send_all(fd, stream->data + *offset, part)) return 0;
+		*offset  = (*offset + part) % stream->size;
+		length  -= part;
+	}
+	return 1;
+}
+
+static void *serve(void *args) {
+	int fd = (int)(intptr_t)args;
+	if ((int64_t)now_us() <
+	    __atomic_load_n(&refuse_until_us, __ATOMIC_RELAXED)) {
+		close(fd);
+		__atomic_sub_fetch(&serving, 1, __ATOMIC_RELEASE);
+		return NULL;
+	}
+
+	/* The request ends with an empty line */
+	char request[1024];
+	size_t length = 0;
+	while (length < sizeof request - 1) {
+		ssize_t n = recv(fd, request + length, sizeof request - 1 - length, 0);
+		if (n <= 0) break;
+		length          += n;
+		request[length]  = '\0';
+		if (strstr(request, "\r\n\r\n")) break;
+	}
+
+	/* GET /stream.<codec> */
+	const struct stream *stream = &streams[RADIO_CODEC_MP3];
+	if (!strncmp(request, "GET /stream.aac ", 16))
+		stream = &streams[RADIO_CODEC_AAC];
+
+	sleep_ms(latency_ms);
+	char header[256], type[64] = "";
+	if (!untyped)
+		snprintf(type, sizeof type, "Content-Type: %s\r\n", stream->type);
+	snprintf(header, sizeof header,
+	         "ICY 200 OK\r\nicy-name: stand-in\r\nicy-br: %d\r\n%s\r\n",
+	         stream->kbps, type);
+
+	unsigned int seed = __atomic_add_fetch(&connections, 1, __ATOMIC_RELAXED);
+	size_t offset     = rand_r(&seed) % stream->size;
+	size_t pace       = (size_t)stream->kbps * 1000 / 8 * PACE_MS / 1000;
+
+	/*
+	 * Stalls of 0.2 to 2 s, 55 paces on average, start at a rate that
+	 * stalls stall_pct of the time. The stream is sent late, not lost.
+	 */
+	double stalled  = (stall_pct < 90 ? stall_pct : 90) / 100.0;
+	double start    = stalled / (55 * (1 - stalled)) * RAND_MAX;
+	int drop_paces  = drop_s ? rand_r(&seed) % (2 * drop_s * 1000 / PACE_MS)
+	                         : -1;
+	int stall_paces = 0, late_paces = 0, p = 0;
+	if (send_all(fd, header, strlen(header)) &&
+	    send_stream(fd, stream, &offset, (size_t)burst_kb * 1024)) {
+		for (; !server_stop && p != drop_paces; ++p) {
+			if (!stall_paces && rand_r(&seed) < start)
+				stall_paces = (200 + rand_r(&seed) % 1801) / PACE_MS;
+			if (stall_paces) {
+				stall_paces--;
+				late_paces++;
+			} else if (!send_stream(fd, stream, &offset,
+			                        pace * (1 + late_paces))) {
+				break;
+			} else {
+				late_paces = 0;
+			}
+			sleep_ms(PACE_MS);
+		}
+	}
+	if (p == drop_paces)
+		__atomic_store_n(&refuse_until_us,
+		                 (int64_t)now_us() + (int64_t)outage_ms * 1000,
+		                 __ATOMIC_RELAXED);
+	close(fd);
+	__atomic_sub_fetch(&serving, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void *accept_connections(void *args) {
+	int server = (int)(intptr_t)args;
+	for (;;) {
+		int fd = accept(server, NULL, NULL);
+		if (fd < 0) continue;
+		pthread_t thread;
+		__atomic_add_fetch(&serving, 1, __ATOMIC_RELAXED);
+		if (pthread_create(&thread, NULL, serve, (void *)(intptr_t)fd) != 0) {
+			__atomic_sub_fetch(&serving, 1, __ATOMIC_RELAXED);
+			close(fd);
+		} else {
+			pthread_detach(thread);
+		}
+	}
+	return NULL;
+}
+
+static int start_server(void) {
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	if (server < 0) return 0;
+
+	struct sockaddr_in address = { 0 };
+	address.sin_family         = AF_INET;
+	address.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+	socklen_t size             = sizeof address;
+	pthread_t thread;
+	if (bind(server, (struct sockaddr *)&address, size) != 0 ||
+	    listen(server, 16) != 0 ||
+	    getsockname(server, (struct sockaddr *)&address, &size) != 0 ||
+	    pthread_create(&thread, NULL, accept_connections,
+	                   (void *)(intptr_t)server) != 0) {
+		close(server);
+		return 0;
+	}
+	pthread_detach(thread);
+	return ntohs(address.sin_port);
+}
+
+/* Wait for the connections to end, they use the stream */
+static void stop_server(void) {
+	server_stop = true;
+	while (__atomic_load_n(&serving, __ATOMIC_ACQUIRE)) sleep_ms(PACE_MS);
+}
+
+/*
+ * The codec of a Content-Type, like the http stream of ADF tells it the
+ * decoder. Other types are told by the frames.
+ */
+static enum radio_codec codec_of_type(const char *type) {
+	static const char *mp3[] = { "audio/mpeg", "audio/mp3" };
+	static const char *aac[] = { "audio/aac", "audio/x-aac", "audio/aacp" };
+	size_t length            = strcspn(type, ";\r\n");
+	for (size_t i = 0; i < sizeof mp3 / sizeof *mp3; ++i)
+		if (strlen(mp3[i]) == length && !strncasecmp(type, mp3[i], length))
+			return RADIO_CODEC_MP3;
+	for (size_t i = 0; i < sizeof aac / sizeof *aac; ++i)
+		if (strlen(aac[i]) == length && !strncasecmp(type, aac[i], length))
+			return RADIO_CODEC_AAC;
+	return RADIO_CODEC_NONE;
+}
+
+/* The codec the stream told, or else the one of its first frames */
+static enum radio_codec find_codec(enum radio_codec told,
+                                   const struct radio_ring *ring) {
+	if (told) return told;
+	uint8_t data[8192];
+	return radio_codec_find(data, radio_ring_peek(ring, 0, data, sizeof data));
+}
+
+/*
+ * Connect to the stream of codec and read the response header, the start of
+ * the stream that came with it is written to the ring.
+ * @param told codec of its Content-Type, RADIO_CODEC_NONE without one
+ */
+static int open_stream(int port, enum radio_codec codec,
+                       struct radio_ring *ring, enum radio_codec *told) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	struct sockaddr_in address = { 0 };
+	address.sin_family         = AF_INET;
+	address.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+	address.sin_port           = htons(port);
+	char request[128];
+	snprintf(request, sizeof request,
+	         "GET /stream.%s HTTP/1.0\r\nHost: localhost\r\n\r\n",
+	         streams[codec].name);
+	if (connect(fd, (struct sockaddr *)&address, sizeof address) != 0 ||
+	    !send_all(fd, request, strlen(request))) {
+		close(fd);
+		return -1;
+	}
+
+	char response[1024];
+	size_t length = 0;
+	char *body    = NULL;
+	while (!body && length < sizeof response - 1) {
+		ssize_t n = recv(fd, response + length, sizeof response - 1 - length,
+		                 0);
+		if (n <= 0) break;
+		length           += n;
+		response[length]  = '\0';
+		body              = strstr(response, "\r\n\r\n");
+	}
+	if (!body) {
+		close(fd);
+		return -1;
+	}
+	*told = RADIO_CODEC_NONE;
+	for (char *line = strstr(response, "\r\n"); line && line < body;
+	     line       = strstr(line + 2, "\r\n"))
+		if (!strncasecmp(line + 2, "Content-Type:", 13))
+			*told = codec_of_type(line + 15 + strspn(line + 15, " "));
+	body += 4;
+	radio_ring_write(ring, body, response + length - body);
+	return fd;
+}
+
+/* Tune cold: connect, tell the codec and sync on the stream */
+static double tune_cold(int port, enum radio_codec codec,
+                        struct radio_ring *ring) {
+	double start = now_us();
+	radio_ring_clear(ring);
+	enum radio_codec told;
+	int fd = open_stream(port, codec, ring, &told);
+	if (fd < 0) return -1;
+
+	uint8_t buffer[4096];
+	enum radio_codec found = find_codec(told, ring);
+	while (!found || !radio_ring_sync(ring, found)) {
+		ssize_t n = recv(fd, buffer, sizeof buffer, 0);
+		if (n <= 0) {
+			close(fd);
+			return -1;
+		}
+		radio_ring_write(ring, buffer, n);
+		found = find_codec(told, ring);
+	}
+	double us = now_us() - start;
+	close(fd);
+	return found == codec ? us : -1;
+}
+
+static void *run_standby(void *args) {
+	struct standby *standby = args;
+	uint8_t buffer[4096];
+	while (!standby->stop) {
+		ssize_t n = recv(standby->fd, buffer, sizeof buffer, 0);
+		if (n <= 0) break;
+		pthread_mutex_lock(&standby->lock);
+		standby->bytes   += n;
+		standby->dropped += radio_ring_overwrite(&standby->ring, buffer, n);
+		pthread_mutex_unlock(&standby->lock);
+	}
+	return NULL;
+}
+
+/* Tune to a channel that was on standby for a while: sync on its ring */
+static double tune_prebuffered(int port, enum radio_codec codec,
+                               struct standby *standby, double *fill_kb,
+                               double *rate_kbps) {
+	enum radio_codec told;
+	radio_ring_clear(&standby->ring);
+	standby->stop    = false;
+	standby->bytes   = 0;
+	standby->dropped = 0;
+	standby->fd      = open_stream(port, codec, &standby->ring, &told);
+	if (standby->fd < 0) return -1;
+	if (pthread_create(&standby->thread, NULL, run_standby, standby) != 0) {
+		close(standby->fd);
+		return -1;
+	}
+	double connected = now_us();
+	sleep_ms(standby_ms);
+
+	/* The stream told its codec long before */
+	pthread_mutex_lock(&standby->lock);
+	enum radio_codec found = find_codec(told, &standby->ring);
+	double start           = now_us();
+	bool synced = found == codec && radio_ring_sync(&standby->ring, found);
+	double us   = now_us() - start;
+	*fill_kb    = standby->ring.fill / 1024.0;
+	*rate_kbps  = standby->bytes * 8 / ((start - connected) / 1e3);
+	pthread_mutex_unlock(&standby->lock);
+
+	standby->stop = true;
+	shutdown(standby->fd, SHUT_RDWR);
+	pthread_join(standby->thread, NULL);
+	close(standby->fd);
+	return synced ? us : -1;
+}
+
+/* Write to the ring, waiting for room like the stream of the active station */
+static void player_write(struct player *player, const uint8_t *data,
+                         size_t length) {
+	struct radio_link *link = &player->link;
+	while (length && !player->stop) {
+		pthread_mutex_lock(&player->lock);
+		size_t n = radio_link_append(link, data, length, (int64_t)now_us());
+		pthread_cond_signal(&player->data);
+		pthread_mutex_unlock(&player->lock);
+		data   += n;
+		length -= n;
+		if (length) sleep_ms(5);
+	}
+}
+
+/*
+ * Receive from the stream like radio_station_write() and
+ * radio_station_audio(): after a connection broke, the new one is held back
+ * until it has a whole frame.
+ */
+static void player_receive(struct player *player, enum radio_codec told,
+                           const uint8_t *data, size_t length) {
+	struct radio_link *link = &player->link;
+	pthread_mutex_lock(&player->lock);
+	/* The player reads nothing until it is told */
+	if (!link->codec)
+		link->codec = told ? told : radio_codec_find(data, length);
+	if (radio_link_received(link, (int64_t)now_us()))
+		player->outage_ms += link->outage_ms;
+	pthread_mutex_unlock(&player->lock);
+
+	size_t used, held;
+	if (!radio_link_resync(link, data, length, &used, &held)) return;
+	player_write(player, link->resync.data, held);
+	player_write(player, data + used, length - used);
+
+	pthread_mutex_lock(&player->lock);
+	if (radio_link_continued(link, (int64_t)now_us()))
+		player->recover_ms += link->recover_ms;
+	pthread_mutex_unlock(&player->lock);
+}
+
+/*
+ * The connection broke like in radio_station_reconnect(), or else the ring
+ * is dropped like ADF does.
+ * @return milliseconds to wait before connecting again
+ */
+static int player_lost(struct player *player) {
+	struct radio_link *link = &player->link;
+	pthread_mutex_lock(&player->lock);
+	int wait_ms = radio_link_lost(link, (int64_t)now_us(),
+	                              rand_r(&player->seed));
+	if (player->drop) {
+		uint32_t underruns = link->jitter.underruns;
+		radio_ring_clear(&link->ring);
+		radio_jitter_reset(&link->jitter);
+		link->jitter.underruns = underruns;
+		wait_ms                = PACE_MS;
+	}
+	pthread_mutex_unlock(&player->lock);
+	return wait_ms;
+}
+
+/* The stream of the active station, it connects again when it is closed */
+static void *run_player_stream(void *args) {
+	struct player *player = args;
+	uint8_t buffer[4096];
+	int wait_ms = 0;
+	while (!player->stop) {
+		for (; wait_ms > 0 && !player->stop; wait_ms -= PACE_MS)
+			sleep_ms(wait_ms < PACE_MS ? wait_ms : PACE_MS);
+		if (player->stop) break;
+
+		struct radio_ring start;
+		enum radio_codec told;
+		radio_ring_init(&start, buffer, sizeof buffer);
+		int fd = open_stream(player->port, player->want, &start, &told);
+		if (fd < 0) {
+			wait_ms = player_lost(player);
+			continue;
+		}
+		struct timeval timeout = { 0, PACE_MS * 1000 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+		if (start.fill) player_receive(player, told, buffer, start.fill);
+
+		while (!player->stop) {
+			ssize_t n = recv(fd, buffer, sizeof buffer, 0);
+			if (n > 0) player_receive(player, told, buffer, n);
+			else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+				break;
+		}
+		close(fd);
+		if (!player->stop) wait_ms = player_lost(player);
+	}
+	return NULL;
+}
+
+static void decode(struct decoder *decoder, enum radio_codec codec,
+                   const uint8_t *data, size_t length) {
+	if (length > sizeof decoder->data - decoder->fill)
+		length = sizeof decoder->data - decoder->fill;
+	memcpy(decoder->data + decoder->fill, data, length);
+	decoder->fill += length;
+
+	size_t offset = 0;
+	while (decoder->fill - offset >= RADIO_FRAME_HEADER) {
+		const uint8_t *header = decoder->data + offset;
+		int frame             = radio_frame_length(codec, header);
+		if (decoder->synced && !frame) {
+			decoder->resets++;
+			decoder->synced = false;
+		}
+		if (!decoder->synced) {
+			size_t skip;
+			bool found = radio_frame_find(codec, header,
+			                              decoder->fill - offset, &skip);
+			offset += skip;
+			if (!found) break;
+			decoder->synced = true;
+			continue;
+		}
+		if (decoder->fill - offset < (size_t)frame) break;
+		offset += frame;
+	}
+	memmove(decoder->data, decoder->data + offset, decoder->fill - offset);
+	decoder->fill -= offset;
+}
+
+/*
+ * Read the stream at its bitrate for jitter_s seconds, like the decoder. The
+ * time it has nothing to read after it started is silent.
+ */
+static int run_player(int port, enum radio_codec codec, const char *what,
+                      size_t max, bool drop) {
+	size_t rate  = (size_t)streams[codec].kbps * 1000 / 8;
+	size_t need  = rate * PACE_MS / 1000;
+	int paces    = jitter_s * 1000 / PACE_MS;
+	void *data   = malloc((size_t)ring_kb * 1024);
+	void *out    = malloc(need);
+	double *fill = malloc(paces * sizeof *fill);
+	struct decoder *decoder = calloc(1, sizeof *decoder);
+	struct player *player   = calloc(1, sizeof *player);
+	if (!data || !out || !fill || !decoder || !player) {
+		free(data);
+		free(out);
+		free(fill);
+		free(decoder);
+		free(player);
+		return 1;
+	}
+	struct radio_link *link = &player->link;
+	player->port            = port;
+	player->drop            = drop;
+	player->want            = codec;
+	player->seed            = 1;
+	radio_link_init(link, data, (size_t)ring_kb * 1024, jitter_ms, max);
+	radio_link_set_active(link, true);
+	__atomic_store_n(&connections, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&refuse_until_us, 0, __ATOMIC_RELAXED);
+	pthread_mutex_init(&player->lock, NULL);
+	pthread_cond_init(&player->data, NULL);
+	if (pthread_create(&player->thread, NULL, run_player_stream, player)) {
+		pthread_cond_destroy(&player->data);
+		pthread_mutex_destroy(&player->lock);
+		free(data);
+		free(out);
+		free(fill);
+		free(decoder);
+		free(player);
+		return 1;
+	}
+
+	double start = now_us(), started_ms = -1, silent_ms = 0;
+	for (int p = 0; p < paces; ++p) {
+		double wait_us = start + (p + 1) * PACE_MS * 1e3 - now_us();
+		if (wait_us > 0) {
+			struct timespec ts = { 0, (long)(wait_us * 1e3) };
+			nanosleep(&ts, NULL);
+		}
+		pthread_mutex_lock(&player->lock);
+		size_t n = radio_link_read(link, codec, out, need);
+		if (!n) {
+			/* Wait for the stream like radio_station_read(), half a pace */
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += PACE_MS * 1000000L / 2;
+			if (until.tv_nsec >= 1000000000L) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&player->data, &player->lock, &until);
+			n = radio_link_read(link, codec, out, need);
+		}
+		if (!n) radio_link_starved(link, codec);
+		fill[p] = link->ring.fill * 1e3 / rate;
+		pthread_mutex_unlock(&player->lock);
+		decode(decoder, codec, out, n);
+
+		if (started_ms < 0 && n) started_ms = (now_us() - start) / 1e3;
+		if (started_ms >= 0) silent_ms += PACE_MS * (double)(need - n) / need;
+	}
+	player->stop = true;
+	pthread_join(player->thread, NULL);
+
+	qsort(fill, paces, sizeof *fill, compare_doubles);
+	printf("%s, %s: %u underruns, %.0f ms silent, %u decoder resets, "
+	       "started after %.0f ms\n",
+	       streams[codec].name, what, link->jitter.underruns, silent_ms,
+	       decoder->resets, started_ms);
+	unsigned int outages = link->outages ? link->outages : 1;
+	printf("  %u outages, %u attempts, outage mean %.0f ms max %.0f ms, "
+	       "recovered mean %.0f ms max %.0f ms\n",
+	       link->outages, link->reconnects, player->outage_ms / outages,
+	       (double)link->outage_max_ms, player->recover_ms / outages,
+	       (double)link->recover_max_ms);
+	printf("  buffered: min %.0f ms, median %.0f ms, target %.0f ms at the "
+	       "end\n",
+	       fill[0], fill[paces / 2], link->jitter.target * 1e3 / rate);
+
+	int failed = link->codec != codec;
+	if (failed)
+		fprintf(stderr, "the %s stream was not told apart\n",
+		        streams[codec].name);
+	pthread_cond_destroy(&player->data);
+	pthread_mutex_destroy(&player->lock);
+	free(data);
+	free(out);
+	free(fill);
+	free(decoder);
+	free(player);
+	return failed;
+}
+
+static int run_jitter(void) {
+	int port = start_server();
+	if (!port) {
+		fprintf(stderr, "cannot start the stand-in server\n");
+		return 1;
+	}
+	printf("stand-in: mp3 %d kbps, aac %d kbps, stalls %d%% of the time, "
+	       "closes after %d s on average, refuses for %d ms, %d s each\n",
+	       bitrate_kbps, aac_kbps, stall_pct, drop_s, outage_ms, jitter_s);
+
+	int failed = 0;
+	for (int c = RADIO_CODEC_MP3; c <= RADIO_CODEC_AAC && !failed; ++c) {
+		/* The fixed buffer is the minimum of the adaptive one */
+		size_t fixed = (size_t)streams[c].kbps * 1000 / 8 * jitter_ms / 1000;
+		size_t max   = (size_t)ring_kb * 1024 / 4 * 3;
+		failed = run_player(port, c, "fixed, dropped", fixed, true) ||
+		         run_player(port, c, "fixed, resumed", fixed, false) ||
+		         run_player(port, c, "adaptive, resumed", max, false);
+	}
+	stop_server();
+	return failed;
+}
+
+static void print_times(const char *what, double *us, int count,
+                        const char *unit, double scale) {
+	qsort(us, count, sizeof *us, compare_doubles);
+	printf("%s: min %.1f %s, median %.1f %s, max %.1f %s\n", what,
+	       us[0] / scale, unit, us[count / 2] / scale, unit,
+	       us[count - 1] / scale, unit);
+}
+
+static int run(void) {
+	int port = start_server();
+	if (!port) {
+		fprintf(stderr, "cannot start the stand-in server\n");
+		return 1;
+	}
+	printf("stand-in: mp3 %d kbps, aac %d kbps, answers after %d ms, %d KB "
+	       "burst%s\n",
+	       bitrate_kbps, aac_kbps, latency_ms, burst_kb,
+	       untyped ? ", without Content-Type" : "");
+
+	struct standby standby;
+	void *data   = malloc((size_t)ring_kb * 1024);
+	double *cold = malloc(rounds * sizeof *cold);
+	double *warm = malloc(rounds * sizeof *warm);
+	if (!data || !cold || !warm) {
+		stop_server();
+		free(data);
+		free(cold);
+		free(warm);
+		return 1;
+	}
+	radio_ring_init(&standby.ring, data, (size_t)ring_kb * 1024);
+	pthread_mutex_init(&standby.lock, NULL);
+
+	int failed = 0;
+	for (int c = RADIO_CODEC_MP3; c <= RADIO_CODEC_AAC && !failed; ++c) {
+		double fill_kb = 0, rate_kbps = 0;
+		for (int r = 0; r < rounds && !failed; ++r) {
+			double fill, rate;
+			cold[r]    = tune_cold(port, c, &standby.ring);
+			warm[r]    = tune_prebuffered(port, c, &standby, &fill, &rate);
+			failed     = cold[r] < 0 || warm[r] < 0;
+			fill_kb   += fill / rounds;
+			rate_kbps += rate / rounds;
+		}
+		if (failed) {
+			fprintf(stderr, "the %s stream was not told apart or synced\n",
+			        streams[c].name);
+			break;
+		}
+		printf("%s%s%s:\n", streams[c].name, streams[c].path ? " " : "",
+		       streams[c].path ? streams[c].path : "");
+		print_times("  cold tune", cold, rounds, "ms", 1e3);
+		print_times("  prebuffered", warm, rounds, "us", 1);
+		printf("  standby: %.1f KB buffered after %d ms, %.0f kbps each "
+		       "with the burst\n",
+		       fill_kb, standby_ms, rate_kbps);
+	}
+
+	stop_server();
+	pthread_mutex_destroy(&standby.lock);
+	free(data);
+	free(cold);
+	free(warm);
+	return failed;
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: radiobench [options...] [mp3 or aac file...]\n");
+	printf("  Measures the time from tuning to the first decodable frame,\n");
+	printf("  cold and prebuffered, against a local stand-in server that\n");
+	printf("  serves an MP3 and an ADTS stream, the files or silent frames,\n");
+	printf("  e.g. radiobench -l 500 -a 48 recording.mp3 recording.aac\n");
+	printf("  -h Show help\n");
+	printf("  -n Specify rounds (default 10)\n");
+	printf("  -l Specify server response time in ms (default 300)\n");
+	printf("  -b Specify burst on connect in KB (default 64)\n");
+	printf("  -r Specify MP3 bitrate in kbps, of the file too (default 128)\n");
+	printf("  -a Specify AAC bitrate in kbps, of the file too (default 64)\n");
+	printf("  -u Specify 1 to leave out the Content-Type (default 0)\n");
+	printf("  -s Specify time on standby in ms (default 2000)\n");
+	printf("  -k Specify station buffer in KB (default 64)\n");
+	printf("  -j Specify seconds to play each buffer instead (default 0)\n");
+	printf("  -t Specify percentage of time the server stalls (default 0)\n");
+	printf("  -d Specify mean seconds before it closes (default never)\n");
+	printf("  -o Specify ms it refuses connections after (default 0)\n");
+	printf("  -m Specify lowest jitter buffer in ms (default 500)\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		if (*argv[i] == '-') {
+			int *value = NULL;
+			switch (argv[i][1]) {
+				case 'n': value = &rounds; break;
+				case 'l': value = &latency_ms; break;
+				case 'b': value = &burst_kb; break;
+				case 'r': value = &bitrate_kbps; break;
+				case 'a': value = &aac_kbps; break;
+				case 'u': value = &untyped; break;
+				case 's': value = &standby_ms; break;
+				case 'k': value = &ring_kb; break;
+				case 'j': value = &jitter_s; break;
+				case 't': value = &stall_pct; break;
+				case 'd': value = &drop_s; break;
+				case 'o': value = &outage_ms; break;
+				case 'm': value = &jitter_ms; break;
+				case 'h': help(); return EXIT_SUCCESS;
+			}
+			if (value) {
+				if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+				*value = atoi(argv[++i]);
+				if (*value < 0) *value = 0;
+			}
+			continue;
+		}
+		if (!read_stream(argv[i])) return EXIT_FAILURE;
+	}
+	if (rounds < 1) rounds = 1;
+	if (bitrate_kbps < 8) bitrate_kbps = 8;
+	if (aac_kbps < 8) aac_kbps = 8;
+	if (ring_kb < 4) ring_kb = 4;
+
+	int failed = !make_streams() || (jitter_s ? run_jitter() : run());
+	for (int c = RADIO_CODEC_MP3; c <= RADIO_CODEC_AAC; ++c)
+		free(streams[c].data);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,295 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Replays how the speaker reads a file while it plays it, to choose the block
+ * size and the window of the read-ahead stream. The file is read for real with
+ * the reads of the stream, run it on a mounted image of the card, and each
+ * read also takes the time the card needs for it: a command latency plus the
+ * bytes at the bandwidth of the 1-line bus. Now and then the card is busy,
+ * e.g. because another file is written, and no read starts until it is done.
+ * Playback takes the file at the bitrate in the chunks of the decoder and
+ * stalls when the window is empty.
+ *
+ * The task and the window are a model of read_ahead_stream.c in simulated
+ * time, not the code of the firmware, so every combination replays in a
+ * fraction of the playing time. Keep the two in step.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* What the decoder takes from its input at a time */
+#define CHUNK_SIZE 2048
+
+static char *path         = NULL;
+static int bitrate_kbps   = 320;
+static int latency_us     = 800;
+static int bandwidth_kbps = 1200;
+static int busy_every_ms  = 5000;
+static int busy_ms        = 500;
+
+/* The fatfs stream of ADF: 4 KB reads into its 8 KB output ringbuffer */
+static const int baseline[2] = { 4, 8 };
+
+static const int block_sizes[] = { 4, 8, 16, 32, 64 };
+static const int windows[]     = { 32, 64, 128, 256, 512 };
+
+struct result {
+	int64_t bytes;
+	uint32_t reads;
+	int64_t read_us;    /* Card and host time of the reads */
+	int64_t host_us;    /* Of that, host time */
+	uint32_t stalls;
+	int64_t stall_us;
+	int64_t startup_us; /* Until the first chunk played */
+	int64_t min_fill;   /* Since the window was full, -1 if never */
+};
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * Read the next block for real and return when it is done if it starts at
+ * start_us. A read that starts while the card is busy waits until it is not.
+ */
+static int64_t read_block(int fd, char *block, int length, int64_t start_us,
+                          int *n, struct result *result) {
+	if (busy_every_ms > 0 && busy_ms > 0) {
+		int64_t every = (int64_t)busy_every_ms * 1000;
+		int64_t busy  = (int64_t)busy_ms * 1000;
+		int64_t phase = start_us % every;
+		/* Busy at the end of each period, the card is free at the start */
+		if (phase >= every - busy) start_us += every - phase;
+	}
+
+	double host = now_us();
+	*n          = (int)read(fd, block, length);
+	host        = now_us() - host;
+	if (*n < 0) *n = 0;
+
+	int64_t card_us = latency_us + (int64_t)*n * 1000 / bandwidth_kbps;
+	int64_t us      = card_us + (int64_t)host;
+	result->reads++;
+	result->read_us += us;
+	result->host_us += (int64_t)host;
+	return start_us + us;
+}
+
+static int replay(int block_size, int window_size, int64_t file_size,
+                  struct result *result) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "cannot open %s\n", path);
+		return 0;
+	}
+	char *block = malloc(block_size);
+	if (!block) {
+		close(fd);
+		return 0;
+	}
+	memset(result, 0, sizeof *result);
+	result->min_fill = -1;
+
+	/* Playback time of a chunk at the bitrate */
+	int64_t chunk_us = (int64_t)CHUNK_SIZE * 8 * 1000 / bitrate_kbps;
+
+	int64_t fill = 0, played = 0, read_bytes = 0;
+	int n        = 0;
+	int was_full = 0, stalled = 0, started = 0;
+	int reading  = 1; /* A read is on its way, done at done_us */
+	int64_t done_us = read_block(fd, block, block_size, 0, &n, result);
+	int64_t need_us = 0; /* Playback needs the next chunk */
+
+	while (played < file_size) {
+		if (reading && done_us <= need_us) {
+			fill       += n;
+			read_bytes += n;
+			reading     = 0;
+			if (fill + block_size > window_size) was_full = 1;
+			if (read_bytes < file_size && fill + block_size <= window_size) {
+				done_us = read_block(fd, block, block_size, done_us, &n,
+				                     result);
+				reading = 1;
+			}
+			continue;
+		}
+
+		int64_t chunk = file_size - played < CHUNK_SIZE ? file_size - played
+		                                                : CHUNK_SIZE;
+		if (fill < chunk) {
+			/* Wait for the read on its way, it is the only one */
+			if (!reading) break;
+			if (started) {
+				if (!stalled) result->stalls++;
+				result->stall_us += done_us - need_us;
+			}
+			stalled = 1;
+			need_us = done_us;
+			continue;
+		}
+
+		if (!started) {
+			result->startup_us = need_us;
+			started            = 1;
+		}
+		/* The window drains at the end of the file */
+		if (was_full && read_bytes < file_size &&
+		    (result->min_fill < 0 || fill < result->min_fill))
+			result->min_fill = fill;
+		stalled  = 0;
+		fill    -= chunk;
+		played  += chunk;
+		// The read task was waiting for room
+		if (!reading && read_bytes < file_size &&
+		    fill + block_size <= window_size) {
+			done_us = read_block(fd, block, block_size, need_us, &n, result);
+			reading = 1;
+		}
+		need_us += chunk_us;
+	}
+	result->bytes = read_bytes;
+
+	free(block);
+	close(fd);
+	return played == file_size;
+}
+
+static void print_result(int block_kb, int window_kb,
+                         const struct result *result) {
+	printf("%5d KB %6d KB %7u %9.0f %8.1f %6u %8.0f %8.0f %8.0f\n", block_kb,
+	       window_kb, result->reads,
+	       result->read_us ? result->bytes * 1e6 / result->read_us / 1024 : 0,
+	       (double)result->host_us / result->reads, result->stalls,
+	       result->stall_us / 1e3, result->startup_us / 1e3,
+	       result->min_fill < 0 ? -1 : result->min_fill / 1024.0);
+}
+
+static int run(void) {
+	struct stat st;
+	if (stat(path, &st) != 0 || st.st_size == 0) {
+		fprintf(stderr, "cannot read %s\n", path);
+		return 1;
+	}
+	printf("%s: %lld KB at %d kbps, %d us per read, %d KB/s, busy %d ms "
+	       "every %d ms\n",
+	       path, (long long)st.st_size / 1024, bitrate_kbps, latency_us,
+	       bandwidth_kbps, busy_ms, busy_every_ms);
+	printf("   block   window   reads     KB/s  host us stalls stall ms "
+	       "start ms min fill\n");
+
+	struct result result;
+	if (!replay(baseline[0] * 1024, baseline[1] * 1024, st.st_size, &result))
+		return 1;
+	print_result(baseline[0], baseline[1], &result);
+
+	for (size_t b = 0; b < sizeof block_sizes / sizeof *block_sizes; ++b) {
+		for (size_t w = 0; w < sizeof windows / sizeof *windows; ++w) {
+			if (windows[w] < 2 * block_sizes[b]) continue;
+			if (!replay(block_sizes[b] * 1024, windows[w] * 1024, st.st_size,
+			            &result))
+				return 1;
+			print_result(block_sizes[b], windows[w], &result);
+		}
+	}
+	return 0;
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: readahead [options...] <file>\n");
+	printf("  Replays playing a file with the read-ahead stream for a range\n");
+	printf("  of block sizes and windows, and with the fatfs stream,\n");
+	printf("  e.g. readahead /mnt/sdimage/music/album/track.mp3\n");
+	printf("  -h Show help\n");
+	printf("  -r Specify bitrate in kbps (default 320)\n");
+	printf("  -l Specify card latency per read in us (default 800)\n");
+	printf("  -w Specify card bandwidth in KB/s (default 1200)\n");
+	printf("  -e Specify how often the card is busy in ms (default 5000)\n");
+	printf("  -d Specify how long the card is busy in ms (default 500)\n");
+}
+
+static int parse_option(int argc, char **argv, int i, int *value) {
+	if (!check_argc(argc, argv, i)) return 0;
+	*value = atoi(argv[i + 1]);
+	if (*value < 0) *value = 0;
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		if (*argv[i] == '-') {
+			int *value = NULL;
+			switch (argv[i][1]) {
+				case 'r': value = &bitrate_kbps; break;
+				case 'l': value = &latency_us; break;
+				case 'w': value = &bandwidth_kbps; break;
+				case 'e': value = &busy_every_ms; break;
+				case 'd': value = &busy_ms; break;
+				case 'h': help(); return EXIT_SUCCESS;
+			}
+			if (value) {
+				if (!parse_option(argc, argv, i, value)) return EXIT_FAILURE;
+				++i;
+			}
+			continue;
+		}
+		if (!path) path = argv[i];
+	}
+
+	if (!path) {
+		fprintf(stderr, "missing file\n");
+		help();
+		return EXIT_FAILURE;
+	}
+	if (bitrate_kbps < 1) bitrate_kbps = 1;
+	if (bandwidth_kbps < 1) bandwidth_kbps = 1;
+
+	return run() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+#include "analyser_sink.h"
+
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "ANALYSER_SINK";
+
+struct analyser_sink {
+	analyser_sink_cfg_t cfg;
+	int16_t *frame;               // Frame being collected
+	int frame_fill;               // Bytes of the frame collected
+	portMUX_TYPE stats_lock;      // Protects the statistics
+	struct audio_analyser_stats stats;
+	int64_t first_frame_us;
+	int64_t last_frame_us;
+	uint64_t process_us_total;
+};
+
+/**
+ * Update the timing statistics for a frame that was completed at now_us and
+ * analysed in process_us
+ */
+static void update_stats(struct analyser_sink *sink, int64_t now_us,
+                         uint32_t process_us) {
+	struct audio_analyser_stats *stats = &sink->stats;
+
+	portENTER_CRITICAL(&sink->stats_lock);
+	if (stats->frames > 0) {
+		uint32_t interval_us = (uint32_t)(now_us - sink->last_frame_us);
+		if (interval_us > stats->interval_us_max)
+			stats->interval_us_max = interval_us;
+		if (interval_us > (uint32_t)(2 * sink->cfg.frame_ms * 1000))
+			stats->frames_late++;
+	} else {
+		sink->first_frame_us = now_us;
+	}
+	sink->last_frame_us = now_us;
+
+	stats->frames++;
+	sink->process_us_total += process_us;
+	stats->process_us_avg = (uint32_t)(sink->process_us_total / stats->frames);
+	if (process_us > stats->process_us_max) stats->process_us_max = process_us;
+	portEXIT_CRITICAL(&sink->stats_lock);
+}
+
+static esp_err_t analyser_sink_open(audio_element_handle_t self) {
+	struct analyser_sink *sink = audio_element_getdata(self);
+
+	sink->frame_fill = 0;
+	if (sink->cfg.reset) sink->cfg.reset();
+	return ESP_OK;
+}
+
+/**
+ * Collect whatever the decimator produced and analyse every complete frame
+ */
+static audio_element_err_t analyser_sink_process(audio_element_handle_t self,
+                                                 char *buffer, int length) {
+	struct analyser_sink *sink = audio_element_getdata(self);
+	int frame_bytes            = sink->cfg.frame_length * sizeof *sink->frame;
+	char *frame                = (char *)sink->frame;
+
+	int bytes = audio_element_input(self, frame + sink->frame_fill,
+	                                frame_bytes - sink->frame_fill);
+	if (bytes <= 0) return bytes;
+
+	// Samples completed by this read, a read may end inside a sample
+	int first = sink->frame_fill / (int)sizeof *sink->frame;
+	sink->frame_fill += bytes;
+	int last = sink->frame_fill / (int)sizeof *sink->frame;
+	if (sink->cfg.analyse_hop && last > first &&
+	    sink->cfg.analyse_hop(sink->frame + first, last - first) != ESP_OK)
+		return AEL_PROCESS_FAIL;
+
+	if (sink->frame_fill < frame_bytes) return bytes;
+	sink->frame_fill = 0;
+
+	int64_t start_us = esp_timer_get_time();
+	if (sink->cfg.analyse(sink->frame) != ESP_OK) return AEL_PROCESS_FAIL;
+	update_stats(sink, start_us, (uint32_t)(esp_timer_get_time() - start_us));
+
+	return bytes;
+}
+
+static esp_err_t analyser_sink_destroy(audio_element_handle_t self) {
+	struct analyser_sink *sink = audio_element_getdata(self);
+
+	free(sink->frame);
+	free(sink);
+	return ESP_OK;
+}
+
+audio_element_handle_t analyser_sink_init(const analyser_sink_cfg_t *config) {
+	struct analyser_sink *sink = calloc(1, sizeof *sink);
+	if (!sink) goto fail;
+	sink->cfg   = *config;
+	sink->frame = calloc(config->frame_length, sizeof *sink->frame);
+	if (!sink->frame) goto fail;
+	portMUX_INITIALIZE(&sink->stats_lock);
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open                = analyser_sink_open;
+	cfg.process             = analyser_sink_process;
+	cfg.destroy             = analyser_sink_destroy;
+	cfg.buffer_len          = config->frame_length * sizeof *sink->frame;
+	cfg.tag                 = "analyser";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	if (!el) goto fail;
+	audio_element_setdata(el, sink);
+	return el;
+
+fail:
+	ESP_LOGE(TAG, "Memory allocation for analyser sink failed");
+	if (sink) free(sink->frame);
+	free(sink);
+	return NULL;
+}
+
+void analyser_sink_get_stats(audio_element_handle_t el,
+                             struct audio_analyser_stats *stats) {
+	struct analyser_sink *sink = audio_element_getdata(el);
+
+	portENTER_CRITICAL(&sink->stats_lock);
+	*stats = sink->stats;
+	if (sink->stats.frames > 0 && sink->cfg.count_dropped) {
+		// Frames that should have arrived since the first one
+		uint32_t expected =
+		    (uint32_t)((sink->last_frame_us - sink->first_frame_us) /
+		               (sink->cfg.frame_ms * 1000)) +
+		    1;
+		stats->frames_dropped =
+		    expected > sink->stats.frames ? expected - sink->stats.frames : 0;
+	}
+	portEXIT_CRITICAL(&sink->stats_lock);
+}
@@ -3,17 +3,24 @@
 
 /* goertzel */
 #include "audio_event_iface.h"
-#include "filter_resample.h"
+#include "decimator.h"
+#include "decimator_filter.h"
+#include "dtmf_decoder.h"
+#include "energy_gate.h"
 #include "freertos/portmacro.h"
-#include "goertzel_filter.h"
+#include "goertzel_bank.h"
+#include "goertzel_sliding.h"
+#include "goertzel_window.h"
+#include "spectrum_analyser.h"
 #include <math.h>
+#include <string.h>
 
 /* audio */
 #include "audio_element.h"
 #include "audio_pipeline.h"
+#include "audio_tee_tap.h"
 #include "driver/i2c.h"
 #include "i2s_stream.h"
-#include "raw_stream.h"
 
 /* logging and errors */
 #include "esp_check.h"
@@ -22,10 +29,14 @@
 
 #include "freertos/semphr.h"
 
+#include <stdlib.h>
+
 #include "led_controller_commands.h"
 #include "utils/macro.h"
 
 #define SEND_DETECT_CMD(command) SEND_CMD(8000, 8000, command, detect_evt)
+#define SEND_DTMF_CMD(digit)                                                   \
+	SEND_CMD(dtmf_digit_to_event(digit), 8001, (int)(digit), detect_evt)
 
 #define GOERTZEL_NR_FREQS                                                      \
 	((sizeof GOERTZEL_DETECT_FREQS) / (sizeof GOERTZEL_DETECT_FREQS[0]))
@@ -34,32 +45,107 @@
 #define GOERTZEL_SAMPLE_RATE_HZ 8000
 
 // Block length in [ms]
-#define GOERTZEL_FRAME_LENGTH_MS 50
+#define GOERTZEL_FRAME_LENGTH_MS 25
 
 // Buffer length in samples
 #define GOERTZEL_BUFFER_LENGTH                                                 \
 	(GOERTZEL_FRAME_LENGTH_MS * GOERTZEL_SAMPLE_RATE_HZ / 1000)
 
 // Detect a tone when log manitude is above this value
-#define GOERTZEL_DETECTION_THRESHOLD 40.0f
+// Same tone level as 40 dB with the former rectangular 50 ms blocks: half the
+// samples and the coherent gain of the Hann window (0.5) cost 6 dB
+#define GOERTZEL_DETECTION_THRESHOLD 34.0f
+
+// Log the frame statistics once per minute
+#define AUDIO_ANALYSER_REPORT_MS (60 * 1000)
+
+// Spectrum bands, log-spaced over the band of the decimated input
+#define SPECTRUM_NR_BANDS   16
+#define SPECTRUM_MIN_FREQ   60
+#define SPECTRUM_MAX_FREQ   (GOERTZEL_SAMPLE_RATE_HZ / 2)
+#define SPECTRUM_DECAY_DB   1.5f
+#define SPECTRUM_HOLD_MS    500
+#define SPECTRUM_FFT_SIZE   CONFIG_AUDIO_ANALYSER_SPECTRUM_FFT_SIZE
+#define SPECTRUM_FRAME_SKIP                                                    \
+	(1000 / GOERTZEL_FRAME_LENGTH_MS / CONFIG_AUDIO_ANALYSER_SPECTRUM_RATE)
+
+// Audio capture sample rate [Hz], independent of the detectors
+#define AUDIO_SAMPLE_RATE 44100
+
+// Decoded blocks that may wait for the analyser before they are dropped
+#define PLAYBACK_QUEUE_LENGTH 4
+
+// Time to wait for a decoded block before the reader checks its state again
+#define PLAYBACK_WAIT_MS 50
 
-// Audio capture sample rate [Hz]
-#define AUDIO_SAMPLE_RATE 8000
+// Bytes of the largest frame, interleaved int16 stereo
+#define PLAYBACK_FRAME_BYTES 4
+
+// Bytes of a decoded block that are decimated at once
+#define PLAYBACK_CHUNK_LENGTH 2048
 
 static const int GOERTZEL_DETECT_FREQS[] = { 200 };
 
 static const char *TAG = "AUDIO_ANALYSER";
 
+static goertzel_weight_t window[GOERTZEL_BUFFER_LENGTH];
+
+#ifdef CONFIG_AUDIO_ANALYSER_SLIDING
+static goertzel_sliding_t sliding[GOERTZEL_NR_FREQS];
+#else
+static goertzel_bank_t bank;
+#endif
+
+#ifdef CONFIG_AUDIO_ANALYSER_DTMF
+static dtmf_decoder_t dtmf;
+#endif
+
+#ifdef CONFIG_AUDIO_ANALYSER_ENERGY_GATE
+static energy_gate_t gate;
+#endif
+
+#ifdef CONFIG_AUDIO_ANALYSER_SPECTRUM
+static spectrum_analyser_t spectrum;
+static int16_t spectrum_samples[SPECTRUM_FFT_SIZE]; // Latest FFT frame
+#endif
+
+// Bands handed out by audio_analyser_get_spectrum, the analyser updates its
+// own bands every frame and only copies them here at the publish rate
+static struct spectrum_bands spectrum_published;
+static portMUX_TYPE spectrum_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Reader of the decoded audio of the active state
+static audio_tee_tap_handle_t tap;
+static decimator_t playback_decimator;
+static int playback_rate;     // Rate the decimator is set up for, 0 if none
+static int playback_channels; // Channels of the decoded audio
+static char playback_input[PLAYBACK_FRAME_BYTES + PLAYBACK_CHUNK_LENGTH];
+static int playback_carry;    // Bytes of an incomplete frame in playback_input
+static int16_t *playback_mono; // Decimator output for a full chunk
+
+static enum audio_analyser_source source;
 static SemaphoreHandle_t semphr;
 static audio_element_handle_t i2s_stream_reader;
-static audio_element_handle_t resample_filter;
-static audio_element_handle_t raw_reader;
+static audio_element_handle_t decimator;
+static audio_element_handle_t playback_reader;
+static audio_element_handle_t analyser_sink;
 static audio_pipeline_handle_t pipeline;
 
 static audio_event_iface_handle_t detect_evt;
 static audio_event_iface_handle_t source_evt;
 static bool set_opts_on_tone_detect = true;
 
+static void tone_detected(int target_freq, float magnitude) {
+	ESP_LOGI(TAG,
+	         "Detection at frequency %d Hz (magnitude %.2f, log magnitude %.2f)",
+	         target_freq, magnitude, 10.0f * log10f(magnitude));
+
+	if (set_opts_on_tone_detect) {
+		SEND_DETECT_CMD(0);
+		set_opts_on_tone_detect = false;
+	}
+}
+
 /**
  * Determine if a frequency was detected or not, based on the magnitude that the
  * Goertzel filter calculated
@@ -68,73 +154,360 @@ static bool set_opts_on_tone_detect = true;
 static void detect_freq(int target_freq, float magnitude) {
 	float logMagnitude = 10.0f * log10f(magnitude);
 	if (logMagnitude > GOERTZEL_DETECTION_THRESHOLD) {
-		ESP_LOGI(
-		    TAG,
-		    "Detection at frequency %d Hz (magnitude %.2f, log magnitude %.2f)",
-		    target_freq, magnitude, logMagnitude);
-
-		if (set_opts_on_tone_detect) {
-			SEND_DETECT_CMD(0);
-			set_opts_on_tone_detect = false;
-		}
+		tone_detected(target_freq, magnitude);
 	}
 }
 
-void tone_detection_task(void *args) {
-	UNUSED esp_err_t ret;
-	goertzel_filter_cfg_t filters_cfg[GOERTZEL_NR_FREQS];
-	goertzel_filter_data_t filters_data[GOERTZEL_NR_FREQS];
+/**
+ * Forget the history of the detectors that span several frames, after frames
+ * were skipped by the energy gate
+ */
+static void clear_detectors(void) {
+#ifdef CONFIG_AUDIO_ANALYSER_SLIDING
+	for (int f = 0; f < GOERTZEL_NR_FREQS; f++)
+		goertzel_sliding_clear(&sliding[f]);
+#endif
+#ifdef CONFIG_AUDIO_ANALYSER_DTMF
+	dtmf_decoder_reset(&dtmf);
+#endif
+}
 
+/**
+ * Setup the detectors, their state is kept between frames
+ */
+static esp_err_t detectors_setup(void) {
 	ESP_LOGI(TAG, "Number of Goertzel detection filters is %d",
 	         GOERTZEL_NR_FREQS);
 
-	ESP_LOGI(TAG, "Create raw sample buffer");
-	int16_t *raw_buffer = malloc(sizeof *raw_buffer * GOERTZEL_BUFFER_LENGTH);
-	if (raw_buffer == NULL) {
-		ESP_LOGE(TAG, "Memory allocation for raw sample buffer failed");
-		goto exit;
+	ESP_LOGI(TAG, "Setup Hann window");
+	goertzel_window_fill(GOERTZEL_WINDOW_HANN, window, GOERTZEL_BUFFER_LENGTH);
+
+#ifdef CONFIG_AUDIO_ANALYSER_SLIDING
+	float threshold = powf(10.0f, GOERTZEL_DETECTION_THRESHOLD / 10.0f);
+
+	ESP_LOGI(TAG, "Setup sliding Goertzel detection filters");
+	for (int f = 0; f < GOERTZEL_NR_FREQS; f++) {
+		goertzel_sliding_cfg_t sliding_cfg = {
+			.sample_rate   = GOERTZEL_SAMPLE_RATE_HZ,
+			.target_freq   = GOERTZEL_DETECT_FREQS[f],
+			.buffer_length = GOERTZEL_BUFFER_LENGTH,
+			.threshold     = threshold,
+			.exact_freq    = true,
+			.window        = GOERTZEL_WINDOW_HANN,
+		};
+		ESP_RETURN_ON_ERROR(goertzel_sliding_setup(&sliding[f], &sliding_cfg),
+		                    TAG, "Error setting up sliding goertzel filter");
+	}
+#else
+	ESP_LOGI(TAG, "Setup Goertzel detection filter bank");
+	goertzel_bank_cfg_t bank_cfg = {
+		.sample_rate   = GOERTZEL_SAMPLE_RATE_HZ,
+		.target_freqs  = GOERTZEL_DETECT_FREQS,
+		.nr_freqs      = GOERTZEL_NR_FREQS,
+		.buffer_length = GOERTZEL_BUFFER_LENGTH,
+		.exact_freq    = true,
+		.window        = window,
+	};
+	ESP_RETURN_ON_ERROR(goertzel_bank_setup(&bank, &bank_cfg), TAG,
+	                    "Error setting up goertzel filter bank");
+#endif
+
+#ifdef CONFIG_AUDIO_ANALYSER_DTMF
+	ESP_LOGI(TAG, "Setup DTMF decoder");
+	ESP_RETURN_ON_ERROR(dtmf_decoder_init(&dtmf, GOERTZEL_SAMPLE_RATE_HZ), TAG,
+	                    "Error setting up DTMF decoder");
+#endif
+
+#ifdef CONFIG_AUDIO_ANALYSER_ENERGY_GATE
+	energy_gate_init(&gate);
+#endif
+
+#ifdef CONFIG_AUDIO_ANALYSER_SPECTRUM
+	ESP_LOGI(TAG, "Setup spectrum analyser");
+	spectrum_analyser_cfg_t spectrum_cfg = {
+		.sample_rate = GOERTZEL_SAMPLE_RATE_HZ,
+		.fft_size    = SPECTRUM_FFT_SIZE,
+		.nr_bands    = SPECTRUM_NR_BANDS,
+		.min_freq    = SPECTRUM_MIN_FREQ,
+		.max_freq    = SPECTRUM_MAX_FREQ,
+		.decay_db    = SPECTRUM_DECAY_DB,
+		.hold_frames = SPECTRUM_HOLD_MS / GOERTZEL_FRAME_LENGTH_MS,
+	};
+	ESP_RETURN_ON_ERROR(spectrum_analyser_setup(&spectrum, &spectrum_cfg), TAG,
+	                    "Error setting up spectrum analyser");
+#endif
+	return ESP_OK;
+}
+
+#ifdef CONFIG_AUDIO_ANALYSER_SPECTRUM
+/**
+ * Update the spectrum with the latest SPECTRUM_FFT_SIZE samples and publish
+ * the bands at CONFIG_AUDIO_ANALYSER_SPECTRUM_RATE, for
+ * audio_analyser_get_spectrum. The FFT is skipped for quiet frames, their
+ * bands only fall.
+ */
+static void analyse_spectrum(const int16_t *samples, bool quiet) {
+	static int frames;
+
+	if (SPECTRUM_FFT_SIZE > GOERTZEL_BUFFER_LENGTH) {
+		int keep = SPECTRUM_FFT_SIZE - GOERTZEL_BUFFER_LENGTH;
+		memmove(spectrum_samples, spectrum_samples + GOERTZEL_BUFFER_LENGTH,
+		        sizeof *spectrum_samples * keep);
+		memcpy(spectrum_samples + keep, samples,
+		       sizeof *spectrum_samples * GOERTZEL_BUFFER_LENGTH);
+	} else {
+		memcpy(spectrum_samples,
+		       samples + GOERTZEL_BUFFER_LENGTH - SPECTRUM_FFT_SIZE,
+		       sizeof spectrum_samples);
+	}
+	if (quiet) spectrum_analyser_decay(&spectrum);
+	else spectrum_analyser_process(&spectrum, spectrum_samples);
+
+	if (++frames >= SPECTRUM_FRAME_SKIP) {
+		frames = 0;
+		portENTER_CRITICAL(&spectrum_lock);
+		spectrum_published = spectrum.bands;
+		portEXIT_CRITICAL(&spectrum_lock);
+	}
+}
+#endif
+
+/**
+ * Run all detectors on one frame of GOERTZEL_BUFFER_LENGTH samples
+ */
+static esp_err_t analyse_frame(int16_t *samples) {
+	bool quiet = false;
+#ifdef CONFIG_AUDIO_ANALYSER_ENERGY_GATE
+	// The playback is analysed for the spectrum only, which is not gated
+	if (source != AUDIO_ANALYSER_SOURCE_PLAYBACK)
+		quiet = !energy_gate_process(&gate, samples, GOERTZEL_BUFFER_LENGTH);
+#endif
+
+#ifdef CONFIG_AUDIO_ANALYSER_SPECTRUM
+	analyse_spectrum(samples, quiet);
+#endif
+
+	// The tone and DTMF detectors listen for commands in the room, not in the
+	// music that is playing
+	if (source == AUDIO_ANALYSER_SOURCE_PLAYBACK) return ESP_OK;
+
+	// Without the energy gate no frame is quiet
+	static bool gate_open = true;
+	if (quiet) {
+		if (gate_open) clear_detectors();
+		gate_open = false;
+		return ESP_OK;
+	}
+	gate_open = true;
+
+#ifndef CONFIG_AUDIO_ANALYSER_SLIDING
+	float magnitudes[GOERTZEL_NR_FREQS];
+	ESP_RETURN_ON_ERROR(
+	    goertzel_bank_process(&bank, samples, GOERTZEL_BUFFER_LENGTH), TAG,
+	    "Error processing goertzel filter bank");
+
+	if (goertzel_bank_new_magnitudes(&bank, magnitudes)) {
+		for (int f = 0; f < GOERTZEL_NR_FREQS; f++)
+			detect_freq(GOERTZEL_DETECT_FREQS[f], magnitudes[f]);
+	}
+#endif
+
+#ifdef CONFIG_AUDIO_ANALYSER_DTMF
+	char digits[8];
+	int nr_digits = dtmf_decoder_process(&dtmf, samples, GOERTZEL_BUFFER_LENGTH,
+	                                     digits, sizeof digits);
+	for (int d = 0; d < nr_digits; d++) {
+		ESP_LOGI(TAG, "DTMF digit %c", digits[d]);
+		SEND_DTMF_CMD(digits[d]);
 	}
+#endif
+	return ESP_OK;
+}
+
+#ifdef CONFIG_AUDIO_ANALYSER_SLIDING
+/**
+ * Slide the tone detectors over the samples as soon as the decimator hands
+ * them over, instead of once their frame is complete. The energy gate decides
+ * per frame, so it does not skip these samples.
+ */
+static esp_err_t analyse_hop(const int16_t *samples, int nr_samples) {
+	if (source == AUDIO_ANALYSER_SOURCE_PLAYBACK) return ESP_OK;
 
-	ESP_LOGI(TAG, "Setup Goertzel detection filters");
 	for (int f = 0; f < GOERTZEL_NR_FREQS; f++) {
-		filters_cfg[f].sample_rate   = GOERTZEL_SAMPLE_RATE_HZ;
-		filters_cfg[f].target_freq   = GOERTZEL_DETECT_FREQS[f];
-		filters_cfg[f].buffer_length = GOERTZEL_BUFFER_LENGTH;
-		ESP_GOTO_ON_ERROR(
-		    goertzel_filter_setup(&filters_data[f], &filters_cfg[f]), exit, TAG,
-		    "");
+		int offset = goertzel_sliding_process(&sliding[f], samples, nr_samples);
+		if (offset < 0) continue;
+
+		ESP_LOGI(TAG, "Tone at %d Hz crossed the threshold %d ms ago",
+		         GOERTZEL_DETECT_FREQS[f],
+		         (nr_samples - offset) * 1000 / GOERTZEL_SAMPLE_RATE_HZ);
+		tone_detected(GOERTZEL_DETECT_FREQS[f],
+		              goertzel_sliding_magnitude(&sliding[f]));
 	}
+	return ESP_OK;
+}
+#endif
 
-	ESP_LOGI(TAG, "Register audio elements to pipeline");
-	audio_pipeline_register(pipeline, i2s_stream_reader, "i2s_reader");
-	audio_pipeline_register(pipeline, resample_filter, "rsp_filter");
-	audio_pipeline_register(pipeline, raw_reader, "raw");
+/**
+ * Follow the format of the decoded audio, 16 bit stereo and mono are
+ * decimated and other blocks are skipped.
+ * @return true if the block can be analysed
+ */
+static bool playback_follow_format(const audio_tee_block_t *block) {
+	if (block->sample_rate == playback_rate &&
+	    block->channels == playback_channels)
+		return playback_mono != NULL;
+
+	playback_rate     = block->sample_rate;
+	playback_channels = block->channels;
+	playback_carry    = 0;
+	decimator_free(&playback_decimator);
+	free(playback_mono);
+	playback_mono = NULL;
+
+	if (block->channels < 1 || block->channels > 2 || block->bits != 16) {
+		ESP_LOGW(TAG, "Not analysing %d channel %d bit playback",
+		         block->channels, block->bits);
+		return false;
+	}
+	ESP_RETURN_ON_FALSE(decimator_setup(&playback_decimator, block->sample_rate,
+	                                    GOERTZEL_SAMPLE_RATE_HZ) == ESP_OK,
+	                    false, TAG, "Not analysing playback at %d Hz",
+	                    block->sample_rate);
+
+	int nr_frames = sizeof playback_input / (2 * block->channels);
+	playback_mono =
+	    malloc(sizeof *playback_mono *
+	           decimator_max_output(&playback_decimator, nr_frames));
+	if (!playback_mono) {
+		decimator_free(&playback_decimator);
+		return false;
+	}
+	ESP_LOGI(TAG, "Analysing %d channel playback at %d Hz", block->channels,
+	         block->sample_rate);
+	return true;
+}
+
+static esp_err_t playback_reader_open(audio_element_handle_t self) {
+	playback_rate     = 0;
+	playback_channels = 0;
+	playback_carry    = 0;
+	return ESP_OK;
+}
+
+static esp_err_t playback_reader_close(audio_element_handle_t self) {
+	decimator_free(&playback_decimator);
+	free(playback_mono);
+	playback_mono = NULL;
+	return ESP_OK;
+}
+
+/**
+ * Downmix and decimate the next decoded block of the active state and pass
+ * the mono samples on to the analyser sink
+ */
+static audio_element_err_t playback_reader_process(audio_element_handle_t self,
+                                                   char *buffer, int length) {
+	audio_tee_block_t *block =
+	    audio_tee_tap_receive(tap, pdMS_TO_TICKS(PLAYBACK_WAIT_MS));
+	// Nothing plays, keep waiting instead of ending the stream
+	if (!block) return AEL_IO_TIMEOUT;
+
+	int ret = AEL_IO_TIMEOUT;
+	if (playback_follow_format(block)) {
+		int frame_bytes = 2 * playback_channels;
+		for (int offset = 0; offset < block->length;) {
+			// Blocks need not end on a frame, keep the rest for the next one
+			int bytes = block->length - offset;
+			if (bytes > PLAYBACK_CHUNK_LENGTH) bytes = PLAYBACK_CHUNK_LENGTH;
+			memcpy(playback_input + playback_carry, block->data + offset,
+			       bytes);
+			offset += bytes;
+
+			int available = playback_carry + bytes;
+			int nr_frames = available / frame_bytes;
+			const int16_t *input = (const int16_t *)playback_input;
+			int nr_mono =
+			    playback_channels == 2
+			        ? decimator_process(&playback_decimator, input, nr_frames,
+			                            playback_mono)
+			        : decimator_process_mono(&playback_decimator, input,
+			                                 nr_frames, playback_mono);
+			playback_carry = available - nr_frames * frame_bytes;
+			memmove(playback_input, playback_input + nr_frames * frame_bytes,
+			        playback_carry);
+
+			if (nr_mono == 0) continue;
+			ret = audio_element_output(self, (char *)playback_mono,
+			                           nr_mono * sizeof *playback_mono);
+			if (ret <= 0) break;
+		}
+	}
+	audio_tee_tap_release(tap, block);
+	return ret;
+}
+
+/**
+ * Create the pipeline source that reads the decoded audio of the active state
+ */
+static audio_element_handle_t playback_reader_init(void) {
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open                = playback_reader_open;
+	cfg.close               = playback_reader_close;
+	cfg.process             = playback_reader_process;
+	cfg.tag                 = "playback";
+	return audio_element_init(&cfg);
+}
+
+void tone_detection_task(void *args) {
+	UNUSED esp_err_t ret;
 
-	ESP_LOGI(TAG, "Link audio elements together to make pipeline ready");
-	const char *link_tag[3] = { "i2s_reader", "rsp_filter", "raw" };
-	audio_pipeline_link(pipeline, link_tag, 3);
+	ESP_GOTO_ON_ERROR(detectors_setup(), exit, TAG,
+	                  "Error setting up detectors");
+
+	ESP_LOGI(TAG, "Register audio elements to pipeline");
+	if (source == AUDIO_ANALYSER_SOURCE_PLAYBACK) {
+		audio_pipeline_register(pipeline, playback_reader, "playback");
+		audio_pipeline_register(pipeline, analyser_sink, "analyser");
+
+		ESP_LOGI(TAG, "Link audio elements together to make pipeline ready");
+		const char *link_tag[2] = { "playback", "analyser" };
+		audio_pipeline_link(pipeline, link_tag, 2);
+	} else {
+		audio_pipeline_register(pipeline, i2s_stream_reader, "i2s_reader");
+		audio_pipeline_register(pipeline, decimator, "decimator");
+		audio_pipeline_register(pipeline, analyser_sink, "analyser");
+
+		ESP_LOGI(TAG, "Link audio elements together to make pipeline ready");
+		const char *link_tag[3] = { "i2s_reader", "decimator", "analyser" };
+		audio_pipeline_link(pipeline, link_tag, 3);
+	}
 
 	ESP_LOGI(TAG, "Start pipeline");
 	audio_pipeline_run(pipeline);
 
+	// The frames are analysed by the pipeline, only report on them here
 	while (1) {
-		vTaskDelay(pdMS_TO_TICKS(500));
+		vTaskDelay(pdMS_TO_TICKS(AUDIO_ANALYSER_REPORT_MS));
 
 		xSemaphoreTake(semphr, portMAX_DELAY);
 
-		raw_stream_read(i2s_stream_reader, (char *)raw_buffer,
-		                sizeof *raw_buffer * GOERTZEL_BUFFER_LENGTH);
-
-		for (int f = 0; f < GOERTZEL_NR_FREQS; f++) {
-			float magnitude;
-			esp_err_t error = goertzel_filter_process(
-			    &filters_data[f], raw_buffer, GOERTZEL_BUFFER_LENGTH);
-			ESP_GOTO_ON_ERROR(error, exit, TAG,
-			                  "Error processing goertzel filter");
-
-			if (goertzel_filter_new_magnitude(&filters_data[f], &magnitude)) {
-				detect_freq(filters_cfg[f].target_freq, magnitude);
-			}
+		struct audio_analyser_stats report;
+		audio_analyser_get_stats(&report);
+		ESP_LOGI(TAG,
+		         "Analysed %u frames: %u skipped, %u late, %u dropped, "
+		         "process time %u us avg %u us max, max interval %u us",
+		         report.frames, report.frames_skipped, report.frames_late,
+		         report.frames_dropped, report.process_us_avg,
+		         report.process_us_max, report.interval_us_max);
+
+		if (source == AUDIO_ANALYSER_SOURCE_PLAYBACK) {
+			struct audio_tee_consumer_stats tap_stats;
+			audio_tee_tap_get_stats(tap, &tap_stats);
+			ESP_LOGI(TAG,
+			         "Playback tap: %u blocks received, %u dropped, lag %u "
+			         "max %u",
+			         tap_stats.received, tap_stats.dropped, tap_stats.lag,
+			         tap_stats.max_lag);
 		}
 
 		xSemaphoreGive(semphr);
@@ -143,30 +516,59 @@ exit:
 	return;
 }
 
-void audio_analyser_init(audio_event_iface_handle_t evt_param) {
-	semphr = xSemaphoreCreateMutex();
+void audio_analyser_get_stats(struct audio_analyser_stats *out) {
+	analyser_sink_get_stats(analyser_sink, out);
+#ifdef CONFIG_AUDIO_ANALYSER_ENERGY_GATE
+	out->frames_skipped = gate.skipped;
+#endif
+}
 
-	/* Init i2s stream reader */
-	ESP_LOGI(TAG, "Create i2s stream to read data from codec chip");
-	i2s_stream_cfg_t i2s_cfg_reader = I2S_STREAM_CFG_DEFAULT();
-	i2s_cfg_reader.type             = AUDIO_STREAM_READER;
-	i2s_stream_reader               = i2s_stream_init(&i2s_cfg_reader);
-
-	/* Init resample filter */
-	rsp_filter_cfg_t rsp_cfg = {
-		.src_rate  = AUDIO_SAMPLE_RATE,
-		.src_ch    = 2,
-		.dest_rate = GOERTZEL_SAMPLE_RATE_HZ,
-		.dest_ch   = 1,
-	};
-	resample_filter = rsp_filter_init(&rsp_cfg);
+void audio_analyser_get_spectrum(struct spectrum_bands *bands) {
+	portENTER_CRITICAL(&spectrum_lock);
+	*bands = spectrum_published;
+	portEXIT_CRITICAL(&spectrum_lock);
+}
 
-	/* Init raw stream */
-	raw_stream_cfg_t raw_cfg = {
-		.out_rb_size = 8 * 1024,
-		.type        = AUDIO_STREAM_READER,
+void audio_analyser_init(audio_event_iface_handle_t evt_param,
+                         enum audio_analyser_source source_param) {
+	semphr = xSemaphoreCreateMutex();
+	source = source_param;
+
+	if (source == AUDIO_ANALYSER_SOURCE_PLAYBACK) {
+		/* Init reader of the decoded audio, follows the active state */
+		ESP_LOGI(TAG, "Create reader for the decoded audio");
+		tap             = audio_tee_tap_create(PLAYBACK_QUEUE_LENGTH);
+		playback_reader = playback_reader_init();
+	} else {
+		/* Init i2s stream reader */
+		ESP_LOGI(TAG, "Create i2s stream to read data from codec chip");
+		i2s_stream_cfg_t i2s_cfg_reader       = I2S_STREAM_CFG_DEFAULT();
+		i2s_cfg_reader.type                   = AUDIO_STREAM_READER;
+		i2s_cfg_reader.i2s_config.sample_rate = AUDIO_SAMPLE_RATE;
+		i2s_stream_reader = i2s_stream_init(&i2s_cfg_reader);
+
+		/* Init decimator, downmixes and filters in one pass */
+		decimator_filter_cfg_t decimator_cfg =
+		    DEFAULT_DECIMATOR_FILTER_CONFIG();
+		decimator_cfg.src_rate  = AUDIO_SAMPLE_RATE;
+		decimator_cfg.dest_rate = GOERTZEL_SAMPLE_RATE_HZ;
+		decimator               = decimator_filter_init(&decimator_cfg);
+	}
+
+	/* Init analyser sink */
+	analyser_sink_cfg_t sink_cfg = {
+		.frame_length = GOERTZEL_BUFFER_LENGTH,
+		.frame_ms     = GOERTZEL_FRAME_LENGTH_MS,
+		// Playback pauses between clips, only the capture clock runs
+		// continuously
+		.count_dropped = source == AUDIO_ANALYSER_SOURCE_MICROPHONE,
+		.analyse       = analyse_frame,
+#ifdef CONFIG_AUDIO_ANALYSER_SLIDING
+		.analyse_hop   = analyse_hop,
+#endif
+		.reset         = clear_detectors,
 	};
-	raw_reader = raw_stream_init(&raw_cfg);
+	analyser_sink = analyser_sink_init(&sink_cfg);
 
 	/* Init audio pipeline */
 	audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
@@ -191,14 +593,33 @@ void audio_analyser_deinit(TaskHandle_t *task) {
 	ESP_ERROR_CHECK(audio_pipeline_wait_for_stop(pipeline));
 	ESP_ERROR_CHECK(audio_pipeline_terminate(pipeline));
 
-	ESP_ERROR_CHECK(audio_pipeline_unregister(pipeline, raw_reader));
-	ESP_ERROR_CHECK(audio_pipeline_unregister(pipeline, i2s_stream_reader));
-	ESP_ERROR_CHECK(audio_pipeline_unregister(pipeline, resample_filter));
+	ESP_ERROR_CHECK(audio_pipeline_unregister(pipeline, analyser_sink));
+	if (source == AUDIO_ANALYSER_SOURCE_PLAYBACK) {
+		ESP_ERROR_CHECK(audio_pipeline_unregister(pipeline, playback_reader));
+	} else {
+		ESP_ERROR_CHECK(audio_pipeline_unregister(pipeline, i2s_stream_reader));
+		ESP_ERROR_CHECK(audio_pipeline_unregister(pipeline, decimator));
+	}
 	ESP_ERROR_CHECK(audio_pipeline_deinit(pipeline));
 
-	ESP_ERROR_CHECK(audio_element_deinit(raw_reader));
-	ESP_ERROR_CHECK(audio_element_deinit(resample_filter));
-	// FIXME: should be deinitialized, but causes a crash
-	// audio_element_deinit(i2s_stream_reader);
+	ESP_ERROR_CHECK(audio_element_deinit(analyser_sink));
+#ifdef CONFIG_AUDIO_ANALYSER_SLIDING
+	for (int f = 0; f < GOERTZEL_NR_FREQS; f++)
+		goertzel_sliding_free(&sliding[f]);
+#endif
+#ifdef CONFIG_AUDIO_ANALYSER_SPECTRUM
+	spectrum_analyser_free(&spectrum);
+	portENTER_CRITICAL(&spectrum_lock);
+	memset(&spectrum_published, 0, sizeof spectrum_published);
+	portEXIT_CRITICAL(&spectrum_lock);
+#endif
+	if (source == AUDIO_ANALYSER_SOURCE_PLAYBACK) {
+		ESP_ERROR_CHECK(audio_element_deinit(playback_reader));
+		audio_tee_tap_destroy(tap);
+	} else {
+		ESP_ERROR_CHECK(audio_element_deinit(decimator));
+		// FIXME: should be deinitialized, but causes a crash
+		// audio_element_deinit(i2s_stream_reader);
+	}
 	vTaskDelete(*task);
 }
@@ -0,0 +1,53 @@
+#include "energy_gate.h"
+
+// Frames must be 6 dB above the noise floor to open the gate
+#define ENERGY_GATE_RATIO 4
+
+// Keep the gate open for 200 ms of 25 ms frames after the energy drops, so the
+// detectors see the end of a tone
+#define ENERGY_GATE_HANGOVER 8
+
+// The floor falls by 1/4 and rises by 1/128 of the difference per frame
+#define ENERGY_GATE_FALL_SHIFT 2
+#define ENERGY_GATE_RISE_SHIFT 7
+
+// Lower limit of the floor (-78 dBFS), digital silence must not open the gate
+#define ENERGY_GATE_MIN_FLOOR 16
+
+void energy_gate_init(energy_gate_t *gate) {
+	gate->noise_floor = ENERGY_GATE_MIN_FLOOR;
+	gate->hangover    = 0;
+	gate->frames      = 0;
+	gate->skipped     = 0;
+}
+
+bool energy_gate_process(energy_gate_t *gate, const int16_t *samples,
+                         int nr_samples) {
+	if (nr_samples <= 0) return false;
+
+	uint64_t energy = 0;
+	for (int s = 0; s < nr_samples; s++)
+		energy += (uint32_t)((int32_t)samples[s] * samples[s]);
+	uint32_t mean_square = (uint32_t)(energy / nr_samples);
+
+	bool onset = (uint64_t)mean_square >
+	             (uint64_t)gate->noise_floor * ENERGY_GATE_RATIO;
+
+	if (mean_square < gate->noise_floor)
+		gate->noise_floor -=
+		    (gate->noise_floor - mean_square) >> ENERGY_GATE_FALL_SHIFT;
+	else
+		gate->noise_floor +=
+		    (mean_square - gate->noise_floor) >> ENERGY_GATE_RISE_SHIFT;
+	if (gate->noise_floor < ENERGY_GATE_MIN_FLOOR)
+		gate->noise_floor = ENERGY_GATE_MIN_FLOOR;
+
+	gate->frames++;
+	if (onset) gate->hangover = ENERGY_GATE_HANGOVER;
+	else if (gate->hangover > 0) gate->hangover--;
+	else {
+		gate->skipped++;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,55 @@
+#ifndef ANALYSER_SINK_H
+#define ANALYSER_SINK_H
+#pragma once
+
+#include "audio_element.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Frame timing statistics of the analyser sink
+ */
+struct audio_analyser_stats {
+	uint32_t frames;          // Frames received from the pipeline
+	uint32_t frames_skipped;  // Frames skipped by the energy gate
+	uint32_t frames_late;     // Frames that arrived over a frame late
+	uint32_t frames_dropped;  // Frames missing in the elapsed capture time
+	uint32_t process_us_avg;  // Average time to analyse a frame [us]
+	uint32_t process_us_max;  // Longest time to analyse a frame [us]
+	uint32_t interval_us_max; // Longest time between two frames [us]
+};
+
+/**
+ * @brief Configuration of the analyser sink
+ */
+typedef struct analyser_sink_cfg {
+	int frame_length;                 // Samples per frame
+	int frame_ms;                     // Duration of a frame [ms]
+	bool count_dropped;               // The input is a capture clock that
+	                                  // runs continuously
+	esp_err_t (*analyse)(int16_t *);  // Runs the detectors on a frame
+	// Runs the per-sample detectors on the samples as they arrive, before
+	// their frame is complete, or NULL
+	esp_err_t (*analyse_hop)(const int16_t *, int);
+	void (*reset)(void);              // Clears the detectors on open, or NULL
+} analyser_sink_cfg_t;
+
+/**
+ * @brief Create the pipeline sink that collects int16 mono frames and runs
+ * the detectors on every complete one in its process callback, so no
+ * captured audio is skipped. analyse_hop gets every read of the decimator
+ * output right away, it does not wait for the rest of the frame.
+ */
+audio_element_handle_t analyser_sink_init(const analyser_sink_cfg_t *config);
+
+/**
+ * @brief Copy the frame timing statistics, safe to call from any task.
+ *
+ * With count_dropped the frames that should have arrived since the first one
+ * and did not are counted as dropped. frames_skipped is left 0.
+ */
+void analyser_sink_get_stats(audio_element_handle_t el,
+                             struct audio_analyser_stats *stats);
+
+#endif /* ANALYSER_SINK_H */
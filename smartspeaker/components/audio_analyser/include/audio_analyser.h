@@ -2,15 +2,43 @@
 #define AUDIO_ANALYSER_H
 #pragma once
 
+#include "analyser_sink.h"
 #include "audio_event_iface.h"
 #include "esp_err.h"
 #include "freertos/task.h"
+#include "spectrum_analyser.h"
+#include <stdint.h>
+
+/**
+ * @brief Audio the analyser listens to
+ */
+enum audio_analyser_source {
+	AUDIO_ANALYSER_SOURCE_MICROPHONE, // Second I2S stream from the codec chip
+	AUDIO_ANALYSER_SOURCE_PLAYBACK,   // Decoded output of the active state
+};
 
 /// @brief Function that runs the audio analyser code
 void tone_detection_task(void *);
 
-/// @brief Sets up pipelines and components to use audio analyser
-void audio_analyser_init(audio_event_iface_handle_t evt_param);
+/// @brief Copy the frame timing statistics, safe to call from any task
+void audio_analyser_get_stats(struct audio_analyser_stats *stats);
+
+/**
+ * @brief Copy the latest published spectrum bands, safe to call from any task
+ *
+ * The bands are published at CONFIG_AUDIO_ANALYSER_SPECTRUM_RATE, nr_bands is
+ * 0 until the first publish or without CONFIG_AUDIO_ANALYSER_SPECTRUM.
+ */
+void audio_analyser_get_spectrum(struct spectrum_bands *bands);
+
+/**
+ * @brief Sets up pipelines and components to use audio analyser
+ *
+ * With AUDIO_ANALYSER_SOURCE_PLAYBACK no capture stream is opened, the
+ * analyser follows the state that is playing and only runs the spectrum.
+ */
+void audio_analyser_init(audio_event_iface_handle_t evt_param,
+                         enum audio_analyser_source source_param);
 
 // @brief Deinits audio pipelines and components to use audio analyser
 void audio_analyser_deinit(TaskHandle_t *task);
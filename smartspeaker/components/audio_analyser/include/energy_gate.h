@@ -0,0 +1,36 @@
+#ifndef ENERGY_GATE_H
+#define ENERGY_GATE_H
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Cheap first stage in front of the tone detectors.
+ *
+ * The mean square of every frame is compared with an adaptive noise floor
+ * using integer math only. The floor follows quieter frames quickly and
+ * louder frames slowly, so a change in background noise is learned within
+ * seconds while a tone opens the gate on its first frame.
+ */
+typedef struct energy_gate {
+	uint32_t noise_floor; // Mean square of the background noise
+	int hangover;         // Frames the gate stays open after the last onset
+	uint32_t frames;      // Frames seen
+	uint32_t skipped;     // Frames for which the gate was closed
+} energy_gate_t;
+
+/**
+ * @brief Start from the lowest noise floor, the gate stays open for the
+ * first seconds while the floor rises to the actual background noise.
+ */
+void energy_gate_init(energy_gate_t *gate);
+
+/**
+ * @brief Update the gate with a frame.
+ * @return true if the frame should be passed on to the detectors.
+ */
+bool energy_gate_process(energy_gate_t *gate, const int16_t *samples,
+                         int nr_samples);
+
+#endif /* ENERGY_GATE_H */
@@ -0,0 +1,283 @@
+#include "audio_tee.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "AUDIO_TEE";
+
+struct audio_tee_consumer {
+	struct audio_tee *tee;
+	QueueHandle_t queue; // Blocks waiting for the consumer
+	bool active;
+	int held; // Blocks queued or received and not released, under refs_lock
+	uint32_t received;
+	uint32_t dropped;
+	uint32_t max_lag;
+};
+
+struct audio_tee {
+	int block_size;
+	int nr_blocks;
+	audio_tee_block_t *blocks;
+	char *pool;                // Data of all blocks
+	char *scratch;             // Input when no block is used
+	QueueHandle_t free_blocks; // Blocks not held by anyone
+	portMUX_TYPE refs_lock;    // Protects the reference counts
+	SemaphoreHandle_t consumers_lock; // Protects the consumer slots
+	int max_consumers;
+	struct audio_tee_consumer *consumers;
+	uint32_t sequence; // Number of the next block
+};
+
+/**
+ * Drop a reference to a block, the last one returns it to the pool
+ */
+static void audio_tee_unref(audio_tee_block_t *block) {
+	struct audio_tee *tee = block->tee;
+
+	portENTER_CRITICAL(&tee->refs_lock);
+	bool last = --block->refs == 0;
+	portEXIT_CRITICAL(&tee->refs_lock);
+
+	if (last) xQueueSend(tee->free_blocks, &block, 0);
+}
+
+/**
+ * Offer a block to every consumer, count a drop for those that cannot take it
+ * (block is NULL if the pool was empty). A consumer may hold its share of the
+ * pool, one block is kept for the next read, so a slow consumer drops its own
+ * blocks and the pool does not run empty for the others.
+ */
+static void audio_tee_publish(struct audio_tee *tee,
+                              audio_tee_block_t *block) {
+	xSemaphoreTake(tee->consumers_lock, portMAX_DELAY);
+	int active = 0;
+	for (int c = 0; c < tee->max_consumers; c++)
+		active += tee->consumers[c].active;
+	int quota = active ? (tee->nr_blocks - 1) / active : 0;
+	if (quota < 1) quota = 1;
+
+	for (int c = 0; c < tee->max_consumers; c++) {
+		struct audio_tee_consumer *consumer = &tee->consumers[c];
+		if (!consumer->active) continue;
+
+		bool room = false;
+		if (block) {
+			portENTER_CRITICAL(&tee->refs_lock);
+			room = consumer->held < quota;
+			if (room) {
+				block->refs++;
+				consumer->held++;
+			}
+			portEXIT_CRITICAL(&tee->refs_lock);
+		}
+		if (room && xQueueSend(consumer->queue, &block, 0) == pdTRUE) {
+			consumer->received++;
+			uint32_t lag = uxQueueMessagesWaiting(consumer->queue);
+			if (lag > consumer->max_lag) consumer->max_lag = lag;
+			continue;
+		}
+		if (room) audio_tee_release(consumer, block);
+		consumer->dropped++;
+	}
+	xSemaphoreGive(tee->consumers_lock);
+}
+
+static bool audio_tee_has_consumers(struct audio_tee *tee) {
+	for (int c = 0; c < tee->max_consumers; c++)
+		if (tee->consumers[c].active) return true;
+	return false;
+}
+
+static esp_err_t audio_tee_open(audio_element_handle_t self) {
+	struct audio_tee *tee = audio_element_getdata(self);
+
+	tee->sequence = 0;
+	return ESP_OK;
+}
+
+static audio_element_err_t audio_tee_process(audio_element_handle_t self,
+                                             char *buffer, int length) {
+	struct audio_tee *tee = audio_element_getdata(self);
+
+	// Read straight into a block when somebody is listening, the block is
+	// passed on downstream and to the consumers from the same memory
+	audio_tee_block_t *block = NULL;
+	bool listening           = audio_tee_has_consumers(tee);
+	if (listening) xQueueReceive(tee->free_blocks, &block, 0);
+
+	char *data = block ? block->data : tee->scratch;
+	int bytes  = audio_element_input(self, data, tee->block_size);
+	if (bytes <= 0) {
+		if (block) xQueueSend(tee->free_blocks, &block, 0);
+		return bytes;
+	}
+
+	if (block) {
+		audio_element_info_t info = { 0 };
+		audio_element_getinfo(self, &info);
+		block->length      = bytes;
+		block->sequence    = tee->sequence;
+		block->sample_rate = info.sample_rates;
+		block->channels    = info.channels;
+		block->bits        = info.bits;
+		block->refs        = 1; // Held by the tee until it is passed on
+	}
+	tee->sequence++;
+
+	int ret = audio_element_output(self, data, bytes);
+	if (listening) audio_tee_publish(tee, block);
+	if (block) audio_tee_unref(block);
+	return ret;
+}
+
+static esp_err_t audio_tee_destroy(audio_element_handle_t self) {
+	struct audio_tee *tee = audio_element_getdata(self);
+
+	for (int c = 0; c < tee->max_consumers; c++)
+		if (tee->consumers[c].active)
+			ESP_LOGW(TAG, "Consumer %d still subscribed", c);
+
+	vQueueDelete(tee->free_blocks);
+	vSemaphoreDelete(tee->consumers_lock);
+	free(tee->consumers);
+	free(tee->blocks);
+	free(tee->pool);
+	free(tee->scratch);
+	free(tee);
+	return ESP_OK;
+}
+
+audio_element_handle_t audio_tee_init(audio_tee_cfg_t *config) {
+	struct audio_tee *tee = calloc(1, sizeof *tee);
+	if (!tee) {
+		ESP_LOGE(TAG, "Memory allocation for tee failed");
+		return NULL;
+	}
+	tee->block_size     = config->block_size;
+	tee->nr_blocks      = config->nr_blocks;
+	tee->max_consumers  = config->max_consumers;
+	tee->blocks         = calloc(tee->nr_blocks, sizeof *tee->blocks);
+	tee->pool           = malloc((size_t)tee->nr_blocks * tee->block_size);
+	tee->scratch        = malloc(tee->block_size);
+	tee->consumers      = calloc(tee->max_consumers, sizeof *tee->consumers);
+	tee->free_blocks    = xQueueCreate(tee->nr_blocks, sizeof(void *));
+	tee->consumers_lock = xSemaphoreCreateMutex();
+	portMUX_INITIALIZE(&tee->refs_lock);
+	if (!tee->blocks || !tee->pool || !tee->scratch || !tee->consumers ||
+	    !tee->free_blocks || !tee->consumers_lock)
+		goto fail;
+
+	for (int b = 0; b < tee->nr_blocks; b++) {
+		audio_tee_block_t *block = &tee->blocks[b];
+		block->data              = tee->pool + (size_t)b * tee->block_size;
+		block->tee               = tee;
+		xQueueSend(tee->free_blocks, &block, 0);
+	}
+	for (int c = 0; c < tee->max_consumers; c++) tee->consumers[c].tee = tee;
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open                = audio_tee_open;
+	cfg.process             = audio_tee_process;
+	cfg.destroy             = audio_tee_destroy;
+	cfg.out_rb_size         = config->out_rb_size;
+	cfg.task_stack          = config->task_stack;
+	cfg.task_core           = config->task_core;
+	cfg.task_prio           = config->task_prio;
+	cfg.tag                 = "tee";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	if (!el) goto fail;
+	audio_element_setdata(el, tee);
+	return el;
+
+fail:
+	ESP_LOGE(TAG, "Memory allocation for tee failed");
+	if (tee->free_blocks) vQueueDelete(tee->free_blocks);
+	if (tee->consumers_lock) vSemaphoreDelete(tee->consumers_lock);
+	free(tee->consumers);
+	free(tee->blocks);
+	free(tee->pool);
+	free(tee->scratch);
+	free(tee);
+	return NULL;
+}
+
+audio_tee_consumer_handle_t audio_tee_subscribe(audio_element_handle_t el,
+                                                int queue_length) {
+	struct audio_tee *tee               = audio_element_getdata(el);
+	struct audio_tee_consumer *consumer = NULL;
+
+	QueueHandle_t queue = xQueueCreate(queue_length, sizeof(void *));
+	if (!queue) return NULL;
+
+	xSemaphoreTake(tee->consumers_lock, portMAX_DELAY);
+	for (int c = 0; c < tee->max_consumers; c++) {
+		if (tee->consumers[c].active) continue;
+
+		consumer           = &tee->consumers[c];
+		consumer->queue    = queue;
+		consumer->received = 0;
+		consumer->dropped  = 0;
+		consumer->max_lag  = 0;
+		consumer->held     = 0;
+		consumer->active   = true;
+		break;
+	}
+	xSemaphoreGive(tee->consumers_lock);
+
+	if (!consumer) {
+		ESP_LOGW(TAG, "No room for another consumer");
+		vQueueDelete(queue);
+	}
+	return consumer;
+}
+
+void audio_tee_unsubscribe(audio_tee_consumer_handle_t consumer) {
+	struct audio_tee *tee = consumer->tee;
+
+	xSemaphoreTake(tee->consumers_lock, portMAX_DELAY);
+	consumer->active = false;
+	xSemaphoreGive(tee->consumers_lock);
+
+	audio_tee_block_t *block;
+	while (xQueueReceive(consumer->queue, &block, 0) == pdTRUE)
+		audio_tee_release(consumer, block);
+	vQueueDelete(consumer->queue);
+	consumer->queue = NULL;
+}
+
+audio_tee_block_t *audio_tee_receive(audio_tee_consumer_handle_t consumer,
+                                     TickType_t ticks_to_wait) {
+	audio_tee_block_t *block;
+	if (xQueueReceive(consumer->queue, &block, ticks_to_wait) != pdTRUE)
+		return NULL;
+	return block;
+}
+
+void audio_tee_release(audio_tee_consumer_handle_t consumer,
+                       audio_tee_block_t *block) {
+	struct audio_tee *tee = consumer->tee;
+
+	portENTER_CRITICAL(&tee->refs_lock);
+	consumer->held--;
+	portEXIT_CRITICAL(&tee->refs_lock);
+	audio_tee_unref(block);
+}
+
+void audio_tee_get_stats(audio_tee_consumer_handle_t consumer,
+                         struct audio_tee_consumer_stats *stats) {
+	struct audio_tee *tee = consumer->tee;
+
+	xSemaphoreTake(tee->consumers_lock, portMAX_DELAY);
+	stats->received = consumer->received;
+	stats->dropped  = consumer->dropped;
+	stats->lag      = consumer->queue ? uxQueueMessagesWaiting(consumer->queue)
+	                                  : 0;
+	stats->max_lag  = consumer->max_lag;
+	xSemaphoreGive(tee->consumers_lock);
+}
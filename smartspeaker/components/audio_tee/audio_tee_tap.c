@@ -0,0 +1,163 @@
+#include "audio_tee_tap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static const char *TAG = "AUDIO_TEE_TAP";
+
+struct audio_tee_tap {
+	portMUX_TYPE lock; // Protects consumer, pinned and waiting
+	int queue_length;
+	audio_tee_consumer_handle_t consumer; // NULL when nothing plays
+	audio_tee_consumer_handle_t pinned;   // Received from, until released
+	bool waiting;                         // For pinned to be let go
+	SemaphoreHandle_t unpinned;           // Given when it was let go
+};
+
+static portMUX_TYPE registry_mux = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t registry_lock; // Protects taps and playback
+static struct audio_tee_tap *taps[AUDIO_TEE_MAX_TAPS];
+static audio_element_handle_t playback;
+
+/**
+ * Create the registry lock on first use, taps and pipelines may come up in any
+ * order
+ */
+static SemaphoreHandle_t get_registry_lock(void) {
+	if (registry_lock) return registry_lock;
+
+	SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+	portENTER_CRITICAL(&registry_mux);
+	if (!registry_lock) {
+		registry_lock = lock;
+		lock          = NULL;
+	}
+	portEXIT_CRITICAL(&registry_mux);
+	if (lock) vSemaphoreDelete(lock);
+	return registry_lock;
+}
+
+/**
+ * Move a tap to the playing tee, the registry lock must be held. The next
+ * receive uses the new tee, a block of the old one is waited for.
+ */
+static void audio_tee_tap_follow(struct audio_tee_tap *tap) {
+	audio_tee_consumer_handle_t consumer =
+	    playback ? audio_tee_subscribe(playback, tap->queue_length) : NULL;
+
+	portENTER_CRITICAL(&tap->lock);
+	audio_tee_consumer_handle_t old = tap->consumer;
+	tap->consumer                   = consumer;
+	tap->waiting                    = old && tap->pinned == old;
+	bool busy                       = tap->waiting;
+	portEXIT_CRITICAL(&tap->lock);
+
+	if (busy) xSemaphoreTake(tap->unpinned, portMAX_DELAY);
+	if (old) audio_tee_unsubscribe(old);
+}
+
+/**
+ * Let go of the consumer a receive used, wake a change of the playback that
+ * waits for it
+ */
+static void audio_tee_tap_unpin(struct audio_tee_tap *tap) {
+	portENTER_CRITICAL(&tap->lock);
+	bool wake    = tap->waiting;
+	tap->pinned  = NULL;
+	tap->waiting = false;
+	portEXIT_CRITICAL(&tap->lock);
+
+	if (wake) xSemaphoreGive(tap->unpinned);
+}
+
+void audio_tee_set_playback(audio_element_handle_t tee) {
+	SemaphoreHandle_t lock = get_registry_lock();
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	playback = tee;
+	for (int t = 0; t < AUDIO_TEE_MAX_TAPS; t++)
+		if (taps[t]) audio_tee_tap_follow(taps[t]);
+	xSemaphoreGive(lock);
+}
+
+audio_tee_tap_handle_t audio_tee_tap_create(int queue_length) {
+	SemaphoreHandle_t lock = get_registry_lock();
+
+	struct audio_tee_tap *tap = calloc(1, sizeof *tap);
+	if (!tap) return NULL;
+	tap->queue_length = queue_length;
+	tap->unpinned     = xSemaphoreCreateBinary();
+	portMUX_INITIALIZE(&tap->lock);
+	if (!tap->unpinned) {
+		free(tap);
+		return NULL;
+	}
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	int slot = 0;
+	while (slot < AUDIO_TEE_MAX_TAPS && taps[slot]) slot++;
+	if (slot < AUDIO_TEE_MAX_TAPS) {
+		audio_tee_tap_follow(tap);
+		taps[slot] = tap;
+	}
+	xSemaphoreGive(lock);
+
+	if (slot == AUDIO_TEE_MAX_TAPS) {
+		ESP_LOGW(TAG, "No room for another tap");
+		vSemaphoreDelete(tap->unpinned);
+		free(tap);
+		return NULL;
+	}
+	return tap;
+}
+
+void audio_tee_tap_destroy(audio_tee_tap_handle_t tap) {
+	SemaphoreHandle_t lock = get_registry_lock();
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	for (int t = 0; t < AUDIO_TEE_MAX_TAPS; t++)
+		if (taps[t] == tap) taps[t] = NULL;
+	xSemaphoreGive(lock);
+
+	if (tap->consumer) audio_tee_unsubscribe(tap->consumer);
+	vSemaphoreDelete(tap->unpinned);
+	free(tap);
+}
+
+audio_tee_block_t *audio_tee_tap_receive(audio_tee_tap_handle_t tap,
+                                         TickType_t ticks_to_wait) {
+	// Pinned until the block is released, the playback may change meanwhile
+	portENTER_CRITICAL(&tap->lock);
+	audio_tee_consumer_handle_t consumer = tap->consumer;
+	tap->pinned                          = consumer;
+	portEXIT_CRITICAL(&tap->lock);
+	if (!consumer) {
+		vTaskDelay(ticks_to_wait);
+		return NULL;
+	}
+
+	audio_tee_block_t *block = audio_tee_receive(consumer, ticks_to_wait);
+	if (!block) audio_tee_tap_unpin(tap);
+	return block;
+}
+
+void audio_tee_tap_release(audio_tee_tap_handle_t tap,
+                           audio_tee_block_t *block) {
+	audio_tee_release(tap->pinned, block);
+	audio_tee_tap_unpin(tap);
+}
+
+void audio_tee_tap_get_stats(audio_tee_tap_handle_t tap,
+                             struct audio_tee_consumer_stats *stats) {
+	SemaphoreHandle_t lock = get_registry_lock();
+
+	// The consumer only changes under the registry lock
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (tap->consumer) audio_tee_get_stats(tap->consumer, stats);
+	else memset(stats, 0, sizeof *stats);
+	xSemaphoreGive(lock);
+}
@@ -0,0 +1,105 @@
+#ifndef AUDIO_TEE_H
+#define AUDIO_TEE_H
+#pragma once
+
+#include "audio_element.h"
+#include "freertos/FreeRTOS.h"
+#include <stdint.h>
+
+/**
+ * @brief A block of audio published by the tee, shared by all consumers.
+ *
+ * Blocks are read-only for consumers and must be handed back with
+ * audio_tee_release() once they are done with them.
+ */
+typedef struct audio_tee_block {
+	char *data;        // Audio as it was passed on downstream
+	int length;        // Valid bytes in data
+	uint32_t sequence; // Number of the block since the tee was opened
+	int sample_rate;   // Format of the audio at the time of the block
+	int channels;
+	int bits;
+	int refs;          // Consumers still holding the block, private
+	struct audio_tee *tee;
+} audio_tee_block_t;
+
+typedef struct audio_tee_consumer *audio_tee_consumer_handle_t;
+
+/**
+ * @brief Counters of a consumer since it subscribed.
+ */
+struct audio_tee_consumer_stats {
+	uint32_t received; // Blocks queued for the consumer
+	uint32_t dropped;  // Blocks lost because the queue, the share of the pool
+	                   // or the pool was full
+	uint32_t lag;      // Blocks waiting in the queue now
+	uint32_t max_lag;  // Most blocks that were ever waiting in the queue
+};
+
+/**
+ * @brief Configuration of the tee element
+ */
+typedef struct audio_tee_cfg {
+	int block_size;    // Bytes per published block
+	int nr_blocks;     // Blocks in the pool, an equal share per consumer
+	int max_consumers; // Consumers that can subscribe at the same time
+	int out_rb_size;   // Size of the output ringbuffer
+	int task_stack;    // Task stack size
+	int task_core;     // Task running on core
+	int task_prio;     // Task priority
+} audio_tee_cfg_t;
+
+#define DEFAULT_AUDIO_TEE_CONFIG()                                             \
+	{                                                                          \
+		.block_size = 2048, .nr_blocks = 8, .max_consumers = 4,                \
+		.out_rb_size = 8 * 1024, .task_stack = 3 * 1024, .task_core = 0,       \
+		.task_prio = 5,                                                        \
+	}
+
+/**
+ * @brief Create an element that passes its input on unchanged and publishes
+ * every block it passed on to the subscribed consumers.
+ *
+ * The audio is read straight into a block from a fixed pool and passed on from
+ * there, consumers get a reference to the same block so nothing is copied.
+ * Playback never waits for a consumer: a consumer whose queue is full, that
+ * holds its share of the pool, or a pool without free blocks, drops the block
+ * for that consumer and counts it. The shares of the consumers leave one block
+ * for the tee, so a slow consumer does not make the others drop.
+ */
+audio_element_handle_t audio_tee_init(audio_tee_cfg_t *config);
+
+/**
+ * @brief Subscribe to the blocks of a tee.
+ * @param queue_length blocks that may wait for the consumer before it drops
+ * @return consumer handle or NULL if all consumer slots are taken
+ */
+audio_tee_consumer_handle_t audio_tee_subscribe(audio_element_handle_t tee,
+                                                int queue_length);
+
+/**
+ * @brief Stop receiving blocks, blocks still queued are released. All
+ * consumers must unsubscribe before the tee is deinitialised.
+ */
+void audio_tee_unsubscribe(audio_tee_consumer_handle_t consumer);
+
+/**
+ * @brief Wait for the next block.
+ * @return block or NULL when nothing arrived within ticks_to_wait
+ */
+audio_tee_block_t *audio_tee_receive(audio_tee_consumer_handle_t consumer,
+                                     TickType_t ticks_to_wait);
+
+/**
+ * @brief Hand a block the consumer received back to the pool.
+ */
+void audio_tee_release(audio_tee_consumer_handle_t consumer,
+                       audio_tee_block_t *block);
+
+/**
+ * @brief Get the counters of a consumer.
+ */
+void audio_tee_get_stats(audio_tee_consumer_handle_t consumer,
+                         struct audio_tee_consumer_stats *stats);
+
+#endif /* AUDIO_TEE_H */
@@ -0,0 +1,50 @@
+#ifndef AUDIO_TEE_TAP_H
+#define AUDIO_TEE_TAP_H
+#pragma once
+
+#include "audio_tee.h"
+
+/// Taps that can exist at the same time
+#define AUDIO_TEE_MAX_TAPS 4
+
+typedef struct audio_tee_tap *audio_tee_tap_handle_t;
+
+/**
+ * @brief Publish the tee of the pipeline that is playing now, or NULL when
+ * nothing plays. Every tap moves to the new tee.
+ *
+ * Call it after the pipeline runs and with NULL before the tee is stopped and
+ * deinitialised. Taps receive from the new tee right away, it only waits for
+ * a tap that still holds a block of the old one to release it.
+ */
+void audio_tee_set_playback(audio_element_handle_t tee);
+
+/**
+ * @brief Create a consumer of whatever is playing, it follows the tees that
+ * are published with audio_tee_set_playback().
+ * @param queue_length blocks that may wait for the tap before it drops
+ * @return tap handle or NULL if there is no room for another tap
+ */
+audio_tee_tap_handle_t audio_tee_tap_create(int queue_length);
+void audio_tee_tap_destroy(audio_tee_tap_handle_t tap);
+
+/**
+ * @brief Wait for the next block of the playing tee.
+ *
+ * A block must be handed back with audio_tee_tap_release() before the tap is
+ * used again, its tee is not let go until then. One task uses a tap.
+ * @return block or NULL when nothing arrived within ticks_to_wait
+ */
+audio_tee_block_t *audio_tee_tap_receive(audio_tee_tap_handle_t tap,
+                                         TickType_t ticks_to_wait);
+void audio_tee_tap_release(audio_tee_tap_handle_t tap,
+                           audio_tee_block_t *block);
+
+/**
+ * @brief Get the counters of the tap for the tee it follows now, all zero
+ * when nothing plays.
+ */
+void audio_tee_tap_get_stats(audio_tee_tap_handle_t tap,
+                             struct audio_tee_consumer_stats *stats);
+
+#endif /* AUDIO_TEE_TAP_H */
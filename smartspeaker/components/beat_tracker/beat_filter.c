@@ -0,0 +1,202 @@
+#include "beat_filter.h"
+#include "beat_tracker.h"
+#include "decimator.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+
+#include "utils/macro.h"
+
+#define SEND_BEAT_CMD(bpm) SEND_CMD(BEAT_EVT, BEAT_EVT, bpm, filter->evt)
+
+// Rate of the onset analysis
+#define BEAT_FILTER_RATE 8000
+
+// Bytes of one interleaved int16 stereo frame
+#define BEAT_FILTER_FRAME_BYTES 4
+
+// Input read per process call
+#define BEAT_FILTER_BUFFER_LENGTH 2048
+
+// Beats reported per process call at most
+#define BEAT_FILTER_MAX_BEATS 4
+
+static const char *TAG = "BEAT_FILTER";
+
+struct beat_filter {
+	beat_tracker_t tracker;
+	decimator_t decimator;
+	audio_event_iface_handle_t evt;
+	audio_event_iface_handle_t listener;
+	int latency_ms;
+	int sample_rate; // Rate the decimator is set up for, 0 if none
+	int channels;    // Channels of the stream
+	char input[BEAT_FILTER_FRAME_BYTES + BEAT_FILTER_BUFFER_LENGTH];
+	int carry;       // Bytes of an incomplete frame at the start of input
+	int16_t *mono;   // Decimator output for a full input buffer
+};
+
+/**
+ * Follow the stream format in the element info, the tracker only handles
+ * stereo and is skipped for anything else.
+ * @return true if the input can be analysed
+ */
+static bool beat_filter_follow_info(audio_element_handle_t self,
+                                    struct beat_filter *filter) {
+	audio_element_info_t info = { 0 };
+	audio_element_getinfo(self, &info);
+	if (info.sample_rates == filter->sample_rate &&
+	    info.channels == filter->channels)
+		return filter->mono != NULL;
+
+	filter->sample_rate = info.sample_rates;
+	filter->channels    = info.channels;
+	decimator_free(&filter->decimator);
+	free(filter->mono);
+	filter->mono = NULL;
+
+	if (info.channels != 2 || info.bits != 16) {
+		ESP_LOGW(TAG, "Not tracking beats in %d channel %d bit audio",
+		         info.channels, info.bits);
+		return false;
+	}
+	ESP_RETURN_ON_FALSE(decimator_setup(&filter->decimator, info.sample_rates,
+	                                    BEAT_FILTER_RATE) == ESP_OK,
+	                    false, TAG, "Not tracking beats at %d Hz",
+	                    info.sample_rates);
+
+	int nr_frames = sizeof filter->input / BEAT_FILTER_FRAME_BYTES;
+	filter->mono  = malloc(sizeof *filter->mono *
+	                       decimator_max_output(&filter->decimator, nr_frames));
+	if (!filter->mono) {
+		decimator_free(&filter->decimator);
+		return false;
+	}
+
+	beat_tracker_reset(&filter->tracker);
+	filter->carry = 0;
+	return true;
+}
+
+static esp_err_t beat_filter_open(audio_element_handle_t self) {
+	struct beat_filter *filter = audio_element_getdata(self);
+
+	beat_tracker_cfg_t tracker_cfg = {
+		.sample_rate = BEAT_FILTER_RATE,
+		.latency_ms  = filter->latency_ms,
+	};
+	ESP_RETURN_ON_ERROR(beat_tracker_setup(&filter->tracker, &tracker_cfg),
+	                    TAG, "Beat tracker setup failed");
+
+	filter->sample_rate = 0;
+	filter->channels    = 0;
+	filter->carry       = 0;
+	return ESP_OK;
+}
+
+static esp_err_t beat_filter_close(audio_element_handle_t self) {
+	struct beat_filter *filter = audio_element_getdata(self);
+
+	beat_tracker_free(&filter->tracker);
+	decimator_free(&filter->decimator);
+	free(filter->mono);
+	filter->mono = NULL;
+	return ESP_OK;
+}
+
+static audio_element_err_t beat_filter_process(audio_element_handle_t self,
+                                               char *buffer, int length) {
+	struct beat_filter *filter = audio_element_getdata(self);
+
+	// A new format drops the carry, so follow it before placing the input
+	// behind the carry
+	bool analyse = beat_filter_follow_info(self, filter);
+
+	char *fresh = filter->input + filter->carry;
+	int bytes   = audio_element_input(self, fresh, BEAT_FILTER_BUFFER_LENGTH);
+	if (bytes <= 0) return bytes;
+
+	if (analyse) {
+		// Ringbuffer reads need not end on a frame, keep the rest for next
+		// time
+		int available = filter->carry + bytes;
+		int nr_frames = available / BEAT_FILTER_FRAME_BYTES;
+		int nr_mono   = decimator_process(&filter->decimator,
+		                                  (const int16_t *)filter->input,
+		                                  nr_frames, filter->mono);
+
+		struct beat beats[BEAT_FILTER_MAX_BEATS];
+		int nr_beats = beat_tracker_process(&filter->tracker, filter->mono,
+		                                    nr_mono, beats, ARRAY_SIZE(beats));
+		for (int b = 0; b < nr_beats; b++) {
+			ESP_LOGD(TAG, "Beat at %u ms, %.1f BPM", beats[b].time_ms,
+			         beats[b].bpm);
+			SEND_BEAT_CMD((int)(beats[b].bpm + 0.5f));
+		}
+
+		// Pass the audio on before moving the incomplete frame
+		int ret = audio_element_output(self, fresh, bytes);
+		filter->carry = available - nr_frames * BEAT_FILTER_FRAME_BYTES;
+		memmove(filter->input,
+		        filter->input + nr_frames * BEAT_FILTER_FRAME_BYTES,
+		        filter->carry);
+		return ret;
+	}
+
+	filter->carry = 0;
+	return audio_element_output(self, fresh, bytes);
+}
+
+static esp_err_t beat_filter_destroy(audio_element_handle_t self) {
+	struct beat_filter *filter = audio_element_getdata(self);
+
+	if (filter->listener)
+		audio_event_iface_remove_listener(filter->listener, filter->evt);
+	audio_event_iface_destroy(filter->evt);
+	free(filter);
+	return ESP_OK;
+}
+
+audio_element_handle_t beat_filter_init(beat_filter_cfg_t *config) {
+	struct beat_filter *filter = calloc(1, sizeof *filter);
+	if (!filter) {
+		ESP_LOGE(TAG, "Memory allocation for beat filter failed");
+		return NULL;
+	}
+	filter->latency_ms = config->latency_ms;
+
+	audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
+	filter->evt                     = audio_event_iface_init(&evt_cfg);
+	if (!filter->evt) {
+		free(filter);
+		return NULL;
+	}
+	filter->listener = config->evt;
+	if (filter->listener)
+		audio_event_iface_set_listener(filter->evt, filter->listener);
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open                = beat_filter_open;
+	cfg.close               = beat_filter_close;
+	cfg.process             = beat_filter_process;
+	cfg.destroy             = beat_filter_destroy;
+	cfg.out_rb_size         = config->out_rb_size;
+	cfg.task_stack          = config->task_stack;
+	cfg.task_core           = config->task_core;
+	cfg.task_prio           = config->task_prio;
+	cfg.tag                 = "beat";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	if (!el) {
+		if (filter->listener)
+			audio_event_iface_remove_listener(filter->listener, filter->evt);
+		audio_event_iface_destroy(filter->evt);
+		free(filter);
+		return NULL;
+	}
+	audio_element_setdata(el, filter);
+	return el;
+}
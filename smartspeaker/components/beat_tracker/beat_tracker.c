@@ -0,0 +1,276 @@
+#include "beat_tracker.h"
+
+#include <math.h>
+#include <string.h>
+
+// Compression of the magnitudes before the flux, log(1 + C * |X|)
+#define BEAT_TRACKER_COMPRESSION 0.001f
+
+// Estimate the tempo every second
+#define BEAT_TRACKER_TEMPO_INTERVAL_MS 1000
+
+// Centre and width (in octaves) of the tempo prior
+#define BEAT_TRACKER_PRIOR_BPM    120.0f
+#define BEAT_TRACKER_PRIOR_OCTAVE 1.0f
+
+// Lags further than this (in octaves) from the current period lose half their
+// weight, which keeps the tempo from jumping between octaves
+#define BEAT_TRACKER_CONTINUITY_OCTAVE 0.1f
+
+// Minimum autocorrelation at the beat period relative to lag 0, below it the
+// onsets are not periodic (speech, noise) and the tempo is unknown
+#define BEAT_TRACKER_MIN_CORRELATION 0.4f
+
+// Weight of the previous beats in the cumulative score
+#define BEAT_TRACKER_ALPHA 0.9f
+
+// Penalty for beat intervals that differ from the period
+#define BEAT_TRACKER_TIGHTNESS 100.0f
+
+// Time constant of the running mean of the onset function
+#define BEAT_TRACKER_MEAN_MS 2000
+
+// No beats are reported when the onset function is this small (silence)
+#define BEAT_TRACKER_MIN_ODF 1.0f
+
+#define HISTORY(array, hop) ((array)[(hop) % BEAT_TRACKER_HISTORY])
+
+esp_err_t beat_tracker_setup(beat_tracker_t *tracker,
+                             const beat_tracker_cfg_t *config) {
+	if (config->sample_rate <= 0) return ESP_ERR_INVALID_ARG;
+
+	memset(tracker, 0, sizeof *tracker);
+	esp_err_t err = fft_real_setup(&tracker->fft, BEAT_TRACKER_FFT_SIZE);
+	if (err != ESP_OK) return err;
+
+	for (int n = 0; n < BEAT_TRACKER_FFT_SIZE; n++)
+		tracker->window[n] = (int16_t)lrintf(
+		    32767.0f * 0.5f *
+		    (1.0f - cosf(2.0f * M_PI * n / BEAT_TRACKER_FFT_SIZE)));
+
+	tracker->hop_ms       = 1000.0f * BEAT_TRACKER_HOP / config->sample_rate;
+	tracker->latency_hops = (int)(config->latency_ms / tracker->hop_ms);
+	tracker->min_lag =
+	    (int)ceilf(60000.0f / BEAT_TRACKER_MAX_BPM / tracker->hop_ms);
+	tracker->max_lag =
+	    (int)(60000.0f / BEAT_TRACKER_MIN_BPM / tracker->hop_ms);
+	if (tracker->min_lag < 2 ||
+	    2 * tracker->max_lag >= BEAT_TRACKER_TEMPO_WINDOW) {
+		fft_real_free(&tracker->fft);
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	beat_tracker_reset(tracker);
+	return ESP_OK;
+}
+
+void beat_tracker_free(beat_tracker_t *tracker) {
+	fft_real_free(&tracker->fft);
+}
+
+void beat_tracker_reset(beat_tracker_t *tracker) {
+	memset(tracker->samples, 0, sizeof tracker->samples);
+	memset(tracker->magnitude, 0, sizeof tracker->magnitude);
+	memset(tracker->odf, 0, sizeof tracker->odf);
+	memset(tracker->score, 0, sizeof tracker->score);
+	tracker->fill      = 0;
+	tracker->odf_mean  = 0.0f;
+	tracker->hop       = 0;
+	tracker->period    = 0.0f;
+	tracker->last_beat = 0;
+}
+
+float beat_tracker_bpm(const beat_tracker_t *tracker) {
+	if (tracker->period <= 0.0f) return 0.0f;
+	return 60000.0f / (tracker->period * tracker->hop_ms);
+}
+
+/**
+ * Spectral flux of the latest frame
+ */
+static float spectral_flux(beat_tracker_t *tracker) {
+	fft_real_power(&tracker->fft, tracker->samples, tracker->window,
+	               tracker->power);
+
+	float flux = 0.0f;
+	for (int k = 1; k <= BEAT_TRACKER_FFT_SIZE / 2; k++) {
+		float magnitude =
+		    logf(1.0f + BEAT_TRACKER_COMPRESSION * sqrtf(tracker->power[k]));
+		float rise = magnitude - tracker->magnitude[k];
+		if (rise > 0.0f) flux += rise;
+		tracker->magnitude[k] = magnitude;
+	}
+	return flux;
+}
+
+/**
+ * Estimate the beat period from the autocorrelation of the onset function
+ */
+static void estimate_tempo(beat_tracker_t *tracker) {
+	float *x       = tracker->scratch;
+	float *r       = tracker->correlation;
+	uint32_t first = tracker->hop - BEAT_TRACKER_TEMPO_WINDOW + 1;
+
+	float mean = 0.0f;
+	for (int i = 0; i < BEAT_TRACKER_TEMPO_WINDOW; i++) {
+		x[i] = HISTORY(tracker->odf, first + i);
+		mean += x[i];
+	}
+	mean /= BEAT_TRACKER_TEMPO_WINDOW;
+	if (mean < BEAT_TRACKER_MIN_ODF) return;
+
+	// Onsets are a hop wide, smooth them over three hops so a period that
+	// falls between two lags still correlates as well as one on a lag
+	float previous = x[0] - mean;
+	for (int i = 0; i < BEAT_TRACKER_TEMPO_WINDOW; i++) {
+		float current = x[i] - mean;
+		float next =
+		    i + 1 < BEAT_TRACKER_TEMPO_WINDOW ? x[i + 1] - mean : current;
+		x[i]     = 0.25f * previous + 0.5f * current + 0.25f * next;
+		previous = current;
+	}
+
+	float prior_lag = 60000.0f / BEAT_TRACKER_PRIOR_BPM / tracker->hop_ms;
+	float best      = 0.0f;
+	int best_lag    = 0;
+
+	float energy = 0.0f;
+	for (int i = 0; i < BEAT_TRACKER_TEMPO_WINDOW; i++) energy += x[i] * x[i];
+	energy /= BEAT_TRACKER_TEMPO_WINDOW;
+
+	// Autocorrelation up to twice the longest period, which reinforces the
+	// lag of the beat with that of the half bar
+	for (int lag = tracker->min_lag; lag <= 2 * tracker->max_lag; lag++) {
+		float sum = 0.0f;
+		for (int i = lag; i < BEAT_TRACKER_TEMPO_WINDOW; i++)
+			sum += x[i] * x[i - lag];
+		r[lag] = sum / (BEAT_TRACKER_TEMPO_WINDOW - lag);
+	}
+	for (int lag = tracker->min_lag; lag <= tracker->max_lag; lag++) {
+		float octaves = log2f(lag / prior_lag) / BEAT_TRACKER_PRIOR_OCTAVE;
+		float weight  = expf(-0.5f * octaves * octaves);
+		if (tracker->period > 0.0f) {
+			float change = log2f(lag / tracker->period) /
+			               BEAT_TRACKER_CONTINUITY_OCTAVE;
+			weight *= 0.5f + 0.5f * expf(-0.5f * change * change);
+		}
+		float score = weight * (r[lag] + 0.5f * r[2 * lag]);
+		if (score > best) {
+			best     = score;
+			best_lag = lag;
+		}
+	}
+	if (best_lag == 0 ||
+	    r[best_lag] < BEAT_TRACKER_MIN_CORRELATION * energy) {
+		tracker->period = 0.0f;
+		return;
+	}
+
+	// Parabolic interpolation between the neighbouring lags
+	float period = best_lag;
+	if (best_lag > tracker->min_lag && best_lag < tracker->max_lag) {
+		float left  = r[best_lag - 1];
+		float right = r[best_lag + 1];
+		float denom = left - 2.0f * r[best_lag] + right;
+		if (denom < 0.0f) period += 0.5f * (left - right) / denom;
+	}
+	tracker->period = period;
+}
+
+/**
+ * Update the cumulative score for the latest hop
+ */
+static void update_score(beat_tracker_t *tracker, float odf) {
+	float best = 0.0f;
+	if (tracker->period > 0.0f) {
+		int from = (int)(0.5f * tracker->period);
+		int to   = (int)(2.0f * tracker->period);
+		if (to >= BEAT_TRACKER_HISTORY) to = BEAT_TRACKER_HISTORY - 1;
+		if (to > (int)tracker->hop) to = tracker->hop;
+
+		best = -INFINITY;
+		for (int t = from; t <= to; t++) {
+			float ratio   = logf(t / tracker->period);
+			float penalty = BEAT_TRACKER_TIGHTNESS * ratio * ratio;
+			float score   = HISTORY(tracker->score, tracker->hop - t) - penalty;
+			if (score > best) best = score;
+		}
+		if (best == -INFINITY) best = 0.0f;
+	}
+	HISTORY(tracker->score, tracker->hop) =
+	    (1.0f - BEAT_TRACKER_ALPHA) * odf + BEAT_TRACKER_ALPHA * best;
+}
+
+/**
+ * Predict the hop of the next beat from the cumulative score. Only hops between
+ * half a period and a period ago are considered: their scores have settled and
+ * the predictions stay ahead of the current hop by up to half a period.
+ * @return predicted hop or 0 if there is no prediction
+ */
+static uint32_t predict_beat(beat_tracker_t *tracker) {
+	if (tracker->period <= 0.0f || tracker->odf_mean < BEAT_TRACKER_MIN_ODF)
+		return 0;
+
+	int period = (int)(tracker->period + 0.5f);
+	if (period > (int)tracker->hop) return 0;
+
+	uint32_t best = tracker->hop - period;
+	for (int t = period - 1; t >= period / 2; t--) {
+		uint32_t hop = tracker->hop - t;
+		if (HISTORY(tracker->score, hop) > HISTORY(tracker->score, best))
+			best = hop;
+	}
+	return best + period;
+}
+
+int beat_tracker_process(beat_tracker_t *tracker, const int16_t *samples,
+                         int nr_samples, struct beat *beats, int max_beats) {
+	const int keep = BEAT_TRACKER_FFT_SIZE - BEAT_TRACKER_HOP;
+	int nr_beats   = 0;
+	int tempo_interval =
+	    (int)(BEAT_TRACKER_TEMPO_INTERVAL_MS / tracker->hop_ms);
+	float mean_weight = tracker->hop_ms / BEAT_TRACKER_MEAN_MS;
+
+	while (nr_samples > 0) {
+		int run = BEAT_TRACKER_HOP - tracker->fill;
+		if (run > nr_samples) run = nr_samples;
+		memcpy(&tracker->samples[keep + tracker->fill], samples,
+		       sizeof *samples * run);
+		tracker->fill += run;
+		samples += run;
+		nr_samples -= run;
+		if (tracker->fill < BEAT_TRACKER_HOP) break;
+
+		// A full hop: update the onset function and the beat score
+		float flux = spectral_flux(tracker);
+		memmove(tracker->samples, &tracker->samples[BEAT_TRACKER_HOP],
+		        sizeof *tracker->samples * keep);
+		tracker->fill = 0;
+
+		tracker->hop++;
+		tracker->odf_mean += mean_weight * (flux - tracker->odf_mean);
+		HISTORY(tracker->odf, tracker->hop) = flux;
+		update_score(tracker, (flux - tracker->odf_mean) /
+		                          (tracker->odf_mean + 1e-6f));
+
+		if (tracker->hop >= BEAT_TRACKER_TEMPO_WINDOW &&
+		    tracker->hop % tempo_interval == 0)
+			estimate_tempo(tracker);
+
+		// Report a predicted beat once it is within the latency, but never
+		// two beats closer than half a period
+		int latency = tracker->latency_hops;
+		if (latency > tracker->period / 2) latency = tracker->period / 2;
+		uint32_t next = predict_beat(tracker);
+		if (next && next <= tracker->hop + latency &&
+		    next >= tracker->last_beat + tracker->period / 2) {
+			tracker->last_beat = next;
+			if (nr_beats < max_beats) {
+				beats[nr_beats].time_ms = (uint32_t)(next * tracker->hop_ms);
+				beats[nr_beats].bpm     = beat_tracker_bpm(tracker);
+				nr_beats++;
+			}
+		}
+	}
+	return nr_beats;
+}
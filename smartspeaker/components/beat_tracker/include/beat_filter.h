@@ -0,0 +1,39 @@
+#ifndef BEAT_FILTER_H
+#define BEAT_FILTER_H
+#pragma once
+
+#include "audio_element.h"
+#include "audio_event_iface.h"
+
+/// Event command and source type of beat events, data is the tempo in BPM
+#define BEAT_EVT 8003
+
+/**
+ * @brief Configuration of the beat filter element
+ */
+typedef struct beat_filter_cfg {
+	audio_event_iface_handle_t evt; // Receives the beat events
+	int latency_ms;                 // Report beats this much earlier [ms]
+	int out_rb_size;                // Size of the output ringbuffer
+	int task_stack;                 // Task stack size
+	int task_core;                  // Task running on core
+	int task_prio;                  // Task priority
+} beat_filter_cfg_t;
+
+#define DEFAULT_BEAT_FILTER_CONFIG()                                           \
+	{                                                                          \
+		.evt = NULL, .latency_ms = 0, .out_rb_size = 8 * 1024,                 \
+		.task_stack = 4 * 1024, .task_core = 0, .task_prio = 5,                \
+	}
+
+/**
+ * @brief Create an element that passes int16 interleaved stereo through
+ * unchanged and sends a BEAT_EVT for every beat found in it, see
+ * beat_tracker.h.
+ *
+ * The decimator follows the sample rate in the element info, set it with
+ * audio_element_setinfo() when the decoder reports its music info.
+ */
+audio_element_handle_t beat_filter_init(beat_filter_cfg_t *config);
+
+#endif /* BEAT_FILTER_H */
@@ -0,0 +1,100 @@
+#ifndef BEAT_TRACKER_H
+#define BEAT_TRACKER_H
+#pragma once
+
+#include "esp_err.h"
+#include "fft_real.h"
+#include <stdint.h>
+
+/// Samples per spectrum and per hop of the onset detection function
+#define BEAT_TRACKER_FFT_SIZE 256
+#define BEAT_TRACKER_HOP      128
+
+/// History of the onset detection function in hops (8 s at 8 kHz)
+#define BEAT_TRACKER_HISTORY 512
+
+/// Hops used for the tempo autocorrelation (4 s at 8 kHz)
+#define BEAT_TRACKER_TEMPO_WINDOW 256
+
+/// Tempo range [BPM]
+#define BEAT_TRACKER_MIN_BPM 60
+#define BEAT_TRACKER_MAX_BPM 180
+
+/**
+ * @brief A beat found by the tracker.
+ */
+struct beat {
+	uint32_t time_ms; // Stream time of the beat since the tracker was reset
+	float bpm;        // Tempo estimate at the time of the beat
+};
+
+/**
+ * @brief Structure containing beat tracker configuration data
+ */
+typedef struct beat_tracker_cfg {
+	int sample_rate; // Sample rate of the mono input [Hz]
+	int latency_ms;  // Report beats this much before they are due
+} beat_tracker_cfg_t;
+
+/**
+ * @brief Online onset and beat tracker.
+ *
+ * Onsets: the onset detection function is the spectral flux, the sum of the
+ * increases of the log-compressed magnitude spectrum from one hop to the next.
+ *
+ * Tempo: about once a second the autocorrelation of the last
+ * BEAT_TRACKER_TEMPO_WINDOW hops of the onset function is weighted with a
+ * log-Gaussian prior around 120 BPM, the best lag gives the beat period.
+ *
+ * Beats: every hop updates the cumulative beat score of Ellis' dynamic
+ * programming beat tracker, C[n] = (1 - a) O[n] + a max(C[n - t] - penalty(t))
+ * for t around the beat period. The highest score within the last period is
+ * the latest beat and the next one is predicted one period later, so beats
+ * are reported when they are due rather than after they were heard.
+ */
+typedef struct beat_tracker {
+	fft_real_t fft;
+	int16_t window[BEAT_TRACKER_FFT_SIZE];
+	int16_t samples[BEAT_TRACKER_FFT_SIZE]; // Latest FFT frame
+	int fill;                               // New samples in the current hop
+	float power[BEAT_TRACKER_FFT_SIZE / 2 + 1];
+	float magnitude[BEAT_TRACKER_FFT_SIZE / 2 + 1]; // Log magnitudes of the
+	                                                // previous hop
+	float odf[BEAT_TRACKER_HISTORY];   // Onset detection function
+	float score[BEAT_TRACKER_HISTORY]; // Cumulative beat score
+	float odf_mean;                    // Running mean of the onset function
+	uint32_t hop;                      // Hops since the last reset
+	float hop_ms;                      // Duration of a hop
+	int latency_hops;                  // Configured latency in hops
+	int min_lag;                       // Shortest beat period in hops
+	int max_lag;                       // Longest beat period in hops
+	float period;                      // Beat period in hops, 0 if unknown
+	uint32_t last_beat;                // Hop of the last reported beat
+	float scratch[BEAT_TRACKER_TEMPO_WINDOW]; // Onset function being correlated
+	float correlation[BEAT_TRACKER_TEMPO_WINDOW]; // Autocorrelation by lag
+} beat_tracker_t;
+
+esp_err_t beat_tracker_setup(beat_tracker_t *tracker,
+                             const beat_tracker_cfg_t *config);
+void beat_tracker_free(beat_tracker_t *tracker);
+
+/**
+ * @brief Forget the history, e.g. when a new stream starts.
+ */
+void beat_tracker_reset(beat_tracker_t *tracker);
+
+/**
+ * @brief Feed mono samples to the tracker.
+ * @param beats receives the beats that are due
+ * @param max_beats room in beats
+ * @return number of beats written to beats
+ */
+int beat_tracker_process(beat_tracker_t *tracker, const int16_t *samples,
+                         int nr_samples, struct beat *beats, int max_beats);
+
+/**
+ * @brief Current tempo estimate, 0 while it is unknown.
+ */
+float beat_tracker_bpm(const beat_tracker_t *tracker);
+
+#endif /* BEAT_TRACKER_H */
@@ -5,6 +5,8 @@
 #include "audio_event_iface.h"
 #include "audio_mem.h"
 #include "audio_pipeline.h"
+#include "audio_tee.h"
+#include "audio_tee_tap.h"
 #include "bluetooth_service.h"
 #include "board.h"
 #include "driver/gpio.h"
@@ -50,6 +52,7 @@ static esp_periph_handle_t bt_periph;
 static audio_pipeline_handle_t pipeline;
 static audio_element_handle_t bt_stream_reader;
 static audio_element_handle_t output_stream_writer;
+static audio_element_handle_t tee;
 
 esp_err_t bt_sink_pre_init(void) {
 	gpio_set_direction(22, GPIO_MODE_OUTPUT);
@@ -89,6 +92,9 @@ esp_err_t bt_sink_init(audio_element_handle_t *elems, size_t count,
 	i2s_cfg.type             = AUDIO_STREAM_WRITER;
 	output_stream_writer     = i2s_stream_init(&i2s_cfg);
 
+	audio_tee_cfg_t tee_cfg = DEFAULT_AUDIO_TEE_CONFIG();
+	tee                     = audio_tee_init(&tee_cfg);
+
 	ESP_LOGI(TAG, "Create audio pipeline");
 	audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
 	pipeline                          = audio_pipeline_init(&pipeline_cfg);
@@ -98,10 +104,11 @@ esp_err_t bt_sink_init(audio_element_handle_t *elems, size_t count,
 
 	ESP_LOGI(TAG, "[3.2] Register all elements to audio pipeline");
 	audio_pipeline_register(pipeline, bt_stream_reader, "bt");
+	audio_pipeline_register(pipeline, tee, "tee");
 	audio_pipeline_register(pipeline, output_stream_writer, "output");
 
-	const char *link_tag[2] = { "bt", "output" };
-	audio_pipeline_link(pipeline, link_tag, 2);
+	const char *link_tag[3] = { "bt", "tee", "output" };
+	audio_pipeline_link(pipeline, link_tag, 3);
 
 	audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
 	evt                             = audio_event_iface_init(&evt_cfg);
@@ -110,6 +117,7 @@ esp_err_t bt_sink_init(audio_element_handle_t *elems, size_t count,
 	                    "audio_pipeline_set_listener failed");
 	ESP_RETURN_ON_ERROR(audio_pipeline_run(pipeline), TAG,
 	                    "audio_pipeline_run failed");
+	audio_tee_set_playback(tee);
 
 	return ESP_OK;
 }
@@ -118,6 +126,7 @@ esp_err_t bt_sink_deinit(audio_element_handle_t *elems, size_t count,
                          audio_event_iface_handle_t evt,
                          esp_periph_set_handle_t periph_set, void *args) {
 	ESP_RETURN_ON_ERROR(audio_pipeline_remove_listener(pipeline), TAG, "");
+	audio_tee_set_playback(NULL);
 
 	ESP_LOGI(TAG, "Stop audio_pipeline");
 	ESP_RETURN_ON_ERROR(audio_pipeline_stop(pipeline), TAG, "");
@@ -126,11 +135,13 @@ esp_err_t bt_sink_deinit(audio_element_handle_t *elems, size_t count,
 
 	ESP_RETURN_ON_ERROR(audio_pipeline_unregister(pipeline, bt_stream_reader),
 	                    TAG, "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_unregister(pipeline, tee), TAG, "");
 	ESP_RETURN_ON_ERROR(
 	    audio_pipeline_unregister(pipeline, output_stream_writer), TAG, "");
 
 	ESP_RETURN_ON_ERROR(audio_pipeline_deinit(pipeline), TAG, "");
 	ESP_RETURN_ON_ERROR(audio_element_deinit(bt_stream_reader), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_element_deinit(tee), TAG, "");
 	ESP_RETURN_ON_ERROR(audio_element_deinit(output_stream_writer), TAG, "");
 
 	ESP_LOGI(TAG, "Destroy Bluetooth peripheral");
@@ -155,6 +166,8 @@ esp_err_t bt_sink_run(audio_event_iface_msg_t *msg, void *args) {
 		         "sample_rates=%d, bits=%d, ch=%d",
 		         music_info.sample_rates, music_info.bits, music_info.channels);
 
+		audio_element_set_music_info(tee, music_info.sample_rates,
+		                             music_info.channels, music_info.bits);
 		audio_element_set_music_info(output_stream_writer,
 		                             music_info.sample_rates,
 		                             music_info.channels, music_info.bits);
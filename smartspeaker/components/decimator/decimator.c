@@ -0,0 +1,160 @@
+#include "decimator.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Kaiser window shape, about 55 dB stop band attenuation
+#define DECIMATOR_KAISER_BETA 5.0f
+
+// Cut-off as a fraction of the output sample rate, just below Nyquist
+#define DECIMATOR_CUTOFF 0.45f
+
+static int gcd(int a, int b) {
+	while (b) {
+		int t = a % b;
+		a     = b;
+		b     = t;
+	}
+	return a;
+}
+
+/**
+ * Zeroth order modified Bessel function of the first kind
+ */
+static float bessel_i0(float x) {
+	float sum  = 1.0f;
+	float term = 1.0f;
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2.0f * k)) * (x / (2.0f * k));
+		sum += term;
+		if (term < sum * 1e-9f) break;
+	}
+	return sum;
+}
+
+esp_err_t decimator_setup(decimator_t *decimator, int src_rate, int dest_rate) {
+	if (src_rate <= 0 || dest_rate <= 0 || dest_rate >= src_rate)
+		return ESP_ERR_INVALID_ARG;
+
+	int divisor = gcd(src_rate, dest_rate);
+	int phases  = dest_rate / divisor;
+	int step    = src_rate / divisor;
+	if (phases > DECIMATOR_MAX_PHASES) return ESP_ERR_INVALID_ARG;
+
+	int16_t *coefficients =
+	    malloc(sizeof *coefficients * phases * DECIMATOR_TAPS);
+	if (!coefficients) return ESP_ERR_NO_MEM;
+
+	// Prototype filter at phases * src_rate, cut-off relative to that rate
+	int length   = phases * DECIMATOR_TAPS;
+	float cutoff = DECIMATOR_CUTOFF * dest_rate / ((float)src_rate * phases);
+	float centre = (length - 1) / 2.0f;
+	float norm   = bessel_i0(DECIMATOR_KAISER_BETA);
+
+	for (int n = 0; n < length; n++) {
+		float t    = n - centre;
+		float sinc = t == 0.0f ? 1.0f : sinf(2.0f * M_PI * cutoff * t) /
+		                                    (2.0f * M_PI * cutoff * t);
+		float r      = t / centre;
+		float kaiser = bessel_i0(DECIMATOR_KAISER_BETA * sqrtf(1.0f - r * r)) /
+		               norm;
+		// Unity gain per phase: the prototype runs at phases times the rate
+		float tap = 2.0f * cutoff * phases * sinc * kaiser;
+
+		// Tap n belongs to phase n % L and multiplies x[i - n / L]; store the
+		// taps of a phase oldest first to match the delay line
+		int phase = n % phases;
+		int k     = DECIMATOR_TAPS - 1 - n / phases;
+		coefficients[phase * DECIMATOR_TAPS + k] =
+		    (int16_t)lrintf(tap * 32768.0f);
+	}
+
+	decimator->phases       = phases;
+	decimator->step         = step;
+	decimator->coefficients = coefficients;
+	decimator_clear(decimator);
+	return ESP_OK;
+}
+
+void decimator_free(decimator_t *decimator) {
+	free(decimator->coefficients);
+	decimator->coefficients = NULL;
+}
+
+void decimator_clear(decimator_t *decimator) {
+	memset(decimator->history, 0, sizeof decimator->history);
+	decimator->index = 0;
+	decimator->phase = 0;
+}
+
+int decimator_max_output(const decimator_t *decimator, int nr_frames) {
+	return (int)(((int64_t)nr_frames * decimator->phases) / decimator->step) +
+	       1;
+}
+
+/**
+ * Shift one mono sample into the delay line at *index and filter the outputs
+ * that fall within it, the caller keeps index and phase in locals.
+ * @return number of samples written to output
+ */
+static inline int decimator_push(decimator_t *decimator, int16_t sample,
+                                 int *index, int *phase, int16_t *output) {
+	int16_t *history = decimator->history;
+	int nr_output    = 0;
+
+	if (++*index >= DECIMATOR_TAPS) *index = 0;
+	history[*index]                  = sample;
+	history[*index + DECIMATOR_TAPS] = sample;
+
+	// For decimation at most one output falls within an input sample
+	for (; *phase < decimator->phases; *phase += decimator->step) {
+		const int16_t *taps = &decimator->coefficients[*phase * DECIMATOR_TAPS];
+		const int16_t *samples = &history[*index + 1];
+
+		int32_t acc = 1 << 14;
+		for (int k = 0; k < DECIMATOR_TAPS; k++)
+			acc += (int32_t)taps[k] * samples[k];
+		acc >>= 15;
+
+		if (acc > INT16_MAX) acc = INT16_MAX;
+		if (acc < INT16_MIN) acc = INT16_MIN;
+		output[nr_output++] = (int16_t)acc;
+	}
+	*phase -= decimator->phases;
+	return nr_output;
+}
+
+int decimator_process(decimator_t *decimator, const int16_t *input,
+                      int nr_frames, int16_t *output) {
+	int index     = decimator->index;
+	int phase     = decimator->phase;
+	int nr_output = 0;
+
+	for (int i = 0; i < nr_frames; i++) {
+		// Downmix straight into the delay line
+		int16_t sample =
+		    (int16_t)(((int32_t)input[2 * i] + input[2 * i + 1]) >> 1);
+		nr_output += decimator_push(decimator, sample, &index, &phase,
+		                            output + nr_output);
+	}
+
+	decimator->index = index;
+	decimator->phase = phase;
+	return nr_output;
+}
+
+int decimator_process_mono(decimator_t *decimator, const int16_t *input,
+                           int nr_samples, int16_t *output) {
+	int index     = decimator->index;
+	int phase     = decimator->phase;
+	int nr_output = 0;
+
+	for (int i = 0; i < nr_samples; i++)
+		nr_output += decimator_push(decimator, input[i], &index, &phase,
+		                            output + nr_output);
+
+	decimator->index = index;
+	decimator->phase = phase;
+	return nr_output;
+}
@@ -0,0 +1,114 @@
+#include "decimator_filter.h"
+#include "decimator.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+
+// Bytes of one interleaved int16 stereo frame
+#define DECIMATOR_FRAME_BYTES 4
+
+// Input read per process call
+#define DECIMATOR_BUFFER_LENGTH 2048
+
+static const char *TAG = "DECIMATOR";
+
+struct decimator_filter {
+	decimator_t decimator;
+	int src_rate;
+	int dest_rate;
+	char input[DECIMATOR_BUFFER_LENGTH];
+	int carry;       // Bytes of an incomplete frame at the start of input
+	int16_t *output; // Room for the output of a full input buffer
+};
+
+static esp_err_t decimator_filter_open(audio_element_handle_t self) {
+	struct decimator_filter *filter = audio_element_getdata(self);
+
+	ESP_RETURN_ON_ERROR(decimator_setup(&filter->decimator, filter->src_rate,
+	                                    filter->dest_rate),
+	                    TAG, "Unsupported conversion from %d Hz to %d Hz",
+	                    filter->src_rate, filter->dest_rate);
+
+	int nr_frames  = DECIMATOR_BUFFER_LENGTH / DECIMATOR_FRAME_BYTES;
+	int nr_output  = decimator_max_output(&filter->decimator, nr_frames);
+	filter->output = malloc(sizeof *filter->output * nr_output);
+	if (!filter->output) {
+		decimator_free(&filter->decimator);
+		return ESP_ERR_NO_MEM;
+	}
+	filter->carry = 0;
+
+	audio_element_set_music_info(self, filter->dest_rate, 1, 16);
+	return ESP_OK;
+}
+
+static esp_err_t decimator_filter_close(audio_element_handle_t self) {
+	struct decimator_filter *filter = audio_element_getdata(self);
+
+	decimator_free(&filter->decimator);
+	free(filter->output);
+	filter->output = NULL;
+	return ESP_OK;
+}
+
+static audio_element_err_t
+decimator_filter_process(audio_element_handle_t self, char *buffer,
+                         int length) {
+	struct decimator_filter *filter = audio_element_getdata(self);
+
+	int bytes = audio_element_input(self, filter->input + filter->carry,
+	                                sizeof filter->input - filter->carry);
+	if (bytes <= 0) return bytes;
+
+	// Ringbuffer reads need not end on a frame, keep the rest for next time
+	int available = filter->carry + bytes;
+	int nr_frames = available / DECIMATOR_FRAME_BYTES;
+	int nr_output = decimator_process(&filter->decimator,
+	                                  (const int16_t *)filter->input, nr_frames,
+	                                  filter->output);
+
+	filter->carry = available - nr_frames * DECIMATOR_FRAME_BYTES;
+	memmove(filter->input, filter->input + nr_frames * DECIMATOR_FRAME_BYTES,
+	        filter->carry);
+
+	if (nr_output == 0) return bytes;
+	return audio_element_output(self, (char *)filter->output,
+	                            sizeof *filter->output * nr_output);
+}
+
+static esp_err_t decimator_filter_destroy(audio_element_handle_t self) {
+	free(audio_element_getdata(self));
+	return ESP_OK;
+}
+
+audio_element_handle_t decimator_filter_init(decimator_filter_cfg_t *config) {
+	struct decimator_filter *filter = calloc(1, sizeof *filter);
+	if (!filter) {
+		ESP_LOGE(TAG, "Memory allocation for decimator failed");
+		return NULL;
+	}
+	filter->src_rate  = config->src_rate;
+	filter->dest_rate = config->dest_rate;
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open                = decimator_filter_open;
+	cfg.close               = decimator_filter_close;
+	cfg.process             = decimator_filter_process;
+	cfg.destroy             = decimator_filter_destroy;
+	cfg.out_rb_size         = config->out_rb_size;
+	cfg.task_stack          = config->task_stack;
+	cfg.task_core           = config->task_core;
+	cfg.task_prio           = config->task_prio;
+	cfg.tag                 = "decimator";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	if (!el) {
+		free(filter);
+		return NULL;
+	}
+	audio_element_setdata(el, filter);
+	return el;
+}
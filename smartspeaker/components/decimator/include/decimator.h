@@ -0,0 +1,75 @@
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+#pragma once
+
+#include "esp_err.h"
+#include <stdint.h>
+
+/// Taps of the anti-aliasing filter per output sample
+#define DECIMATOR_TAPS 64
+
+/// Largest interpolation factor, 80 is needed for 44.1 kHz to 8 kHz
+#define DECIMATOR_MAX_PHASES 160
+
+/**
+ * @brief Polyphase decimator from interleaved stereo or mono to mono.
+ *
+ * Converts src_rate to dest_rate by the rational factor L/M (e.g. 80/441 for
+ * 44.1 kHz to 8 kHz, 1/6 for 48 kHz to 8 kHz). The prototype low-pass filter
+ * is a Kaiser windowed sinc, split into L phases of DECIMATOR_TAPS Q15 taps
+ * when the decimator is set up. Only the phases that produce an output sample
+ * are evaluated.
+ *
+ * The channels are summed while the samples enter the delay line, so the
+ * downmix and the filter share one pass over the input. The delay line is
+ * written twice, at i and i + DECIMATOR_TAPS, so every output is a single
+ * contiguous dot product.
+ */
+typedef struct decimator {
+	int phases;               // Interpolation factor L
+	int step;                 // Decimation factor M
+	int phase;                // Phase of the next output sample
+	int index;                // Position of the newest sample in the delay line
+	int16_t *coefficients;    // L phases of DECIMATOR_TAPS taps, oldest first
+	int16_t history[2 * DECIMATOR_TAPS]; // Delay line of mono samples
+} decimator_t;
+
+/**
+ * @brief Calculate the filter phases for src_rate to dest_rate.
+ * @return ESP_ERR_INVALID_ARG if dest_rate is not lower than src_rate or the
+ * ratio needs more than DECIMATOR_MAX_PHASES phases
+ */
+esp_err_t decimator_setup(decimator_t *decimator, int src_rate, int dest_rate);
+
+/**
+ * @brief Free the filter phases.
+ */
+void decimator_free(decimator_t *decimator);
+
+/**
+ * @brief Clear the delay line, e.g. when the stream restarts.
+ */
+void decimator_clear(decimator_t *decimator);
+
+/**
+ * @brief Maximum number of samples decimator_process produces for nr_frames.
+ */
+int decimator_max_output(const decimator_t *decimator, int nr_frames);
+
+/**
+ * @brief Downmix and decimate nr_frames interleaved stereo frames.
+ * @param output receives at most decimator_max_output() mono samples
+ * @return number of samples written to output
+ */
+int decimator_process(decimator_t *decimator, const int16_t *input,
+                      int nr_frames, int16_t *output);
+
+/**
+ * @brief Decimate nr_samples mono samples, a frame of one sample each.
+ * @param output receives at most decimator_max_output() samples
+ * @return number of samples written to output
+ */
+int decimator_process_mono(decimator_t *decimator, const int16_t *input,
+                           int nr_samples, int16_t *output);
+
+#endif /* DECIMATOR_H */
@@ -0,0 +1,31 @@
+#ifndef DECIMATOR_FILTER_H
+#define DECIMATOR_FILTER_H
+#pragma once
+
+#include "audio_element.h"
+
+/**
+ * @brief Configuration of the decimator filter element
+ */
+typedef struct decimator_filter_cfg {
+	int src_rate;    // Sample rate of the interleaved stereo input [Hz]
+	int dest_rate;   // Sample rate of the mono output [Hz]
+	int out_rb_size; // Size of the output ringbuffer
+	int task_stack;  // Task stack size
+	int task_core;   // Task running on core
+	int task_prio;   // Task priority
+} decimator_filter_cfg_t;
+
+#define DEFAULT_DECIMATOR_FILTER_CONFIG()                                      \
+	{                                                                          \
+		.src_rate = 44100, .dest_rate = 8000, .out_rb_size = 2 * 1024,         \
+		.task_stack = 3 * 1024, .task_core = 0, .task_prio = 5,                \
+	}
+
+/**
+ * @brief Create an element that turns int16 interleaved stereo into mono at a
+ * lower rate in one pass, see decimator.h.
+ */
+audio_element_handle_t decimator_filter_init(decimator_filter_cfg_t *config);
+
+#endif /* DECIMATOR_FILTER_H */
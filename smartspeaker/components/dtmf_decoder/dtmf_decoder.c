@@ -0,0 +1,213 @@
+#include "dtmf_decoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Reference sample rate for DTMF_BLOCK_LENGTH
+#define DTMF_REF_SAMPLE_RATE 8000
+
+// Minimum mean square of a block, about -40 dBFS per tone
+#define DTMF_MIN_MEAN_SQUARE 5000
+
+// Minimum fraction of the block energy that must be in the row and column tone
+#define DTMF_MIN_SNR 0.7f
+
+// Strongest row/column must be 6 dB above the other rows/columns
+#define DTMF_MIN_PEAK_RATIO 4.0f
+
+// Columns may be 8 dB stronger than rows (normal twist)
+#define DTMF_MAX_NORMAL_TWIST 6.31f
+
+// Rows may be 4 dB stronger than columns (reverse twist)
+#define DTMF_MAX_REVERSE_TWIST 2.51f
+
+// Second harmonics must be 10 dB below their fundamental, rejects speech
+#define DTMF_MAX_HARMONIC_RATIO 0.1f
+
+// The second harmonics of the first three rows are 58 to 71 Hz (1.5 to 1.8
+// bins) from a column tone, which leaks into them only 13 to 19 dB below
+// itself. With normal twist that is above DTMF_MAX_HARMONIC_RATIO, so a row
+// harmonic this close to the column of the digit is not checked.
+#define DTMF_HARMONIC_GUARD_HZ 80
+
+// Consecutive blocks a digit must be present in to be reported, and absent
+// from to be released. The blocks overlap by half, so two hits take 1.5 blocks
+// (38 ms) of tone plus up to half a block for the alignment, which still fits
+// the 40 to 50 ms of a short key press.
+#define DTMF_MIN_HITS   2
+#define DTMF_MIN_MISSES 2
+
+/* Fundamentals (4 rows, 4 columns) followed by their second harmonics. */
+static const int dtmf_freqs[2 * DTMF_NR_TONES] = {
+	697,  770,  852,  941,  1209, 1336, 1477, 1633,
+	1394, 1540, 1704, 1882, 2418, 2672, 2954, 3266,
+};
+
+static const char dtmf_keys[4][4] = {
+	{ '1', '2', '3', 'A' },
+	{ '4', '5', '6', 'B' },
+	{ '7', '8', '9', 'C' },
+	{ '*', '0', '#', 'D' },
+};
+
+/**
+ * Find the strongest of 4 tones and check that it stands out from the others.
+ * @return index of the strongest tone or -1 if it is not a clear peak.
+ */
+static int dtmf_peak(const float *power) {
+	int peak = 0;
+	for (int i = 1; i < 4; i++)
+		if (power[i] > power[peak]) peak = i;
+
+	for (int i = 0; i < 4; i++)
+		if (i != peak && power[i] * DTMF_MIN_PEAK_RATIO > power[peak])
+			return -1;
+	return peak;
+}
+
+/**
+ * Check the magnitudes of one block.
+ * @return decoded digit or 0 if the block does not contain a valid digit.
+ */
+static char dtmf_classify(const float *magnitudes, int64_t energy,
+                          int block_length) {
+	float power[2 * DTMF_NR_TONES];
+	for (int i = 0; i < 2 * DTMF_NR_TONES; i++)
+		power[i] = magnitudes[i] * magnitudes[i];
+
+	if (energy < (int64_t)DTMF_MIN_MEAN_SQUARE * block_length) return 0;
+
+	int row = dtmf_peak(&power[0]);
+	int col = dtmf_peak(&power[4]);
+	if (row < 0 || col < 0) return 0;
+
+	float row_power = power[row];
+	float col_power = power[4 + col];
+
+	// A tone of amplitude A has a power of (A * N / 2)^2 and an energy of
+	// N * A^2 / 2, so 2 * power / N is the energy captured by the bin.
+	float tone_energy = 2.0f * (row_power + col_power) / block_length;
+	if (tone_energy < DTMF_MIN_SNR * energy) return 0;
+
+	if (col_power > row_power * DTMF_MAX_NORMAL_TWIST) return 0;
+	if (row_power > col_power * DTMF_MAX_REVERSE_TWIST) return 0;
+
+	int guard = abs(dtmf_freqs[DTMF_NR_TONES + row] - dtmf_freqs[4 + col]);
+	if (guard > DTMF_HARMONIC_GUARD_HZ &&
+	    power[DTMF_NR_TONES + row] > row_power * DTMF_MAX_HARMONIC_RATIO)
+		return 0;
+	if (power[DTMF_NR_TONES + 4 + col] > col_power * DTMF_MAX_HARMONIC_RATIO)
+		return 0;
+
+	return dtmf_keys[row][col];
+}
+
+/**
+ * Debounce the result of a block.
+ * @return digit to report or 0.
+ */
+static char dtmf_debounce(dtmf_decoder_t *decoder, char digit) {
+	if (digit && digit == decoder->candidate) decoder->hits++;
+	else decoder->hits = digit ? 1 : 0;
+	decoder->candidate = digit;
+
+	if (digit) decoder->misses = 0;
+	else decoder->misses++;
+
+	if (decoder->current && decoder->misses >= DTMF_MIN_MISSES)
+		decoder->current = 0;
+
+	if (!decoder->current && decoder->hits >= DTMF_MIN_HITS) {
+		decoder->current = digit;
+		return digit;
+	}
+	return 0;
+}
+
+esp_err_t dtmf_decoder_init(dtmf_decoder_t *decoder, int sample_rate) {
+	memset(decoder, 0, sizeof *decoder);
+
+	goertzel_bank_cfg_t bank_cfg = {
+		.sample_rate   = sample_rate,
+		.target_freqs  = dtmf_freqs,
+		.nr_freqs      = 2 * DTMF_NR_TONES,
+		.buffer_length = DTMF_BLOCK_LENGTH * sample_rate / DTMF_REF_SAMPLE_RATE,
+		.exact_freq    = true,
+	};
+	for (int b = 0; b < DTMF_NR_BLOCKS; b++) {
+		esp_err_t err = goertzel_bank_setup(&decoder->blocks[b].bank,
+		                                    &bank_cfg);
+		if (err != ESP_OK) return err;
+	}
+	dtmf_decoder_reset(decoder);
+	return ESP_OK;
+}
+
+void dtmf_decoder_reset(dtmf_decoder_t *decoder) {
+	int block_length = decoder->blocks[0].bank.buffer_length;
+	for (int b = 0; b < DTMF_NR_BLOCKS; b++) {
+		dtmf_block_t *block = &decoder->blocks[b];
+		goertzel_bank_clear(&block->bank);
+		block->sample_counter = -b * block_length / DTMF_NR_BLOCKS;
+		block->energy         = 0;
+	}
+	decoder->candidate      = 0;
+	decoder->current        = 0;
+	decoder->hits           = 0;
+	decoder->misses         = 0;
+}
+
+int dtmf_decoder_process(dtmf_decoder_t *decoder, const int16_t *samples,
+                         int nr_samples, char *digits, int max_digits) {
+	int block_length = decoder->blocks[0].bank.buffer_length;
+	int nr_digits    = 0;
+
+	while (nr_samples > 0) {
+		// Stop at the next start or end of a block, to keep the energy in step
+		// with the banks and to debounce the blocks in the order they end
+		int run = nr_samples;
+		for (int b = 0; b < DTMF_NR_BLOCKS; b++) {
+			int counter = decoder->blocks[b].sample_counter;
+			int left    = counter < 0 ? -counter : block_length - counter;
+			if (run > left) run = left;
+		}
+
+		int64_t energy = 0;
+		for (int s = 0; s < run; s++) energy += (int32_t)samples[s] * samples[s];
+
+		for (int b = 0; b < DTMF_NR_BLOCKS; b++) {
+			dtmf_block_t *block = &decoder->blocks[b];
+			if (block->sample_counter < 0) {
+				block->sample_counter += run;
+				continue;
+			}
+
+			goertzel_bank_process(&block->bank, samples, run);
+			block->sample_counter += run;
+			block->energy         += energy;
+
+			float magnitudes[2 * DTMF_NR_TONES];
+			if (!goertzel_bank_new_magnitudes(&block->bank, magnitudes))
+				continue;
+
+			char digit = dtmf_classify(magnitudes, block->energy,
+			                           block_length);
+			digit = dtmf_debounce(decoder, digit);
+			if (digit && nr_digits < max_digits) digits[nr_digits++] = digit;
+
+			block->sample_counter = 0;
+			block->energy         = 0;
+		}
+		samples    += run;
+		nr_samples -= run;
+	}
+	return nr_digits;
+}
+
+int dtmf_digit_to_event(char digit) {
+	if (digit >= '0' && digit <= '9') return DTMF_EVT_0 + (digit - '0');
+	if (digit >= 'A' && digit <= 'D') return DTMF_EVT_A + (digit - 'A');
+	if (digit == '*') return DTMF_EVT_STAR;
+	if (digit == '#') return DTMF_EVT_HASH;
+	return -1;
+}
@@ -0,0 +1,88 @@
+#ifndef DTMF_DECODER_H
+#define DTMF_DECODER_H
+#pragma once
+
+#include "esp_err.h"
+#include "goertzel_bank.h"
+#include <stdint.h>
+
+/// Number of samples per analysis block at 8 kHz (25.6 ms)
+#define DTMF_BLOCK_LENGTH 205
+
+/// Number of row plus column tones
+#define DTMF_NR_TONES 8
+
+/// Number of overlapping analysis blocks, each starts half a block later
+#define DTMF_NR_BLOCKS 2
+
+/**
+ * @brief Event commands sent for decoded digits, one per key.
+ */
+enum dtmf_event {
+	DTMF_EVT_0 = 8100,
+	DTMF_EVT_1,
+	DTMF_EVT_2,
+	DTMF_EVT_3,
+	DTMF_EVT_4,
+	DTMF_EVT_5,
+	DTMF_EVT_6,
+	DTMF_EVT_7,
+	DTMF_EVT_8,
+	DTMF_EVT_9,
+	DTMF_EVT_A,
+	DTMF_EVT_B,
+	DTMF_EVT_C,
+	DTMF_EVT_D,
+	DTMF_EVT_STAR,
+	DTMF_EVT_HASH,
+};
+
+/**
+ * @brief DTMF decoder state.
+ *
+ * Two Goertzel banks watch the 8 row/column tones and their second harmonics,
+ * on blocks that overlap by half. Every block is checked for level, signal to
+ * noise ratio, relative peak height, twist and harmonics. A digit is reported
+ * once per key press after two consecutive blocks agree, it has to be absent
+ * for two blocks before the same digit is reported again.
+ */
+typedef struct dtmf_block {
+	goertzel_bank_t bank;
+	int sample_counter; // Samples handled, negative until the block starts
+	int64_t energy;     // Sum of squared samples in the block
+} dtmf_block_t;
+
+typedef struct dtmf_decoder {
+	dtmf_block_t blocks[DTMF_NR_BLOCKS];
+	char candidate;     // Digit seen in the previous block, 0 if none
+	char current;       // Digit currently reported, 0 if none
+	int hits;           // Consecutive blocks with the same candidate
+	int misses;         // Consecutive blocks without a digit
+} dtmf_decoder_t;
+
+/**
+ * @brief Set up the decoder for a stream of samples at sample_rate.
+ */
+esp_err_t dtmf_decoder_init(dtmf_decoder_t *decoder, int sample_rate);
+
+/**
+ * @brief Reset the debouncing state, e.g. after a gap in the audio.
+ */
+void dtmf_decoder_reset(dtmf_decoder_t *decoder);
+
+/**
+ * @brief Feed samples to the decoder.
+ * @param digits receives newly decoded digits ('0'-'9', 'A'-'D', '*', '#')
+ * @param max_digits room in digits
+ * @return number of digits written to digits
+ */
+int dtmf_decoder_process(dtmf_decoder_t *decoder, const int16_t *samples,
+                         int nr_samples, char *digits, int max_digits);
+
+/**
+ * @brief Convert a decoded digit to its event command.
+ * @return one of enum dtmf_event, or -1 for an invalid digit
+ */
+int dtmf_digit_to_event(char digit);
+
+#endif /* DTMF_DECODER_H */
@@ -0,0 +1,134 @@
+#include <math.h>
+#include <string.h>
+
+#include "goertzel_bank.h"
+
+/**
+ * Run the Goertzel recurrence for every bin over a run of samples, window
+ * points at the weight of the first sample or is NULL.
+ * The bin loop has no dependencies between iterations and nr_lanes is a
+ * multiple of GOERTZEL_BANK_LANES, so the compiler can unroll and vectorise it.
+ */
+#ifdef CONFIG_GOERTZEL_FIXED_POINT
+static void bank_kernel(int nr_lanes, const int32_t *restrict coefficient,
+                        int32_t *restrict q1, int32_t *restrict q2,
+                        const int16_t *restrict samples,
+                        const int16_t *restrict window, int nr_samples) {
+	for (int s = 0; s < nr_samples; s++) {
+		int32_t sample = samples[s];
+		if (window)
+			sample = (sample * window[s] + (1 << (GOERTZEL_WEIGHT_SHIFT - 1))) >>
+			         GOERTZEL_WEIGHT_SHIFT;
+		for (int f = 0; f < nr_lanes; f++) {
+			int64_t product = (int64_t)coefficient[f] * q1[f] +
+			                  (1 << (GOERTZEL_COEFF_SHIFT - 1));
+			int32_t q0 =
+			    sample + (int32_t)(product >> GOERTZEL_COEFF_SHIFT) - q2[f];
+			q2[f] = q1[f];
+			q1[f] = q0;
+		}
+	}
+}
+#else
+static void bank_kernel(int nr_lanes, const float *restrict coefficient,
+                        float *restrict q1, float *restrict q2,
+                        const int16_t *restrict samples,
+                        const float *restrict window, int nr_samples) {
+	for (int s = 0; s < nr_samples; s++) {
+		float sample = (float)samples[s];
+		if (window) sample *= window[s];
+		for (int f = 0; f < nr_lanes; f++) {
+			float q0 = sample + coefficient[f] * q1[f] - q2[f];
+			q2[f]    = q1[f];
+			q1[f]    = q0;
+		}
+	}
+}
+#endif
+
+esp_err_t goertzel_bank_setup(goertzel_bank_t *bank,
+                              const goertzel_bank_cfg_t *config) {
+	if (config->nr_freqs <= 0 || config->nr_freqs > GOERTZEL_BANK_MAX_FREQS ||
+	    config->buffer_length <= 0)
+		return ESP_ERR_INVALID_ARG;
+
+	int nr_groups = (config->nr_freqs + GOERTZEL_BANK_LANES - 1) /
+	                GOERTZEL_BANK_LANES;
+
+	memset(bank, 0, sizeof *bank);
+	bank->nr_freqs      = config->nr_freqs;
+	bank->nr_lanes      = nr_groups * GOERTZEL_BANK_LANES;
+	bank->buffer_length = config->buffer_length;
+	bank->window        = config->window;
+
+	float nr_samples = (float)config->buffer_length;
+	for (int f = 0; f < config->nr_freqs; f++) {
+		float k = nr_samples * config->target_freqs[f] / config->sample_rate;
+		if (!config->exact_freq) k = (float)(int)(0.5f + k);
+		float omega = (2.0f * M_PI * k) / nr_samples;
+#ifdef CONFIG_GOERTZEL_FIXED_POINT
+		esp_err_t err = goertzel_fixed_coefficient(
+		    omega, config->buffer_length, &bank->coefficient[f]);
+		if (err != ESP_OK) return err;
+#else
+		bank->coefficient[f] = 2.0f * cosf(omega);
+#endif
+	}
+
+	return goertzel_bank_clear(bank);
+}
+
+esp_err_t goertzel_bank_clear(goertzel_bank_t *bank) {
+	memset(bank->q1, 0, sizeof bank->q1);
+	memset(bank->q2, 0, sizeof bank->q2);
+	memset(bank->magnitude, 0, sizeof bank->magnitude);
+	bank->sample_counter = 0;
+	bank->updated        = false;
+
+	return ESP_OK;
+}
+
+esp_err_t goertzel_bank_process(goertzel_bank_t *bank, const int16_t *samples,
+                                int nr_samples) {
+	while (nr_samples > 0) {
+		// Never run the kernel past the end of a block
+		int run = bank->buffer_length - bank->sample_counter;
+		if (run > nr_samples) run = nr_samples;
+
+		const goertzel_weight_t *window =
+		    bank->window ? bank->window + bank->sample_counter : NULL;
+		bank_kernel(bank->nr_lanes, bank->coefficient, bank->q1, bank->q2,
+		            samples, window, run);
+		samples              += run;
+		nr_samples           -= run;
+		bank->sample_counter += run;
+
+		if (bank->sample_counter >= bank->buffer_length) {
+			for (int f = 0; f < bank->nr_freqs; f++) {
+				float q1 = (float)bank->q1[f];
+				float q2 = (float)bank->q2[f];
+#ifdef CONFIG_GOERTZEL_FIXED_POINT
+				float coefficient = (float)bank->coefficient[f] /
+				                    (1 << GOERTZEL_COEFF_SHIFT);
+#else
+				float coefficient = bank->coefficient[f];
+#endif
+				bank->magnitude[f] =
+				    sqrtf(q1 * q1 + q2 * q2 - q1 * q2 * coefficient);
+			}
+			memset(bank->q1, 0, sizeof bank->q1);
+			memset(bank->q2, 0, sizeof bank->q2);
+			bank->sample_counter = 0;
+			bank->updated        = true;
+		}
+	}
+	return ESP_OK;
+}
+
+bool goertzel_bank_new_magnitudes(goertzel_bank_t *bank, float *magnitudes) {
+	if (!bank->updated) return false;
+
+	memcpy(magnitudes, bank->magnitude, sizeof *magnitudes * bank->nr_freqs);
+	bank->updated = false;
+	return true;
+}
@@ -25,7 +25,11 @@ esp_err_t goertzel_filter_setup(goertzel_filter_data_t *data, goertzel_filter_cf
     float numSamples = (float) config->buffer_length;
     //data->scaling_factor = numSamples / 2.0f;
     data->buffer_length = config->buffer_length;
-    int k = (int) (0.5f + ((numSamples * config->target_freq) / config->sample_rate));
+    data->window = config->window;
+    float k = (numSamples * config->target_freq) / config->sample_rate;
+    if (!config->exact_freq) {
+        k = (float) (int) (0.5f + k);   // Round to the nearest integer bin
+    }
     float omega = (2.0f * M_PI * k) / numSamples;
     //data->omega = omega;
     data->coefficient = 2.0f * cosf(omega);
@@ -53,6 +57,9 @@ esp_err_t goertzel_filter_process(goertzel_filter_data_t *filter, int16_t *sampl
     for (int s = 0; s < numSamples; s++) {
         // Process one sample
         float sample = (float) samples[s];
+        if (filter->window) {
+            sample *= filter->window[filter->sample_counter];
+        }
         filter->q0 = sample + filter->coefficient * filter->q1 - filter->q2; // Goertzel filter equation
         filter->q2 = filter->q1;
         filter->q1 = filter->q0;
@@ -0,0 +1,107 @@
+/**
+ * Goertzel filter, fixed-point variant
+ *
+ * Same interface as goertzel_filter.c, selected with CONFIG_GOERTZEL_FIXED_POINT.
+ * Coefficients are Q14, the filter state is kept in 32-bit integers and the
+ * products are formed in 64 bits. See goertzel_filter.h for the overflow and
+ * error bounds.
+ */
+#include <math.h>
+
+#include "goertzel_filter.h"
+
+#define GOERTZEL_COEFF_ONE   (1 << GOERTZEL_COEFF_SHIFT)
+#define GOERTZEL_COEFF_ROUND (1 << (GOERTZEL_COEFF_SHIFT - 1))
+
+esp_err_t goertzel_fixed_coefficient(float omega, int buffer_length, int32_t *coefficient)
+{
+    // The state grows to at most N * 2^15 / |sin(omega)|, keep it below 2^31
+    if (buffer_length >= 65536.0f * fabsf(sinf(omega)))
+        return ESP_ERR_INVALID_ARG;
+
+    *coefficient = (int32_t) lrintf(2.0f * cosf(omega) * GOERTZEL_COEFF_ONE);
+    return ESP_OK;
+}
+
+/**
+ * Setup the filter using the provided config data to prepare for processing
+ */
+esp_err_t goertzel_filter_setup(goertzel_filter_data_t *data, goertzel_filter_cfg_t *config)
+{
+    float numSamples = (float) config->buffer_length;
+    data->buffer_length = config->buffer_length;
+    data->window = config->window;
+    float k = (numSamples * config->target_freq) / config->sample_rate;
+    if (!config->exact_freq) {
+        k = (float) (int) (0.5f + k);   // Round to the nearest integer bin
+    }
+    float omega = (2.0f * M_PI * k) / numSamples;
+
+    esp_err_t err = goertzel_fixed_coefficient(omega, config->buffer_length, &data->coefficient);
+    if (err != ESP_OK)
+        return err;
+
+    return goertzel_filter_clear(data);
+}
+
+/**
+ * Clear the filter data to prepare for processing of samples
+ */
+esp_err_t goertzel_filter_clear(goertzel_filter_data_t *data)
+{
+    data->q0 = 0;
+    data->q1 = 0;
+    data->q2 = 0;
+    data->sample_counter = 0;   // Start a new block of samples
+    data->magnitude = 0.0f;     // Start off with a magnitude of 0
+    data->updated = false;      // No new magnitude yet
+
+    return ESP_OK;
+}
+
+esp_err_t goertzel_filter_process(goertzel_filter_data_t *filter, int16_t *samples, int numSamples)
+{
+    for (int s = 0; s < numSamples; s++) {
+        int32_t sample = samples[s];
+        if (filter->window) {
+            sample = (sample * filter->window[filter->sample_counter] + (1 << (GOERTZEL_WEIGHT_SHIFT - 1))) >> GOERTZEL_WEIGHT_SHIFT;
+        }
+        // Process one sample, coefficient * q1 is Q14 and rounded back to Q0
+        int64_t product = (int64_t) filter->coefficient * filter->q1 + GOERTZEL_COEFF_ROUND;
+        filter->q0 = sample + (int32_t) (product >> GOERTZEL_COEFF_SHIFT) - filter->q2;
+        filter->q2 = filter->q1;
+        filter->q1 = filter->q0;
+        filter->sample_counter += 1;
+        // If an entire buffer length of samples is processed, calculate the magnitude
+        if (filter->sample_counter >= filter->buffer_length) {
+            float q1 = (float) filter->q1;
+            float q2 = (float) filter->q2;
+            float coefficient = (float) filter->coefficient / GOERTZEL_COEFF_ONE;
+            filter->magnitude = sqrtf(q1 * q1 + q2 * q2 - q1 * q2 * coefficient);
+            filter->updated = true;     // New magnitude value is available
+            filter->sample_counter = 0; // Start a new block of samples
+
+            // Reset the filter data
+            filter->q0 = 0;
+            filter->q1 = 0;
+            filter->q2 = 0;
+        }
+    }
+    return ESP_OK;
+}
+
+/**
+ * Return true if a new magnitude value is available and update the value of the
+ * magnitude parameter accordingly,
+ * or return false if no new magnitude is available
+ */
+bool goertzel_filter_new_magnitude(goertzel_filter_data_t *filter, float *magnitude)
+{
+    if (filter->updated) {
+        *magnitude = filter->magnitude;
+        filter->updated = false;
+        return true;
+    } else {
+        return false;
+    }
+}
@@ -0,0 +1,123 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "goertzel_sliding.h"
+
+// Damping keeps rounding errors from accumulating in the recursive update
+#define GOERTZEL_SLIDING_DAMPING 0.9999f
+
+/* Weights of the bins around k for the windows of goertzel_window.c */
+static int window_bins(enum goertzel_window window, float *weight) {
+	switch (window) {
+		case GOERTZEL_WINDOW_HANN:
+			weight[0] = -0.25f;
+			weight[1] = 0.5f;
+			weight[2] = -0.25f;
+			return 3;
+		case GOERTZEL_WINDOW_BLACKMAN:
+			weight[0] = 0.04f;
+			weight[1] = -0.25f;
+			weight[2] = 0.42f;
+			weight[3] = -0.25f;
+			weight[4] = 0.04f;
+			return 5;
+		case GOERTZEL_WINDOW_RECTANGULAR:
+		default: weight[0] = 1.0f; return 1;
+	}
+}
+
+/* Squared magnitude of the windowed bin */
+static float goertzel_sliding_power(const goertzel_sliding_t *filter) {
+	float re = 0.0f;
+	float im = 0.0f;
+	for (int b = 0; b < filter->nr_bins; b++) {
+		re += filter->weight[b] * filter->re[b];
+		im += filter->weight[b] * filter->im[b];
+	}
+	return re * re + im * im;
+}
+
+esp_err_t goertzel_sliding_setup(goertzel_sliding_t *filter,
+                                 const goertzel_sliding_cfg_t *config) {
+	if (config->buffer_length <= 0) return ESP_ERR_INVALID_ARG;
+
+	filter->history = calloc(config->buffer_length, sizeof *filter->history);
+	if (!filter->history) return ESP_ERR_NO_MEM;
+
+	// Same bin as the block filter, so magnitudes are comparable
+	float nr_samples = (float)config->buffer_length;
+	float k          = nr_samples * config->target_freq / config->sample_rate;
+	if (!config->exact_freq) k = (float)(int)(0.5f + k);
+	float damping_n = powf(GOERTZEL_SLIDING_DAMPING, nr_samples);
+
+	filter->buffer_length = config->buffer_length;
+	filter->nr_bins       = window_bins(config->window, filter->weight);
+	filter->damping       = GOERTZEL_SLIDING_DAMPING;
+	filter->threshold_2   = config->threshold * config->threshold;
+
+	// A fractional bin does not turn a whole number of times over the
+	// window, the sample leaving it is rotated by e^(jwN) rather than 1
+	for (int b = 0; b < filter->nr_bins; b++) {
+		float omega = (2.0f * M_PI * (k + b - filter->nr_bins / 2)) /
+		              nr_samples;
+		filter->cos_w[b]    = cosf(omega);
+		filter->sin_w[b]    = sinf(omega);
+		filter->leave_re[b] = damping_n * cosf(omega * nr_samples);
+		filter->leave_im[b] = damping_n * sinf(omega * nr_samples);
+	}
+
+	return goertzel_sliding_clear(filter);
+}
+
+void goertzel_sliding_free(goertzel_sliding_t *filter) {
+	free(filter->history);
+	filter->history = NULL;
+}
+
+esp_err_t goertzel_sliding_clear(goertzel_sliding_t *filter) {
+	for (int i = 0; i < filter->buffer_length; i++) filter->history[i] = 0;
+	for (int b = 0; b < filter->nr_bins; b++) {
+		filter->re[b] = 0.0f;
+		filter->im[b] = 0.0f;
+	}
+	filter->index    = 0;
+	filter->detected = false;
+
+	return ESP_OK;
+}
+
+int goertzel_sliding_process(goertzel_sliding_t *filter,
+                             const int16_t *samples, int nr_samples) {
+	int onset = -1;
+
+	for (int s = 0; s < nr_samples; s++) {
+		float x   = (float)samples[s];
+		float old = (float)filter->history[filter->index];
+		filter->history[filter->index] = samples[s];
+		if (++filter->index >= filter->buffer_length) filter->index = 0;
+
+		// S[n] = e^(jw) * (r * S[n-1] + x[n] - r^N * e^(jwN) * x[n-N])
+		for (int b = 0; b < filter->nr_bins; b++) {
+			float re = filter->damping * filter->re[b] + x -
+			           filter->leave_re[b] * old;
+			float im = filter->damping * filter->im[b] -
+			           filter->leave_im[b] * old;
+			filter->re[b] = re * filter->cos_w[b] - im * filter->sin_w[b];
+			filter->im[b] = re * filter->sin_w[b] + im * filter->cos_w[b];
+		}
+
+		// Compare squared magnitudes, the square root is only taken on demand
+		float power = goertzel_sliding_power(filter);
+		if (!filter->detected && power > filter->threshold_2) {
+			filter->detected = true;
+			if (onset < 0) onset = s;
+		} else if (filter->detected && power < filter->threshold_2 * 0.25f) {
+			filter->detected = false;
+		}
+	}
+	return onset;
+}
+
+float goertzel_sliding_magnitude(const goertzel_sliding_t *filter) {
+	return sqrtf(goertzel_sliding_power(filter));
+}
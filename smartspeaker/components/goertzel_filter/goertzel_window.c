@@ -0,0 +1,31 @@
+#include <math.h>
+
+#include "goertzel_window.h"
+
+static float window_weight(enum goertzel_window window, int n, int length) {
+	float phase = 2.0f * M_PI * n / length;
+	switch (window) {
+		case GOERTZEL_WINDOW_HANN: return 0.5f - 0.5f * cosf(phase);
+		case GOERTZEL_WINDOW_BLACKMAN:
+			return 0.42f - 0.5f * cosf(phase) + 0.08f * cosf(2.0f * phase);
+		case GOERTZEL_WINDOW_RECTANGULAR:
+		default: return 1.0f;
+	}
+}
+
+float goertzel_window_fill(enum goertzel_window window,
+                           goertzel_weight_t *table, int length) {
+	float sum = 0.0f;
+
+	for (int n = 0; n < length; n++) {
+		float weight = window_weight(window, n, length);
+#ifdef CONFIG_GOERTZEL_FIXED_POINT
+		long q15 = lrintf(weight * (1 << GOERTZEL_WEIGHT_SHIFT));
+		table[n] = q15 > INT16_MAX ? INT16_MAX : (goertzel_weight_t)q15;
+#else
+		table[n] = weight;
+#endif
+		sum += weight;
+	}
+	return length > 0 ? sum / length : 0.0f;
+}
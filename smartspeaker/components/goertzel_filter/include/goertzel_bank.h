@@ -0,0 +1,84 @@
+#ifndef GOERTZEL_BANK_H
+#define GOERTZEL_BANK_H
+#pragma once
+
+#include "esp_err.h"
+#include "goertzel_filter.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Maximum number of frequencies a single bank can watch.
+#define GOERTZEL_BANK_MAX_FREQS 16
+
+/// Bins are processed in groups of this size, unused bins are zero padded.
+#define GOERTZEL_BANK_LANES 4
+
+/**
+ * @brief Configuration for a Goertzel filter bank.
+ * @param sample_rate number of samples per second [Hz]
+ * @param target_freqs frequencies to detect [Hz]
+ * @param nr_freqs number of entries in target_freqs
+ * @param buffer_length number of samples per block [N]
+ * @param exact_freq use the exact (fractional) bin instead of rounding k
+ * @param window optional window of buffer_length weights, see goertzel_window.h
+ */
+typedef struct goertzel_bank_cfg {
+	int sample_rate;
+	const int *target_freqs;
+	int nr_freqs;
+	int buffer_length;
+	bool exact_freq;
+	const goertzel_weight_t *window;
+} goertzel_bank_cfg_t;
+
+/**
+ * @brief Goertzel filter bank, all bins share one block length and are updated
+ * in a single pass over the samples.
+ *
+ * State is stored as a struct of arrays so the per-sample update runs over
+ * contiguous memory. With CONFIG_GOERTZEL_FIXED_POINT the bank uses the same
+ * Q14 arithmetic and bounds as the fixed-point goertzel_filter.
+ */
+typedef struct goertzel_bank {
+	int nr_freqs;       // Number of configured bins
+	int nr_lanes;       // nr_freqs rounded up to GOERTZEL_BANK_LANES
+	int buffer_length;  // Number of samples to process [N]
+	int sample_counter; // Number of samples handled in the current block
+	bool updated;       // True whenever new magnitudes are calculated
+
+	// Window weights or NULL for a rectangular window
+	const goertzel_weight_t *window;
+	goertzel_state_t coefficient[GOERTZEL_BANK_MAX_FREQS];
+	goertzel_state_t q1[GOERTZEL_BANK_MAX_FREQS];
+	goertzel_state_t q2[GOERTZEL_BANK_MAX_FREQS];
+	float magnitude[GOERTZEL_BANK_MAX_FREQS];
+} goertzel_bank_t;
+
+/**
+ * @brief Calculate the coefficients of every bin and clear the bank.
+ * @return ESP_ERR_INVALID_ARG if more than GOERTZEL_BANK_MAX_FREQS frequencies
+ * are requested or a fixed-point bin could overflow.
+ */
+esp_err_t goertzel_bank_setup(goertzel_bank_t *bank,
+                              const goertzel_bank_cfg_t *config);
+
+/**
+ * @brief Reset the filter state of every bin and start a new block.
+ */
+esp_err_t goertzel_bank_clear(goertzel_bank_t *bank);
+
+/**
+ * @brief Feed samples to every bin of the bank. Magnitudes are calculated each
+ * time buffer_length samples have been processed.
+ */
+esp_err_t goertzel_bank_process(goertzel_bank_t *bank, const int16_t *samples,
+                                int nr_samples);
+
+/**
+ * @brief Copy the magnitudes of the last finished block to magnitudes.
+ * @param magnitudes array with room for nr_freqs values.
+ * @return true if new magnitudes were available, false otherwise.
+ */
+bool goertzel_bank_new_magnitudes(goertzel_bank_t *bank, float *magnitudes);
+
+#endif /* GOERTZEL_BANK_H */
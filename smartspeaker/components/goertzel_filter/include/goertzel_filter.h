@@ -13,7 +13,48 @@
 #define GOERTZEL_FILTER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_GOERTZEL_FIXED_POINT
+/**
+ * Fixed-point filters store the coefficient 2cos(omega) as Q14 and keep the
+ * state q1/q2 as 32-bit integers in the same scale as the int16 input samples.
+ * The product coefficient * q1 is formed in 64 bits and rounded back to Q0.
+ *
+ * Overflow: for |x| <= 2^15 the state is bounded by
+ *     |q| <= N * 2^15 / |sin(omega)|
+ * so a block length N is only accepted when N < 2^16 * |sin(omega)|.
+ * For the analyser (N = 200, 200 Hz at 8 kHz) that leaves a margin of 51x.
+ *
+ * Error compared with the float filters:
+ *  - Coefficient rounding is at most 2^-15, which shifts the detected
+ *    frequency by at most 2^-16 / |sin(omega)| radians per sample.
+ *  - Rounding the product adds at most 0.5 per sample, so the state is off by
+ *    at most N / (2 * |sin(omega)|), for the analyser that is below 1e-3 of a
+ *    full scale tone.
+ *
+ * The per-sample loop is integer only, the FPU is used once per block to
+ * calculate the magnitude.
+ */
+#define GOERTZEL_COEFF_SHIFT 14
+typedef int32_t goertzel_state_t;
+
+/// Window weights are Q15, applied to the sample before the recurrence.
+#define GOERTZEL_WEIGHT_SHIFT 15
+typedef int16_t goertzel_weight_t;
+
+/**
+ * @brief Calculate the Q14 coefficient for omega and check the overflow bound
+ * for a block of buffer_length samples.
+ * @return ESP_ERR_INVALID_ARG if the state could overflow.
+ */
+esp_err_t goertzel_fixed_coefficient(float omega, int buffer_length, int32_t *coefficient);
+#else
+typedef float goertzel_state_t;
+typedef float goertzel_weight_t;
+#endif
 
 struct goertzel_filt_dat_t;
 
@@ -25,6 +66,8 @@ typedef struct goertzel_filt_conf_t {
     int target_freq;        // Target frequency to detect [Hz]
     int buffer_length;      // Number of samples to process [N]
     //float scaling_factor;   // Used in alternative magnitude calculation
+    bool exact_freq;        // Use the exact (fractional) bin instead of rounding k
+    const goertzel_weight_t *window; // Optional window of buffer_length weights
 } goertzel_filter_cfg_t;
 
 /**
@@ -33,12 +76,13 @@ typedef struct goertzel_filt_conf_t {
 typedef struct goertzel_filt_dat_t {
     int buffer_length;      // Number of samples to process [N]
     int sample_counter;     // Number of samples handled
+    const goertzel_weight_t *window; // Window weights or NULL for rectangular
     //float scaling_factor;   // Used in alternative magnitude calculation
     //float omega;
-    float coefficient;      // Precalculated coefficient
-    float q0;
-    float q1;
-    float q2;
+    goertzel_state_t coefficient; // Precalculated coefficient
+    goertzel_state_t q0;
+    goertzel_state_t q1;
+    goertzel_state_t q2;
     float magnitude;        // Calculated magnitude value
     bool updated;           // True whenever new magnitude is calculated
 } goertzel_filter_data_t;
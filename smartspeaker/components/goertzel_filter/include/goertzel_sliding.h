@@ -0,0 +1,88 @@
+#ifndef GOERTZEL_SLIDING_H
+#define GOERTZEL_SLIDING_H
+#pragma once
+
+#include "esp_err.h"
+#include "goertzel_window.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Bins tracked for the widest window, Blackman needs k - 2 to k + 2
+#define GOERTZEL_SLIDING_MAX_BINS 5
+
+/**
+ * @brief Configuration for a sliding Goertzel (sliding DFT) filter.
+ * @param sample_rate number of samples per second [Hz]
+ * @param target_freq frequency to detect [Hz]
+ * @param buffer_length length of the sliding window [N]
+ * @param threshold magnitude at which a detection fires, same scale as the
+ * block Goertzel filter magnitude.
+ * @param exact_freq use the exact (fractional) bin instead of rounding k
+ * @param window window shape, the same windows as goertzel_window_fill()
+ */
+typedef struct goertzel_sliding_cfg {
+	int sample_rate;
+	int target_freq;
+	int buffer_length;
+	float threshold;
+	bool exact_freq;
+	enum goertzel_window window;
+} goertzel_sliding_cfg_t;
+
+/**
+ * @brief Sliding DFT for a single bin. The magnitude of the last buffer_length
+ * samples is updated on every sample at a constant cost per sample.
+ *
+ * A window cannot be applied to the samples of a sliding window, each sample
+ * takes every position in it. It is applied to the spectrum instead: Hann is
+ * 0.5 X[k] - 0.25 (X[k-1] + X[k+1]) and Blackman adds 0.04 (X[k-2] + X[k+2]),
+ * so those windows cost three and five times as much per sample.
+ */
+typedef struct goertzel_sliding {
+	int buffer_length; // Length of the sliding window [N]
+	int index;         // Oldest sample in history
+	int16_t *history;  // Last buffer_length samples
+	int nr_bins;       // Bins around k the window needs, 1, 3 or 5
+	float cos_w[GOERTZEL_SLIDING_MAX_BINS];   // Twiddle factor, real part
+	float sin_w[GOERTZEL_SLIDING_MAX_BINS];   // Twiddle factor, imaginary part
+	float leave_re[GOERTZEL_SLIDING_MAX_BINS]; // r^N e^(jwN), real part
+	float leave_im[GOERTZEL_SLIDING_MAX_BINS]; // r^N e^(jwN), imaginary part
+	float weight[GOERTZEL_SLIDING_MAX_BINS];   // Window weight of each bin
+	float re[GOERTZEL_SLIDING_MAX_BINS];       // Bin value, real part
+	float im[GOERTZEL_SLIDING_MAX_BINS];       // Bin value, imaginary part
+	float damping;     // Per sample damping factor r
+	float threshold_2; // Squared detection threshold
+	bool detected;     // True while the magnitude is above the threshold
+} goertzel_sliding_t;
+
+/**
+ * @brief Allocate the sample history and calculate the twiddle factor.
+ */
+esp_err_t goertzel_sliding_setup(goertzel_sliding_t *filter,
+                                 const goertzel_sliding_cfg_t *config);
+
+/**
+ * @brief Free the sample history.
+ */
+void goertzel_sliding_free(goertzel_sliding_t *filter);
+
+/**
+ * @brief Empty the window, as if buffer_length zero samples were processed.
+ */
+esp_err_t goertzel_sliding_clear(goertzel_sliding_t *filter);
+
+/**
+ * @brief Slide the window over samples.
+ * @return Offset into samples at which the magnitude rose above the threshold,
+ * or -1 if it did not. The detection rearms once the magnitude has dropped
+ * 6 dB below the threshold.
+ */
+int goertzel_sliding_process(goertzel_sliding_t *filter,
+                             const int16_t *samples, int nr_samples);
+
+/**
+ * @brief Magnitude of the window ending at the last processed sample.
+ */
+float goertzel_sliding_magnitude(const goertzel_sliding_t *filter);
+
+#endif /* GOERTZEL_SLIDING_H */
@@ -0,0 +1,29 @@
+#ifndef GOERTZEL_WINDOW_H
+#define GOERTZEL_WINDOW_H
+#pragma once
+
+#include "goertzel_filter.h"
+
+enum goertzel_window {
+	GOERTZEL_WINDOW_RECTANGULAR = 0,
+	GOERTZEL_WINDOW_HANN,
+	GOERTZEL_WINDOW_BLACKMAN,
+};
+
+/**
+ * @brief Precalculate a window table for the Goertzel filters.
+ *
+ * Windowing lowers the leakage of strong neighbouring content (e.g. music)
+ * into a bin, which allows shorter blocks for the same false positive rate.
+ * The table is applied to the samples in the same pass as the recurrence.
+ *
+ * @param window window shape
+ * @param table array of length weights to fill
+ * @param length block length of the filter [N]
+ * @return Coherent gain of the window (mean weight). A tone yields a magnitude
+ * this much lower than with a rectangular window.
+ */
+float goertzel_window_fill(enum goertzel_window window,
+                           goertzel_weight_t *table, int length);
+
+#endif /* GOERTZEL_WINDOW_H */
@@ -12,6 +12,14 @@ enum ui_cmd {
 	UIC_PARTY_MODE_OFF,
 	UIC_ASK_CLOCK_TIME,
 	UIC_SET_STARTUP_OPTS,
+	UIC_MUSIC,
+	UIC_MUSIC_SHUFFLE,
+	UIC_MUSIC_NEXT_FOLDER,
+	UIC_SEEK_FORWARD,
+	UIC_SEEK_BACKWARD,
+	UIC_MUSIC_RESCAN,
+	UIC_PAUSE,
+	UIC_LIVE,
 };
 
 struct ui_cmd_data {
@@ -7,10 +7,18 @@
 #include "audio_element.h"
 #include "audio_event_iface.h"
 #include "esp_log.h"
+#include "radio.h"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define SEND_UI_CMD(command) SEND_CMD(6969, 6969, command, evt_ptr)
+#define SEND_TUNE(channel)   SEND_CMD(8005, 8005, channel, evt_ptr)
+
+// Longest search entered on the LCD and the stations it lists
+#define SEARCH_LENGTH      16
+#define SEARCH_MAX_RESULTS 32
 
 static int isPartyModeOn = 0;
 static int isBLuetoothOn = 0;
@@ -136,6 +144,81 @@ static void change_language_french(void *args) {
 	ESP_LOGI(TAG, "%d", current_language);
 }
 
+/**
+ * @brief Plays the music on the sdcard when off and the radio when on.
+ */
+static void musicOnOff(void *args) {
+	ESP_LOGI(TAG, "Audio output switched (in menu music)");
+
+	SEND_UI_CMD(UIC_MUSIC);
+}
+
+/**
+ * @brief Plays the music in a random order when in order and the other way
+ * round.
+ */
+static void musicShuffle(void *args) {
+	ESP_LOGI(TAG, "shuffle");
+
+	SEND_UI_CMD(UIC_MUSIC_SHUFFLE);
+}
+
+/**
+ * @brief Skips to the next folder. (music)
+ */
+static void musicNextFolder(void *args) {
+	ESP_LOGI(TAG, "next folder");
+
+	SEND_UI_CMD(UIC_MUSIC_NEXT_FOLDER);
+}
+
+/**
+ * @brief Jumps forward in the current track, or in the recording of the
+ * channel up to live. (music, radio)
+ */
+static void seekForward(void *args) {
+	ESP_LOGI(TAG, "seek forward");
+
+	SEND_UI_CMD(UIC_SEEK_FORWARD);
+}
+
+/**
+ * @brief Jumps back in the current track, or in the recording of the
+ * channel. (music, radio)
+ */
+static void seekBackward(void *args) {
+	ESP_LOGI(TAG, "seek backward");
+
+	SEND_UI_CMD(UIC_SEEK_BACKWARD);
+}
+
+/**
+ * @brief Pauses the channel while it is recorded on, or plays on. (radio)
+ */
+static void radioPause(void *args) {
+	ESP_LOGI(TAG, "pause");
+
+	SEND_UI_CMD(UIC_PAUSE);
+}
+
+/**
+ * @brief Catches up with the stream after a pause or a rewind. (radio)
+ */
+static void radioLive(void *args) {
+	ESP_LOGI(TAG, "live");
+
+	SEND_UI_CMD(UIC_LIVE);
+}
+
+/**
+ * @brief Looks for music that was added to or removed from the sdcard.
+ */
+static void musicRescan(void *args) {
+	ESP_LOGI(TAG, "rescan music");
+
+	SEND_UI_CMD(UIC_MUSIC_RESCAN);
+}
+
 static void setStartupOpts(void *args) {
 	ESP_LOGI(TAG, "set startup opts");
 
@@ -146,6 +229,32 @@ static void screen_draw_menu(struct screen *screen, int redraw);
 static void screen_event_handler_menu(struct screen *screen, enum button_id);
 static void screen_draw_welcome(struct screen *screen, int redraw);
 static void screen_event_handler_welcome(struct screen *screen, enum button_id);
+static void screen_draw_search(struct screen *screen, int redraw);
+static void screen_event_handler_search(struct screen *screen, enum button_id);
+static void screen_draw_results(struct screen *screen, int redraw);
+static void screen_event_handler_results(struct screen *screen,
+                                         enum button_id);
+static void screen_draw_playing(struct screen *screen, int redraw);
+static void screen_event_handler_playing(struct screen *screen,
+                                         enum button_id);
+
+struct screen screen_search = {
+	.draw          = screen_draw_search,
+	.event_handler = screen_event_handler_search,
+	.data          = NULL,
+};
+
+struct screen screen_results = {
+	.draw          = screen_draw_results,
+	.event_handler = screen_event_handler_results,
+	.data          = NULL,
+};
+
+struct screen screen_playing = {
+	.draw          = screen_draw_playing,
+	.event_handler = screen_event_handler_playing,
+	.data          = NULL,
+};
 
 static struct menu menu_main;
 static struct menu menu_languages;
@@ -189,12 +298,58 @@ static struct menu_item menu_radio_items[] = {
 	{ .type          = MENU_TYPE_FUNCTION,
 	  .name          = "Change channel down",
 	  .data.function = changeChannelDown },
+	{ .type        = MENU_TYPE_SCREEN,
+	  .name        = "Search stations",
+	  .data.screen = &screen_search },
+	{ .type        = MENU_TYPE_SCREEN,
+	  .name        = "Now playing",
+	  .data.screen = &screen_playing },
+	{ .type          = MENU_TYPE_FUNCTION,
+	  .name          = "Pause/Play",
+	  .data.function = radioPause },
+	{ .type          = MENU_TYPE_FUNCTION,
+	  .name          = "Rewind",
+	  .data.function = seekBackward },
+	{ .type          = MENU_TYPE_FUNCTION,
+	  .name          = "Forward",
+	  .data.function = seekForward },
+	{ .type = MENU_TYPE_FUNCTION, .name = "Live", .data.function = radioLive },
 
 	{ .type = MENU_TYPE_FUNCTION, .name = "+", .data.function = plusVolume },
 	{ .type = MENU_TYPE_FUNCTION, .name = "-", .data.function = minVolume },
 	{ .type = MENU_TYPE_MENU, .name = "Back", .data.menu = &menu_main },
 };
 
+static struct menu_item menu_music_items[] = {
+	{ .type          = MENU_TYPE_FUNCTION,
+	  .name          = "Music On/Off",
+	  .data.function = musicOnOff },
+	{ .type          = MENU_TYPE_FUNCTION,
+	  .name          = "Next track",
+	  .data.function = changeChannelUp },
+	{ .type          = MENU_TYPE_FUNCTION,
+	  .name          = "Previous track",
+	  .data.function = changeChannelDown },
+	{ .type          = MENU_TYPE_FUNCTION,
+	  .name          = "Next folder",
+	  .data.function = musicNextFolder },
+	{ .type          = MENU_TYPE_FUNCTION,
+	  .name          = "Shuffle On/Off",
+	  .data.function = musicShuffle },
+	{ .type          = MENU_TYPE_FUNCTION,
+	  .name          = "Seek forward",
+	  .data.function = seekForward },
+	{ .type          = MENU_TYPE_FUNCTION,
+	  .name          = "Seek backward",
+	  .data.function = seekBackward },
+	{ .type          = MENU_TYPE_FUNCTION,
+	  .name          = "Rescan",
+	  .data.function = musicRescan },
+	{ .type = MENU_TYPE_FUNCTION, .name = "+", .data.function = plusVolume },
+	{ .type = MENU_TYPE_FUNCTION, .name = "-", .data.function = minVolume },
+	{ .type = MENU_TYPE_MENU, .name = "Back", .data.menu = &menu_main },
+};
+
 static struct menu_item menu_bluetooth_items[] = {
 	{ .type          = MENU_TYPE_FUNCTION,
 	  .name          = "Bluetooth On/Off",
@@ -226,6 +381,12 @@ static struct menu menu_radio = {
 	.items = menu_radio_items,
 };
 
+static struct menu menu_music = {
+	.size  = ARRAY_SIZE(menu_music_items),
+	.index = 0,
+	.items = menu_music_items,
+};
+
 static struct menu menu_bluetooth = {
 	.size  = ARRAY_SIZE(menu_bluetooth_items),
 	.index = 0,
@@ -235,6 +396,7 @@ static struct menu menu_bluetooth = {
 static struct menu_item menu_main_items[] = {
 	{ .type = MENU_TYPE_MENU, .name = "Clock", .data.menu = &menu_clock },
 	{ .type = MENU_TYPE_MENU, .name = "Radio", .data.menu = &menu_radio },
+	{ .type = MENU_TYPE_MENU, .name = "Music", .data.menu = &menu_music },
 	{ .type      = MENU_TYPE_MENU,
 	  .name      = "Bluetooth",
 	  .data.menu = &menu_bluetooth },
@@ -336,6 +498,190 @@ static void screen_event_handler_menu(struct screen *screen,
 	}
 }
 
+/*
+ * The search is entered a character at a time, up and down pick it from
+ * search_keys and OK adds it. "<" removes the last one, or goes back to the
+ * menu if there is none, and ">" lists the stations found.
+ */
+static const char search_keys[] = "abcdefghijklmnopqrstuvwxyz0123456789 <>";
+static char search[SEARCH_LENGTH + 1];
+static size_t search_length = 0;
+static size_t search_key    = 0;
+static uint32_t search_results[SEARCH_MAX_RESULTS];
+static int nr_search_results = 0;
+static size_t search_result  = 0; // Index of the results and Back
+
+/**
+ * @brief Writes a name cut to the width of the display.
+ */
+static void write_cut_str(const char *string, size_t width) {
+	char line[CONFIG_LCD_NUM_VISIBLE_COLUMNS + 1];
+	if (width > CONFIG_LCD_NUM_VISIBLE_COLUMNS)
+		width = CONFIG_LCD_NUM_VISIBLE_COLUMNS;
+	snprintf(line, width + 1, "%s", string);
+	lcd_write_str(line);
+}
+
+/**
+ * @brief Draws the search, the picked character and the stations found.
+ */
+static void screen_draw_search(struct screen *screen, int redraw) {
+	char line[CONFIG_LCD_NUM_VISIBLE_COLUMNS + 1];
+	lcd_clear();
+
+	// The end of a search longer than the line
+	size_t shown = CONFIG_LCD_NUM_VISIBLE_COLUMNS - sizeof "Search:[x]" + 1;
+	const char *end =
+	    search_length > shown ? search + search_length - shown : search;
+	lcd_move_cursor(0, 0);
+	snprintf(line, sizeof line, "Search:%s[%c]", end,
+	         search_keys[search_key]);
+	lcd_write_str(line);
+
+	lcd_move_cursor(0, 1);
+	if (search_length) {
+		snprintf(line, sizeof line, "%d%s stations", nr_search_results,
+		         nr_search_results == SEARCH_MAX_RESULTS ? "+" : "");
+		lcd_write_str(line);
+	}
+	if (nr_search_results > 0) {
+		lcd_move_cursor(0, 2);
+		write_cut_str(radio_channel_name(search_results[0]),
+		              CONFIG_LCD_NUM_VISIBLE_COLUMNS);
+	}
+	lcd_move_cursor(0, CONFIG_LCD_NUM_ROWS - 1);
+	lcd_write_str("OK: add  <del >list");
+}
+
+/**
+ * @brief Handles button presses while a search is entered.
+ */
+static void screen_event_handler_search(struct screen *screen,
+                                        enum button_id button) {
+	ESP_LOGI(TAG, "button: %d", button);
+	size_t nr_keys = sizeof search_keys - 1;
+	switch (button) {
+		case BUTTON_DOWN:
+			search_key = (search_key + nr_keys - 1) % nr_keys;
+			break;
+		case BUTTON_UP: search_key = (search_key + 1) % nr_keys; break;
+		case BUTTON_OK:
+			if (search_keys[search_key] == '>') {
+				search_result  = 0;
+				screen_current = &screen_results;
+				break;
+			} else if (search_keys[search_key] == '<') {
+				if (!search_length) {
+					screen_current = &screen_menu;
+					break;
+				}
+				search[--search_length] = '\0';
+			} else if (search_length < SEARCH_LENGTH) {
+				search[search_length++] = search_keys[search_key];
+				search[search_length]   = '\0';
+			}
+			nr_search_results =
+			    radio_search(search, search_results, SEARCH_MAX_RESULTS);
+			ESP_LOGI(TAG, "search \"%s\": %d stations", search,
+			         nr_search_results);
+			break;
+		default: break;
+	}
+	screen_current->draw(screen_current, true);
+}
+
+/**
+ * @brief Draws the stations found, with Back after the last one.
+ */
+static void screen_draw_results(struct screen *screen, int redraw) {
+	lcd_clear();
+	size_t size  = nr_search_results + 1;
+	size_t first = 0;
+	if (size > CONFIG_LCD_NUM_ROWS)
+		first = MIN(search_result, size - CONFIG_LCD_NUM_ROWS);
+
+	for (size_t i = first; i < MIN(size, first + CONFIG_LCD_NUM_ROWS); i++) {
+		lcd_move_cursor(0, i - first);
+		lcd_write_str(search_result == i ? "-" : " ");
+		if (i < (size_t)nr_search_results)
+			write_cut_str(radio_channel_name(search_results[i]),
+			              CONFIG_LCD_NUM_VISIBLE_COLUMNS - 1);
+		else lcd_write_str("Back");
+	}
+}
+
+/**
+ * @brief Handles button presses on the stations found, OK tunes to one.
+ */
+static void screen_event_handler_results(struct screen *screen,
+                                         enum button_id button) {
+	ESP_LOGI(TAG, "button: %d", button);
+	switch (button) {
+		case BUTTON_DOWN:
+			if (search_result > 0) search_result--;
+			break;
+		case BUTTON_UP:
+			if (search_result < (size_t)nr_search_results) search_result++;
+			break;
+		case BUTTON_OK:
+			if (search_result < (size_t)nr_search_results) {
+				ESP_LOGI(TAG, "tune to %s",
+				         radio_channel_name(search_results[search_result]));
+				SEND_TUNE(search_results[search_result]);
+				screen_current = &screen_menu;
+			} else {
+				screen_current = &screen_search;
+			}
+			break;
+		default: break;
+	}
+	screen_current->draw(screen_current, true);
+}
+
+// What the playing screen shows, it is drawn again when it changes
+static char playing_title[RADIO_ICY_TITLE_LENGTH];
+static int playing_channel = -1;
+
+/**
+ * @brief Draws the channel that plays and its title over the other rows. It is
+ * polled, without redraw it only draws when the title or channel changed.
+ */
+static void screen_draw_playing(struct screen *screen, int redraw) {
+	char title[RADIO_ICY_TITLE_LENGTH] = "";
+	bool on     = radio_get_title(title, sizeof title) == ESP_OK;
+	int channel = on ? radio_get_channel() : -1;
+	if (!redraw && channel == playing_channel && !strcmp(title, playing_title))
+		return;
+	playing_channel = channel;
+	strcpy(playing_title, title);
+
+	lcd_clear();
+	lcd_move_cursor(0, 0);
+	if (!on) {
+		lcd_write_str("The radio is off");
+		return;
+	}
+	write_cut_str(radio_channel_name(channel), CONFIG_LCD_NUM_VISIBLE_COLUMNS);
+
+	const char *rest = title;
+	for (int row = 1; row < CONFIG_LCD_NUM_ROWS && *rest; row++) {
+		lcd_move_cursor(0, row);
+		write_cut_str(rest, CONFIG_LCD_NUM_VISIBLE_COLUMNS);
+		rest += MIN(strlen(rest), CONFIG_LCD_NUM_VISIBLE_COLUMNS);
+	}
+}
+
+/**
+ * @brief Handles button presses on the playing screen, OK goes back.
+ */
+static void screen_event_handler_playing(struct screen *screen,
+                                         enum button_id button) {
+	ESP_LOGI(TAG, "button: %d", button);
+	if (button != BUTTON_OK) return;
+	screen_current = &screen_menu;
+	screen_current->draw(screen_current, true);
+}
+
 /**
  * @brief Draws the welcome screen.
  */
@@ -422,6 +768,9 @@ void lcd1602_task(void *pvParameter) {
 				screen_current->event_handler(screen_current, BUTTON_UP);
 			}
 		}
+		// The title changes while the screen shows it
+		if (screen_current == &screen_playing)
+			screen_current->draw(screen_current, false);
 		vTaskDelay(100 / portTICK_PERIOD_MS);
 	}
 	lcd1602_task_deinit();
@@ -11,6 +11,7 @@ enum strip_cmd {
 	SC_OFF = 0,
 	SC_SET_VOLUME,
 	SC_RAINBOW_FLASH,
+	SC_BEAT,
 };
 
 /**
@@ -25,6 +26,13 @@ esp_err_t led_controller_config_master(void);
  */
 esp_err_t set_party_mode(enum strip_cmd cmd);
 
+/**
+ * Tells the LED strip controlling ESP32 that a beat is due, so the party mode
+ * effect moves on in time with the music. Nothing is sent when party mode is
+ * off.
+ */
+esp_err_t led_controller_beat(void);
+
 /**
  * Calculates and sets the amount of LED's on the strip
  * to represent the current volume (a command is sent over I2C to the LED strip
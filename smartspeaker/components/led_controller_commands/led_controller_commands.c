@@ -51,7 +51,7 @@ static esp_err_t send_command(uint8_t *msg, size_t len) {
 }
 
 esp_err_t set_party_mode(enum strip_cmd cmd) {
-	if (cmd == SC_SET_VOLUME) return ESP_ERR_INVALID_STATE;
+	if (cmd == SC_SET_VOLUME || cmd == SC_BEAT) return ESP_ERR_INVALID_STATE;
 
 	if (cur_strip_cmd != cmd) {
 		cur_strip_cmd = cmd;
@@ -64,6 +64,13 @@ esp_err_t set_party_mode(enum strip_cmd cmd) {
 	return ESP_OK;
 }
 
+esp_err_t led_controller_beat(void) {
+	if (cur_strip_cmd != SC_RAINBOW_FLASH) return ESP_OK;
+
+	uint8_t msg[] = { SC_BEAT, 100 };
+	return send_command(msg, ARRAY_SIZE(msg));
+}
+
 esp_err_t led_controller_show_volume(int player_volume) {
 	uint8_t msg[] = { SC_SET_VOLUME, player_volume };
 	return send_command(msg, ARRAY_SIZE(msg));
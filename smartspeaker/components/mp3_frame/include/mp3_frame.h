@@ -0,0 +1,37 @@
+#ifndef MP3_FRAME_H
+#define MP3_FRAME_H
+#pragma once
+
+/*
+ * Layer III frame headers, shared by the firmware and the host tools, so it
+ * only depends on the C library.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Bytes of a frame header
+#define MP3_FRAME_HEADER 4
+
+/**
+ * @brief Properties of a Layer III frame, from its header.
+ */
+struct mp3_frame {
+	int length;      // Bytes including the header
+	int bitrate;     // [kbit/s]
+	int sample_rate; // [Hz]
+	int channels;
+	int samples;     // Samples per channel
+	int side_info;   // Offset of the main data from the header
+};
+
+/**
+ * @brief Parse the Layer III frame header at data.
+ * @param length bytes at data, a header needs MP3_FRAME_HEADER
+ * @return false if there is no valid frame header
+ */
+bool mp3_frame_parse(const uint8_t *data, size_t length,
+                     struct mp3_frame *frame);
+
+#endif /* MP3_FRAME_H */
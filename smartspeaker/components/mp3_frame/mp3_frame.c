@@ -0,0 +1,39 @@
+#include "mp3_frame.h"
+
+// Layer III bitrates [kbit/s] for MPEG-1 and MPEG-2/2.5
+static const int mp3_bitrates[2][15] = {
+	{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+	{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+};
+
+static const int mp3_sample_rates[3] = { 44100, 48000, 32000 };
+
+bool mp3_frame_parse(const uint8_t *data, size_t length,
+                     struct mp3_frame *frame) {
+	if (length < MP3_FRAME_HEADER || data[0] != 0xff ||
+	    (data[1] & 0xe0) != 0xe0)
+		return false;
+
+	int version  = (data[1] >> 3) & 3; // 0 MPEG-2.5, 2 MPEG-2, 3 MPEG-1
+	int layer    = (data[1] >> 1) & 3; // 1 Layer III
+	int bitrate  = data[2] >> 4;
+	int rate     = (data[2] >> 2) & 3;
+	int padding  = (data[2] >> 1) & 1;
+	bool mono    = (data[3] >> 6) == 3;
+	bool has_crc = !(data[1] & 1);
+	if (version == 1 || layer != 1 || bitrate == 0 || bitrate == 15 ||
+	    rate == 3)
+		return false;
+
+	bool mpeg1         = version == 3;
+	int rate_shift     = mpeg1 ? 0 : version == 2 ? 1 : 2;
+	frame->bitrate     = mp3_bitrates[mpeg1 ? 0 : 1][bitrate];
+	frame->sample_rate = mp3_sample_rates[rate] >> rate_shift;
+	frame->channels    = mono ? 1 : 2;
+	frame->samples     = mpeg1 ? 1152 : 576;
+	int scale          = mpeg1 ? 144000 : 72000; // Samples / 8 bits * 1000
+	frame->length      = scale * frame->bitrate / frame->sample_rate + padding;
+	frame->side_info   = 4 + (has_crc ? 2 : 0) +
+	                   (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+	return true;
+}
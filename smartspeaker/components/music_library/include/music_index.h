@@ -0,0 +1,139 @@
+#ifndef MUSIC_INDEX_H
+#define MUSIC_INDEX_H
+#pragma once
+
+/*
+ * Index of the music on the sdcard, shared by the firmware and the host
+ * indexer, so it only depends on the C library and POSIX directories.
+ *
+ * The file is written as it is kept in memory, little-endian:
+ *
+ *   header | dirs[nr_dirs] | tracks[nr_tracks] | strings[strings_size]
+ *
+ * The folders are in depth-first order with their subfolders sorted by name,
+ * the tracks of a folder follow each other sorted by name. Names, paths and
+ * tags are offsets into the strings, offset 0 is the empty string.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MUSIC_INDEX_MAGIC       "SPMI"
+#define MUSIC_INDEX_VERSION     1
+/// Longest path of a track relative to the root
+#define MUSIC_INDEX_PATH_LENGTH 256
+/// Longest tag that is kept, longer tags are cut
+#define MUSIC_INDEX_TAG_LENGTH  64
+/// Deepest folder below the root that is indexed, bounds the recursion
+#define MUSIC_INDEX_MAX_DEPTH   8
+/// Parent of the root folder
+#define MUSIC_INDEX_NO_DIR      UINT32_MAX
+
+enum music_codec {
+	MUSIC_CODEC_MP3 = 1,
+};
+
+struct music_index_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t nr_dirs;
+	uint32_t nr_tracks;
+	uint32_t strings_size;
+};
+
+struct music_dir {
+	uint32_t path;        // Relative to the root, "" for the root itself
+	uint32_t parent;      // MUSIC_INDEX_NO_DIR for the root
+	uint32_t mtime;       // Modification time when it was scanned
+	uint32_t first_track;
+	uint32_t nr_tracks;
+};
+
+struct music_track {
+	uint32_t dir;
+	uint32_t name;        // File name
+	uint32_t title;       // Tags, 0 if the file has none
+	uint32_t artist;
+	uint32_t album;
+	uint32_t size;        // Bytes of the file
+	uint32_t mtime;
+	uint32_t data_offset; // First byte of audio after the ID3v2 tag
+	uint32_t data_length; // Bytes of audio without the tags
+	uint32_t duration_ms;
+	uint8_t codec;        // enum music_codec
+	uint8_t reserved[3];
+};
+
+struct music_index {
+	struct music_dir *dirs;
+	uint32_t nr_dirs;
+	struct music_track *tracks;
+	uint32_t nr_tracks;
+	char *strings;
+	uint32_t strings_size;
+};
+
+struct music_index_scan_stats {
+	uint32_t dirs_reused;   // Folders taken from the old index unread
+	uint32_t dirs_read;     // Folders that were listed
+	uint32_t tracks_reused; // Files taken from the old index unopened
+	uint32_t tracks_parsed; // Files that were opened for tags and duration
+};
+
+/**
+ * @brief Read an index file.
+ * @return false if the file is missing or not a valid index
+ */
+bool music_index_load(struct music_index *index, const char *path);
+
+/**
+ * @brief Write an index file, through a temporary file so a power loss keeps
+ * the previous one.
+ */
+bool music_index_save(const struct music_index *index, const char *path);
+
+void music_index_free(struct music_index *index);
+
+/**
+ * @brief Index the music below root.
+ *
+ * A folder of old with an unchanged modification time is taken over without
+ * listing it, and a file with an unchanged size and modification time without
+ * opening it. Only the changed folders are read.
+ * @param old previous index of the same root or NULL
+ * @param cancel stops the scan when it becomes true, may be NULL
+ * @return false if root cannot be read, the scan was cancelled or memory ran
+ * out
+ */
+bool music_index_scan(struct music_index *index, const char *root,
+                      const struct music_index *old,
+                      const volatile bool *cancel,
+                      struct music_index_scan_stats *stats);
+
+static inline const char *music_index_string(const struct music_index *index,
+                                             uint32_t offset) {
+	return offset < index->strings_size ? index->strings + offset : "";
+}
+
+/**
+ * @brief Write the full path of a track, root/folder/name.
+ * @return false if it does not fit in size
+ */
+bool music_index_track_path(const struct music_index *index, uint32_t track,
+                            const char *root, char *path, size_t size);
+
+/**
+ * @brief Byte of the file to continue a track from at a position.
+ */
+uint32_t music_index_seek_offset(const struct music_index *index,
+                                 uint32_t track, uint32_t position_ms);
+
+/**
+ * @brief Position in a track of a byte of the file.
+ */
+uint32_t music_index_position_ms(const struct music_index *index,
+                                 uint32_t track, uint32_t offset);
+
+#endif /* MUSIC_INDEX_H */
@@ -0,0 +1,59 @@
+#ifndef MUSIC_LIBRARY_H
+#define MUSIC_LIBRARY_H
+#pragma once
+
+#include <stdbool.h>
+
+#include "audio_element.h"
+#include "audio_event_iface.h"
+#include "esp_err.h"
+#include "esp_peripherals.h"
+
+/**
+ * @brief Load the index of the music on the sdcard and start playing it.
+ *
+ * The index is brought up to date in the background, a card without an index
+ * starts playing when the first scan is done.
+ */
+esp_err_t music_library_init(audio_element_handle_t *elems, size_t count,
+                             audio_event_iface_handle_t evt,
+                             esp_periph_set_handle_t periph_set, void *args);
+
+esp_err_t music_library_deinit(audio_element_handle_t *elems, size_t count,
+                               audio_event_iface_handle_t evt,
+                               esp_periph_set_handle_t periph_set, void *args);
+
+/**
+ * @brief Play the next track when one ends and pick up a finished scan.
+ */
+esp_err_t music_library_run(audio_event_iface_msg_t *msg, void *args);
+
+esp_err_t music_library_next(void);
+esp_err_t music_library_prev(void);
+
+/**
+ * @brief Skip to the first track of the next folder, in the order of the
+ * folders on the card.
+ */
+esp_err_t music_library_next_folder(void);
+
+/**
+ * @brief Play the library in a random order or in the order of the card
+ * again, the current track keeps playing.
+ */
+esp_err_t music_library_set_shuffle(bool shuffle);
+bool music_library_get_shuffle(void);
+
+/**
+ * @brief Jump forward or back in the current track.
+ * @param seconds negative to jump back
+ */
+esp_err_t music_library_seek(int seconds);
+
+/**
+ * @brief Rebuild the index in the background, only the folders that changed
+ * are read again.
+ */
+esp_err_t music_library_rescan(void);
+
+#endif /* MUSIC_LIBRARY_H */
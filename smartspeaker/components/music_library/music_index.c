@@ -0,0 +1,674 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "music_index.h"
+#include "mp3_frame.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Bytes searched for the first MP3 frame after the ID3v2 tag
+#define MP3_SYNC_WINDOW   4096
+// Strings that were added last, tracks of an album repeat its artist and name
+#define NR_RECENT_STRINGS 4
+
+struct old_dir {
+	const char *path;
+	uint32_t dir;
+};
+
+struct scan {
+	const char *root;
+	struct music_index *index;
+	uint32_t dirs_capacity;
+	uint32_t tracks_capacity;
+	uint32_t strings_capacity;
+	const struct music_index *old;
+	struct old_dir *old_dirs; // Folders of old sorted by path
+	uint32_t recent[NR_RECENT_STRINGS];
+	uint32_t next_recent;
+	const volatile bool *cancel;
+	struct music_index_scan_stats *stats;
+};
+
+static uint32_t read_be32(const uint8_t *data) {
+	return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+	       (uint32_t)data[2] << 8 | data[3];
+}
+
+static uint32_t read_syncsafe(const uint8_t *data) {
+	return (uint32_t)(data[0] & 0x7f) << 21 | (uint32_t)(data[1] & 0x7f) << 14 |
+	       (uint32_t)(data[2] & 0x7f) << 7 | (data[3] & 0x7f);
+}
+
+/**
+ * Append a code point as UTF-8 if it fits
+ */
+static size_t put_utf8(char *out, size_t length, size_t size, uint32_t c) {
+	int bytes = c < 0x80 ? 1 : c < 0x800 ? 2 : 3;
+	if (length + bytes >= size) return length;
+
+	if (bytes == 1) {
+		out[length++] = (char)c;
+	} else if (bytes == 2) {
+		out[length++] = (char)(0xc0 | c >> 6);
+		out[length++] = (char)(0x80 | (c & 0x3f));
+	} else {
+		out[length++] = (char)(0xe0 | c >> 12);
+		out[length++] = (char)(0x80 | ((c >> 6) & 0x3f));
+		out[length++] = (char)(0x80 | (c & 0x3f));
+	}
+	return length;
+}
+
+/**
+ * Convert the text of an ID3 frame to UTF-8, cut at size
+ */
+static void id3_text(const uint8_t *data, size_t length, char *out,
+                     size_t size) {
+	size_t n = 0;
+	if (length > 0) {
+		uint8_t encoding = data[0];
+		data++;
+		length--;
+		if (encoding == 1 || encoding == 2) {
+			// UTF-16 with a byte order mark, or big-endian without one
+			bool big_endian = encoding == 2;
+			if (encoding == 1 && length >= 2) {
+				big_endian = data[0] == 0xfe && data[1] == 0xff;
+				data      += 2;
+				length    -= 2;
+			}
+			for (size_t i = 0; i + 1 < length; i += 2) {
+				uint32_t c = big_endian ? (uint32_t)data[i] << 8 | data[i + 1]
+				                        : (uint32_t)data[i + 1] << 8 | data[i];
+				if (c == 0) break;
+				// Characters outside the BMP are dropped
+				if (c >= 0xd800 && c < 0xe000) continue;
+				n = put_utf8(out, n, size, c);
+			}
+		} else {
+			for (size_t i = 0; i < length && data[i]; i++)
+				n = encoding == 3 ? (n + 1 < size ? (out[n] = data[i], n + 1)
+				                                  : n)
+				                  : put_utf8(out, n, size, data[i]);
+		}
+	}
+	// Trailing spaces of ID3v1 and of some taggers
+	while (n > 0 && out[n - 1] == ' ') n--;
+	out[n] = '\0';
+}
+
+enum { TAG_TITLE, TAG_ARTIST, TAG_ALBUM, NR_TAGS };
+
+/**
+ * Read the title, artist and album from an ID3v2 tag
+ * @return bytes of the tag, 0 if the file has none
+ */
+static uint32_t id3v2_read(FILE *f,
+                           char tags[NR_TAGS][MUSIC_INDEX_TAG_LENGTH]) {
+	uint8_t header[10];
+	if (fread(header, 1, 10, f) != 10 || memcmp(header, "ID3", 3) != 0)
+		return 0;
+
+	int version      = header[3];
+	uint32_t size    = read_syncsafe(header + 6);
+	uint32_t end     = 10 + size;
+	uint32_t tag_end = end + (header[5] & 0x10 ? 10 : 0);
+	if (version < 2 || version > 4) return tag_end;
+
+	static const char *const ids[2][NR_TAGS] = {
+		{ "TT2", "TP1", "TAL" },
+		{ "TIT2", "TPE1", "TALB" },
+	};
+	int id_length     = version == 2 ? 3 : 4;
+	int header_length = version == 2 ? 6 : 10;
+
+	uint32_t pos = 10;
+	if (header[5] & 0x40 && version > 2) {
+		// Extended header
+		uint8_t extended[4];
+		if (fread(extended, 1, 4, f) != 4) return tag_end;
+		pos += version == 4 ? read_syncsafe(extended) : 4 + read_be32(extended);
+	}
+
+	while (pos + header_length <= end) {
+		uint8_t frame[10];
+		if (fseek(f, pos, SEEK_SET) != 0 ||
+		    fread(frame, 1, header_length, f) != (size_t)header_length ||
+		    frame[0] == 0)
+			break;
+
+		uint32_t length =
+		    version == 2 ? (uint32_t)frame[3] << 16 | frame[4] << 8 | frame[5]
+		    : version == 4 ? read_syncsafe(frame + 4)
+		                   : read_be32(frame + 4);
+		for (int t = 0; t < NR_TAGS; t++) {
+			if (memcmp(frame, ids[version == 2 ? 0 : 1][t], id_length) != 0)
+				continue;
+			uint8_t text[2 * MUSIC_INDEX_TAG_LENGTH + 3];
+			size_t n = length < sizeof text ? length : sizeof text;
+			n        = fread(text, 1, n, f);
+			id3_text(text, n, tags[t], MUSIC_INDEX_TAG_LENGTH);
+		}
+		pos += header_length + length;
+	}
+	return tag_end;
+}
+
+/**
+ * Read the tags of an ID3v1 tag for those the ID3v2 tag did not have
+ * @return true if the file ends with an ID3v1 tag
+ */
+static bool id3v1_read(FILE *f, uint32_t size,
+                       char tags[NR_TAGS][MUSIC_INDEX_TAG_LENGTH]) {
+	uint8_t tag[128];
+	if (size < 128 || fseek(f, size - 128, SEEK_SET) != 0 ||
+	    fread(tag, 1, 128, f) != 128 || memcmp(tag, "TAG", 3) != 0)
+		return false;
+
+	for (int t = 0; t < NR_TAGS; t++) {
+		if (tags[t][0]) continue;
+		// Encoding byte 0, ISO-8859-1
+		uint8_t text[31] = { 0 };
+		memcpy(text + 1, tag + 3 + 30 * t, 30);
+		id3_text(text, 31, tags[t], MUSIC_INDEX_TAG_LENGTH);
+	}
+	return true;
+}
+
+/**
+ * Find the audio of an MP3 file, its duration and its tags
+ * @return false if the file holds no Layer III frames
+ */
+static bool mp3_parse_file(const char *path, struct music_track *track,
+                           char tags[NR_TAGS][MUSIC_INDEX_TAG_LENGTH]) {
+	FILE *f = fopen(path, "rb");
+	if (!f) return false;
+
+	uint32_t start = id3v2_read(f, tags);
+	uint32_t end   = track->size;
+	if (id3v1_read(f, track->size, tags)) end -= 128;
+
+	// Off the stack, the scan recurses on a small firmware task
+	uint8_t *window = malloc(MP3_SYNC_WINDOW);
+	size_t n        = 0;
+	if (window && start < end && fseek(f, start, SEEK_SET) == 0)
+		n = fread(window, 1, MP3_SYNC_WINDOW, f);
+	fclose(f);
+
+	struct mp3_frame frame;
+	size_t pos = 0;
+	while (pos < n && !mp3_frame_parse(window + pos, n - pos, &frame)) pos++;
+	if (pos >= n) {
+		free(window);
+		return false;
+	}
+
+	track->codec       = MUSIC_CODEC_MP3;
+	track->data_offset = start + pos;
+	track->data_length = end > track->data_offset ? end - track->data_offset
+	                                              : 0;
+
+	// Frame count of a Xing/Info or VBRI header, constant bitrate otherwise
+	uint32_t frames     = 0;
+	const uint8_t *xing = window + pos + frame.side_info;
+	const uint8_t *vbri = window + pos + 36;
+	if (xing + 12 <= window + n &&
+	    (memcmp(xing, "Xing", 4) == 0 || memcmp(xing, "Info", 4) == 0) &&
+	    read_be32(xing + 4) & 1)
+		frames = read_be32(xing + 8);
+	else if (vbri + 18 <= window + n && memcmp(vbri, "VBRI", 4) == 0)
+		frames = read_be32(vbri + 14);
+
+	if (frames)
+		track->duration_ms = (uint32_t)((uint64_t)frames * frame.samples *
+		                                1000 / frame.sample_rate);
+	else
+		track->duration_ms =
+		    (uint32_t)((uint64_t)track->data_length * 8 / frame.bitrate);
+	free(window);
+	return true;
+}
+
+static bool is_mp3(const char *name) {
+	size_t length = strlen(name);
+	if (length <= 4 || name[length - 4] != '.') return false;
+	const char *ext = name + length - 3;
+	return (ext[0] | 0x20) == 'm' && (ext[1] | 0x20) == 'p' && ext[2] == '3';
+}
+
+static bool grow(void **array, uint32_t *capacity, uint32_t needed,
+                 size_t element) {
+	if (needed <= *capacity) return true;
+
+	uint32_t new_capacity = *capacity ? *capacity * 2 : 64;
+	while (new_capacity < needed) new_capacity *= 2;
+	void *grown = realloc(*array, (size_t)new_capacity * element);
+	if (!grown) return false;
+	*array    = grown;
+	*capacity = new_capacity;
+	return true;
+}
+
+static bool add_string(struct scan *scan, const char *string,
+                       uint32_t *offset) {
+	struct music_index *index = scan->index;
+	if (!string[0]) {
+		*offset = 0;
+		return true;
+	}
+
+	for (int r = 0; r < NR_RECENT_STRINGS; r++) {
+		if (scan->recent[r] &&
+		    strcmp(index->strings + scan->recent[r], string) == 0) {
+			*offset = scan->recent[r];
+			return true;
+		}
+	}
+
+	size_t length = strlen(string) + 1;
+	if (!grow((void **)&index->strings, &scan->strings_capacity,
+	          index->strings_size + length, 1))
+		return false;
+	*offset = index->strings_size;
+	memcpy(index->strings + index->strings_size, string, length);
+	index->strings_size += length;
+	scan->recent[scan->next_recent++ % NR_RECENT_STRINGS] = *offset;
+	return true;
+}
+
+static struct music_track *add_track(struct scan *scan) {
+	struct music_index *index = scan->index;
+	if (!grow((void **)&index->tracks, &scan->tracks_capacity,
+	          index->nr_tracks + 1, sizeof *index->tracks))
+		return NULL;
+	struct music_track *track = &index->tracks[index->nr_tracks++];
+	memset(track, 0, sizeof *track);
+	return track;
+}
+
+/**
+ * Take a track over from the old index
+ */
+static bool reuse_track(struct scan *scan, const struct music_track *old_track,
+                        uint32_t dir) {
+	const struct music_index *old = scan->old;
+	struct music_track *track     = add_track(scan);
+	if (!track) return false;
+
+	*track     = *old_track;
+	track->dir = dir;
+	scan->stats->tracks_reused++;
+	return add_string(scan, music_index_string(old, old_track->name),
+	                  &track->name) &&
+	       add_string(scan, music_index_string(old, old_track->title),
+	                  &track->title) &&
+	       add_string(scan, music_index_string(old, old_track->artist),
+	                  &track->artist) &&
+	       add_string(scan, music_index_string(old, old_track->album),
+	                  &track->album);
+}
+
+static int compare_old_dirs(const void *a, const void *b) {
+	return strcmp(((const struct old_dir *)a)->path,
+	              ((const struct old_dir *)b)->path);
+}
+
+static const struct music_dir *find_old_dir(struct scan *scan,
+                                            const char *path) {
+	if (!scan->old_dirs) return NULL;
+
+	struct old_dir key         = { .path = path };
+	const struct old_dir *found = bsearch(&key, scan->old_dirs,
+	                                      scan->old->nr_dirs,
+	                                      sizeof *scan->old_dirs,
+	                                      compare_old_dirs);
+	return found ? &scan->old->dirs[found->dir] : NULL;
+}
+
+static const struct music_track *find_old_track(struct scan *scan,
+                                                const struct music_dir *dir,
+                                                const char *name) {
+	const struct music_index *old = scan->old;
+	uint32_t low = dir->first_track, high = dir->first_track + dir->nr_tracks;
+	while (low < high) {
+		uint32_t middle = low + (high - low) / 2;
+		int order = strcmp(music_index_string(old, old->tracks[middle].name),
+		                   name);
+		if (order == 0) return &old->tracks[middle];
+		if (order < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return NULL;
+}
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void free_names(char **names, size_t count) {
+	for (size_t i = 0; i < count; i++) free(names[i]);
+	free(names);
+}
+
+static bool join_path(char *out, size_t size, const char *a, const char *b) {
+	int length = a[0] ? snprintf(out, size, "%s/%s", a, b)
+	                  : snprintf(out, size, "%s", b);
+	return length >= 0 && (size_t)length < size;
+}
+
+static bool scan_dir(struct scan *scan, const char *path, uint32_t parent,
+                     int depth);
+
+/**
+ * Take an unchanged folder over from the old index, its subfolders are still
+ * checked
+ */
+static bool reuse_dir(struct scan *scan, const struct music_dir *old_dir,
+                      uint32_t dir, int depth) {
+	const struct music_index *old = scan->old;
+	for (uint32_t t = 0; t < old_dir->nr_tracks; t++)
+		if (!reuse_track(scan, &old->tracks[old_dir->first_track + t], dir))
+			return false;
+	scan->stats->dirs_reused++;
+
+	// The subfolders follow the folder in depth-first order
+	uint32_t old_index = old_dir - old->dirs;
+	const char *prefix = music_index_string(old, old_dir->path);
+	size_t prefix_length = strlen(prefix);
+	for (uint32_t d = old_index + 1; d < old->nr_dirs; d++) {
+		const char *sub = music_index_string(old, old->dirs[d].path);
+		if (prefix_length &&
+		    (strncmp(sub, prefix, prefix_length) != 0 ||
+		     sub[prefix_length] != '/'))
+			break;
+		if (old->dirs[d].parent == old_index &&
+		    !scan_dir(scan, sub, dir, depth + 1))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * List a folder that changed, files that did not change are taken over from
+ * the old index
+ */
+static bool read_dir(struct scan *scan, const char *full,
+                     const struct music_dir *old_dir, const char *path,
+                     uint32_t dir, int depth) {
+	DIR *d = opendir(full);
+	if (!d) return true;
+
+	char **files = NULL, **subdirs = NULL;
+	uint32_t nr_files = 0, nr_subdirs = 0, files_capacity = 0,
+	         subdirs_capacity = 0;
+	char entry_path[MUSIC_INDEX_PATH_LENGTH + 64];
+	bool ok = true;
+
+	struct dirent *entry;
+	while (ok && (entry = readdir(d))) {
+		// Hidden files, . and .. and the files macOS leaves behind
+		if (entry->d_name[0] == '.') continue;
+		if (!join_path(entry_path, sizeof entry_path, full, entry->d_name))
+			continue;
+
+		struct stat st;
+		if (stat(entry_path, &st) != 0) continue;
+		bool is_dir = S_ISDIR(st.st_mode) && depth < MUSIC_INDEX_MAX_DEPTH;
+		if (!is_dir && !(S_ISREG(st.st_mode) && is_mp3(entry->d_name)))
+			continue;
+
+		char ***names      = is_dir ? &subdirs : &files;
+		uint32_t *count    = is_dir ? &nr_subdirs : &nr_files;
+		uint32_t *capacity = is_dir ? &subdirs_capacity : &files_capacity;
+		char *name         = strdup(entry->d_name);
+		ok = name && grow((void **)names, capacity, *count + 1, sizeof name);
+		if (ok)
+			(*names)[(*count)++] = name;
+		else
+			free(name);
+	}
+	closedir(d);
+	scan->stats->dirs_read++;
+
+	if (ok && nr_files) qsort(files, nr_files, sizeof *files, compare_names);
+	if (ok && nr_subdirs)
+		qsort(subdirs, nr_subdirs, sizeof *subdirs, compare_names);
+
+	for (uint32_t f = 0; ok && f < nr_files; f++) {
+		struct stat st;
+		if (!join_path(entry_path, sizeof entry_path, full, files[f]) ||
+		    stat(entry_path, &st) != 0 || st.st_size > UINT32_MAX)
+			continue;
+
+		const struct music_track *old_track =
+		    old_dir ? find_old_track(scan, old_dir, files[f]) : NULL;
+		if (old_track && old_track->size == (uint32_t)st.st_size &&
+		    old_track->mtime == (uint32_t)st.st_mtime) {
+			ok = reuse_track(scan, old_track, dir);
+			continue;
+		}
+
+		struct music_track parsed = {
+			.dir   = dir,
+			.size  = (uint32_t)st.st_size,
+			.mtime = (uint32_t)st.st_mtime,
+		};
+		char tags[NR_TAGS][MUSIC_INDEX_TAG_LENGTH] = { { 0 } };
+		if (!mp3_parse_file(entry_path, &parsed, tags)) continue;
+		scan->stats->tracks_parsed++;
+
+		struct music_track *track = add_track(scan);
+		ok = track && add_string(scan, files[f], &parsed.name) &&
+		     add_string(scan, tags[TAG_TITLE], &parsed.title) &&
+		     add_string(scan, tags[TAG_ARTIST], &parsed.artist) &&
+		     add_string(scan, tags[TAG_ALBUM], &parsed.album);
+		if (ok) *track = parsed;
+	}
+
+	for (uint32_t s = 0; ok && s < nr_subdirs; s++) {
+		char sub[MUSIC_INDEX_PATH_LENGTH];
+		if (join_path(sub, sizeof sub, path, subdirs[s]))
+			ok = scan_dir(scan, sub, dir, depth + 1);
+	}
+
+	free_names(files, nr_files);
+	free_names(subdirs, nr_subdirs);
+	return ok;
+}
+
+static bool scan_dir(struct scan *scan, const char *path, uint32_t parent,
+                     int depth) {
+	if (scan->cancel && *scan->cancel) return false;
+
+	char full[MUSIC_INDEX_PATH_LENGTH + 64];
+	struct stat st;
+	if (!join_path(full, sizeof full, scan->root, path) ||
+	    stat(full, &st) != 0 || !S_ISDIR(st.st_mode))
+		return parent != MUSIC_INDEX_NO_DIR;
+
+	struct music_index *index = scan->index;
+	if (!grow((void **)&index->dirs, &scan->dirs_capacity,
+	          index->nr_dirs + 1, sizeof *index->dirs))
+		return false;
+	uint32_t dir          = index->nr_dirs++;
+	struct music_dir *new = &index->dirs[dir];
+	new->parent           = parent;
+	new->mtime            = (uint32_t)st.st_mtime;
+	new->first_track      = index->nr_tracks;
+	if (!add_string(scan, path, &index->dirs[dir].path)) return false;
+
+	const struct music_dir *old_dir = find_old_dir(scan, path);
+	bool ok = old_dir && old_dir->mtime == (uint32_t)st.st_mtime
+	              ? reuse_dir(scan, old_dir, dir, depth)
+	              : read_dir(scan, full, old_dir, path, dir, depth);
+
+	// The tracks of the folder come before those of its subfolders
+	uint32_t nr_tracks = 0;
+	while (index->dirs[dir].first_track + nr_tracks < index->nr_tracks &&
+	       index->tracks[index->dirs[dir].first_track + nr_tracks].dir == dir)
+		nr_tracks++;
+	index->dirs[dir].nr_tracks = nr_tracks;
+	return ok;
+}
+
+bool music_index_scan(struct music_index *index, const char *root,
+                      const struct music_index *old,
+                      const volatile bool *cancel,
+                      struct music_index_scan_stats *stats) {
+	struct music_index_scan_stats unused;
+	struct scan scan = {
+		.root   = root,
+		.index  = index,
+		.old    = old && old->nr_dirs ? old : NULL,
+		.cancel = cancel,
+		.stats  = stats ? stats : &unused,
+	};
+	memset(index, 0, sizeof *index);
+	memset(scan.stats, 0, sizeof *scan.stats);
+
+	if (scan.old) {
+		scan.old_dirs = malloc(old->nr_dirs * sizeof *scan.old_dirs);
+		if (!scan.old_dirs) return false;
+		for (uint32_t d = 0; d < old->nr_dirs; d++) {
+			scan.old_dirs[d].path = music_index_string(old, old->dirs[d].path);
+			scan.old_dirs[d].dir  = d;
+		}
+		qsort(scan.old_dirs, old->nr_dirs, sizeof *scan.old_dirs,
+		      compare_old_dirs);
+	}
+
+	// Offset 0 is the empty string
+	bool ok = grow((void **)&index->strings, &scan.strings_capacity, 1, 1);
+	if (ok) {
+		index->strings[0]   = '\0';
+		index->strings_size = 1;
+		ok                  = scan_dir(&scan, "", MUSIC_INDEX_NO_DIR, 0);
+	}
+	free(scan.old_dirs);
+	if (!ok) music_index_free(index);
+	return ok;
+}
+
+bool music_index_load(struct music_index *index, const char *path) {
+	memset(index, 0, sizeof *index);
+	FILE *f = fopen(path, "rb");
+	if (!f) return false;
+
+	struct music_index_header header;
+	bool ok = fread(&header, sizeof header, 1, f) == 1 &&
+	          memcmp(header.magic, MUSIC_INDEX_MAGIC, 4) == 0 &&
+	          header.version == MUSIC_INDEX_VERSION && header.nr_dirs > 0 &&
+	          header.strings_size > 0 && header.nr_dirs < (1u << 24) &&
+	          header.nr_tracks < (1u << 24) &&
+	          header.strings_size < (1u << 28);
+	if (ok) {
+		index->nr_dirs      = header.nr_dirs;
+		index->nr_tracks    = header.nr_tracks;
+		index->strings_size = header.strings_size;
+		index->dirs   = malloc(index->nr_dirs * sizeof *index->dirs);
+		index->tracks = malloc((index->nr_tracks ? index->nr_tracks : 1) *
+		                       sizeof *index->tracks);
+		index->strings = malloc(index->strings_size);
+		ok = index->dirs && index->tracks && index->strings &&
+		     fread(index->dirs, sizeof *index->dirs, index->nr_dirs, f) ==
+		         index->nr_dirs &&
+		     fread(index->tracks, sizeof *index->tracks, index->nr_tracks,
+		           f) == index->nr_tracks &&
+		     fread(index->strings, 1, index->strings_size, f) ==
+		         index->strings_size;
+	}
+	fclose(f);
+
+	// Every lookup stays inside the index, also for a damaged file
+	for (uint32_t d = 0; ok && d < index->nr_dirs; d++)
+		ok = index->dirs[d].first_track <= index->nr_tracks &&
+		     index->dirs[d].nr_tracks <=
+		         index->nr_tracks - index->dirs[d].first_track;
+	for (uint32_t t = 0; ok && t < index->nr_tracks; t++)
+		ok = index->tracks[t].dir < index->nr_dirs;
+	if (!ok) {
+		music_index_free(index);
+		return false;
+	}
+	index->strings[index->strings_size - 1] = '\0';
+	return true;
+}
+
+bool music_index_save(const struct music_index *index, const char *path) {
+	char temporary[MUSIC_INDEX_PATH_LENGTH];
+	if (snprintf(temporary, sizeof temporary, "%s.tmp", path) >=
+	    (int)sizeof temporary)
+		return false;
+
+	FILE *f = fopen(temporary, "wb");
+	if (!f) return false;
+
+	struct music_index_header header = {
+		.version      = MUSIC_INDEX_VERSION,
+		.nr_dirs      = index->nr_dirs,
+		.nr_tracks    = index->nr_tracks,
+		.strings_size = index->strings_size,
+	};
+	memcpy(header.magic, MUSIC_INDEX_MAGIC, 4);
+	bool ok =
+	    fwrite(&header, sizeof header, 1, f) == 1 &&
+	    fwrite(index->dirs, sizeof *index->dirs, index->nr_dirs, f) ==
+	        index->nr_dirs &&
+	    fwrite(index->tracks, sizeof *index->tracks, index->nr_tracks, f) ==
+	        index->nr_tracks &&
+	    fwrite(index->strings, 1, index->strings_size, f) ==
+	        index->strings_size;
+	if (fclose(f) != 0) ok = false;
+
+	// FAT cannot rename onto an existing file
+	if (ok) remove(path);
+	if (ok) ok = rename(temporary, path) == 0;
+	if (!ok) remove(temporary);
+	return ok;
+}
+
+void music_index_free(struct music_index *index) {
+	free(index->dirs);
+	free(index->tracks);
+	free(index->strings);
+	memset(index, 0, sizeof *index);
+}
+
+bool music_index_track_path(const struct music_index *index, uint32_t track,
+                            const char *root, char *path, size_t size) {
+	if (track >= index->nr_tracks) return false;
+
+	const struct music_track *t = &index->tracks[track];
+	const char *dir = music_index_string(index, index->dirs[t->dir].path);
+	const char *name = music_index_string(index, t->name);
+	int length = dir[0] ? snprintf(path, size, "%s/%s/%s", root, dir, name)
+	                    : snprintf(path, size, "%s/%s", root, name);
+	return length >= 0 && (size_t)length < size;
+}
+
+uint32_t music_index_seek_offset(const struct music_index *index,
+                                 uint32_t track, uint32_t position_ms) {
+	const struct music_track *t = &index->tracks[track];
+	if (t->duration_ms == 0 || position_ms >= t->duration_ms)
+		return t->data_offset + t->data_length;
+
+	// Exact for a constant bitrate, close enough for a variable one
+	return t->data_offset +
+	       (uint32_t)((uint64_t)t->data_length * position_ms / t->duration_ms);
+}
+
+uint32_t music_index_position_ms(const struct music_index *index,
+                                 uint32_t track, uint32_t offset) {
+	const struct music_track *t = &index->tracks[track];
+	if (offset <= t->data_offset || t->data_length == 0) return 0;
+	if (offset >= t->data_offset + t->data_length) return t->duration_ms;
+
+	return (uint32_t)((uint64_t)(offset - t->data_offset) * t->duration_ms /
+	                  t->data_length);
+}
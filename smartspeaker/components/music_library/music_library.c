@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "audio_element.h"
+#include "audio_event_iface.h"
+#include "audio_mem.h"
+#include "audio_pipeline.h"
+#include "audio_tee.h"
+#include "audio_tee_tap.h"
+#include "i2s_stream.h"
+#include "mp3_decoder.h"
+#include "read_ahead_stream.h"
+
+#include "sd_storage.h"
+#include "utils/macro.h"
+
+#include "music_index.h"
+#include "music_library.h"
+
+#define SEND_MUSIC_CMD(ok) SEND_CMD(8004, 8004, ok, evt)
+
+// Room for the recursion of the scan, see MUSIC_INDEX_MAX_DEPTH
+#define MUSIC_LIBRARY_SCAN_STACK 12288
+// The scan task ends right after it reported, its report waits for that
+#define MUSIC_LIBRARY_SCAN_WAIT  pdMS_TO_TICKS(100)
+
+static const char *TAG = "MUSIC_LIBRARY";
+
+static audio_pipeline_handle_t pipeline;
+static audio_element_handle_t file_reader, mp3_decoder, tee,
+    i2s_stream_writer;
+static audio_event_iface_handle_t evt;
+static sd_storage_handle_t storage;
+
+static struct music_index library;
+static uint32_t *order;   // Tracks in the order they are played
+static uint32_t position; // Index into order of the current track
+static bool playing;      // The pipeline was started with a track
+static bool shuffle;
+static uint32_t failed_opens;
+
+struct music_scan {
+	TaskHandle_t task; // NULL if no scan is running
+	SemaphoreHandle_t done;
+	volatile bool cancel;
+	bool ok;
+	struct music_index index;
+	struct music_index_scan_stats stats;
+	int64_t duration_us;
+};
+
+static struct music_scan scan;
+
+static bool music_library_initialized = false;
+
+/**
+ * Build the order of play, a Fisher-Yates shuffle when shuffling that puts
+ * first at the front
+ */
+static esp_err_t music_library_set_order(uint32_t first) {
+	free(order);
+	order    = NULL;
+	position = 0;
+	if (!library.nr_tracks) return ESP_OK;
+
+	order = malloc(library.nr_tracks * sizeof *order);
+	ESP_RETURN_ON_FALSE(order, ESP_ERR_NO_MEM, TAG, "No memory for order");
+	for (uint32_t t = 0; t < library.nr_tracks; t++) order[t] = t;
+	if (!shuffle) {
+		position = first < library.nr_tracks ? first : 0;
+		return ESP_OK;
+	}
+
+	for (uint32_t t = library.nr_tracks - 1; t > 0; t--) {
+		uint32_t other = esp_random() % (t + 1);
+		uint32_t swap  = order[t];
+		order[t]       = order[other];
+		order[other]   = swap;
+	}
+	for (uint32_t t = 0; t < library.nr_tracks; t++) {
+		if (order[t] != first) continue;
+		order[t] = order[0];
+		order[0] = first;
+		break;
+	}
+	return ESP_OK;
+}
+
+/**
+ * Start a track from a byte of its file, the elements are reset like for a
+ * new radio channel
+ */
+static esp_err_t music_library_play(uint32_t new_position, uint32_t offset) {
+	if (!order) return ESP_ERR_NOT_FOUND;
+
+	position       = new_position % library.nr_tracks;
+	uint32_t track = order[position];
+	char path[MUSIC_INDEX_PATH_LENGTH + sizeof CONFIG_MUSIC_LIBRARY_ROOT];
+	ESP_RETURN_ON_FALSE(music_index_track_path(&library, track,
+	                                           CONFIG_MUSIC_LIBRARY_ROOT, path,
+	                                           sizeof path),
+	                    ESP_ERR_INVALID_SIZE, TAG, "Path of track too long");
+
+	const struct music_track *t = &library.tracks[track];
+	ESP_LOGI(TAG, "Playing %s - %s (%s), %u:%02u from %u s",
+	         music_index_string(&library, t->artist),
+	         music_index_string(&library, t->title),
+	         music_index_string(&library, t->album), t->duration_ms / 60000,
+	         t->duration_ms / 1000 % 60,
+	         music_index_position_ms(&library, track, offset) / 1000);
+
+	if (playing) {
+		audio_pipeline_stop(pipeline);
+		audio_pipeline_wait_for_stop(pipeline);
+	}
+	ESP_RETURN_ON_ERROR(audio_element_reset_state(file_reader), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_element_reset_state(mp3_decoder), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_element_reset_state(tee), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_element_reset_state(i2s_stream_writer), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_reset_ringbuffer(pipeline), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_reset_items_state(pipeline), TAG, "");
+
+	ESP_RETURN_ON_ERROR(audio_element_set_uri(file_reader, path), TAG, "");
+	// The reader seeks to it when it opens the file
+	ESP_RETURN_ON_ERROR(audio_element_set_byte_pos(file_reader, offset), TAG,
+	                    "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_run(pipeline), TAG, "");
+	playing = true;
+
+	return ESP_OK;
+}
+
+/**
+ * Take over a new index, the current track keeps playing where it is in the
+ * new index
+ */
+static esp_err_t music_library_adopt(struct music_index *new_index) {
+	uint32_t current = UINT32_MAX;
+	if (playing && order) {
+		const struct music_track *t = &library.tracks[order[position]];
+		const char *dir =
+		    music_index_string(&library, library.dirs[t->dir].path);
+		const char *name = music_index_string(&library, t->name);
+		for (uint32_t n = 0; n < new_index->nr_tracks; n++) {
+			const struct music_track *c = &new_index->tracks[n];
+			if (strcmp(music_index_string(new_index, c->name), name) == 0 &&
+			    strcmp(music_index_string(
+			               new_index, new_index->dirs[c->dir].path),
+			           dir) == 0) {
+				current = n;
+				break;
+			}
+		}
+	}
+
+	music_index_free(&library);
+	library = *new_index;
+	memset(new_index, 0, sizeof *new_index);
+	ESP_RETURN_ON_ERROR(music_library_set_order(current), TAG, "");
+
+	if (!playing && library.nr_tracks) return music_library_play(0, 0);
+	return ESP_OK;
+}
+
+static void music_library_scan_task(void *args) {
+	const struct music_index *old = args;
+	int64_t start                 = esp_timer_get_time();
+	scan.ok = music_index_scan(&scan.index, CONFIG_MUSIC_LIBRARY_ROOT, old,
+	                           &scan.cancel, &scan.stats);
+	scan.duration_us = esp_timer_get_time() - start;
+
+	// Unchanged folders are not read, an unchanged library is not written
+	if (scan.ok && scan.stats.dirs_read &&
+	    !music_index_save(&scan.index, CONFIG_MUSIC_LIBRARY_INDEX))
+		ESP_LOGW(TAG, "Could not write %s", CONFIG_MUSIC_LIBRARY_INDEX);
+	if (scan.ok && scan.stats.dirs_read)
+		sd_storage_invalidate(storage, CONFIG_MUSIC_LIBRARY_INDEX);
+
+	// Done last, deinit destroys evt once it has it
+	SEND_MUSIC_CMD(scan.ok);
+	xSemaphoreGive(scan.done);
+	vTaskDelete(NULL);
+}
+
+/**
+ * Cancel the scan task and wait for it to end
+ */
+static void music_library_cancel_scan(void) {
+	if (!scan.task) return;
+
+	scan.cancel = true;
+	xSemaphoreTake(scan.done, portMAX_DELAY);
+	scan.task = NULL;
+}
+
+esp_err_t music_library_rescan(void) {
+	if (!music_library_initialized) return ESP_ERR_INVALID_STATE;
+	if (scan.task) {
+		ESP_LOGW(TAG, "Already scanning the library");
+		return ESP_OK;
+	}
+
+	// The current index is only read by both tasks until the scan ends
+	scan.cancel = false;
+	const struct music_index *old = library.nr_dirs ? &library : NULL;
+	ESP_RETURN_ON_FALSE(xTaskCreate(music_library_scan_task, "music_scan",
+	                                MUSIC_LIBRARY_SCAN_STACK, (void *)old, 4,
+	                                &scan.task) == pdPASS,
+	                    ESP_ERR_NO_MEM, TAG, "Could not start scan task");
+	ESP_LOGI(TAG, "Scanning %s", CONFIG_MUSIC_LIBRARY_ROOT);
+
+	return ESP_OK;
+}
+
+static void music_library_finish_scan(void) {
+	// A scan of an earlier visit of the state may still report
+	if (!scan.task ||
+	    xSemaphoreTake(scan.done, MUSIC_LIBRARY_SCAN_WAIT) != pdTRUE)
+		return;
+	scan.task = NULL;
+	if (!scan.ok) {
+		ESP_LOGW(TAG, "Scanning %s failed", CONFIG_MUSIC_LIBRARY_ROOT);
+		return;
+	}
+
+	ESP_LOGI(TAG,
+	         "Scanned %u folders and %u tracks in %u ms: %u folders read, %u "
+	         "reused, %u tracks parsed, %u reused",
+	         scan.index.nr_dirs, scan.index.nr_tracks,
+	         (unsigned)(scan.duration_us / 1000), scan.stats.dirs_read,
+	         scan.stats.dirs_reused, scan.stats.tracks_parsed,
+	         scan.stats.tracks_reused);
+	if (!scan.stats.dirs_read && library.nr_dirs) {
+		music_index_free(&scan.index);
+		return;
+	}
+	if (music_library_adopt(&scan.index) != ESP_OK)
+		ESP_LOGE(TAG, "Could not play the new index");
+}
+
+esp_err_t music_library_init(audio_element_handle_t *elems, size_t count,
+                             audio_event_iface_handle_t evt_handle,
+                             esp_periph_set_handle_t periph_set, void *args) {
+	if (music_library_initialized) {
+		ESP_LOGW(TAG, "Music library already initialized, skipping "
+		              "initialization");
+		return ESP_OK;
+	}
+
+	ESP_RETURN_ON_ERROR(sd_storage_acquire(&storage), TAG, "No SD card");
+
+	// Initialize read-ahead stream, it seeks to the byte position when it
+	// opens and keeps playing while the card is slow
+	read_ahead_stream_cfg_t file_cfg = DEFAULT_READ_AHEAD_STREAM_CONFIG();
+	file_reader                      = read_ahead_stream_init(&file_cfg);
+
+	// Initialize MP3 decoder
+	mp3_decoder_cfg_t mp3_cfg = DEFAULT_MP3_DECODER_CONFIG();
+	mp3_decoder               = mp3_decoder_init(&mp3_cfg);
+
+	// Initialize tee, it publishes the decoded audio for analysis
+	audio_tee_cfg_t tee_cfg = DEFAULT_AUDIO_TEE_CONFIG();
+	tee                     = audio_tee_init(&tee_cfg);
+
+	// Initialize I2S stream
+	i2s_stream_cfg_t i2s_cfg = I2S_STREAM_CFG_DEFAULT();
+	i2s_cfg.type             = AUDIO_STREAM_WRITER;
+	i2s_stream_writer        = i2s_stream_init(&i2s_cfg);
+
+	// Initialize audio pipeline
+	// [sdcard]-->read_ahead-->mp3_decoder-->tee-->i2s_stream-->[codec_chip]
+	audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
+	pipeline                          = audio_pipeline_init(&pipeline_cfg);
+	ESP_RETURN_ON_ERROR(audio_pipeline_register(pipeline, file_reader, "file"),
+	                    TAG, "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_register(pipeline, mp3_decoder, "mp3"),
+	                    TAG, "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_register(pipeline, tee, "tee"), TAG,
+	                    "");
+	ESP_RETURN_ON_ERROR(
+	    audio_pipeline_register(pipeline, i2s_stream_writer, "i2s"), TAG, "");
+	ESP_RETURN_ON_ERROR(
+	    audio_pipeline_link(
+	        pipeline, (const char *[]){ "file", "mp3", "tee", "i2s" }, 4),
+	    TAG, "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_set_listener(pipeline, evt_handle), TAG,
+	                    "");
+	audio_tee_set_playback(tee);
+
+	// The scan task reports through its own interface
+	audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
+	evt                             = audio_event_iface_init(&evt_cfg);
+	audio_event_iface_set_listener(evt, evt_handle);
+	if (!scan.done) scan.done = xSemaphoreCreateBinary();
+	ESP_RETURN_ON_FALSE(scan.done, ESP_ERR_NO_MEM, TAG, "");
+
+	playing                   = false;
+	failed_opens              = 0;
+	music_library_initialized = true;
+
+	// Play from the index right away, changes on the card are picked up by
+	// the scan behind it
+	int64_t start = esp_timer_get_time();
+	if (music_index_load(&library, CONFIG_MUSIC_LIBRARY_INDEX)) {
+		ESP_LOGI(TAG, "Loaded %u folders and %u tracks in %u ms",
+		         library.nr_dirs, library.nr_tracks,
+		         (unsigned)((esp_timer_get_time() - start) / 1000));
+		ESP_RETURN_ON_ERROR(music_library_set_order(0), TAG, "");
+		if (library.nr_tracks) music_library_play(0, 0);
+	} else {
+		ESP_LOGI(TAG, "No index at %s, playing after the first scan",
+		         CONFIG_MUSIC_LIBRARY_INDEX);
+	}
+	ESP_RETURN_ON_ERROR(music_library_rescan(), TAG, "");
+
+	audio_mem_print("MUSIC LIBRARY MEM CHECK", __LINE__, __FUNCTION__);
+
+	return ESP_OK;
+}
+
+esp_err_t music_library_deinit(audio_element_handle_t *elems, size_t count,
+                               audio_event_iface_handle_t evt_handle,
+                               esp_periph_set_handle_t periph_set,
+                               void *args) {
+	if (!music_library_initialized) {
+		ESP_LOGW(TAG, "Music library already deinitialized, skipping "
+		              "deinitialization");
+		return ESP_OK;
+	}
+
+	music_library_cancel_scan();
+	music_index_free(&scan.index);
+
+	audio_event_iface_remove_listener(evt, evt_handle);
+	audio_event_iface_destroy(evt);
+	ESP_RETURN_ON_ERROR(audio_pipeline_remove_listener(pipeline), TAG, "");
+	audio_tee_set_playback(NULL);
+
+	if (playing) {
+		audio_pipeline_stop(pipeline);
+		audio_pipeline_wait_for_stop(pipeline);
+	}
+	ESP_RETURN_ON_ERROR(audio_pipeline_terminate(pipeline), TAG, "");
+
+	ESP_RETURN_ON_ERROR(audio_pipeline_unregister(pipeline, file_reader), TAG,
+	                    "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_unregister(pipeline, mp3_decoder), TAG,
+	                    "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_unregister(pipeline, tee), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_unregister(pipeline, i2s_stream_writer),
+	                    TAG, "");
+
+	ESP_RETURN_ON_ERROR(audio_pipeline_deinit(pipeline), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_element_deinit(file_reader), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_element_deinit(mp3_decoder), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_element_deinit(tee), TAG, "");
+	audio_element_deinit(i2s_stream_writer);
+
+	// The index is loaded again on the next visit, it is quick
+	music_index_free(&library);
+	free(order);
+	order   = NULL;
+	playing = false;
+
+	sd_storage_release(storage);
+	storage = NULL;
+
+	music_library_initialized = false;
+
+	return ESP_OK;
+}
+
+esp_err_t music_library_next(void) {
+	if (!music_library_initialized) return ESP_ERR_INVALID_STATE;
+	return music_library_play(position + 1, 0);
+}
+
+esp_err_t music_library_prev(void) {
+	if (!music_library_initialized) return ESP_ERR_INVALID_STATE;
+	if (!library.nr_tracks) return ESP_ERR_NOT_FOUND;
+	return music_library_play(position + library.nr_tracks - 1, 0);
+}
+
+esp_err_t music_library_next_folder(void) {
+	if (!music_library_initialized) return ESP_ERR_INVALID_STATE;
+	if (!order) return ESP_ERR_NOT_FOUND;
+
+	// Folders are browsed in the order of the card, not shuffled
+	uint32_t dir = library.tracks[order[position]].dir;
+	for (uint32_t d = 1; d <= library.nr_dirs; d++) {
+		const struct music_dir *next =
+		    &library.dirs[(dir + d) % library.nr_dirs];
+		if (!next->nr_tracks) continue;
+		ESP_LOGI(TAG, "Next folder %s",
+		         music_index_string(&library, next->path));
+		shuffle = false;
+		ESP_RETURN_ON_ERROR(music_library_set_order(next->first_track), TAG,
+		                    "");
+		return music_library_play(position, 0);
+	}
+	return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t music_library_set_shuffle(bool new_shuffle) {
+	shuffle = new_shuffle;
+	ESP_LOGI(TAG, "Shuffle %s", shuffle ? "on" : "off");
+	if (!order) return ESP_OK;
+
+	return music_library_set_order(order[position]);
+}
+
+bool music_library_get_shuffle(void) { return shuffle; }
+
+esp_err_t music_library_seek(int seconds) {
+	if (!music_library_initialized) return ESP_ERR_INVALID_STATE;
+	if (!order || !playing) return ESP_ERR_NOT_FOUND;
+
+	// From where the decoder is, only its buffers and the I2S DMA buffers
+	// are ahead of the speaker
+	int64_t byte_pos = read_ahead_stream_get_decoded_pos(file_reader);
+	uint32_t track   = order[position];
+	int64_t position_ms =
+	    (int64_t)music_index_position_ms(&library, track, byte_pos) +
+	    (int64_t)seconds * 1000;
+	if (position_ms < 0) position_ms = 0;
+	if (position_ms >= library.tracks[track].duration_ms)
+		return music_library_next();
+
+	return music_library_play(
+	    position, music_index_seek_offset(&library, track, position_ms));
+}
+
+esp_err_t music_library_run(audio_event_iface_msg_t *msg, void *args) {
+	if (!music_library_initialized) return ESP_FAIL;
+
+	if (msg->source_type == 8004 && msg->cmd == 8004) {
+		music_library_finish_scan();
+	} else if (msg->source_type == AUDIO_ELEMENT_TYPE_ELEMENT &&
+	           msg->source == (void *)mp3_decoder &&
+	           msg->cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO) {
+		audio_element_info_t music_info = { 0 };
+		ESP_RETURN_ON_ERROR(audio_element_getinfo(mp3_decoder, &music_info),
+		                    TAG, "Could not get audio info");
+
+		ESP_LOGI(TAG, "Received music info, sample_rates=%d, bits=%d, ch=%d",
+		         music_info.sample_rates, music_info.bits, music_info.channels);
+
+		ESP_RETURN_ON_ERROR(audio_element_setinfo(tee, &music_info), TAG,
+		                    "Could not set tee info");
+		ESP_RETURN_ON_ERROR(
+		    i2s_stream_set_clk(i2s_stream_writer, music_info.sample_rates,
+		                       music_info.bits, music_info.channels),
+		    TAG, "Could not set I2S clock");
+	} else if (msg->source_type == AUDIO_ELEMENT_TYPE_ELEMENT &&
+	           msg->source == (void *)i2s_stream_writer &&
+	           msg->cmd == AEL_MSG_CMD_REPORT_STATUS &&
+	           (int)msg->data == AEL_STATUS_STATE_FINISHED) {
+		// Stopping for a skip reports STOPPED, only the end of a track
+		// finishes
+		failed_opens = 0;
+		ESP_RETURN_ON_ERROR(music_library_next(), TAG, "Could not play next");
+	} else if (msg->source_type == AUDIO_ELEMENT_TYPE_ELEMENT &&
+	           msg->source == (void *)file_reader &&
+	           msg->cmd == AEL_MSG_CMD_REPORT_STATUS &&
+	           (int)msg->data == AEL_STATUS_ERROR_OPEN) {
+		// Removed since the last scan, stop when none of them opens
+		if (++failed_opens >= library.nr_tracks) {
+			ESP_LOGE(TAG, "No track could be opened, rescan the card");
+			return ESP_FAIL;
+		}
+		ESP_LOGW(TAG, "Failed to open the track, skipping it");
+		ESP_RETURN_ON_ERROR(music_library_next(), TAG, "Could not play next");
+	}
+
+	return ESP_OK;
+}
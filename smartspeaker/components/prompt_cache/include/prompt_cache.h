@@ -0,0 +1,83 @@
+#ifndef PROMPT_CACHE_H
+#define PROMPT_CACHE_H
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Longest path of a cached prompt, including the terminator
+#define PROMPT_PATH_LENGTH 32
+
+/// Prompts that can be cached at the same time
+#define PROMPT_CACHE_MAX_PROMPTS 64
+
+/**
+ * @brief Decoded PCM of a clip, read-only for everyone but the cache.
+ */
+typedef struct prompt {
+	char path[PROMPT_PATH_LENGTH]; // File the prompt was decoded from
+	char *data;                    // Interleaved PCM as the decoder wrote it
+	size_t length;                 // Bytes in data
+	int sample_rate;
+	int channels;
+	int bits;
+	uint32_t last_used; // Lookup counter at the last use, private
+	int refs;           // Readers playing the prompt, private
+} prompt_t;
+
+/**
+ * @brief Counters of the cache since it was set up.
+ *
+ * Time to first sample runs from the request to play a clip until its first
+ * PCM leaves the source, the file lookup and the decoder for a miss.
+ */
+struct prompt_cache_stats {
+	uint32_t hits;          // Clips played from the cache
+	uint32_t misses;        // Clips that had to be decoded
+	uint32_t evictions;     // Prompts dropped to make room
+	uint32_t prompts;       // Prompts cached now
+	size_t bytes;           // Memory used by the cached prompts
+	uint32_t hit_ttfs_us;   // Average time to first sample of a hit [us]
+	uint32_t miss_ttfs_us;  // Average time to first sample of a miss [us]
+};
+
+/**
+ * @brief Set up the cache with a memory budget of budget bytes. The cache is
+ * kept until reboot, calling it again does nothing.
+ */
+esp_err_t prompt_cache_init(size_t budget);
+
+/**
+ * @brief Look up the prompt decoded from path and count a hit or a miss.
+ * @return prompt, to be handed back with prompt_cache_release(), or NULL
+ */
+const prompt_t *prompt_cache_acquire(const char *path);
+void prompt_cache_release(const prompt_t *prompt);
+
+/**
+ * @brief Check if length bytes could be cached, possibly by evicting prompts
+ * that are not being played.
+ */
+bool prompt_cache_fits(size_t length);
+
+/**
+ * @brief Add a decoded prompt, the least recently used prompts are evicted to
+ * stay within the budget.
+ * @param data PCM from heap_caps_malloc(), owned by the cache from now on,
+ * also on error
+ * @return ESP_ERR_NO_MEM if the prompt does not fit
+ */
+esp_err_t prompt_cache_insert(const char *path, char *data, size_t length,
+                              int sample_rate, int channels, int bits);
+
+/**
+ * @brief Record the time to first sample of a clip.
+ * @param hit true if the clip was played from the cache
+ */
+void prompt_cache_report_ttfs(bool hit, uint32_t ttfs_us);
+
+void prompt_cache_get_stats(struct prompt_cache_stats *stats);
+
+#endif /* PROMPT_CACHE_H */
@@ -0,0 +1,57 @@
+#ifndef PROMPT_PACK_H
+#define PROMPT_PACK_H
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "prompt_pack_format.h"
+
+/// Separates the pack from the id in the path of a packed clip
+#define PROMPT_PACK_SEPARATOR '#'
+
+typedef struct prompt_pack *prompt_pack_handle_t;
+
+/**
+ * @brief Open a pack and read its table, the file stays open until the pack
+ * is closed.
+ * @return pack or NULL if the file is missing or not a valid pack
+ */
+prompt_pack_handle_t prompt_pack_open(const char *path);
+void prompt_pack_close(prompt_pack_handle_t pack);
+
+/**
+ * @brief Path the pack was opened with.
+ */
+const char *prompt_pack_get_path(prompt_pack_handle_t pack);
+
+/**
+ * @brief Look a clip up in the table of the pack.
+ * @return ESP_ERR_NOT_FOUND if the pack has no clip with the id
+ */
+esp_err_t prompt_pack_find(prompt_pack_handle_t pack, uint32_t id,
+                           struct prompt_pack_entry *entry);
+
+/**
+ * @brief Read the payload of a clip into data, entry->length bytes.
+ */
+esp_err_t prompt_pack_read(prompt_pack_handle_t pack,
+                           const struct prompt_pack_entry *entry, void *data);
+
+/**
+ * @brief Write the path of a packed clip, "<pack>#<id>", the form the
+ * playlist and the prompt cache take.
+ * @return false if it does not fit in size
+ */
+bool prompt_pack_clip_path(char *path, size_t size, const char *pack,
+                           uint32_t id);
+
+/**
+ * @brief Split the path of a packed clip into the path of the pack and the id.
+ * @return false if path is an ordinary file
+ */
+bool prompt_pack_parse_clip_path(const char *path, char *pack, size_t size,
+                                 uint32_t *id);
+
+#endif /* PROMPT_PACK_H */
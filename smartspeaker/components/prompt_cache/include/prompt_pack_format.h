@@ -0,0 +1,71 @@
+#ifndef PROMPT_PACK_FORMAT_H
+#define PROMPT_PACK_FORMAT_H
+#pragma once
+
+/*
+ * Layout of a prompt pack, shared by the firmware and the host packer.
+ *
+ * A pack holds every clip of one language in a single file:
+ *
+ *   header | entries[nr_entries] | padding | payload | padding | payload ...
+ *
+ * The entries are sorted by id. Every payload starts on a multiple of
+ * PROMPT_PACK_ALIGNMENT, so reading a clip is one seek and whole sectors of
+ * the card. All fields are little-endian.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define PROMPT_PACK_MAGIC       "SPPK"
+#define PROMPT_PACK_VERSION     1
+/// Alignment of the payloads, the sector size of the card
+#define PROMPT_PACK_ALIGNMENT   512
+/// Clips in one pack at most
+#define PROMPT_PACK_MAX_ENTRIES 1024
+
+/// Bit set in the ids of clips with a name that is not a number
+#define PROMPT_PACK_NAMED_ID 0x80000000u
+
+enum prompt_pack_format {
+	PROMPT_PACK_FORMAT_MP3 = 1,
+};
+
+struct prompt_pack_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t nr_entries;
+	uint32_t alignment;
+	uint32_t reserved;
+};
+
+struct prompt_pack_entry {
+	uint32_t id;
+	uint32_t offset; // Bytes from the start of the pack
+	uint32_t length; // Bytes of the payload
+	uint16_t format; // enum prompt_pack_format
+	uint16_t reserved;
+};
+
+/**
+ * @brief Id of the clip that was the file name (without extension) in the
+ * folder layout: "59" is 59, names that are not a number are hashed, e.g.
+ * "cu".
+ */
+static inline uint32_t prompt_pack_id(const char *name) {
+	char *end;
+	unsigned long number = strtoul(name, &end, 10);
+	if (end != name && *end == '\0' && number < PROMPT_PACK_NAMED_ID)
+		return (uint32_t)number;
+
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (const char *c = name; *c; c++) {
+		hash ^= (uint8_t)*c;
+		hash *= 16777619u;
+	}
+	return hash | PROMPT_PACK_NAMED_ID;
+}
+
+#endif /* PROMPT_PACK_FORMAT_H */
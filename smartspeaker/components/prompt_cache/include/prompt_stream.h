@@ -0,0 +1,73 @@
+#ifndef PROMPT_STREAM_H
+#define PROMPT_STREAM_H
+#pragma once
+
+#include "audio_element.h"
+#include "prompt_cache.h"
+
+/// Clips in one announcement at most
+#define PROMPT_STREAM_MAX_CLIPS 8
+
+/**
+ * @brief Layout of the decoded audio of one clip in a playlist.
+ *
+ * The decoder output of the clip is pcm_length bytes, of which skip_start
+ * bytes of encoder and decoder delay and skip_end bytes of padding are not
+ * part of the clip.
+ */
+struct prompt_clip {
+	char path[PROMPT_PATH_LENGTH];
+	size_t pcm_length;  // Bytes the decoder produces for the clip
+	size_t skip_start;  // Bytes to drop at the start
+	size_t skip_end;    // Bytes to drop at the end
+	int sample_rate;
+	int channels;
+	int64_t request_us; // Time the playlist was set
+};
+
+/**
+ * @brief Create a source element that plays cached prompts back-to-back.
+ */
+audio_element_handle_t prompt_reader_init(void);
+
+/**
+ * @brief Play prompts on the next run, the reader holds them until other
+ * prompts are set or the element is deinitialised.
+ */
+void prompt_reader_set_prompts(audio_element_handle_t el,
+                               const prompt_t *const prompts[], int nr_prompts);
+
+/**
+ * @brief Create an element that passes the decoded clips of a playlist on
+ * without their delay and padding and adds every complete clip to the cache.
+ *
+ * Audio for which no clip was announced is passed on unchanged.
+ */
+audio_element_handle_t prompt_recorder_init(void);
+
+/**
+ * @brief Announce the next clip the decoder is going to produce, called by
+ * the playlist before the first byte of the clip enters the decoder.
+ */
+void prompt_recorder_add_clip(audio_element_handle_t el,
+                              const struct prompt_clip *clip);
+
+/**
+ * @brief Create a source element that streams the MP3 files of a playlist
+ * back-to-back into one decoder.
+ *
+ * A task reads every file completely while the previous one is streamed, so
+ * the lookup of the next file does not interrupt the stream. ID3 tags and the
+ * Xing/Info frame are not passed on, the decoder only sees audio frames.
+ * @param recorder element after the decoder that gets the clip layouts, or
+ * NULL
+ */
+audio_element_handle_t prompt_playlist_init(audio_element_handle_t recorder);
+
+/**
+ * @brief Play the files in paths on the next run.
+ */
+void prompt_playlist_set(audio_element_handle_t el, const char *const paths[],
+                         int nr_paths);
+
+#endif /* PROMPT_STREAM_H */
@@ -0,0 +1,184 @@
+#include "prompt_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "PROMPT_CACHE";
+
+static prompt_t prompts[PROMPT_CACHE_MAX_PROMPTS];
+static SemaphoreHandle_t lock; // Protects the prompts and the counters
+static size_t budget;
+static size_t used;
+static uint32_t lookups; // Counter to order the prompts by their last use
+
+static struct prompt_cache_stats stats;
+static uint64_t hit_ttfs_total;
+static uint32_t hit_ttfs_count;
+static uint64_t miss_ttfs_total;
+static uint32_t miss_ttfs_count;
+
+static prompt_t *prompt_cache_find(const char *path) {
+	for (int p = 0; p < PROMPT_CACHE_MAX_PROMPTS; p++)
+		if (prompts[p].data && strcmp(prompts[p].path, path) == 0)
+			return &prompts[p];
+	return NULL;
+}
+
+/**
+ * Find the least recently used prompt that is not being played
+ */
+static prompt_t *prompt_cache_lru(void) {
+	prompt_t *lru = NULL;
+	for (int p = 0; p < PROMPT_CACHE_MAX_PROMPTS; p++) {
+		if (!prompts[p].data || prompts[p].refs > 0) continue;
+		if (!lru || lookups - prompts[p].last_used > lookups - lru->last_used)
+			lru = &prompts[p];
+	}
+	return lru;
+}
+
+static void prompt_cache_evict(prompt_t *prompt) {
+	ESP_LOGD(TAG, "Evict %s (%u bytes)", prompt->path,
+	         (unsigned)prompt->length);
+	used -= prompt->length;
+	heap_caps_free(prompt->data);
+	prompt->data = NULL;
+	stats.evictions++;
+}
+
+/**
+ * Bytes that would be free after evicting every prompt that is not played
+ */
+static size_t prompt_cache_reclaimable(void) {
+	size_t free_bytes = budget - used;
+	for (int p = 0; p < PROMPT_CACHE_MAX_PROMPTS; p++)
+		if (prompts[p].data && prompts[p].refs == 0)
+			free_bytes += prompts[p].length;
+	return free_bytes;
+}
+
+esp_err_t prompt_cache_init(size_t budget_param) {
+	if (lock) return ESP_OK;
+
+	lock = xSemaphoreCreateMutex();
+	if (!lock) return ESP_ERR_NO_MEM;
+	budget = budget_param;
+	ESP_LOGI(TAG, "Caching prompts in %u KB", (unsigned)(budget / 1024));
+	return ESP_OK;
+}
+
+const prompt_t *prompt_cache_acquire(const char *path) {
+	if (!lock) return NULL;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	prompt_t *prompt = prompt_cache_find(path);
+	if (prompt) {
+		prompt->last_used = ++lookups;
+		prompt->refs++;
+		stats.hits++;
+	} else {
+		stats.misses++;
+	}
+	xSemaphoreGive(lock);
+	return prompt;
+}
+
+void prompt_cache_release(const prompt_t *prompt) {
+	xSemaphoreTake(lock, portMAX_DELAY);
+	((prompt_t *)prompt)->refs--;
+	xSemaphoreGive(lock);
+}
+
+bool prompt_cache_fits(size_t length) {
+	if (!lock) return false;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	bool fits = length <= prompt_cache_reclaimable();
+	xSemaphoreGive(lock);
+	return fits;
+}
+
+esp_err_t prompt_cache_insert(const char *path, char *data, size_t length,
+                              int sample_rate, int channels, int bits) {
+	if (!lock || strlen(path) >= PROMPT_PATH_LENGTH || sample_rate <= 0) {
+		heap_caps_free(data);
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (prompt_cache_find(path)) {
+		// Decoded twice, e.g. the same minute and hour, keep the first one
+		xSemaphoreGive(lock);
+		heap_caps_free(data);
+		return ESP_OK;
+	}
+	if (length > prompt_cache_reclaimable()) {
+		xSemaphoreGive(lock);
+		heap_caps_free(data);
+		return ESP_ERR_NO_MEM;
+	}
+
+	prompt_t *slot = NULL;
+	for (int p = 0; p < PROMPT_CACHE_MAX_PROMPTS && !slot; p++)
+		if (!prompts[p].data) slot = &prompts[p];
+	while (used + length > budget || !slot) {
+		prompt_t *lru = prompt_cache_lru();
+		if (!lru) break;
+		prompt_cache_evict(lru);
+		if (!slot) slot = lru;
+	}
+	if (!slot || used + length > budget) {
+		xSemaphoreGive(lock);
+		heap_caps_free(data);
+		return ESP_ERR_NO_MEM;
+	}
+
+	strcpy(slot->path, path);
+	slot->data        = data;
+	slot->length      = length;
+	slot->sample_rate = sample_rate;
+	slot->channels    = channels;
+	slot->bits        = bits;
+	slot->last_used   = ++lookups;
+	slot->refs        = 0;
+	used             += length;
+	xSemaphoreGive(lock);
+
+	ESP_LOGI(TAG, "Cached %s (%u bytes, %u KB in use)", path, (unsigned)length,
+	         (unsigned)(used / 1024));
+	return ESP_OK;
+}
+
+void prompt_cache_report_ttfs(bool hit, uint32_t ttfs_us) {
+	if (!lock) return;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (hit) {
+		hit_ttfs_total   += ttfs_us;
+		stats.hit_ttfs_us = (uint32_t)(hit_ttfs_total / ++hit_ttfs_count);
+	} else {
+		miss_ttfs_total   += ttfs_us;
+		stats.miss_ttfs_us = (uint32_t)(miss_ttfs_total / ++miss_ttfs_count);
+	}
+	xSemaphoreGive(lock);
+}
+
+void prompt_cache_get_stats(struct prompt_cache_stats *out) {
+	if (!lock) {
+		memset(out, 0, sizeof *out);
+		return;
+	}
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	*out         = stats;
+	out->prompts = 0;
+	for (int p = 0; p < PROMPT_CACHE_MAX_PROMPTS; p++)
+		if (prompts[p].data) out->prompts++;
+	out->bytes = used;
+	xSemaphoreGive(lock);
+}
@@ -0,0 +1,122 @@
+#include "prompt_pack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char *TAG = "PROMPT_PACK";
+
+struct prompt_pack {
+	FILE *file;
+	char *path;
+	int nr_entries;
+	struct prompt_pack_entry *entries; // Sorted by id
+};
+
+prompt_pack_handle_t prompt_pack_open(const char *path) {
+	struct prompt_pack *pack = calloc(1, sizeof *pack);
+	if (!pack) {
+		ESP_LOGE(TAG, "Memory allocation for pack failed");
+		return NULL;
+	}
+
+	pack->file = fopen(path, "rb");
+	if (!pack->file) {
+		// No pack for this language, the clips are separate files
+		ESP_LOGD(TAG, "No pack %s", path);
+		free(pack);
+		return NULL;
+	}
+
+	struct prompt_pack_header header;
+	if (fread(&header, sizeof header, 1, pack->file) != 1 ||
+	    memcmp(header.magic, PROMPT_PACK_MAGIC, 4) != 0 ||
+	    header.version != PROMPT_PACK_VERSION ||
+	    header.nr_entries > PROMPT_PACK_MAX_ENTRIES) {
+		ESP_LOGE(TAG, "%s is not a version %d pack", path,
+		         PROMPT_PACK_VERSION);
+		goto error;
+	}
+
+	pack->nr_entries = header.nr_entries;
+	pack->entries    = malloc(pack->nr_entries * sizeof *pack->entries);
+	pack->path       = strdup(path);
+	if (!pack->entries || !pack->path ||
+	    fread(pack->entries, sizeof *pack->entries, pack->nr_entries,
+	          pack->file) != (size_t)pack->nr_entries) {
+		ESP_LOGE(TAG, "Cannot read the table of %s", path);
+		goto error;
+	}
+
+	ESP_LOGI(TAG, "Opened %s with %d clips", path, pack->nr_entries);
+	return pack;
+
+error:
+	prompt_pack_close(pack);
+	return NULL;
+}
+
+void prompt_pack_close(prompt_pack_handle_t pack) {
+	if (!pack) return;
+
+	if (pack->file) fclose(pack->file);
+	free(pack->entries);
+	free(pack->path);
+	free(pack);
+}
+
+const char *prompt_pack_get_path(prompt_pack_handle_t pack) {
+	return pack->path;
+}
+
+esp_err_t prompt_pack_find(prompt_pack_handle_t pack, uint32_t id,
+                           struct prompt_pack_entry *entry) {
+	int low = 0, high = pack->nr_entries - 1;
+	while (low <= high) {
+		int middle = low + (high - low) / 2;
+		uint32_t middle_id = pack->entries[middle].id;
+		if (middle_id == id) {
+			*entry = pack->entries[middle];
+			return ESP_OK;
+		}
+		if (middle_id < id)
+			low = middle + 1;
+		else
+			high = middle - 1;
+	}
+	return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t prompt_pack_read(prompt_pack_handle_t pack,
+                           const struct prompt_pack_entry *entry, void *data) {
+	if (fseek(pack->file, entry->offset, SEEK_SET) != 0 ||
+	    fread(data, 1, entry->length, pack->file) != entry->length) {
+		ESP_LOGE(TAG, "Cannot read clip %u of %s", (unsigned)entry->id,
+		         pack->path);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+bool prompt_pack_clip_path(char *path, size_t size, const char *pack,
+                           uint32_t id) {
+	int length = snprintf(path, size, "%s%c%u", pack, PROMPT_PACK_SEPARATOR,
+	                      (unsigned)id);
+	return length > 0 && (size_t)length < size;
+}
+
+bool prompt_pack_parse_clip_path(const char *path, char *pack, size_t size,
+                                 uint32_t *id) {
+	const char *separator = strrchr(path, PROMPT_PACK_SEPARATOR);
+	if (!separator || (size_t)(separator - path) >= size) return false;
+
+	char *end;
+	*id = (uint32_t)strtoul(separator + 1, &end, 10);
+	if (end == separator + 1 || *end != '\0') return false;
+
+	memcpy(pack, path, separator - path);
+	pack[separator - path] = '\0';
+	return true;
+}
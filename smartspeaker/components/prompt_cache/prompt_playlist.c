@@ -0,0 +1,432 @@
+/**
+ * Playlist reader
+ *
+ * Streams the MP3 files of a playlist into one decoder without restarting the
+ * pipeline. Every file is parsed before it is streamed: the frames are counted
+ * to know how much audio the decoder will produce for it, and the LAME tag in
+ * the Xing/Info frame gives the encoder delay and padding, so the recorder
+ * after the decoder can cut the clips apart and trim them.
+ *
+ * A clip is a file or a clip in a pack, "<pack>#<id>". The last pack stays
+ * open, so the clips of a sentence cost one open and a seek each.
+ *
+ * A task reads and parses the next clip while the current one is streamed,
+ * the element only waits for it when the decoder is faster than the card.
+ */
+#include "prompt_stream.h"
+#include "mp3_frame.h"
+#include "prompt_pack.h"
+#include "sd_storage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// Bytes passed on per process call
+#define PROMPT_PLAYLIST_BUFFER_LENGTH 2048
+
+// Largest file that is read, clips are a few seconds at most
+#define PROMPT_PLAYLIST_MAX_FILE_SIZE (256 * 1024)
+
+// Longest wait for the next clip before the element checks for commands
+#define PROMPT_PLAYLIST_TIMEOUT_MS 100
+
+#define PROMPT_PLAYLIST_TASK_STACK (3 * 1024)
+
+// Delay of the MP3 synthesis filter bank [samples], part of the LAME delay
+// and padding arithmetic
+#define MP3_DECODER_DELAY 529
+
+static const char *TAG = "PROMPT_PLAYLIST";
+
+struct prompt_file {
+	char *data;   // Contents of the file, NULL if none
+	size_t start; // First byte of the first audio frame
+	size_t end;   // End of the last audio frame
+	struct prompt_clip clip;
+};
+
+struct prompt_playlist {
+	char paths[PROMPT_STREAM_MAX_CLIPS][PROMPT_PATH_LENGTH];
+	int nr_paths;
+	int next;                    // Path to prefetch next
+	int64_t request_us;          // Time the playlist was set
+	audio_element_handle_t recorder;
+	struct prompt_file current;  // File being streamed
+	struct prompt_file ahead;    // File read before current ends
+	prompt_pack_handle_t pack;   // Pack of the last packed clip, or NULL
+	sd_storage_handle_t storage; // Card, held while running
+	int task_core;
+	int task_prio;
+	TaskHandle_t task;           // Prefetch task, NULL if not running
+	SemaphoreHandle_t fetch;     // Given to read the next clip into ahead
+	SemaphoreHandle_t ready;     // Given once ahead is read
+	SemaphoreHandle_t task_done;
+	bool fetching;               // The task owns ahead and the pack
+	volatile bool stop;
+};
+
+static uint32_t read_be32(const uint8_t *data) {
+	return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+	       (uint32_t)data[2] << 8 | data[3];
+}
+
+/**
+ * Read the encoder delay and padding from the LAME tag of a Xing/Info frame
+ * @return false if the frame is an audio frame
+ */
+static bool mp3_parse_info_frame(const uint8_t *data,
+                                 const struct mp3_frame *frame, int *delay,
+                                 int *padding) {
+	const uint8_t *tag = data + frame->side_info;
+	if (frame->side_info + 8 > frame->length ||
+	    (memcmp(tag, "Xing", 4) != 0 && memcmp(tag, "Info", 4) != 0))
+		return false;
+
+	uint32_t flags = read_be32(tag + 4);
+	int offset     = frame->side_info + 8;
+	if (flags & 1) offset += 4;   // Frames
+	if (flags & 2) offset += 4;   // Bytes
+	if (flags & 4) offset += 100; // Table of contents
+	if (flags & 8) offset += 4;   // Quality
+
+	*delay   = 0;
+	*padding = 0;
+	if (offset + 24 <= frame->length &&
+	    memcmp(data + offset, "LAME", 4) == 0) {
+		const uint8_t *lame = data + offset + 21;
+		*delay              = lame[0] << 4 | lame[1] >> 4;
+		*padding            = (lame[1] & 0x0f) << 8 | lame[2];
+	}
+	return true;
+}
+
+/**
+ * Find the audio frames of a file and the layout of its decoded audio
+ * @return false if the file holds no Layer III frames
+ */
+static bool prompt_file_parse(struct prompt_file *file, size_t length) {
+	const uint8_t *data = (const uint8_t *)file->data;
+	size_t pos          = 0;
+
+	// ID3v2 tag, the size is syncsafe and excludes the header and footer
+	if (length >= 10 && memcmp(data, "ID3", 3) == 0) {
+		pos = 10 + ((data[6] & 0x7f) << 21 | (data[7] & 0x7f) << 14 |
+		            (data[8] & 0x7f) << 7 | (data[9] & 0x7f));
+		if (data[5] & 0x10) pos += 10;
+	}
+
+	struct mp3_frame frame;
+	while (pos < length && !mp3_frame_parse(data + pos, length - pos, &frame))
+		pos++;
+	if (pos >= length) return false;
+
+	int delay = 0, padding = 0;
+	if (pos + frame.length <= length &&
+	    mp3_parse_info_frame(data + pos, &frame, &delay, &padding))
+		pos += frame.length;
+
+	file->start            = pos;
+	int nr_frames          = 0;
+	struct mp3_frame first = { 0 };
+	while (mp3_frame_parse(data + pos, length - pos, &frame) &&
+	       pos + frame.length <= length) {
+		if (nr_frames++ == 0) first = frame;
+		pos += frame.length;
+	}
+	if (nr_frames == 0) return false;
+	file->end = pos;
+
+	size_t frame_bytes = (size_t)first.channels * sizeof(int16_t);
+	size_t samples     = (size_t)nr_frames * first.samples;
+	size_t skip_start  = 0;
+	size_t skip_end    = 0;
+	if (delay || padding) {
+		skip_start = delay + MP3_DECODER_DELAY;
+		skip_end   = padding > MP3_DECODER_DELAY
+		                 ? padding - MP3_DECODER_DELAY
+		                 : 0;
+		if (skip_start + skip_end >= samples) skip_start = skip_end = 0;
+	}
+	file->clip.pcm_length  = samples * frame_bytes;
+	file->clip.skip_start  = skip_start * frame_bytes;
+	file->clip.skip_end    = skip_end * frame_bytes;
+	file->clip.sample_rate = first.sample_rate;
+	file->clip.channels    = first.channels;
+	return true;
+}
+
+/**
+ * Read a clip from a pack, the pack stays open for the next clips
+ */
+static bool prompt_file_read_packed(struct prompt_playlist *playlist,
+                                    const char *pack_path, uint32_t id,
+                                    char **data, size_t *length) {
+	if (!playlist->pack ||
+	    strcmp(prompt_pack_get_path(playlist->pack), pack_path) != 0) {
+		prompt_pack_close(playlist->pack);
+		playlist->pack = prompt_pack_open(pack_path);
+		if (!playlist->pack) {
+			ESP_LOGE(TAG, "Cannot open pack %s", pack_path);
+			return false;
+		}
+	}
+
+	struct prompt_pack_entry entry;
+	if (prompt_pack_find(playlist->pack, id, &entry) != ESP_OK) {
+		ESP_LOGE(TAG, "No clip %u in %s", (unsigned)id, pack_path);
+		return false;
+	}
+	if (entry.format != PROMPT_PACK_FORMAT_MP3 || entry.length == 0 ||
+	    entry.length > PROMPT_PLAYLIST_MAX_FILE_SIZE) {
+		ESP_LOGE(TAG, "Not playing clip %u of %s", (unsigned)id, pack_path);
+		return false;
+	}
+
+	*data = malloc(entry.length);
+	if (!*data) return false;
+	if (prompt_pack_read(playlist->pack, &entry, *data) != ESP_OK) {
+		free(*data);
+		*data = NULL;
+		return false;
+	}
+	*length = entry.length;
+	return true;
+}
+
+/**
+ * Read a whole file, a file that was played before is still open
+ */
+static bool prompt_file_read(struct prompt_playlist *playlist,
+                             const char *path, char **data, size_t *length) {
+	size_t size;
+	FILE *f = playlist->storage
+	              ? sd_storage_open(playlist->storage, path, &size)
+	              : NULL;
+	if (!f) {
+		ESP_LOGE(TAG, "Cannot open %s", path);
+		return false;
+	}
+	if (size == 0 || size > PROMPT_PLAYLIST_MAX_FILE_SIZE) {
+		ESP_LOGE(TAG, "Not playing %s of %u bytes", path, (unsigned)size);
+		sd_storage_close(playlist->storage, f);
+		return false;
+	}
+
+	*data   = malloc(size);
+	bool ok = *data && fread(*data, 1, size, f) == size;
+	sd_storage_close(playlist->storage, f);
+	if (!ok) {
+		free(*data);
+		*data = NULL;
+		return false;
+	}
+	*length = size;
+	return true;
+}
+
+/**
+ * Read and parse a clip, a file or a "<pack>#<id>" path
+ */
+static bool prompt_file_load(struct prompt_playlist *playlist,
+                             struct prompt_file *file, const char *path) {
+	char pack_path[PROMPT_PATH_LENGTH];
+	uint32_t id;
+	size_t length = 0;
+	bool ok =
+	    prompt_pack_parse_clip_path(path, pack_path, sizeof pack_path, &id)
+	        ? prompt_file_read_packed(playlist, pack_path, id, &file->data,
+	                                  &length)
+	        : prompt_file_read(playlist, path, &file->data, &length);
+	if (ok) ok = prompt_file_parse(file, length);
+	if (!ok) {
+		ESP_LOGE(TAG, "Cannot play %s", path);
+		free(file->data);
+		file->data = NULL;
+		return false;
+	}
+	strcpy(file->clip.path, path);
+	return true;
+}
+
+static void prompt_file_free(struct prompt_file *file) {
+	free(file->data);
+	file->data = NULL;
+}
+
+/**
+ * Read the next file that can be played into ahead each time fetch is given,
+ * ahead stays empty at the end of the playlist
+ */
+static void prompt_playlist_task(void *args) {
+	struct prompt_playlist *playlist = args;
+
+	while (xSemaphoreTake(playlist->fetch, portMAX_DELAY) == pdTRUE &&
+	       !playlist->stop) {
+		while (playlist->next < playlist->nr_paths &&
+		       !prompt_file_load(playlist, &playlist->ahead,
+		                         playlist->paths[playlist->next++]))
+			;
+		playlist->ahead.clip.request_us = playlist->request_us;
+		xSemaphoreGive(playlist->ready);
+	}
+
+	xSemaphoreGive(playlist->task_done);
+	vTaskDelete(NULL);
+}
+
+/**
+ * Let the task read the next clip while the current one plays
+ */
+static void prompt_playlist_prefetch(struct prompt_playlist *playlist) {
+	playlist->fetching = true;
+	xSemaphoreGive(playlist->fetch);
+}
+
+static esp_err_t prompt_playlist_open(audio_element_handle_t self) {
+	struct prompt_playlist *playlist = audio_element_getdata(self);
+
+	if (sd_storage_acquire(&playlist->storage) != ESP_OK)
+		ESP_LOGE(TAG, "No card to play from");
+	playlist->next = 0;
+	playlist->stop = false;
+	if (xTaskCreatePinnedToCore(prompt_playlist_task, "prompt_playlist",
+	                            PROMPT_PLAYLIST_TASK_STACK, playlist,
+	                            playlist->task_prio, &playlist->task,
+	                            playlist->task_core) != pdPASS) {
+		ESP_LOGE(TAG, "Cannot start prefetch task");
+		playlist->task = NULL;
+		sd_storage_release(playlist->storage);
+		playlist->storage = NULL;
+		return ESP_FAIL;
+	}
+	prompt_playlist_prefetch(playlist);
+	return ESP_OK;
+}
+
+static esp_err_t prompt_playlist_close(audio_element_handle_t self) {
+	struct prompt_playlist *playlist = audio_element_getdata(self);
+
+	// The task finishes the clip it is reading first
+	if (playlist->task) {
+		playlist->stop = true;
+		xSemaphoreGive(playlist->fetch);
+		xSemaphoreTake(playlist->task_done, portMAX_DELAY);
+		playlist->task = NULL;
+	}
+	xSemaphoreTake(playlist->fetch, 0);
+	xSemaphoreTake(playlist->ready, 0);
+	playlist->fetching = false;
+
+	prompt_file_free(&playlist->current);
+	prompt_file_free(&playlist->ahead);
+	sd_storage_release(playlist->storage);
+	playlist->storage = NULL;
+	return ESP_OK;
+}
+
+static audio_element_err_t prompt_playlist_process(audio_element_handle_t self,
+                                                   char *buffer, int length) {
+	struct prompt_playlist *playlist = audio_element_getdata(self);
+	struct prompt_file *current      = &playlist->current;
+
+	if (!current->data || current->start >= current->end) {
+		prompt_file_free(current);
+		if (playlist->fetching) {
+			if (xSemaphoreTake(playlist->ready,
+			                   PROMPT_PLAYLIST_TIMEOUT_MS /
+			                       portTICK_PERIOD_MS) != pdTRUE)
+				return AEL_IO_TIMEOUT;
+			playlist->fetching = false;
+		}
+		if (!playlist->ahead.data) return AEL_IO_DONE;
+
+		// Announce the clip before the decoder sees it, then read the next
+		// file while this one plays
+		*current             = playlist->ahead;
+		playlist->ahead.data = NULL;
+		if (playlist->recorder)
+			prompt_recorder_add_clip(playlist->recorder, &current->clip);
+		prompt_playlist_prefetch(playlist);
+	}
+
+	size_t bytes = current->end - current->start;
+	if (bytes > (size_t)length) bytes = length;
+
+	int ret =
+	    audio_element_output(self, current->data + current->start, (int)bytes);
+	if (ret > 0) current->start += ret;
+	return ret;
+}
+
+static esp_err_t prompt_playlist_destroy(audio_element_handle_t self) {
+	struct prompt_playlist *playlist = audio_element_getdata(self);
+
+	prompt_file_free(&playlist->current);
+	prompt_file_free(&playlist->ahead);
+	prompt_pack_close(playlist->pack);
+	vSemaphoreDelete(playlist->fetch);
+	vSemaphoreDelete(playlist->ready);
+	vSemaphoreDelete(playlist->task_done);
+	free(playlist);
+	return ESP_OK;
+}
+
+audio_element_handle_t prompt_playlist_init(audio_element_handle_t recorder) {
+	struct prompt_playlist *playlist = calloc(1, sizeof *playlist);
+	if (!playlist) {
+		ESP_LOGE(TAG, "Memory allocation for playlist failed");
+		return NULL;
+	}
+	playlist->recorder  = recorder;
+	playlist->fetch     = xSemaphoreCreateBinary();
+	playlist->ready     = xSemaphoreCreateBinary();
+	playlist->task_done = xSemaphoreCreateBinary();
+	if (!playlist->fetch || !playlist->ready || !playlist->task_done)
+		goto fail;
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open                = prompt_playlist_open;
+	cfg.close               = prompt_playlist_close;
+	cfg.process             = prompt_playlist_process;
+	cfg.destroy             = prompt_playlist_destroy;
+	cfg.buffer_len          = PROMPT_PLAYLIST_BUFFER_LENGTH;
+	cfg.tag                 = "playlist";
+
+	// The prefetch task runs like the element task
+	playlist->task_core = cfg.task_core;
+	playlist->task_prio = cfg.task_prio;
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	if (!el) goto fail;
+	audio_element_setdata(el, playlist);
+	return el;
+
+fail:
+	ESP_LOGE(TAG, "Memory allocation for playlist failed");
+	if (playlist->fetch) vSemaphoreDelete(playlist->fetch);
+	if (playlist->ready) vSemaphoreDelete(playlist->ready);
+	if (playlist->task_done) vSemaphoreDelete(playlist->task_done);
+	free(playlist);
+	return NULL;
+}
+
+void prompt_playlist_set(audio_element_handle_t el, const char *const paths[],
+                         int nr_paths) {
+	struct prompt_playlist *playlist = audio_element_getdata(el);
+
+	playlist->nr_paths = 0;
+	for (int p = 0; p < nr_paths && p < PROMPT_STREAM_MAX_CLIPS; p++) {
+		if (strlen(paths[p]) >= PROMPT_PATH_LENGTH) {
+			ESP_LOGE(TAG, "Path %s is too long", paths[p]);
+			continue;
+		}
+		strcpy(playlist->paths[playlist->nr_paths++], paths[p]);
+	}
+	playlist->request_us = esp_timer_get_time();
+}
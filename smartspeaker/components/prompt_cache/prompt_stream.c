@@ -0,0 +1,299 @@
+#include "prompt_stream.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+
+// Bytes passed on per process call
+#define PROMPT_STREAM_BUFFER_LENGTH 2048
+
+static const char *TAG = "PROMPT_STREAM";
+
+struct prompt_reader {
+	const prompt_t *prompts[PROMPT_STREAM_MAX_CLIPS]; // Prompts to play
+	int nr_prompts;
+	int index;          // Prompt being played
+	size_t offset;      // Bytes of the prompt passed on
+	int64_t request_us; // Time the prompts were set
+	bool started;       // First sample has been passed on
+};
+
+struct prompt_recorder {
+	QueueHandle_t clips;     // Announced clips that did not start yet
+	struct prompt_clip clip; // Clip passing through now
+	bool in_clip;            // clip is valid
+	size_t position;         // Decoded bytes of the clip seen so far
+	char *data;              // Recorded body of the clip, NULL if not cached
+	bool started;            // First sample of the run has been passed on
+};
+
+/**
+ * Report the format of the current prompt, the same report as a decoder so
+ * the output follows it
+ */
+static void prompt_reader_report_info(audio_element_handle_t self,
+                                      const prompt_t *prompt) {
+	audio_element_info_t info = { 0 };
+	audio_element_getinfo(self, &info);
+	if (info.sample_rates == prompt->sample_rate &&
+	    info.channels == prompt->channels && info.bits == prompt->bits)
+		return;
+
+	audio_element_set_music_info(self, prompt->sample_rate, prompt->channels,
+	                             prompt->bits);
+	audio_element_report_info(self);
+}
+
+static esp_err_t prompt_reader_open(audio_element_handle_t self) {
+	struct prompt_reader *reader = audio_element_getdata(self);
+
+	reader->index   = 0;
+	reader->offset  = 0;
+	reader->started = false;
+	if (reader->nr_prompts > 0)
+		prompt_reader_report_info(self, reader->prompts[0]);
+	return ESP_OK;
+}
+
+static audio_element_err_t prompt_reader_process(audio_element_handle_t self,
+                                                 char *buffer, int length) {
+	struct prompt_reader *reader = audio_element_getdata(self);
+
+	while (reader->index < reader->nr_prompts &&
+	       reader->offset >= reader->prompts[reader->index]->length) {
+		// Next prompt, straight after the previous one
+		reader->offset = 0;
+		if (++reader->index < reader->nr_prompts)
+			prompt_reader_report_info(self, reader->prompts[reader->index]);
+	}
+	if (reader->index >= reader->nr_prompts) return AEL_IO_DONE;
+
+	const prompt_t *prompt = reader->prompts[reader->index];
+	size_t bytes           = prompt->length - reader->offset;
+	if (bytes > (size_t)length) bytes = length;
+
+	int ret =
+	    audio_element_output(self, prompt->data + reader->offset, (int)bytes);
+	if (ret <= 0) return ret;
+
+	if (!reader->started) {
+		reader->started = true;
+		prompt_cache_report_ttfs(
+		    true, (uint32_t)(esp_timer_get_time() - reader->request_us));
+	}
+	reader->offset += ret;
+	return ret;
+}
+
+static void prompt_reader_release(struct prompt_reader *reader) {
+	for (int p = 0; p < reader->nr_prompts; p++)
+		prompt_cache_release(reader->prompts[p]);
+	reader->nr_prompts = 0;
+}
+
+static esp_err_t prompt_reader_destroy(audio_element_handle_t self) {
+	struct prompt_reader *reader = audio_element_getdata(self);
+
+	prompt_reader_release(reader);
+	free(reader);
+	return ESP_OK;
+}
+
+audio_element_handle_t prompt_reader_init(void) {
+	struct prompt_reader *reader = calloc(1, sizeof *reader);
+	if (!reader) {
+		ESP_LOGE(TAG, "Memory allocation for prompt reader failed");
+		return NULL;
+	}
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open                = prompt_reader_open;
+	cfg.process             = prompt_reader_process;
+	cfg.destroy             = prompt_reader_destroy;
+	cfg.buffer_len          = PROMPT_STREAM_BUFFER_LENGTH;
+	cfg.tag                 = "prompt";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	if (!el) {
+		free(reader);
+		return NULL;
+	}
+	audio_element_setdata(el, reader);
+	return el;
+}
+
+void prompt_reader_set_prompts(audio_element_handle_t el,
+                               const prompt_t *const prompts[],
+                               int nr_prompts) {
+	struct prompt_reader *reader = audio_element_getdata(el);
+
+	prompt_reader_release(reader);
+	if (nr_prompts > PROMPT_STREAM_MAX_CLIPS)
+		nr_prompts = PROMPT_STREAM_MAX_CLIPS;
+	for (int p = 0; p < nr_prompts; p++) reader->prompts[p] = prompts[p];
+	reader->nr_prompts = nr_prompts;
+	reader->request_us = esp_timer_get_time();
+}
+
+/**
+ * Start on the next announced clip and decide whether to record it
+ * @return false if no clip was announced
+ */
+static bool prompt_recorder_next_clip(struct prompt_recorder *recorder) {
+	if (xQueueReceive(recorder->clips, &recorder->clip, 0) != pdTRUE)
+		return false;
+
+	recorder->in_clip  = true;
+	recorder->position = 0;
+
+	size_t body = recorder->clip.pcm_length - recorder->clip.skip_start -
+	              recorder->clip.skip_end;
+	if (prompt_cache_fits(body))
+		recorder->data = heap_caps_malloc(body, MALLOC_CAP_SPIRAM);
+	return true;
+}
+
+/**
+ * Hand the recorded clip over to the cache once all of it passed
+ */
+static void prompt_recorder_end_clip(struct prompt_recorder *recorder) {
+	const struct prompt_clip *clip = &recorder->clip;
+
+	if (recorder->data) {
+		prompt_cache_insert(clip->path, recorder->data,
+		                    clip->pcm_length - clip->skip_start -
+		                        clip->skip_end,
+		                    clip->sample_rate, clip->channels, 16);
+	}
+	recorder->data    = NULL;
+	recorder->in_clip = false;
+}
+
+/**
+ * Drop a clip that was cut short and forget the clips that did not start
+ */
+static void prompt_recorder_flush(struct prompt_recorder *recorder) {
+	heap_caps_free(recorder->data);
+	recorder->data    = NULL;
+	recorder->in_clip = false;
+	xQueueReset(recorder->clips);
+}
+
+static esp_err_t prompt_recorder_open(audio_element_handle_t self) {
+	struct prompt_recorder *recorder = audio_element_getdata(self);
+
+	recorder->started = false;
+	return ESP_OK;
+}
+
+static esp_err_t prompt_recorder_close(audio_element_handle_t self) {
+	struct prompt_recorder *recorder = audio_element_getdata(self);
+
+	prompt_recorder_flush(recorder);
+	return ESP_OK;
+}
+
+static audio_element_err_t
+prompt_recorder_process(audio_element_handle_t self, char *buffer,
+                        int length) {
+	struct prompt_recorder *recorder = audio_element_getdata(self);
+
+	int bytes = audio_element_input(self, buffer, length);
+	if (bytes <= 0) return bytes;
+
+	// Keep the body of every clip, compacted to the start of buffer
+	int kept = 0;
+	for (int offset = 0; offset < bytes;) {
+		if (!recorder->in_clip && !prompt_recorder_next_clip(recorder)) {
+			// Nothing is known about the rest, pass it on unchanged
+			memmove(buffer + kept, buffer + offset, bytes - offset);
+			kept += bytes - offset;
+			break;
+		}
+
+		const struct prompt_clip *clip = &recorder->clip;
+		size_t run = clip->pcm_length - recorder->position;
+		if (run > (size_t)(bytes - offset)) run = bytes - offset;
+
+		size_t body_end = clip->pcm_length - clip->skip_end;
+		size_t from     = recorder->position > clip->skip_start
+		                      ? recorder->position
+		                      : clip->skip_start;
+		size_t to       = recorder->position + run < body_end
+		                      ? recorder->position + run
+		                      : body_end;
+		if (from < to) {
+			char *body = buffer + offset + (from - recorder->position);
+			if (recorder->data)
+				memcpy(recorder->data + from - clip->skip_start, body,
+				       to - from);
+			memmove(buffer + kept, body, to - from);
+			kept += to - from;
+		}
+
+		recorder->position += run;
+		offset             += run;
+		if (recorder->position == clip->pcm_length)
+			prompt_recorder_end_clip(recorder);
+	}
+	if (kept == 0) return bytes;
+
+	if (!recorder->started && recorder->clip.request_us) {
+		recorder->started = true;
+		prompt_cache_report_ttfs(false, (uint32_t)(esp_timer_get_time() -
+		                                           recorder->clip.request_us));
+	}
+	return audio_element_output(self, buffer, kept);
+}
+
+static esp_err_t prompt_recorder_destroy(audio_element_handle_t self) {
+	struct prompt_recorder *recorder = audio_element_getdata(self);
+
+	heap_caps_free(recorder->data);
+	vQueueDelete(recorder->clips);
+	free(recorder);
+	return ESP_OK;
+}
+
+audio_element_handle_t prompt_recorder_init(void) {
+	struct prompt_recorder *recorder = calloc(1, sizeof *recorder);
+	if (!recorder) {
+		ESP_LOGE(TAG, "Memory allocation for prompt recorder failed");
+		return NULL;
+	}
+	recorder->clips =
+	    xQueueCreate(PROMPT_STREAM_MAX_CLIPS, sizeof(struct prompt_clip));
+	if (!recorder->clips) {
+		free(recorder);
+		return NULL;
+	}
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open                = prompt_recorder_open;
+	cfg.close               = prompt_recorder_close;
+	cfg.process             = prompt_recorder_process;
+	cfg.destroy             = prompt_recorder_destroy;
+	cfg.buffer_len          = PROMPT_STREAM_BUFFER_LENGTH;
+	cfg.tag                 = "recorder";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	if (!el) {
+		vQueueDelete(recorder->clips);
+		free(recorder);
+		return NULL;
+	}
+	audio_element_setdata(el, recorder);
+	return el;
+}
+
+void prompt_recorder_add_clip(audio_element_handle_t el,
+                              const struct prompt_clip *clip) {
+	struct prompt_recorder *recorder = audio_element_getdata(el);
+
+	if (xQueueSend(recorder->clips, clip, 0) != pdTRUE)
+		ESP_LOGW(TAG, "Too many clips, %s is not trimmed", clip->path);
+}
@@ -1,11 +1,16 @@
 #ifndef SS_RADIO_H
 #define SS_RADIO_H
 
+#include <stdint.h>
+
 #include "audio_element.h"
 #include "audio_event_iface.h"
 #include "esp_err.h"
 #include "esp_peripherals.h"
 
+#include "radio_station.h"
+#include "radio_icy.h"
+
 /* TODO: add documentation */
 
 struct radio_channel {
@@ -13,6 +18,55 @@ struct radio_channel {
 	char *url;
 };
 
+/**
+ * @brief Load the stations from CONFIG_RADIO_STATIONS_FILE on the SD card,
+ * else from the "stations" namespace in NVS, else the built-in ones. The list
+ * is read line by line. Loaded by radio_init() if it was not before.
+ */
+esp_err_t radio_load_stations(void);
+
+/**
+ * @return number of channels, 0 before the stations are loaded
+ */
+int radio_nr_channels(void);
+
+/**
+ * @return name of a channel, "" if there is no such channel
+ */
+const char *radio_channel_name(int channel);
+
+/**
+ * @brief Find the channels with a word in their name starting with each word
+ * of the query, see station_db_search().
+ * @return number of channels found, at most max
+ */
+int radio_search(const char *query, uint32_t *channels, int max);
+
+/**
+ * @return channel that plays, or that the radio starts with
+ */
+int radio_get_channel(void);
+
+/**
+ * @brief Counters of the stream of the channel that plays, from any task.
+ * @return ESP_ERR_INVALID_STATE if the radio does not play
+ */
+esp_err_t radio_get_stats(struct radio_station_stats *stats);
+
+/**
+ * @brief Title of the song on the channel that plays, from the ICY metadata
+ * of its stream, from any task. RADIO_TITLE_EVT tells when it changes.
+ * @return ESP_ERR_INVALID_STATE if the radio does not play
+ */
+esp_err_t radio_get_title(char *title, size_t size);
+
+/**
+ * @brief CPU the decoder took since the channel was tuned, of the core it runs
+ * on. It is measured with CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS only.
+ * @return permille, -1 if it is not measured
+ */
+int radio_get_decoder_load(void);
+
 esp_err_t radio_init(audio_element_handle_t *elems, size_t count,
                      audio_event_iface_handle_t evt,
                      esp_periph_set_handle_t periph_set, void *args);
@@ -23,11 +77,34 @@ esp_err_t radio_deinit(audio_element_handle_t *elems, size_t count,
 
 esp_err_t radio_run(audio_event_iface_msg_t *msg, void *args);
 
+/**
+ * @brief Switch to a channel, before the radio is started it is the channel
+ * it starts with.
+ */
 esp_err_t tune_radio(unsigned int channel_idx);
 
 esp_err_t channel_up();
 esp_err_t channel_down();
 
+/**
+ * @brief Pause the channel that plays, or play on where it was paused. Its
+ * stream is recorded on meanwhile, up to what the timeshift file holds.
+ * @return ESP_ERR_INVALID_STATE without a timeshift
+ */
+esp_err_t radio_pause(void);
+
+/**
+ * @brief Go seconds back in the channel that plays, or forward when seconds
+ * is positive, up to the stream that arrives.
+ * @return ESP_ERR_INVALID_STATE without a timeshift
+ */
+esp_err_t radio_seek(int seconds);
+
+/**
+ * @brief Catch up with the stream of the channel that plays.
+ */
+esp_err_t radio_live(void);
+
 esp_err_t volume_up();
 esp_err_t volume_down();
 
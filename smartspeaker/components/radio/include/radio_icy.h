@@ -0,0 +1,101 @@
+#ifndef RADIO_ICY_H
+#define RADIO_ICY_H
+#pragma once
+
+/*
+ * Parser of the ICY metadata a server puts in the stream every metaint bytes
+ * when it was asked with "Icy-MetaData: 1", shared by the firmware and the
+ * host tools, so it only depends on the C library. It passes the audio on in
+ * runs between the blocks without copying it and keeps the StreamTitle of
+ * the blocks in the struct.
+ *
+ * The http stream of ADF does not pass the response headers on, so without
+ * the icy-metaint header the interval is found from the stream. The first
+ * block with a title is found by its length byte and "StreamTitle='", the
+ * bytes that may start it are held back meanwhile, at most
+ * RADIO_ICY_KEY_LENGTH. The audio before it is a whole number of intervals,
+ * each but the last followed by an empty block, a single 0 length byte, which
+ * servers send while there is no title. The intervals that fit are followed
+ * until the next blocks confirm the shortest one that is left: a 0 or a
+ * length byte and "StreamTitle='" where it puts the next block. Until then
+ * the 0s are passed on as audio.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Longest title that is kept, longer titles are cut
+#define RADIO_ICY_TITLE_LENGTH 128
+/// Audio the first block is looked for in, the largest interval found
+#define RADIO_ICY_SEARCH_SIZE  65536
+/// Length of "StreamTitle='"
+#define RADIO_ICY_KEY_LENGTH   13
+/// Intervals the first block with a title is followed with
+#define RADIO_ICY_CANDIDATES   8
+/// Shortest interval that is followed, besides the offset of the first block
+#define RADIO_ICY_MIN_INTERVAL 1024
+/// Blocks an interval must fit, the first one included
+#define RADIO_ICY_CONFIRMATIONS 3
+
+enum radio_icy_state {
+	RADIO_ICY_SEARCH = 0, // For the first block, the interval is not known
+	RADIO_ICY_AUDIO,      // Audio until the next block
+	RADIO_ICY_LENGTH,     // The length byte of the next block
+	RADIO_ICY_BLOCK,      // Metadata
+	RADIO_ICY_CONFIRM,    // Audio until a block confirms the interval
+	RADIO_ICY_OFF,        // No block was found, all of it is audio
+};
+
+struct radio_icy {
+	uint32_t metaint; // Audio between the blocks, 0 until it is found
+	uint32_t left;    // Bytes of the audio or the block until the next state
+	uint32_t searched;
+	uint8_t state;
+
+	// Held back while searching: a length byte and the key matched after it
+	uint8_t held;
+	uint8_t held_data[RADIO_ICY_KEY_LENGTH];
+
+	// Intervals the blocks fit so far, with the offset of their next length
+	// byte after the last block
+	uint8_t candidates;
+	uint32_t interval[RADIO_ICY_CANDIDATES]; // Longest first
+	uint32_t expect[RADIO_ICY_CANDIDATES];
+	uint8_t hits[RADIO_ICY_CANDIDATES];
+	uint32_t after; // Bytes since the last block
+
+	// The block that is parsed
+	int8_t key;    // Characters of the key matched, -1 within a field
+	bool in_title; // Between "StreamTitle='" and "';"
+	bool quote;    // A quote in the title, it ends the title before ';'
+	bool has_title;
+	uint8_t next_length;
+	char next[RADIO_ICY_TITLE_LENGTH];
+
+	char title[RADIO_ICY_TITLE_LENGTH]; // Of the last block with one
+	uint32_t blocks;                    // Blocks with metadata
+	uint32_t titles;                    // Times the title changed
+};
+
+/**
+ * @brief Receives a run of audio, it points into the data that was fed or
+ * into the bytes that were held back.
+ */
+typedef void (*radio_icy_audio_t)(void *context, const uint8_t *data,
+                                  size_t length);
+
+/**
+ * @brief Start parsing a stream from the start of its body.
+ * @param metaint of the icy-metaint header, 0 to find it from the stream
+ */
+void radio_icy_init(struct radio_icy *icy, uint32_t metaint);
+
+/**
+ * @brief Parse the next bytes of the stream, its audio is passed to audio.
+ * @return true if a block changed the title
+ */
+bool radio_icy_feed(struct radio_icy *icy, const uint8_t *data, size_t length,
+                    radio_icy_audio_t audio, void *context);
+
+#endif /* RADIO_ICY_H */
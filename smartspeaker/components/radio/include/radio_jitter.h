@@ -0,0 +1,83 @@
+#ifndef RADIO_JITTER_H
+#define RADIO_JITTER_H
+#pragma once
+
+/*
+ * Watermark of the ring of the active station, shared by the firmware and
+ * the host tools, so it only depends on the C library. It does not lock, the
+ * owner does.
+ *
+ * The decoder waits until the ring holds the target, after a tune and after
+ * an underrun, and then plays until the ring is empty. The target follows
+ * the arrival rate of the stream like a TCP retransmission timeout follows
+ * the round trip time: the mean and the mean deviation of the rate in
+ * windows of half a second. It grows to the minimum plus four deviations at
+ * once and shrinks back slowly, an underrun doubles it. A steady stream
+ * plays with the minimum buffered, a stream over bad Wi-Fi buffers more.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Length of the windows the rate is measured in
+#define RADIO_JITTER_WINDOW_MS 500
+/// Rate assumed until it is measured, 128 kbps
+#define RADIO_JITTER_RATE      16000
+/// Wait before the first attempt to connect again, doubled each attempt
+#define RADIO_BACKOFF_MS       250
+/// Longest wait between attempts
+#define RADIO_BACKOFF_MAX_MS   30000
+
+struct radio_jitter {
+	int min_ms;          // Lowest target in audio at the rate of the stream
+	size_t max;          // Highest target in bytes
+	size_t target;       // Fill the decoder waits for
+	bool buffering;      // The decoder waits for the target
+	uint32_t rate;       // Mean arrival rate [B/s], 0 until measured
+	uint32_t deviation;  // Mean deviation of the rate [B/s]
+	int windows;         // Measured, the first one holds the burst
+	int64_t window_us;   // Start of the window, 0 before the first byte
+	size_t window_bytes; // Arrived in the window
+	uint32_t underruns;  // The ring ran empty while playing
+};
+
+/**
+ * @param min_ms lowest target, in milliseconds of audio
+ * @param max highest target in bytes, below the size of the ring so there is
+ * room for the stream to arrive
+ */
+void radio_jitter_init(struct radio_jitter *jitter, int min_ms, size_t max);
+
+/**
+ * @brief Forget the stream after a tune, the decoder waits for the minimum.
+ */
+void radio_jitter_reset(struct radio_jitter *jitter);
+
+/**
+ * @brief Count bytes that arrived, at a time in microseconds.
+ */
+void radio_jitter_arrived(struct radio_jitter *jitter, size_t bytes,
+                          int64_t now_us);
+
+/**
+ * @brief Whether the decoder may read from a ring with fill bytes, it stops
+ * waiting once the ring holds the target.
+ */
+bool radio_jitter_can_read(struct radio_jitter *jitter, size_t fill);
+
+/**
+ * @brief The decoder found the ring empty, it waits for a larger target.
+ * @return true if it played, which makes it an underrun
+ */
+bool radio_jitter_empty(struct radio_jitter *jitter);
+
+/**
+ * @brief Wait before an attempt to connect again, exponential with a random
+ * half so speakers that lost the same server do not return at once.
+ * @param attempt 0 for the first one
+ * @param random any random number
+ */
+int radio_backoff_ms(int attempt, uint32_t random);
+
+#endif /* RADIO_JITTER_H */
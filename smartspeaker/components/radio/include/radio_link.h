@@ -0,0 +1,129 @@
+#ifndef RADIO_LINK_H
+#define RADIO_LINK_H
+#pragma once
+
+/*
+ * Connection of a station to its stream, shared by the firmware and the host
+ * tools, so it only depends on the C library. It does not lock, the owner
+ * does, except where a function tells it is called by the stream only.
+ *
+ * On standby the ring keeps the newest part of the stream. Active, the
+ * stream waits for room and the decoder for the target of the jitter
+ * buffer, see radio_jitter.h.
+ *
+ * When the connection breaks, the ring is cut back to its last whole frame
+ * and the stream connects again after a backoff that doubles each attempt,
+ * see radio_backoff_ms(). The new connection is held back until it has a
+ * whole frame, so the decoder plays on as if nothing happened. The outage
+ * lasts until a byte arrives again, the stream is recovered once it is
+ * appended to the ring again.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "radio_jitter.h"
+#include "radio_ring.h"
+
+struct radio_link {
+	struct radio_ring ring;
+	struct radio_jitter jitter;
+	enum radio_codec codec; // Of the channel, the decoder waits for it
+	bool active;            // The decoder reads the ring
+	uint64_t dropped;       // Oldest bytes dropped on standby
+
+	int attempt;     // Attempts since the stream last continued
+	int64_t lost_us; // Connection broke, 0 while it is up
+	bool arrived;    // A byte arrived since the last attempt
+	bool framed;     // The ring held whole frames since the tune
+	bool resyncing;  // The new connection waits for a whole frame, only
+	                 // the stream uses it and resync while it runs
+	struct radio_resync resync;
+
+	uint32_t reconnects; // Attempts to connect again since the tune
+	uint32_t outages;    // Connections that broke and were made again
+	int outage_ms;       // Of the last one, until a byte arrived again
+	int outage_max_ms;
+	int recover_ms;      // Of the last one, until the stream continued
+	int recover_max_ms;
+};
+
+/**
+ * @brief Use size bytes at data for the ring, the memory stays the caller's.
+ * @param min_ms lowest target of the jitter buffer, see radio_jitter_init()
+ * @param max highest target in bytes
+ */
+void radio_link_init(struct radio_link *link, void *data, size_t size,
+                     int min_ms, size_t max);
+
+/**
+ * @brief Forget the stream and the counters, for a tune.
+ */
+void radio_link_reset(struct radio_link *link);
+
+/**
+ * @brief Activate the station or put it on standby, an active ring starts at
+ * a whole frame.
+ */
+void radio_link_set_active(struct radio_link *link, bool active);
+
+/**
+ * @brief Append bytes that arrived at now_us to the ring. Active, only what
+ * fits is taken and the stream waits for room for the rest. On standby the
+ * oldest bytes make room.
+ * @return bytes taken from data
+ */
+size_t radio_link_append(struct radio_link *link, const void *data,
+                         size_t length, int64_t now_us);
+
+/**
+ * @brief Read for the decoder of codec, once the ring holds the target.
+ * @return bytes read, 0 while the decoder waits for the target or the ring
+ * holds another codec
+ */
+size_t radio_link_read(struct radio_link *link, enum radio_codec codec,
+                       void *data, size_t length);
+
+/**
+ * @brief The decoder of codec still read nothing after it waited for the
+ * stream, it waits for a larger target.
+ * @return true if it played, which makes it an underrun
+ */
+bool radio_link_starved(struct radio_link *link, enum radio_codec codec);
+
+/**
+ * @brief Count bytes that arrived at now_us, before they are appended.
+ * @return true for the first ones after the connection broke, which ends
+ * the outage
+ */
+bool radio_link_received(struct radio_link *link, int64_t now_us);
+
+/**
+ * @brief Hold a new connection back until it has a whole frame, after the
+ * connection broke. Called by the stream only, without the lock.
+ * @param used set to the bytes of data the stream continues after
+ * @param held set to the bytes of resync.data that continue the stream
+ * before the rest of data, 0 but once
+ * @return false while the connection is held back, all of data was used
+ */
+bool radio_link_resync(struct radio_link *link, const void *data,
+                       size_t length, size_t *used, size_t *held);
+
+/**
+ * @brief The stream was appended to the ring at now_us.
+ * @return attempts it took to connect again if the connection had broken,
+ * 0 if it did not
+ */
+int radio_link_continued(struct radio_link *link, int64_t now_us);
+
+/**
+ * @brief The connection broke or an attempt failed at now_us, the ring is
+ * cut back to a whole frame the new connection will follow.
+ * @param random any random number, for radio_backoff_ms()
+ * @return milliseconds to wait before the next attempt
+ */
+int radio_link_lost(struct radio_link *link, int64_t now_us,
+                    uint32_t random);
+
+#endif /* RADIO_LINK_H */
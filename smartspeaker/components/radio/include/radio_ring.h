@@ -0,0 +1,153 @@
+#ifndef RADIO_RING_H
+#define RADIO_RING_H
+#pragma once
+
+/*
+ * Ring of compressed radio data, shared by the firmware and the host tools,
+ * so it only depends on the C library. It does not lock, the owner does.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct radio_ring {
+	uint8_t *data;
+	size_t size;
+	size_t head; // Oldest byte
+	size_t fill;
+};
+
+/// Compressed audio the stations send, told by the frames in the ring
+enum radio_codec {
+	RADIO_CODEC_NONE = 0, // Not known yet
+	RADIO_CODEC_MP3,      // MPEG Layer III frames
+	RADIO_CODEC_AAC,      // ADTS frames of AAC-LC or HE-AAC
+};
+
+/// Bytes of a frame header that are looked at, of ADTS without CRC
+#define RADIO_FRAME_HEADER 7
+
+/// Holds the longest MP3 frame, or stereo ADTS frame of one block, and the
+/// header of the next one
+#define RADIO_RESYNC_SIZE 2048
+
+/**
+ * @brief Start of a stream that connected again, held until it has a whole
+ * frame to continue the stream with.
+ */
+struct radio_resync {
+	uint8_t data[RADIO_RESYNC_SIZE];
+	size_t fill;
+};
+
+/**
+ * @brief Use size bytes at data for the ring, the memory stays the caller's.
+ */
+void radio_ring_init(struct radio_ring *ring, void *data, size_t size);
+void radio_ring_clear(struct radio_ring *ring);
+
+static inline size_t radio_ring_free(const struct radio_ring *ring) {
+	return ring->size - ring->fill;
+}
+
+/**
+ * @brief Append as much of data as there is room for.
+ * @return bytes appended
+ */
+size_t radio_ring_write(struct radio_ring *ring, const void *data,
+                        size_t length);
+
+/**
+ * @brief Append all of data, dropping the oldest bytes to make room. Only
+ * the last size bytes are kept of data longer than the ring.
+ * @return bytes dropped
+ */
+size_t radio_ring_overwrite(struct radio_ring *ring, const void *data,
+                            size_t length);
+
+/**
+ * @brief Take the oldest bytes out of the ring.
+ * @return bytes read, 0 when the ring is empty
+ */
+size_t radio_ring_read(struct radio_ring *ring, void *out, size_t length);
+
+/**
+ * @brief Copy bytes from offset past the oldest one without taking them.
+ * @return bytes copied
+ */
+size_t radio_ring_peek(const struct radio_ring *ring, size_t offset, void *out,
+                       size_t length);
+
+void radio_ring_skip(struct radio_ring *ring, size_t length);
+
+/**
+ * @brief Length of the MP3 frame with this header.
+ * @return bytes including the header, 0 if it is no Layer III header
+ */
+int radio_frame_mp3_length(const uint8_t header[4]);
+
+/**
+ * @brief Length of the ADTS frame with this header.
+ * @return bytes including the header, 0 if it is no ADTS header
+ */
+int radio_frame_adts_length(const uint8_t header[RADIO_FRAME_HEADER]);
+
+/**
+ * @brief Length of the frame of codec with this header.
+ * @return bytes including the header, 0 if it starts no frame
+ */
+int radio_frame_length(enum radio_codec codec,
+                       const uint8_t header[RADIO_FRAME_HEADER]);
+
+/**
+ * @brief Audio of the frame of codec with this header.
+ * @return microseconds, 0 if it starts no frame
+ */
+uint32_t radio_frame_us(enum radio_codec codec,
+                        const uint8_t header[RADIO_FRAME_HEADER]);
+
+/**
+ * @brief Drop the bytes before the first frame that is followed by another
+ * one, a ring that starts in the middle of a frame then starts with a whole
+ * one. Without such a frame only the bytes that cannot start one are
+ * dropped.
+ * @return true if the ring starts with a frame
+ */
+bool radio_ring_sync(struct radio_ring *ring, enum radio_codec codec);
+
+/**
+ * @brief Drop the newest bytes after the last whole frame, so a stream that
+ * broke off ends with a whole frame.
+ * @return false if the ring holds no frame followed by another one, it is
+ * left as it is then
+ */
+bool radio_ring_trim(struct radio_ring *ring, enum radio_codec codec);
+
+/**
+ * @brief Find the first frame in data that is followed by another one.
+ * @param offset of the frame, or of the first byte that may still start one
+ * @return true if it was found
+ */
+bool radio_frame_find(enum radio_codec codec, const uint8_t *data,
+                      size_t length, size_t *offset);
+
+/**
+ * @brief Tell the codec of a stream from its frames, for a stream whose
+ * Content-Type did not tell it.
+ * @return codec of the first frame followed by another one, RADIO_CODEC_NONE
+ * if data holds none
+ */
+enum radio_codec radio_codec_find(const uint8_t *data, size_t length);
+
+/**
+ * @brief Take a stream that starts anywhere until it holds a whole frame
+ * followed by another one.
+ * @param used bytes of data taken
+ * @return true once resync->data starts with that frame, resync->fill bytes
+ * then continue the stream before the rest of data
+ */
+bool radio_resync(struct radio_resync *resync, enum radio_codec codec,
+                  const void *data, size_t length, size_t *used);
+
+#endif /* RADIO_RING_H */
@@ -0,0 +1,162 @@
+#ifndef RADIO_STATION_H
+#define RADIO_STATION_H
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "audio_element.h"
+#include "audio_event_iface.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#include "radio_ring.h"
+
+/// Sent when the ICY metadata changes the title, the data is the channel
+#define RADIO_TITLE_EVT 8006
+/// Sent when the codec of the channel is known, the data is the channel
+#define RADIO_CODEC_EVT 8007
+
+/**
+ * @brief Counters of the connection to the station it is tuned to now.
+ */
+struct radio_station_stats {
+	int64_t tuned_us;     // esp_timer time of the tune, 0 if not tuned
+	int64_t first_us;     // Of the first byte, 0 if none arrived yet
+	uint64_t bytes;       // Received
+	uint64_t dropped;     // Oldest bytes dropped on standby
+	int fill;             // Bytes in the ring
+	int target;           // Bytes the decoder waits for before it plays
+	uint32_t rate;        // Mean arrival rate [B/s], 0 until measured
+	uint32_t kbps;        // Mean bandwidth since the first byte
+	uint32_t underruns;   // The decoder found the ring empty
+	uint32_t reconnects;  // Attempts to connect again since the tune
+	uint32_t outages;     // Connections that broke and were made again
+	int outage_ms;        // Of the last one, until a byte arrived again
+	int outage_max_ms;
+	int recover_ms;       // Of the last one, until the stream continued
+	int recover_max_ms;
+	uint32_t titles;      // Titles of the ICY metadata
+	enum radio_codec codec;
+	bool shifted;         // Plays from the timeshift instead of live
+	int lag_s;            // Plays behind the newest audio that arrived
+	int recorded_s;       // Of the timeshift, 0 without one
+};
+
+typedef struct radio_station *radio_station_handle_t;
+
+/**
+ * @brief Create a connection to a station with a ring for its stream, the
+ * ring is in PSRAM when there is PSRAM.
+ *
+ * On standby the ring keeps the newest ring_size bytes of the stream. Once it
+ * is active the stream waits for the decoder to read from the ring, and the
+ * decoder waits for the ring to hold a target after a tune or an underrun,
+ * see radio_jitter.h.
+ * @param jitter_ms lowest target, in milliseconds of audio
+ * @param evt listener of the messages of its http stream, its titles and its
+ * codec
+ */
+radio_station_handle_t radio_station_create(int ring_size, int jitter_ms,
+                                            audio_event_iface_handle_t evt);
+void radio_station_destroy(radio_station_handle_t station,
+                           audio_event_iface_handle_t evt);
+
+/**
+ * @brief Connect to a station, a connection to another one is closed and its
+ * stream dropped.
+ * @param channel of the station, reported by radio_station_get_channel()
+ */
+esp_err_t radio_station_tune(radio_station_handle_t station, int channel,
+                             const char *url);
+
+/**
+ * @brief Connect again to the channel after the stream ended or failed to
+ * connect, after a backoff that doubles each attempt. It connects in the task
+ * of the stream while the decoder plays what the ring holds.
+ *
+ * The stream continues with the first whole frame of the new connection after
+ * the last whole frame of the old one, so the decoder does not notice.
+ */
+esp_err_t radio_station_reconnect(radio_station_handle_t station);
+
+/**
+ * @brief Close the connection and drop the stream.
+ */
+esp_err_t radio_station_stop(radio_station_handle_t station);
+
+/**
+ * @brief Codec of the stream, from its Content-Type or else its frames.
+ * RADIO_CODEC_EVT tells when it is known.
+ * @return RADIO_CODEC_NONE until it is known
+ */
+enum radio_codec radio_station_get_codec(radio_station_handle_t station);
+
+/**
+ * @return channel it is tuned to, -1 if it is not
+ */
+int radio_station_get_channel(radio_station_handle_t station);
+
+/**
+ * @return http stream of the connection, the source of its messages
+ */
+audio_element_handle_t radio_station_get_reader(radio_station_handle_t station);
+
+/**
+ * @brief Let the decoder read from the station or put it on standby.
+ *
+ * An activated ring is cut to the first whole frame. An activated station
+ * starts a new recording, it plays live.
+ */
+void radio_station_set_active(radio_station_handle_t station, bool active);
+
+/**
+ * @brief Read the stream of the active station, for the read callback of the
+ * decoder. Live, what it reads is recorded, else it reads the recording and
+ * the ring is moved into it.
+ * @param codec of the decoder, it reads nothing from a stream of another codec
+ * @return bytes read or AEL_IO_TIMEOUT when nothing arrived in time
+ */
+int radio_station_read(radio_station_handle_t station, enum radio_codec codec,
+                       char *buffer, int len, TickType_t ticks_to_wait);
+
+/**
+ * @brief Record the active station to a file on the SD card, so it can be
+ * paused and gone back on, see radio_timeshift.h. The file is made once with
+ * its full size and kept for the next boot. Without it the stations play
+ * live only.
+ * @param size_mb of the file
+ */
+esp_err_t radio_station_timeshift_init(const char *path, int size_mb);
+
+/**
+ * @brief Stop recording, after the stations were destroyed.
+ */
+void radio_station_timeshift_deinit(void);
+
+/**
+ * @brief Move the decoder seconds back or forward in the recording of the
+ * active station, from where it plays. 0 stays where it is, for a pause: the
+ * stream is recorded on while the decoder does not read. Going forward past
+ * the newest second catches up with the stream.
+ * @return ESP_ERR_INVALID_STATE if it is not recorded or its codec not known
+ */
+esp_err_t radio_station_seek(radio_station_handle_t station, int seconds);
+
+/**
+ * @brief Catch up with the stream, the decoder plays the last seconds of the
+ * recording that the jitter buffer would have held and then the stream.
+ */
+void radio_station_live(radio_station_handle_t station);
+
+/**
+ * @brief Title of the ICY metadata of the stream, empty if it sent none.
+ */
+void radio_station_get_title(radio_station_handle_t station, char *title,
+                             size_t size);
+
+void radio_station_get_stats(radio_station_handle_t station,
+                             struct radio_station_stats *stats);
+
+#endif /* RADIO_STATION_H */
@@ -0,0 +1,164 @@
+#ifndef RADIO_TIMESHIFT_H
+#define RADIO_TIMESHIFT_H
+#pragma once
+
+/*
+ * Recording of the stream that plays, for pausing and going back on live
+ * radio, shared by the firmware and the host tools, so it only depends on the
+ * C library. It does not lock, the owner does.
+ *
+ * The stream is kept in a file of a fixed size, a ring of blocks that are
+ * each written at once, so the SD card only sees large sequential writes. The
+ * block that fills and the one before it, until it is written, are kept in
+ * memory and read from there. A position is the offset in the stream since
+ * the recording started, its block and place in the file follow from it.
+ *
+ * The frames are followed as the stream is recorded. For each second of
+ * audio the index keeps the position of the first frame that starts in it,
+ * so the decoder can go back or forward by seconds and start at a frame.
+ *
+ * The SD host only moves DMA-capable memory in one transfer, other memory
+ * goes a sector at a time. Blocks in PSRAM are moved through a bounce buffer
+ * of internal memory instead, in pieces of its size.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "radio_ring.h"
+
+/// Written and read at once, a multiple of the sectors of the card
+#define RADIO_TIMESHIFT_BLOCK 32768
+/// The position is no longer recorded, the file was written over it
+#define RADIO_TIMESHIFT_LOST  -1
+/// The file could not be read
+#define RADIO_TIMESHIFT_ERROR -2
+
+struct radio_timeshift {
+	FILE *file;       // Only written by radio_timeshift_write()
+	uint32_t blocks;  // Of the file
+	uint8_t *ram[2];  // Block n is in ram[n % 2] until it is written
+	uint64_t end;     // Position after the newest byte
+	uint64_t on_file; // Blocks written to the file
+	uint32_t starts;  // Recordings started, tells a write that is too late
+	enum radio_codec codec;
+	uint8_t *bounce;  // Blocks are written through it if set
+	size_t bounce_size;
+
+	// The frame the stream is at
+	uint8_t header[RADIO_FRAME_HEADER];
+	uint8_t header_fill;
+	bool synced;    // The last header was one
+	uint64_t frame; // Position of the header that is collected
+	uint32_t skip;  // Bytes of the last frame that did not arrive yet
+	uint64_t us;    // Audio before the next frame
+	uint32_t lost;  // Times a frame did not follow the one before it
+
+	// The first frame of second s is at index[s % index_size]
+	uint64_t *index;
+	uint32_t index_size;
+	uint32_t seconds; // Indexed
+};
+
+/**
+ * @brief Reads the recording in blocks, one at a time from the file.
+ */
+struct radio_timeshift_reader {
+	FILE *file;
+	uint8_t *data;     // A block of the file
+	uint64_t block;    // In data, UINT64_MAX if none
+	uint32_t starts;   // Of the recording the block is from
+	uint64_t position; // Of the next byte that is read
+	uint8_t *bounce;   // Blocks are read through it if set
+	size_t bounce_size;
+};
+
+/**
+ * @brief Record to blocks * RADIO_TIMESHIFT_BLOCK bytes of file from its
+ * start, with 2 * RADIO_TIMESHIFT_BLOCK bytes at ram for the blocks in
+ * memory and index_size seconds of index. The memory stays the caller's.
+ */
+void radio_timeshift_init(struct radio_timeshift *shift, FILE *file,
+                          uint32_t blocks, void *ram, uint64_t *index,
+                          uint32_t index_size);
+
+/**
+ * @brief Drop the recording and start a new one of a stream of codec.
+ */
+void radio_timeshift_start(struct radio_timeshift *shift,
+                           enum radio_codec codec);
+
+/**
+ * @brief Record the next bytes of the stream, as many as the blocks in
+ * memory have room for.
+ * @return bytes recorded, less than length while a full block waits to be
+ * written
+ */
+size_t radio_timeshift_append(struct radio_timeshift *shift, const void *data,
+                              size_t length);
+
+/**
+ * @return true if the oldest block in memory is full and waits to be written
+ */
+static inline bool
+radio_timeshift_pending(const struct radio_timeshift *shift) {
+	return shift->end >= (shift->on_file + 1) * RADIO_TIMESHIFT_BLOCK;
+}
+
+/**
+ * @brief Write the full block in memory to its place in the file. It only
+ * reads the block, so the owner may append and read while it writes. Once it
+ * is written radio_timeshift_written() lets the block in memory go, unless
+ * the recording started again in the meantime.
+ * @param block shift->on_file when it was pending
+ * @return false if it could not be written
+ */
+bool radio_timeshift_write(const struct radio_timeshift *shift,
+                           uint64_t block);
+void radio_timeshift_written(struct radio_timeshift *shift);
+
+/**
+ * @return oldest position that can still be read
+ */
+uint64_t radio_timeshift_oldest(const struct radio_timeshift *shift);
+
+/**
+ * @brief Read from the file with a block of memory at data.
+ */
+void radio_timeshift_reader_init(struct radio_timeshift_reader *reader,
+                                 FILE *file, void *data);
+
+/**
+ * @brief Copy bytes from the reader's position on, from the file or the
+ * blocks in memory, and move it on.
+ * @return bytes read, 0 at the end of the recording, RADIO_TIMESHIFT_LOST or
+ * RADIO_TIMESHIFT_ERROR
+ */
+int radio_timeshift_read(const struct radio_timeshift *shift,
+                         struct radio_timeshift_reader *reader, void *out,
+                         size_t length);
+
+/**
+ * @return second of audio the frame at position plays in
+ */
+uint32_t radio_timeshift_second(const struct radio_timeshift *shift,
+                                uint64_t position);
+
+/**
+ * @brief Find the frame seconds after the second of position, or before it
+ * when seconds is negative. Going back stops at the oldest frame that is
+ * still recorded.
+ * @param frame its position
+ * @return false if it is past the newest second
+ */
+bool radio_timeshift_seek(const struct radio_timeshift *shift,
+                          uint64_t position, int seconds, uint64_t *frame);
+
+/**
+ * @return seconds of audio that can be gone back to from the end
+ */
+uint32_t radio_timeshift_recorded(const struct radio_timeshift *shift);
+
+#endif /* RADIO_TIMESHIFT_H */
@@ -0,0 +1,117 @@
+#ifndef STATION_DB_H
+#define STATION_DB_H
+#pragma once
+
+/*
+ * Table of radio stations with a search index on the words of their names,
+ * shared by the firmware and the host tools, so it only depends on the C
+ * library.
+ *
+ * Names and urls are offsets into one block of strings, equal strings are
+ * stored once. The index holds every word of every name sorted by its
+ * lowercase letters and digits, under a table of the first two characters.
+ * A prefix search looks the range of the first two characters up and binary
+ * searches it, the memory is 8 bytes per station and per word plus the
+ * strings and the table.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// Longest line of a station list that is read, longer lines are skipped
+#define STATION_DB_LINE_LENGTH 512
+/// Longest name that is kept, longer names are cut
+#define STATION_DB_NAME_LENGTH 96
+/// Words of a query that are matched
+#define STATION_DB_QUERY_WORDS 4
+/// Characters a word starts with, their folded values, 38 * 38 ranges
+#define STATION_DB_BUCKETS     (38 * 38)
+
+struct station {
+	uint32_t name; // Offsets into the strings
+	uint32_t url;
+};
+
+struct station_word {
+	uint32_t station;
+	uint32_t offset; // Of the first character of the word in the strings
+};
+
+struct station_db {
+	uint32_t nr_stations;
+	struct station *stations;
+	char *strings; // Starts with the empty string at offset 0
+	uint32_t strings_size;
+	uint32_t nr_words;
+	struct station_word *words;
+	uint32_t *buckets; // STATION_DB_BUCKETS + 1 starts of ranges of words
+
+	// While the list is added, freed by station_db_finish()
+	uint32_t stations_capacity;
+	uint32_t strings_capacity;
+	uint32_t *intern; // Hash table of strings, 0 if the slot is free
+	uint32_t intern_size;
+	uint32_t intern_count;
+	char pending[STATION_DB_NAME_LENGTH]; // #EXTINF name of the next url
+	uint32_t skipped;                     // Lines that were too long
+};
+
+/**
+ * @brief Start an empty table, stations are then added one by one.
+ */
+bool station_db_begin(struct station_db *db);
+
+/**
+ * @brief Append a station.
+ * @return false if there is no memory
+ */
+bool station_db_add(struct station_db *db, const char *name, const char *url);
+
+/**
+ * @brief Append the station of a line of a list. Lines are "name<TAB>url",
+ * an extended M3U playlist, or urls on their own.
+ * @return false if there is no memory, other lines are skipped
+ */
+bool station_db_add_line(struct station_db *db, const char *line);
+
+/**
+ * @brief Append the stations of a list line by line, only one line is held
+ * in memory.
+ */
+bool station_db_add_file(struct station_db *db, FILE *f);
+
+/**
+ * @brief Trim the table to its size and build the index. It is read-only
+ * afterwards and may be searched from any task.
+ */
+bool station_db_finish(struct station_db *db);
+
+void station_db_free(struct station_db *db);
+
+static inline const char *station_db_name(const struct station_db *db,
+                                          uint32_t station) {
+	return db->strings + db->stations[station].name;
+}
+
+static inline const char *station_db_url(const struct station_db *db,
+                                         uint32_t station) {
+	return db->strings + db->stations[station].url;
+}
+
+/**
+ * @brief Find the stations with a word in their name starting with each word
+ * of the query, ignoring case and punctuation.
+ * @param results stations in the order of the words they matched
+ * @return number of results, at most max
+ */
+int station_db_search(const struct station_db *db, const char *query,
+                      uint32_t *results, int max);
+
+/**
+ * @brief Bytes the finished table takes.
+ */
+size_t station_db_memory(const struct station_db *db);
+
+#endif /* STATION_DB_H */
@@ -2,24 +2,36 @@
 
 #include "esp_check.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "nvs.h"
 
 #include "board.h"
 
+#include "aac_decoder.h"
 #include "audio_common.h"
 #include "audio_element.h"
 #include "audio_event_iface.h"
 #include "audio_mem.h"
 #include "audio_pipeline.h"
+#include "audio_tee.h"
+#include "audio_tee_tap.h"
 #include "board.h"
-#include "http_stream.h"
 #include "i2s_stream.h"
 #include "mp3_decoder.h"
 #include "periph_button.h"
 #include "periph_touch.h"
 
 #include "radio.h"
+#include "radio_station.h"
+#include "sd_storage.h"
+#include "station_db.h"
+
+#ifdef CONFIG_BEAT_TRACKER
+#	include "beat_filter.h"
+#endif
 
 typedef struct rc {
 	char *name;
@@ -30,39 +42,339 @@ static const char *TAG = "RADIO_COMPONENT";
 
 TaskHandle_t radio_task_handle = NULL;
 
-audio_pipeline_handle_t pipeline;
-audio_element_handle_t i2s_stream_writer, mp3_decoder, http_stream_reader;
+// The active station and, on standby, the next and the previous one
+#ifdef CONFIG_RADIO_STANDBY
+#	define RADIO_STATIONS 3
+#else
+#	define RADIO_STATIONS 1
+#endif
 
-// Add more channels to your liking
-static const radio_channel channels[] = {
+audio_pipeline_handle_t pipeline;
+audio_element_handle_t i2s_stream_writer, tee;
+// The decoders of the codecs and their tags, the one of the active station is
+// linked
+static audio_element_handle_t decoders[RADIO_CODEC_AAC + 1];
+static const char *decoder_tags[] = { [RADIO_CODEC_MP3] = "mp3",
+	                                  [RADIO_CODEC_AAC] = "aac" };
+static enum radio_codec decoder_codec = RADIO_CODEC_MP3;
+static audio_event_iface_handle_t radio_evt;
+static radio_station_handle_t stations[RADIO_STATIONS];
+static radio_station_handle_t active_station;
+static SemaphoreHandle_t stats_lock; // Keeps the stations while it is read
+static int64_t tuned_us; // Until the decoder reports the audio
+static bool tuned_prebuffered;
+static bool radio_paused; // The pipeline is paused, the stream is recorded on
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+// Run time of the decoder task and of its core since the tune, sampled each
+// second under stats_lock
+static esp_timer_handle_t load_timer;
+static TaskHandle_t load_task;
+static uint32_t load_last_task, load_last_total;
+static uint64_t load_decoder, load_total;
+#endif
+#ifdef CONFIG_BEAT_TRACKER
+audio_element_handle_t beat_filter;
+#endif
+
+// Played when neither the SD card nor NVS has a list of stations
+static const radio_channel default_channels[] = {
 	{ .name = "Radio1Rock",
 	  .url  = "http://stream.radioreklama.bg:80/radio1rock128" },
 	{ .name = "Radio 1 Classics",
 	  .url  = "http://icecast-servers.vrtcdn.be/radio1_classics_mid.mp3" }
 };
+
+// Read-only once loaded, searched from the web and LCD tasks
+static struct station_db station_list;
+static bool stations_loaded = false;
+#define NR_CHANNELS           (station_list.nr_stations)
+#define CHANNEL_NAME(channel) station_db_name(&station_list, channel)
+#define CHANNEL_URL(channel)  station_db_url(&station_list, channel)
 static int cur_chnl_idx = 0;
 int player_volume       = 0;
 
 bool radio_initialized = false;
 
 /**
- * @brief  Event handler for HTTP stream responsible for handling track and
- * playlist state.
- * @param  msg: Event message
+ * @brief  Add the stations of the list on the SD card.
+ */
+static esp_err_t radio_load_file(void) {
+	sd_storage_handle_t storage;
+	if (sd_storage_acquire(&storage) != ESP_OK) return ESP_ERR_NOT_FOUND;
+
+	esp_err_t ret = ESP_ERR_NOT_FOUND;
+	FILE *f       = fopen(CONFIG_RADIO_STATIONS_FILE, "r");
+	if (f) {
+		ret = ESP_OK;
+		if (!station_db_add_file(&station_list, f)) {
+			// The stations before a read error are kept
+			if (ferror(f)) ESP_LOGW(TAG, "Could not read all stations");
+			else ret = ESP_ERR_NO_MEM;
+		}
+		fclose(f);
+	}
+	sd_storage_release(storage);
+	return ret;
+}
+
+/**
+ * @brief  Add the stations in NVS, "name<TAB>url" strings under the keys
+ * "0", "1" and so on.
+ */
+static esp_err_t radio_load_nvs(void) {
+	nvs_handle_t nvs;
+	esp_err_t err = nvs_open("stations", NVS_READONLY, &nvs);
+	if (err != ESP_OK) return err;
+
+	esp_err_t ret = ESP_OK;
+	char key[NVS_KEY_NAME_MAX_SIZE];
+	char line[STATION_DB_LINE_LENGTH];
+	for (int i = 0;; i++) {
+		size_t length = sizeof line;
+		snprintf(key, sizeof key, "%d", i);
+		err           = nvs_get_str(nvs, key, line, &length);
+		if (err == ESP_ERR_NVS_INVALID_LENGTH) {
+			station_list.skipped++;
+			continue;
+		} else if (err != ESP_OK) {
+			break;
+		}
+		if (!station_db_add_line(&station_list, line)) {
+			ret = ESP_ERR_NO_MEM;
+			break;
+		}
+	}
+	nvs_close(nvs);
+	return ret;
+}
+
+esp_err_t radio_load_stations(void) {
+	if (stations_loaded) station_db_free(&station_list);
+	stations_loaded = false;
+	if (!station_db_begin(&station_list)) return ESP_ERR_NO_MEM;
+
+	int64_t start_us = esp_timer_get_time();
+	const char *from = CONFIG_RADIO_STATIONS_FILE;
+	esp_err_t err    = radio_load_file();
+	if (err != ESP_ERR_NO_MEM && !station_list.nr_stations) {
+		from = "NVS";
+		err  = radio_load_nvs();
+	}
+	if (err != ESP_ERR_NO_MEM && !station_list.nr_stations) {
+		from               = "built-in list";
+		err                = ESP_OK;
+		size_t nr_defaults = sizeof default_channels / sizeof *default_channels;
+		for (size_t i = 0; i < nr_defaults && err == ESP_OK; i++)
+			if (!station_db_add(&station_list, default_channels[i].name,
+			                    default_channels[i].url))
+				err = ESP_ERR_NO_MEM;
+	}
+	if (err == ESP_OK && !station_db_finish(&station_list))
+		err = ESP_ERR_NO_MEM;
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Could not load the stations (err=%d)", err);
+		station_db_free(&station_list);
+		return err;
+	}
+
+	ESP_LOGI(TAG,
+	         "Loaded %u stations from %s in %lld ms, %u bytes, %u lines "
+	         "skipped",
+	         (unsigned)station_list.nr_stations, from,
+	         (long long)(esp_timer_get_time() - start_us) / 1000,
+	         (unsigned)station_db_memory(&station_list),
+	         (unsigned)station_list.skipped);
+	if ((uint32_t)cur_chnl_idx >= NR_CHANNELS) cur_chnl_idx = 0;
+	stations_loaded = true;
+	return ESP_OK;
+}
+
+int radio_nr_channels(void) { return stations_loaded ? (int)NR_CHANNELS : 0; }
+
+const char *radio_channel_name(int channel) {
+	if (channel < 0 || channel >= radio_nr_channels()) return "";
+	return CHANNEL_NAME(channel);
+}
+
+int radio_search(const char *query, uint32_t *channels, int max) {
+	if (!stations_loaded) return 0;
+	return station_db_search(&station_list, query, channels, max);
+}
+
+int radio_get_channel(void) { return cur_chnl_idx; }
+
+esp_err_t radio_get_stats(struct radio_station_stats *stats) {
+	if (!stats_lock) return ESP_ERR_INVALID_STATE;
+
+	xSemaphoreTake(stats_lock, portMAX_DELAY);
+	if (active_station) radio_station_get_stats(active_station, stats);
+	esp_err_t err = active_station ? ESP_OK : ESP_ERR_INVALID_STATE;
+	xSemaphoreGive(stats_lock);
+	return err;
+}
+
+esp_err_t radio_get_title(char *title, size_t size) {
+	if (!stats_lock) return ESP_ERR_INVALID_STATE;
+
+	xSemaphoreTake(stats_lock, portMAX_DELAY);
+	if (active_station) radio_station_get_title(active_station, title, size);
+	esp_err_t err = active_station ? ESP_OK : ESP_ERR_INVALID_STATE;
+	xSemaphoreGive(stats_lock);
+	return err;
+}
+
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+/**
+ * @brief  Add the run time of the decoder since the last sample, in the
+ * esp_timer task. The task of a decoder that was linked again is new.
  */
-esp_err_t http_stream_event_handle(http_stream_event_msg_t *msg) {
-	switch (msg->event_id) {
-		case HTTP_STREAM_FINISH_TRACK:
-			ESP_LOGI(TAG, "HTTP_STREAM_FINISH_TRACK");
-			return http_stream_next_track(msg->el);
-		case HTTP_STREAM_FINISH_PLAYLIST:
-			ESP_LOGI(TAG, "HTTP_STREAM_FINISH_PLAYLIST");
-			return http_stream_restart(msg->el);
-		default: break;
+static void radio_sample_load(void *arg) {
+	xSemaphoreTake(stats_lock, portMAX_DELAY);
+	TaskHandle_t task = xTaskGetHandle(decoder_tags[decoder_codec]);
+	if (task) {
+		TaskStatus_t status;
+		vTaskGetInfo(task, &status, pdFALSE, eRunning);
+		uint32_t total = portGET_RUN_TIME_COUNTER_VALUE();
+		if (task == load_task) {
+			load_decoder += status.ulRunTimeCounter - load_last_task;
+			load_total   += total - load_last_total;
+		}
+		load_last_task  = status.ulRunTimeCounter;
+		load_last_total = total;
 	}
+	load_task = task;
+	xSemaphoreGive(stats_lock);
+}
+#endif
+
+/**
+ * @brief  Start measuring the decoder again, for another station or decoder.
+ */
+static void radio_reset_load(void) {
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+	xSemaphoreTake(stats_lock, portMAX_DELAY);
+	load_task    = NULL;
+	load_decoder = 0;
+	load_total   = 0;
+	xSemaphoreGive(stats_lock);
+#endif
+}
+
+int radio_get_decoder_load(void) {
+	int load = -1;
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+	if (!stats_lock) return load;
+	xSemaphoreTake(stats_lock, portMAX_DELAY);
+	if (load_total) load = load_decoder * 1000 / load_total;
+	xSemaphoreGive(stats_lock);
+#endif
+	return load;
+}
+
+/**
+ * @brief  Input of the decoders, the stream of the active station. The
+ * context is the codec of the decoder.
+ */
+static int radio_read(audio_element_handle_t self, char *buffer, int len,
+                      TickType_t ticks_to_wait, void *context) {
+	return radio_station_read(active_station,
+	                          (enum radio_codec)(intptr_t)context, buffer, len,
+	                          ticks_to_wait);
+}
+
+/**
+ * @brief  Tags of the pipeline from the decoder of codec to I2S.
+ * @return number of tags
+ */
+static int radio_link_tags(enum radio_codec codec, const char *tags[4]) {
+	int n     = 0;
+	tags[n++] = decoder_tags[codec];
+#ifdef CONFIG_BEAT_TRACKER
+	tags[n++] = "beat";
+#endif
+	tags[n++] = "tee";
+	tags[n++] = "i2s";
+	return n;
+}
+
+/**
+ * @brief  Link the decoder of codec in place of the one that is linked, while
+ * the pipeline is stopped. The task of the other one ends until it is linked
+ * again.
+ */
+static esp_err_t radio_switch_decoder(enum radio_codec codec) {
+	if (!codec || codec == decoder_codec) return ESP_OK;
+
+	ESP_LOGI(TAG, "Switching the decoder from %s to %s",
+	         decoder_tags[decoder_codec], decoder_tags[codec]);
+	audio_element_handle_t old = decoders[decoder_codec];
+	ESP_RETURN_ON_ERROR(audio_pipeline_breakup_elements(pipeline, old), TAG,
+	                    "");
+	ESP_RETURN_ON_ERROR(audio_element_terminate(old), TAG, "");
+
+	const char *tags[4];
+	ESP_RETURN_ON_ERROR(audio_pipeline_relink(pipeline, tags,
+	                                          radio_link_tags(codec, tags)),
+	                    TAG, "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_set_listener(pipeline, radio_evt), TAG,
+	                    "");
+	xSemaphoreTake(stats_lock, portMAX_DELAY);
+	decoder_codec = codec;
+	xSemaphoreGive(stats_lock);
+	radio_reset_load();
 	return ESP_OK;
 }
 
+/**
+ * @brief  Start the stopped pipeline from the start of the stream of the
+ * active station.
+ */
+static esp_err_t radio_restart_pipeline(void) {
+	ESP_RETURN_ON_ERROR(audio_element_reset_state(decoders[decoder_codec]),
+	                    TAG, "");
+#ifdef CONFIG_BEAT_TRACKER
+	ESP_RETURN_ON_ERROR(audio_element_reset_state(beat_filter), TAG, "");
+#endif
+	ESP_RETURN_ON_ERROR(audio_element_reset_state(tee), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_element_reset_state(i2s_stream_writer), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_reset_ringbuffer(pipeline), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_reset_items_state(pipeline), TAG, "");
+	return audio_pipeline_run(pipeline);
+}
+
+static radio_station_handle_t radio_find_station(int channel) {
+	for (int s = 0; s < RADIO_STATIONS; s++)
+		if (radio_station_get_channel(stations[s]) == channel)
+			return stations[s];
+	return NULL;
+}
+
+/**
+ * @brief  Connect the stations on standby to the channels next to the one
+ * that plays, a station keeps its connection if it is still next to it.
+ */
+static void radio_prepare_standby(void) {
+	int wanted[2] = { (cur_chnl_idx + 1) % NR_CHANNELS,
+		              (cur_chnl_idx + NR_CHANNELS - 1) % NR_CHANNELS };
+
+	for (int w = 0; w < 2; w++) {
+		if (wanted[w] == cur_chnl_idx || radio_find_station(wanted[w]))
+			continue;
+		for (int s = 0; s < RADIO_STATIONS; s++) {
+			int channel = radio_station_get_channel(stations[s]);
+			if (stations[s] == active_station || channel == wanted[0] ||
+			    channel == wanted[1])
+				continue;
+			ESP_LOGI(TAG, "Prebuffering %s", CHANNEL_NAME(wanted[w]));
+			if (radio_station_tune(stations[s], wanted[w],
+			                       CHANNEL_URL(wanted[w])) != ESP_OK)
+				ESP_LOGW(TAG, "Could not prebuffer %s",
+				         CHANNEL_NAME(wanted[w]));
+			break;
+		}
+	}
+}
+
 esp_err_t radio_init(audio_element_handle_t *elems, size_t count,
                      audio_event_iface_handle_t evt,
                      esp_periph_set_handle_t periph_set, void *args) {
@@ -71,19 +383,54 @@ esp_err_t radio_init(audio_element_handle_t *elems, size_t count,
 		return ESP_OK;
 	}
 
-	// Initialize HTTP stream
-	http_stream_cfg_t http_cfg      = HTTP_STREAM_CFG_DEFAULT();
-	http_cfg.type                   = AUDIO_STREAM_READER;
-	http_cfg.event_handle           = http_stream_event_handle;
-	http_cfg.enable_playlist_parser = true;
-	http_stream_reader              = http_stream_init(&http_cfg);
-	ESP_RETURN_ON_ERROR(
-	    audio_element_set_uri(http_stream_reader, channels[cur_chnl_idx].url),
-	    TAG, "");
+	if (!stations_loaded)
+		ESP_RETURN_ON_ERROR(radio_load_stations(), TAG, "No stations");
+	if (!stats_lock) stats_lock = xSemaphoreCreateMutex();
+	if (!stats_lock) return ESP_ERR_NO_MEM;
+
+	// Initialize the stations, each with an HTTP stream outside the pipeline
+	for (int s = 0; s < RADIO_STATIONS; s++) {
+		stations[s] = radio_station_create(CONFIG_RADIO_BUFFER_KB * 1024,
+		                                   CONFIG_RADIO_JITTER_MIN_MS, evt);
+		if (!stations[s]) {
+			while (s--) radio_station_destroy(stations[s], evt);
+			return ESP_ERR_NO_MEM;
+		}
+	}
+#ifdef CONFIG_RADIO_TIMESHIFT
+	if (radio_station_timeshift_init(CONFIG_RADIO_TIMESHIFT_FILE,
+	                                 CONFIG_RADIO_TIMESHIFT_MB) != ESP_OK)
+		ESP_LOGW(TAG, "No timeshift, the radio plays live only");
+#endif
+	active_station = stations[0];
+	ESP_RETURN_ON_ERROR(radio_station_tune(active_station, cur_chnl_idx,
+	                                       CHANNEL_URL(cur_chnl_idx)),
+	                    TAG, "");
+	radio_station_set_active(active_station, true);
+	tuned_us          = esp_timer_get_time();
+	tuned_prebuffered = false;
 
-	// initialize MP3 decoder
+	// Initialize the decoders, the one for the codec of the active station
+	// reads its stream
 	mp3_decoder_cfg_t mp3_cfg = DEFAULT_MP3_DECODER_CONFIG();
-	mp3_decoder               = mp3_decoder_init(&mp3_cfg);
+	decoders[RADIO_CODEC_MP3] = mp3_decoder_init(&mp3_cfg);
+	aac_decoder_cfg_t aac_cfg = DEFAULT_AAC_DECODER_CONFIG();
+	decoders[RADIO_CODEC_AAC] = aac_decoder_init(&aac_cfg);
+	for (int c = RADIO_CODEC_MP3; c <= RADIO_CODEC_AAC; c++)
+		audio_element_set_read_cb(decoders[c], radio_read,
+		                          (void *)(intptr_t)c);
+
+#ifdef CONFIG_BEAT_TRACKER
+	// Initialize beat tracker, it passes the decoded audio on to I2S
+	beat_filter_cfg_t beat_cfg = DEFAULT_BEAT_FILTER_CONFIG();
+	beat_cfg.evt               = evt;
+	beat_cfg.latency_ms        = CONFIG_BEAT_TRACKER_LATENCY_MS;
+	beat_filter                = beat_filter_init(&beat_cfg);
+#endif
+
+	// Initialize tee, it publishes the decoded audio for analysis
+	audio_tee_cfg_t tee_cfg = DEFAULT_AUDIO_TEE_CONFIG();
+	tee                     = audio_tee_init(&tee_cfg);
 
 	// Initialize I2S stream
 	i2s_stream_cfg_t i2s_cfg = I2S_STREAM_CFG_DEFAULT();
@@ -93,21 +440,41 @@ esp_err_t radio_init(audio_element_handle_t *elems, size_t count,
 	// Initialize audio pipeline
 	audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
 	pipeline                          = audio_pipeline_init(&pipeline_cfg);
-	ESP_RETURN_ON_ERROR(
-	    audio_pipeline_register(pipeline, http_stream_reader, "http"), TAG, "");
-	ESP_RETURN_ON_ERROR(audio_pipeline_register(pipeline, mp3_decoder, "mp3"),
-	                    TAG, "");
+	for (int c = RADIO_CODEC_MP3; c <= RADIO_CODEC_AAC; c++)
+		ESP_RETURN_ON_ERROR(
+		    audio_pipeline_register(pipeline, decoders[c], decoder_tags[c]),
+		    TAG, "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_register(pipeline, tee, "tee"), TAG,
+	                    "");
 	ESP_RETURN_ON_ERROR(
 	    audio_pipeline_register(pipeline, i2s_stream_writer, "i2s"), TAG, "");
-	ESP_RETURN_ON_ERROR(
-	    audio_pipeline_link(pipeline, (const char *[]){ "http", "mp3", "i2s" },
-	                        3),
-	    TAG, "");
+#ifdef CONFIG_BEAT_TRACKER
+	ESP_RETURN_ON_ERROR(audio_pipeline_register(pipeline, beat_filter, "beat"),
+	                    TAG, "");
+#endif
+	const char *tags[4];
+	ESP_RETURN_ON_ERROR(audio_pipeline_link(pipeline, tags,
+	                                        radio_link_tags(decoder_codec,
+	                                                        tags)),
+	                    TAG, "");
 
 	// Set up audio event interface and subscribe to pipeline events
+	radio_evt = evt;
 	ESP_RETURN_ON_ERROR(audio_pipeline_set_listener(pipeline, evt), TAG, "");
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+	const esp_timer_create_args_t load_cfg = {
+		.callback = radio_sample_load,
+		.name     = "radio_load",
+	};
+	if (!load_timer)
+		ESP_RETURN_ON_ERROR(esp_timer_create(&load_cfg, &load_timer), TAG, "");
+	radio_reset_load();
+	ESP_RETURN_ON_ERROR(esp_timer_start_periodic(load_timer, 1000000), TAG,
+	                    "");
+#endif
 
 	ESP_RETURN_ON_ERROR(audio_pipeline_run(pipeline), TAG, "");
+	audio_tee_set_playback(tee);
 
 	radio_initialized = true;
 
@@ -127,22 +494,47 @@ esp_err_t radio_deinit(audio_element_handle_t *elems, size_t count,
 		return ESP_OK;
 	}
 
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+	esp_timer_stop(load_timer);
+#endif
 	ESP_RETURN_ON_ERROR(audio_pipeline_remove_listener(pipeline), TAG, "");
+	audio_tee_set_playback(NULL);
 
 	ESP_RETURN_ON_ERROR(audio_pipeline_stop(pipeline), TAG, "");
 	ESP_RETURN_ON_ERROR(audio_pipeline_wait_for_stop(pipeline), TAG, "");
 	ESP_RETURN_ON_ERROR(audio_pipeline_terminate(pipeline), TAG, "");
 
-	ESP_RETURN_ON_ERROR(audio_pipeline_unregister(pipeline, http_stream_reader),
-	                    TAG, "");
 	ESP_RETURN_ON_ERROR(audio_pipeline_unregister(pipeline, i2s_stream_writer),
 	                    TAG, "");
-	ESP_RETURN_ON_ERROR(audio_pipeline_unregister(pipeline, mp3_decoder), TAG,
+	for (int c = RADIO_CODEC_MP3; c <= RADIO_CODEC_AAC; c++) {
+		// The one that is not linked may still listen from before
+		if (c != (int)decoder_codec)
+			audio_element_msg_remove_listener(decoders[c], evt);
+		ESP_RETURN_ON_ERROR(audio_pipeline_unregister(pipeline, decoders[c]),
+		                    TAG, "");
+	}
+#ifdef CONFIG_BEAT_TRACKER
+	ESP_RETURN_ON_ERROR(audio_pipeline_unregister(pipeline, beat_filter), TAG,
 	                    "");
+#endif
+	ESP_RETURN_ON_ERROR(audio_pipeline_unregister(pipeline, tee), TAG, "");
 
 	ESP_RETURN_ON_ERROR(audio_pipeline_deinit(pipeline), TAG, "");
-	ESP_RETURN_ON_ERROR(audio_element_deinit(http_stream_reader), TAG, "");
-	ESP_RETURN_ON_ERROR(audio_element_deinit(mp3_decoder), TAG, "");
+	xSemaphoreTake(stats_lock, portMAX_DELAY);
+	for (int s = 0; s < RADIO_STATIONS; s++)
+		radio_station_destroy(stations[s], evt);
+	active_station = NULL;
+	xSemaphoreGive(stats_lock);
+#ifdef CONFIG_RADIO_TIMESHIFT
+	radio_station_timeshift_deinit();
+#endif
+	radio_paused = false;
+	for (int c = RADIO_CODEC_MP3; c <= RADIO_CODEC_AAC; c++)
+		ESP_RETURN_ON_ERROR(audio_element_deinit(decoders[c]), TAG, "");
+#ifdef CONFIG_BEAT_TRACKER
+	ESP_RETURN_ON_ERROR(audio_element_deinit(beat_filter), TAG, "");
+#endif
+	ESP_RETURN_ON_ERROR(audio_element_deinit(tee), TAG, "");
 	audio_element_deinit(i2s_stream_writer);
 
 	radio_initialized = false;
@@ -155,13 +547,7 @@ esp_err_t radio_deinit(audio_element_handle_t *elems, size_t count,
  */
 esp_err_t channel_up() {
 	ESP_LOGD(TAG, "Increasing channel");
-	cur_chnl_idx++;
-
-	if (cur_chnl_idx >= sizeof(channels) / sizeof(radio_channel)) {
-		cur_chnl_idx = 0;
-	}
-
-	ESP_RETURN_ON_ERROR(tune_radio(cur_chnl_idx), TAG, "");
+	ESP_RETURN_ON_ERROR(tune_radio((cur_chnl_idx + 1) % NR_CHANNELS), TAG, "");
 
 	return ESP_OK;
 }
@@ -171,13 +557,8 @@ esp_err_t channel_up() {
  */
 esp_err_t channel_down() {
 	ESP_LOGD(TAG, "Decreasing channel");
-	cur_chnl_idx--;
-
-	if (cur_chnl_idx < 0) {
-		cur_chnl_idx = (sizeof(channels) / sizeof(radio_channel)) - 1;
-	}
-
-	ESP_RETURN_ON_ERROR(tune_radio(cur_chnl_idx), TAG, "");
+	ESP_RETURN_ON_ERROR(
+	    tune_radio((cur_chnl_idx + NR_CHANNELS - 1) % NR_CHANNELS), TAG, "");
 
 	return ESP_OK;
 }
@@ -188,37 +569,77 @@ esp_err_t channel_down() {
  * for available channels)
  */
 esp_err_t tune_radio(unsigned int channel_idx) {
-	if (channel_idx >= sizeof(channels) / sizeof(radio_channel)) {
+	if (!stations_loaded || channel_idx >= NR_CHANNELS) {
 		ESP_LOGE(TAG, "Invalid channel, cancelling tune request");
 		return ESP_ERR_INVALID_ARG;
 	}
 
-	cur_chnl_idx                         = channel_idx;
-	const radio_channel *current_channel = &channels[channel_idx];
-
-	ESP_LOGD(TAG, "Tuning to channel %s", current_channel->name);
+	cur_chnl_idx = channel_idx;
+	// Played from that channel on when the radio starts
+	if (!radio_initialized) return ESP_OK;
+
+	tuned_us         = esp_timer_get_time();
+	const char *name = CHANNEL_NAME(channel_idx);
+
+	ESP_LOGD(TAG, "Tuning to channel %s", name);
+
+	// A station on standby already buffered the channel, otherwise the
+	// active one connects to it
+	struct radio_station_stats left;
+	radio_station_get_stats(active_station, &left);
+	int load     = radio_get_decoder_load();
+	char cpu[32] = "";
+	if (load >= 0)
+		snprintf(cpu, sizeof cpu, ", decoder %d.%d%% CPU", load / 10,
+		         load % 10);
+	if (left.codec)
+		ESP_LOGI(TAG, "Leaving channel %d: %s, %u kbps%s",
+		         radio_station_get_channel(active_station),
+		         decoder_tags[left.codec], (unsigned)left.kbps, cpu);
+
+	radio_station_handle_t station = radio_find_station(channel_idx);
+	tuned_prebuffered              = station != NULL;
+	if (station) {
+		struct radio_station_stats stats;
+		radio_station_get_stats(station, &stats);
+		ESP_LOGI(TAG, "Switching to %s, %d KB buffered", name,
+		         stats.fill / 1024);
+	} else {
+		station = active_station;
+	}
 
-	// Reset pipeline, set new URL and start playing
+	// Reset pipeline, switch the decoder to the station and start playing
 	ESP_RETURN_ON_ERROR(audio_pipeline_stop(pipeline), TAG, "");
 	ESP_RETURN_ON_ERROR(audio_pipeline_wait_for_stop(pipeline), TAG, "");
-	ESP_RETURN_ON_ERROR(audio_element_reset_state(mp3_decoder), TAG, "");
-	ESP_RETURN_ON_ERROR(audio_element_reset_state(i2s_stream_writer), TAG, "");
-	ESP_RETURN_ON_ERROR(audio_pipeline_reset_ringbuffer(pipeline), TAG, "");
-	ESP_RETURN_ON_ERROR(audio_pipeline_reset_items_state(pipeline), TAG, "");
-
+	radio_station_set_active(active_station, false);
+	if (!tuned_prebuffered)
+		ESP_RETURN_ON_ERROR(
+		    radio_station_tune(station, channel_idx, CHANNEL_URL(channel_idx)),
+		    TAG, "");
+	radio_station_set_active(station, true);
+	xSemaphoreTake(stats_lock, portMAX_DELAY);
+	active_station = station;
+	xSemaphoreGive(stats_lock);
+	radio_reset_load();
+	// A station that is not heard from yet tells its codec later
 	ESP_RETURN_ON_ERROR(
-	    audio_element_set_uri(http_stream_reader, current_channel->url), TAG,
-	    "");
-	ESP_RETURN_ON_ERROR(audio_pipeline_run(pipeline), TAG, "");
+	    radio_switch_decoder(radio_station_get_codec(station)), TAG, "");
+	ESP_RETURN_ON_ERROR(radio_restart_pipeline(), TAG, "");
+	radio_paused = false;
 
 	audio_element_info_t music_info = { 0 };
-	ESP_RETURN_ON_ERROR(audio_element_getinfo(mp3_decoder, &music_info), TAG,
-	                    "");
+	ESP_RETURN_ON_ERROR(
+	    audio_element_getinfo(decoders[decoder_codec], &music_info), TAG, "");
 
 	ESP_LOGD(TAG,
-	         "Receive music info from mp3 decoder, "
+	         "Receive music info from decoder, "
 	         "sample_rates=%d, bits=%d, ch=%d",
 	         music_info.sample_rates, music_info.bits, music_info.channels);
+#ifdef CONFIG_BEAT_TRACKER
+	ESP_RETURN_ON_ERROR(audio_element_setinfo(beat_filter, &music_info), TAG,
+	                    "");
+#endif
+	ESP_RETURN_ON_ERROR(audio_element_setinfo(tee, &music_info), TAG, "");
 	ESP_RETURN_ON_ERROR(audio_element_setinfo(i2s_stream_writer, &music_info),
 	                    TAG, "");
 	ESP_RETURN_ON_ERROR(
@@ -229,39 +650,137 @@ esp_err_t tune_radio(unsigned int channel_idx) {
 	return ESP_OK;
 }
 
+esp_err_t radio_pause(void) {
+	if (!radio_initialized) return ESP_ERR_INVALID_STATE;
+	if (radio_paused) {
+		ESP_RETURN_ON_ERROR(audio_pipeline_resume(pipeline), TAG, "");
+		radio_paused = false;
+		ESP_LOGI(TAG, "Playing on");
+		return ESP_OK;
+	}
+
+	// The decoder goes on in the recording where it stopped reading
+	ESP_RETURN_ON_ERROR(radio_station_seek(active_station, 0), TAG,
+	                    "Nothing recorded to pause");
+	ESP_RETURN_ON_ERROR(audio_pipeline_pause(pipeline), TAG, "");
+	radio_paused = true;
+	ESP_LOGI(TAG, "Paused");
+	return ESP_OK;
+}
+
+/**
+ * @brief  Start the decoder again at another frame of the recording of the
+ * active station, or live.
+ */
+static esp_err_t radio_move(int seconds, bool live) {
+	if (!radio_initialized) return ESP_ERR_INVALID_STATE;
+
+	ESP_RETURN_ON_ERROR(audio_pipeline_stop(pipeline), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_pipeline_wait_for_stop(pipeline), TAG, "");
+	esp_err_t err = ESP_OK;
+	if (live) radio_station_live(active_station);
+	else err = radio_station_seek(active_station, seconds);
+	ESP_RETURN_ON_ERROR(radio_restart_pipeline(), TAG, "");
+	radio_paused = false;
+
+	struct radio_station_stats stats;
+	radio_station_get_stats(active_station, &stats);
+	ESP_LOGI(TAG, "Playing %d s behind, %d s recorded", stats.lag_s,
+	         stats.recorded_s);
+	return err;
+}
+
+esp_err_t radio_seek(int seconds) { return radio_move(seconds, false); }
+
+esp_err_t radio_live(void) {
+	struct radio_station_stats stats;
+	if (radio_get_stats(&stats) != ESP_OK) return ESP_ERR_INVALID_STATE;
+	// Already playing live or catching up
+	if (!stats.shifted && !radio_paused) return ESP_OK;
+	return radio_move(0, true);
+}
+
 /**
  * @brief  Listen for radio events and user input and handle them.
  */
 esp_err_t radio_run(audio_event_iface_msg_t *msg, void *args) {
 	if (msg->source_type == AUDIO_ELEMENT_TYPE_ELEMENT &&
-	    msg->source == (void *)mp3_decoder &&
+	    msg->source == (void *)decoders[decoder_codec] &&
 	    msg->cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO) {
 
 		audio_element_info_t music_info = { 0 };
-		ESP_RETURN_ON_ERROR(audio_element_getinfo(mp3_decoder, &music_info),
-		                    TAG, "Could not get audio info");
+		ESP_RETURN_ON_ERROR(
+		    audio_element_getinfo(decoders[decoder_codec], &music_info), TAG,
+		    "Could not get audio info");
 
 		ESP_LOGI(TAG, "Received music info, sample_rates=%d, bits=%d, ch=%d",
 		         music_info.sample_rates, music_info.bits, music_info.channels);
+		if (tuned_us) {
+			ESP_LOGI(TAG, "%s plays %lld ms after tuning, %s",
+			         CHANNEL_NAME(cur_chnl_idx),
+			         (long long)(esp_timer_get_time() - tuned_us) / 1000,
+			         tuned_prebuffered ? "prebuffered" : "connected");
+			tuned_us = 0;
+
+			// The channel plays, the others may take the bandwidth now
+			radio_prepare_standby();
+		}
 
+#ifdef CONFIG_BEAT_TRACKER
+		ESP_RETURN_ON_ERROR(audio_element_setinfo(beat_filter, &music_info),
+		                    TAG, "Could not set beat tracker info");
+#endif
+		ESP_RETURN_ON_ERROR(audio_element_setinfo(tee, &music_info), TAG,
+		                    "Could not set tee info");
 		ESP_RETURN_ON_ERROR(
 		    i2s_stream_set_clk(i2s_stream_writer, music_info.sample_rates,
 		                       music_info.bits, music_info.channels),
 		    TAG, "Could not set I2S clock");
 
 	} else if (msg->source_type == AUDIO_ELEMENT_TYPE_ELEMENT &&
-	           msg->source == (void *)http_stream_reader &&
 	           msg->cmd == AEL_MSG_CMD_REPORT_STATUS &&
-	           (int)msg->data == AEL_STATUS_ERROR_OPEN) {
-		ESP_LOGW(TAG, "Failed to open the file, restarting stream");
-
-		ESP_ERROR_CHECK(audio_pipeline_stop(pipeline));
-		ESP_ERROR_CHECK(audio_pipeline_wait_for_stop(pipeline));
-		ESP_ERROR_CHECK(audio_element_reset_state(mp3_decoder));
-		ESP_ERROR_CHECK(audio_element_reset_state(i2s_stream_writer));
-		ESP_ERROR_CHECK(audio_pipeline_reset_ringbuffer(pipeline));
-		ESP_ERROR_CHECK(audio_pipeline_reset_items_state(pipeline));
-		ESP_ERROR_CHECK(audio_pipeline_run(pipeline));
+	           ((int)msg->data == AEL_STATUS_ERROR_OPEN ||
+	            (int)msg->data == AEL_STATUS_ERROR_INPUT ||
+	            (int)msg->data == AEL_STATUS_ERROR_TIMEOUT ||
+	            (int)msg->data == AEL_STATUS_STATE_FINISHED)) {
+		for (int s = 0; s < RADIO_STATIONS; s++) {
+			if (msg->source != (void *)radio_station_get_reader(stations[s]))
+				continue;
+			int channel = radio_station_get_channel(stations[s]);
+			if (channel < 0) break;
+
+			if (stations[s] == active_station) {
+				// The decoder plays the ring while the stream reconnects
+				ESP_LOGW(TAG, "Stream of %s broke off", CHANNEL_NAME(channel));
+				ESP_ERROR_CHECK(radio_station_reconnect(stations[s]));
+			} else {
+				// Connected again when it is next to the playing channel
+				ESP_LOGW(TAG, "Stream of %s on standby ended",
+				         CHANNEL_NAME(channel));
+				ESP_ERROR_CHECK(radio_station_stop(stations[s]));
+			}
+			break;
+		}
+	} else if (msg->source_type == RADIO_CODEC_EVT &&
+	           msg->cmd == RADIO_CODEC_EVT &&
+	           (int)msg->data == cur_chnl_idx) {
+		// The decoder of another codec waits for the stream, swap it
+		enum radio_codec codec = radio_station_get_codec(active_station);
+		if (codec && codec != decoder_codec) {
+			ESP_RETURN_ON_ERROR(audio_pipeline_stop(pipeline), TAG, "");
+			ESP_RETURN_ON_ERROR(audio_pipeline_wait_for_stop(pipeline), TAG,
+			                    "");
+			ESP_RETURN_ON_ERROR(radio_switch_decoder(codec), TAG,
+			                    "Could not switch the decoder");
+			ESP_RETURN_ON_ERROR(radio_restart_pipeline(), TAG, "");
+		}
+	} else if (msg->source_type == RADIO_TITLE_EVT &&
+	           msg->cmd == RADIO_TITLE_EVT &&
+	           (int)msg->data == cur_chnl_idx) {
+		// Stations on standby change their titles too
+		char title[RADIO_ICY_TITLE_LENGTH];
+		if (radio_get_title(title, sizeof title) == ESP_OK)
+			ESP_LOGI(TAG, "%s plays %s", CHANNEL_NAME(cur_chnl_idx), title);
 	} else if ((msg->source_type == PERIPH_ID_TOUCH ||
 	            msg->source_type == PERIPH_ID_BUTTON) &&
 	           (msg->cmd == PERIPH_TOUCH_TAP ||
@@ -0,0 +1,312 @@
+#include "radio_icy.h"
+
+#include <string.h>
+
+static const char key[] = "StreamTitle='";
+
+void radio_icy_init(struct radio_icy *icy, uint32_t metaint) {
+	memset(icy, 0, sizeof *icy);
+	icy->metaint = metaint;
+	icy->left    = metaint;
+	icy->state   = metaint ? RADIO_ICY_AUDIO : RADIO_ICY_SEARCH;
+}
+
+static void radio_icy_block_start(struct radio_icy *icy) {
+	icy->key         = 0;
+	icy->in_title    = false;
+	icy->quote       = false;
+	icy->has_title   = false;
+	icy->next_length = 0;
+	icy->blocks++;
+}
+
+/* Parse a part of a block */
+static void radio_icy_parse(struct radio_icy *icy, const uint8_t *data,
+                            size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		char c = (char)data[i];
+		if (icy->in_title) {
+			// A quote followed by ';' or the padding ends the title
+			if (icy->quote) {
+				icy->quote = false;
+				if (c == ';' || c == '\0') {
+					icy->in_title = false;
+					icy->key      = c == ';' ? 0 : -1;
+					continue;
+				}
+				if (icy->next_length < RADIO_ICY_TITLE_LENGTH - 1)
+					icy->next[icy->next_length++] = '\'';
+			}
+			if (c == '\'') icy->quote = true;
+			else if (c == '\0') icy->in_title = false;
+			else if (icy->next_length < RADIO_ICY_TITLE_LENGTH - 1)
+				icy->next[icy->next_length++] = c;
+			continue;
+		}
+
+		// The key is matched at the start of the block and after a ';'
+		if (icy->key >= 0 && c == key[icy->key]) {
+			if (++icy->key == RADIO_ICY_KEY_LENGTH) {
+				icy->in_title    = true;
+				icy->has_title   = true;
+				icy->next_length = 0;
+				icy->key         = -1;
+			}
+		} else {
+			icy->key = c == ';' ? 0 : -1;
+		}
+	}
+}
+
+/* The block ended, its title replaces the last one */
+static bool radio_icy_block_end(struct radio_icy *icy) {
+	if (!icy->has_title) return false;
+	icy->next[icy->next_length] = '\0';
+	if (!strcmp(icy->next, icy->title)) return false;
+	memcpy(icy->title, icy->next, icy->next_length + 1);
+	icy->titles++;
+	return true;
+}
+
+/*
+ * The first block with a title is position bytes into the stream, after k
+ * intervals and k - 1 empty blocks for each k that divides position + 1
+ */
+static void radio_icy_candidates(struct radio_icy *icy, uint32_t position) {
+	icy->candidates = 0;
+	for (uint32_t k = 1; icy->candidates < RADIO_ICY_CANDIDATES; k++) {
+		uint32_t interval = (position + 1) / k - 1;
+		if (k > 1 && interval < RADIO_ICY_MIN_INTERVAL) break;
+		if ((position + 1) % k) continue;
+		icy->interval[icy->candidates] = interval;
+		icy->expect[icy->candidates]   = interval;
+		icy->hits[icy->candidates]     = 1;
+		icy->candidates++;
+	}
+}
+
+/*
+ * A 0 or a block with a title is at icy->after, the intervals that expect a
+ * block there fit it. The others are dropped if it has a title, otherwise
+ * the 0 is audio to them.
+ * @return true once the shortest interval that is left is confirmed
+ */
+static bool radio_icy_fits(struct radio_icy *icy, bool title) {
+	uint8_t left = 0;
+	for (uint8_t c = 0; c < icy->candidates; c++) {
+		bool fits = icy->expect[c] == icy->after;
+		if (title && !fits) continue;
+		icy->interval[left] = icy->interval[c];
+		icy->expect[left]   = icy->expect[c];
+		icy->hits[left]     = icy->hits[c] + fits;
+		if (fits) icy->expect[left] += icy->interval[c] + 1;
+		left++;
+	}
+	icy->candidates = left;
+	if (!left || icy->hits[left - 1] < RADIO_ICY_CONFIRMATIONS) return false;
+	icy->metaint = icy->interval[left - 1];
+	return true;
+}
+
+/* The held bytes are audio, the intervals that expect a block in them go */
+static void radio_icy_misses(struct radio_icy *icy) {
+	uint8_t left = 0;
+	for (uint8_t c = 0; c < icy->candidates; c++) {
+		if (icy->expect[c] < icy->after + icy->held) continue;
+		icy->interval[left] = icy->interval[c];
+		icy->expect[left]   = icy->expect[c];
+		icy->hits[left]     = icy->hits[c];
+		left++;
+	}
+	icy->candidates = left;
+	if (!left) icy->state = RADIO_ICY_OFF;
+}
+
+/*
+ * Let the oldest n of the held bytes go, those held before this call come
+ * first, then data from *start on. The bytes of data before *start are passed
+ * on in one run by the caller.
+ */
+static void radio_icy_release(struct radio_icy *icy, size_t *start, size_t n,
+                              radio_icy_audio_t audio, void *context) {
+	size_t before = n < icy->held ? n : icy->held;
+	if (before) {
+		audio(context, icy->held_data, before);
+		icy->held -= before;
+		memmove(icy->held_data, icy->held_data + before, icy->held);
+	}
+	*start        += n - before;
+	icy->searched += n;
+}
+
+/*
+ * Look for the length byte and key of the first block. Each byte that does
+ * not continue the key is audio, except the last one, which may be the length
+ * byte of a key that follows.
+ * @return bytes used
+ */
+static size_t radio_icy_search(struct radio_icy *icy, const uint8_t *data,
+                               size_t length, radio_icy_audio_t audio,
+                               void *context) {
+	size_t start = 0;
+	for (size_t i = 0; i < length; i++) {
+		size_t held = icy->held + (i - start);
+		if (icy->searched > RADIO_ICY_SEARCH_SIZE) {
+			radio_icy_release(icy, &start, held, audio, context);
+			if (start) audio(context, data, start);
+			icy->state = RADIO_ICY_OFF;
+			return i;
+		}
+
+		uint8_t c = data[i];
+		// Most bytes do not start the key, the byte before the next 'S' may
+		// be the length byte
+		if (held == 1 && c != (uint8_t)key[0]) {
+			const uint8_t *next = memchr(data + i, key[0], length - i);
+			size_t skip = (next ? (size_t)(next - data) : length) - i;
+			radio_icy_release(icy, &start, skip, audio, context);
+			i += skip - 1;
+			continue;
+		}
+		if (held && c == (uint8_t)key[held - 1]) {
+			if (held < RADIO_ICY_KEY_LENGTH) continue;
+
+			uint8_t size = icy->held ? icy->held_data[0] : data[start];
+			if (size * 16 >= RADIO_ICY_KEY_LENGTH) {
+				if (start) audio(context, data, start);
+				radio_icy_candidates(icy, icy->searched);
+				icy->held = 0;
+				radio_icy_block_start(icy);
+				icy->in_title  = true;
+				icy->has_title = true;
+				icy->key       = -1;
+				icy->left      = size * 16 - RADIO_ICY_KEY_LENGTH;
+				icy->state     = RADIO_ICY_BLOCK;
+				return i + 1;
+			}
+		}
+
+		// The key starts again after the byte before c
+		size_t keep = c == (uint8_t)key[0] && held ? 2 : 1;
+		radio_icy_release(icy, &start, held + 1 - keep, audio, context);
+	}
+	if (start) audio(context, data, start);
+	memcpy(icy->held_data + icy->held, data + start, length - start);
+	icy->held += length - start;
+	return length;
+}
+
+/*
+ * Pass the audio on up to the next byte an interval expects a block at, then
+ * look at it. A byte other than 0 is held back with the key that follows it.
+ * @return bytes used
+ */
+static size_t radio_icy_confirm(struct radio_icy *icy, const uint8_t *data,
+                                size_t length, radio_icy_audio_t audio,
+                                void *context) {
+	if (!icy->held) {
+		uint32_t expect = icy->expect[0];
+		for (uint8_t c = 1; c < icy->candidates; c++)
+			if (icy->expect[c] < expect) expect = icy->expect[c];
+		if (icy->after < expect) {
+			size_t run = expect - icy->after;
+			if (run > length) run = length;
+			audio(context, data, run);
+			icy->after += run;
+			return run;
+		}
+
+		if (*data) {
+			icy->held_data[0] = *data;
+			icy->held         = 1;
+			return 1;
+		}
+		// An empty block, it is passed on while it may be audio
+		if (radio_icy_fits(icy, false)) {
+			icy->left  = icy->metaint;
+			icy->state = RADIO_ICY_AUDIO;
+		} else {
+			audio(context, data, 1);
+			icy->after++;
+		}
+		return 1;
+	}
+
+	for (size_t i = 0; i < length; i++) {
+		if (data[i] != (uint8_t)key[icy->held - 1] ||
+		    icy->held_data[0] * 16 < RADIO_ICY_KEY_LENGTH) {
+			radio_icy_misses(icy);
+			audio(context, icy->held_data, icy->held);
+			icy->after += icy->held;
+			icy->held   = 0;
+			return i;
+		}
+		if (icy->held < RADIO_ICY_KEY_LENGTH) {
+			icy->held_data[icy->held++] = data[i];
+			continue;
+		}
+
+		// A block with a title, the intervals count from its end again
+		radio_icy_fits(icy, true);
+		for (uint8_t c = 0; c < icy->candidates; c++)
+			icy->expect[c] = icy->interval[c];
+		icy->after = 0;
+		radio_icy_block_start(icy);
+		icy->in_title  = true;
+		icy->has_title = true;
+		icy->key       = -1;
+		icy->left      = icy->held_data[0] * 16 - RADIO_ICY_KEY_LENGTH;
+		icy->state     = RADIO_ICY_BLOCK;
+		icy->held      = 0;
+		return i + 1;
+	}
+	return length;
+}
+
+bool radio_icy_feed(struct radio_icy *icy, const uint8_t *data, size_t length,
+                    radio_icy_audio_t audio, void *context) {
+	bool changed = false;
+	while (length) {
+		size_t used = length;
+		switch (icy->state) {
+			case RADIO_ICY_SEARCH:
+				used = radio_icy_search(icy, data, length, audio, context);
+				break;
+			case RADIO_ICY_CONFIRM:
+				used = radio_icy_confirm(icy, data, length, audio, context);
+				break;
+			case RADIO_ICY_AUDIO:
+				if (used > icy->left) used = icy->left;
+				audio(context, data, used);
+				icy->left -= used;
+				if (!icy->left) icy->state = RADIO_ICY_LENGTH;
+				break;
+			case RADIO_ICY_LENGTH:
+				used      = 1;
+				icy->left = *data * 16;
+				if (icy->left) {
+					radio_icy_block_start(icy);
+					icy->state = RADIO_ICY_BLOCK;
+				} else {
+					icy->left  = icy->metaint;
+					icy->state = RADIO_ICY_AUDIO;
+				}
+				break;
+			case RADIO_ICY_BLOCK:
+				if (used > icy->left) used = icy->left;
+				radio_icy_parse(icy, data, used);
+				icy->left -= used;
+				if (!icy->left) {
+					changed    |= radio_icy_block_end(icy);
+					icy->left   = icy->metaint;
+					icy->state  = icy->metaint ? RADIO_ICY_AUDIO
+					                           : RADIO_ICY_CONFIRM;
+				}
+				break;
+			default: audio(context, data, length); break;
+		}
+		data   += used;
+		length -= used;
+	}
+	return changed;
+}
@@ -0,0 +1,82 @@
+#include "radio_jitter.h"
+
+static size_t radio_jitter_min(const struct radio_jitter *jitter) {
+	uint32_t rate = jitter->rate ? jitter->rate : RADIO_JITTER_RATE;
+	size_t min    = (size_t)((int64_t)rate * jitter->min_ms / 1000);
+	return min < jitter->max ? min : jitter->max;
+}
+
+static void radio_jitter_clamp(struct radio_jitter *jitter) {
+	size_t min = radio_jitter_min(jitter);
+	if (jitter->target < min) jitter->target = min;
+	if (jitter->target > jitter->max) jitter->target = jitter->max;
+}
+
+void radio_jitter_init(struct radio_jitter *jitter, int min_ms, size_t max) {
+	jitter->min_ms = min_ms;
+	jitter->max    = max;
+	radio_jitter_reset(jitter);
+}
+
+void radio_jitter_reset(struct radio_jitter *jitter) {
+	jitter->buffering    = true;
+	jitter->rate         = 0;
+	jitter->deviation    = 0;
+	jitter->windows      = 0;
+	jitter->window_us    = 0;
+	jitter->window_bytes = 0;
+	jitter->underruns    = 0;
+	jitter->target       = radio_jitter_min(jitter);
+}
+
+void radio_jitter_arrived(struct radio_jitter *jitter, size_t bytes,
+                          int64_t now_us) {
+	if (!jitter->window_us) jitter->window_us = now_us;
+	jitter->window_bytes += bytes;
+	int64_t elapsed       = now_us - jitter->window_us;
+	if (elapsed < RADIO_JITTER_WINDOW_MS * 1000) return;
+
+	int64_t sample       = (int64_t)jitter->window_bytes * 1000000 / elapsed;
+	jitter->window_us    = now_us;
+	jitter->window_bytes = 0;
+	if (jitter->windows++ == 0) return;
+
+	if (!jitter->rate) {
+		jitter->rate      = sample;
+		jitter->deviation = sample / 4;
+	} else {
+		int64_t error      = sample - jitter->rate;
+		int64_t deviation  = error < 0 ? -error : error;
+		jitter->rate      += error / 8;
+		jitter->deviation += (deviation - (int64_t)jitter->deviation) / 4;
+	}
+
+	size_t wanted = radio_jitter_min(jitter) +
+	                (size_t)((int64_t)jitter->deviation * 4 *
+	                         RADIO_JITTER_WINDOW_MS / 1000);
+	if (wanted > jitter->target) jitter->target = wanted;
+	else jitter->target -= (jitter->target - wanted) / 16;
+	radio_jitter_clamp(jitter);
+}
+
+bool radio_jitter_can_read(struct radio_jitter *jitter, size_t fill) {
+	if (jitter->buffering && fill >= jitter->target)
+		jitter->buffering = false;
+	return !jitter->buffering;
+}
+
+bool radio_jitter_empty(struct radio_jitter *jitter) {
+	if (jitter->buffering) return false;
+	jitter->buffering  = true;
+	jitter->target    *= 2;
+	radio_jitter_clamp(jitter);
+	jitter->underruns++;
+	return true;
+}
+
+int radio_backoff_ms(int attempt, uint32_t random) {
+	int wait = RADIO_BACKOFF_MAX_MS;
+	if (attempt < 16 && RADIO_BACKOFF_MS << attempt < RADIO_BACKOFF_MAX_MS)
+		wait = RADIO_BACKOFF_MS << attempt;
+	return wait / 2 + (int)(random % (uint32_t)(wait / 2 + 1));
+}
@@ -0,0 +1,109 @@
+#include "radio_link.h"
+
+static void radio_link_count(int *last_ms, int *max_ms, int64_t us) {
+	*last_ms = us / 1000;
+	if (*last_ms > *max_ms) *max_ms = *last_ms;
+}
+
+void radio_link_init(struct radio_link *link, void *data, size_t size,
+                     int min_ms, size_t max) {
+	radio_ring_init(&link->ring, data, size);
+	radio_jitter_init(&link->jitter, min_ms, max);
+	link->active = false;
+	radio_link_reset(link);
+}
+
+void radio_link_reset(struct radio_link *link) {
+	radio_ring_clear(&link->ring);
+	radio_jitter_reset(&link->jitter);
+	link->codec          = RADIO_CODEC_NONE;
+	link->dropped        = 0;
+	link->attempt        = 0;
+	link->lost_us        = 0;
+	link->arrived        = false;
+	link->framed         = false;
+	link->resyncing      = false;
+	link->resync.fill    = 0;
+	link->reconnects     = 0;
+	link->outages        = 0;
+	link->outage_ms      = 0;
+	link->outage_max_ms  = 0;
+	link->recover_ms     = 0;
+	link->recover_max_ms = 0;
+}
+
+void radio_link_set_active(struct radio_link *link, bool active) {
+	link->active = active;
+	if (active && radio_ring_sync(&link->ring, link->codec))
+		link->framed = true;
+}
+
+size_t radio_link_append(struct radio_link *link, const void *data,
+                         size_t length, int64_t now_us) {
+	size_t before = link->ring.fill;
+	if (link->active) length = radio_ring_write(&link->ring, data, length);
+	else link->dropped += radio_ring_overwrite(&link->ring, data, length);
+	if (link->ring.fill > before)
+		radio_jitter_arrived(&link->jitter, link->ring.fill - before, now_us);
+	return length;
+}
+
+size_t radio_link_read(struct radio_link *link, enum radio_codec codec,
+                       void *data, size_t length) {
+	// Another decoder is linked when the codec is told
+	if (link->codec != codec ||
+	    !radio_jitter_can_read(&link->jitter, link->ring.fill))
+		return 0;
+	return radio_ring_read(&link->ring, data, length);
+}
+
+bool radio_link_starved(struct radio_link *link, enum radio_codec codec) {
+	return link->codec == codec && radio_jitter_empty(&link->jitter);
+}
+
+bool radio_link_received(struct radio_link *link, int64_t now_us) {
+	if (!link->lost_us || link->arrived) return false;
+	link->arrived = true;
+	radio_link_count(&link->outage_ms, &link->outage_max_ms,
+	                 now_us - link->lost_us);
+	return true;
+}
+
+bool radio_link_resync(struct radio_link *link, const void *data,
+                       size_t length, size_t *used, size_t *held) {
+	*used = 0;
+	*held = 0;
+	if (!link->resyncing) return true;
+	if (!radio_resync(&link->resync, link->codec, data, length, used))
+		return false;
+	link->resyncing   = false;
+	*held             = link->resync.fill;
+	link->resync.fill = 0;
+	return true;
+}
+
+int radio_link_continued(struct radio_link *link, int64_t now_us) {
+	if (!link->lost_us) return 0;
+	radio_link_count(&link->recover_ms, &link->recover_max_ms,
+	                 now_us - link->lost_us);
+	link->outages++;
+	link->lost_us = 0;
+	// A server that closes before a frame arrived keeps backing off
+	int attempts  = link->attempt;
+	link->attempt = 0;
+	return attempts;
+}
+
+int radio_link_lost(struct radio_link *link, int64_t now_us,
+                    uint32_t random) {
+	if (!link->lost_us) {
+		link->lost_us = now_us;
+		// The stream continues at a frame of the new connection
+		if (radio_ring_trim(&link->ring, link->codec)) link->framed = true;
+		link->resyncing = link->framed;
+	}
+	link->arrived     = false;
+	link->resync.fill = 0;
+	link->reconnects++;
+	return radio_backoff_ms(link->attempt++, random);
+}
@@ -0,0 +1,229 @@
+#include "radio_ring.h"
+#include "mp3_frame.h"
+
+#include <string.h>
+
+// Sampling frequencies of ADTS by index
+static const int adts_sample_rates[13] = { 96000, 88200, 64000, 48000, 44100,
+	                                       32000, 24000, 22050, 16000, 12000,
+	                                       11025, 8000,  7350 };
+
+void radio_ring_init(struct radio_ring *ring, void *data, size_t size) {
+	ring->data = data;
+	ring->size = size;
+	radio_ring_clear(ring);
+}
+
+void radio_ring_clear(struct radio_ring *ring) {
+	ring->head = 0;
+	ring->fill = 0;
+}
+
+size_t radio_ring_write(struct radio_ring *ring, const void *data,
+                        size_t length) {
+	if (length > radio_ring_free(ring)) length = radio_ring_free(ring);
+
+	size_t tail  = (ring->head + ring->fill) % ring->size;
+	size_t first = ring->size - tail < length ? ring->size - tail : length;
+	memcpy(ring->data + tail, data, first);
+	memcpy(ring->data, (const uint8_t *)data + first, length - first);
+	ring->fill += length;
+	return length;
+}
+
+size_t radio_ring_overwrite(struct radio_ring *ring, const void *data,
+                            size_t length) {
+	size_t dropped = 0;
+	if (length > ring->size) {
+		dropped += length - ring->size;
+		data     = (const uint8_t *)data + length - ring->size;
+		length   = ring->size;
+	}
+	if (length > radio_ring_free(ring)) {
+		size_t room  = length - radio_ring_free(ring);
+		dropped     += room;
+		radio_ring_skip(ring, room);
+	}
+	radio_ring_write(ring, data, length);
+	return dropped;
+}
+
+size_t radio_ring_peek(const struct radio_ring *ring, size_t offset, void *out,
+                       size_t length) {
+	if (offset >= ring->fill) return 0;
+	if (length > ring->fill - offset) length = ring->fill - offset;
+
+	size_t start = (ring->head + offset) % ring->size;
+	size_t first = ring->size - start < length ? ring->size - start : length;
+	memcpy(out, ring->data + start, first);
+	memcpy((uint8_t *)out + first, ring->data, length - first);
+	return length;
+}
+
+void radio_ring_skip(struct radio_ring *ring, size_t length) {
+	if (length > ring->fill) length = ring->fill;
+	ring->head  = (ring->head + length) % ring->size;
+	ring->fill -= length;
+	if (!ring->fill) ring->head = 0;
+}
+
+size_t radio_ring_read(struct radio_ring *ring, void *out, size_t length) {
+	length = radio_ring_peek(ring, 0, out, length);
+	radio_ring_skip(ring, length);
+	return length;
+}
+
+int radio_frame_mp3_length(const uint8_t header[4]) {
+	struct mp3_frame frame;
+	return mp3_frame_parse(header, MP3_FRAME_HEADER, &frame) ? frame.length
+	                                                         : 0;
+}
+
+int radio_frame_adts_length(const uint8_t header[RADIO_FRAME_HEADER]) {
+	// Sync word and layer 0, which MP3 frames never have
+	if (header[0] != 0xff || (header[1] & 0xf6) != 0xf0) return 0;
+
+	int rate   = (header[2] >> 2) & 0x0f;
+	int length = (header[3] & 0x03) << 11 | header[4] << 3 | header[5] >> 5;
+	int size   = header[1] & 0x01 ? 7 : 9; // Without or with CRC
+	if (rate > 12 || length < size) return 0;
+	return length;
+}
+
+int radio_frame_length(enum radio_codec codec,
+                       const uint8_t header[RADIO_FRAME_HEADER]) {
+	switch (codec) {
+		case RADIO_CODEC_MP3: return radio_frame_mp3_length(header);
+		case RADIO_CODEC_AAC: return radio_frame_adts_length(header);
+		default: return 0;
+	}
+}
+
+uint32_t radio_frame_us(enum radio_codec codec,
+                        const uint8_t header[RADIO_FRAME_HEADER]) {
+	if (codec == RADIO_CODEC_MP3) {
+		struct mp3_frame frame;
+		if (!mp3_frame_parse(header, MP3_FRAME_HEADER, &frame)) return 0;
+		return frame.samples * 1000000ULL / frame.sample_rate;
+	}
+	if (!radio_frame_length(codec, header)) return 0;
+	// Blocks of 1024 samples, HE-AAC tells the rate of its core
+	int blocks = (header[6] & 0x03) + 1;
+	return blocks * 1024 * 1000000ULL /
+	       adts_sample_rates[(header[2] >> 2) & 0x0f];
+}
+
+/*
+ * The next frame has the same version, layer and sample rate, and for ADTS
+ * the same profile and channels
+ */
+static bool radio_frames_match(enum radio_codec codec,
+                               const uint8_t header[RADIO_FRAME_HEADER],
+                               const uint8_t next[RADIO_FRAME_HEADER]) {
+	if (!radio_frame_length(codec, next) ||
+	    (next[1] & 0xfe) != (header[1] & 0xfe))
+		return false;
+	if (codec == RADIO_CODEC_MP3)
+		return (next[2] & 0x0c) == (header[2] & 0x0c);
+	return (next[2] & 0xfd) == (header[2] & 0xfd) &&
+	       (next[3] & 0xc0) == (header[3] & 0xc0);
+}
+
+bool radio_ring_sync(struct radio_ring *ring, enum radio_codec codec) {
+	uint8_t header[RADIO_FRAME_HEADER], next[RADIO_FRAME_HEADER];
+
+	size_t offset = 0;
+	for (; offset + sizeof header <= ring->fill; offset++) {
+		if (ring->data[(ring->head + offset) % ring->size] != 0xff) continue;
+		radio_ring_peek(ring, offset, header, sizeof header);
+		int length = radio_frame_length(codec, header);
+		if (!length) continue;
+
+		// Keep a frame that may be followed by one that did not arrive yet
+		if (radio_ring_peek(ring, offset + length, next, sizeof next) <
+		    sizeof next) {
+			radio_ring_skip(ring, offset);
+			return false;
+		}
+		if (radio_frames_match(codec, header, next)) {
+			radio_ring_skip(ring, offset);
+			return true;
+		}
+	}
+	radio_ring_skip(ring, offset);
+	return false;
+}
+
+bool radio_ring_trim(struct radio_ring *ring, enum radio_codec codec) {
+	uint8_t header[RADIO_FRAME_HEADER], next[RADIO_FRAME_HEADER];
+	int length = 0;
+
+	// The first frame that is followed by another one
+	size_t offset = 0;
+	for (; offset + sizeof header <= ring->fill; offset++) {
+		if (ring->data[(ring->head + offset) % ring->size] != 0xff) continue;
+		radio_ring_peek(ring, offset, header, sizeof header);
+		length = radio_frame_length(codec, header);
+		if (length &&
+		    radio_ring_peek(ring, offset + length, next, sizeof next) ==
+		        sizeof next &&
+		    radio_frames_match(codec, header, next))
+			break;
+	}
+	if (offset + sizeof header > ring->fill) return false;
+
+	// Follow the frames to the last one, cut it unless it is whole
+	while (offset + length + sizeof next <= ring->fill) {
+		radio_ring_peek(ring, offset + length, next, sizeof next);
+		if (!radio_frames_match(codec, header, next)) break;
+		offset += length;
+		memcpy(header, next, sizeof header);
+		length = radio_frame_length(codec, header);
+	}
+	ring->fill = offset + length <= ring->fill ? offset + length : offset;
+	if (!ring->fill) ring->head = 0;
+	return true;
+}
+
+bool radio_frame_find(enum radio_codec codec, const uint8_t *data,
+                      size_t length, size_t *offset) {
+	for (*offset = 0; *offset + RADIO_FRAME_HEADER <= length; ++*offset) {
+		const uint8_t *header = data + *offset;
+		int frame             = radio_frame_length(codec, header);
+		if (!frame) continue;
+		if (*offset + frame + RADIO_FRAME_HEADER > length) return false;
+		if (radio_frames_match(codec, header, header + frame)) return true;
+	}
+	return false;
+}
+
+enum radio_codec radio_codec_find(const uint8_t *data, size_t length) {
+	size_t mp3, adts;
+	bool is_mp3  = radio_frame_find(RADIO_CODEC_MP3, data, length, &mp3);
+	bool is_adts = radio_frame_find(RADIO_CODEC_AAC, data, length, &adts);
+	if (is_mp3 && (!is_adts || mp3 < adts)) return RADIO_CODEC_MP3;
+	return is_adts ? RADIO_CODEC_AAC : RADIO_CODEC_NONE;
+}
+
+bool radio_resync(struct radio_resync *resync, enum radio_codec codec,
+                  const void *data, size_t length, size_t *used) {
+	for (*used = 0; *used < length;) {
+		size_t part = sizeof resync->data - resync->fill;
+		if (part > length - *used) part = length - *used;
+		memcpy(resync->data + resync->fill, (const uint8_t *)data + *used,
+		       part);
+		resync->fill += part;
+		*used        += part;
+
+		size_t offset;
+		bool found =
+		    radio_frame_find(codec, resync->data, resync->fill, &offset);
+		// A frame fits, so a full buffer has found one or moved on
+		if (!found && !offset && resync->fill == sizeof resync->data)
+			offset = 1;
+		memmove(resync->data, resync->data + offset, resync->fill - offset);
+		resync->fill -= offset;
+		if (found) return true;
+	}
+	return false;
+}
@@ -0,0 +1,753 @@
+#include "radio_station.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_common.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "http_stream.h"
+#include "sd_storage.h"
+#include "utils/macro.h"
+
+#include "radio_icy.h"
+#include "radio_jitter.h"
+#include "radio_link.h"
+#include "radio_ring.h"
+#include "radio_timeshift.h"
+
+// Longest wait before the stream or the decoder check for commands
+#define RADIO_STATION_WAIT_MS 50
+
+// Bounce buffers of the timeshift file, see radio_timeshift.h
+#define RADIO_STATION_BOUNCE     8192
+// Lowest rate of a stream the timeshift index has a second for [B/s]
+#define RADIO_STATION_MIN_RATE   4000
+#define RADIO_STATION_TASK_STACK (3 * 1024)
+// Below the audio elements, a block is due every few seconds of the stream
+#define RADIO_STATION_TASK_PRIO  4
+
+#define SEND_STATION_CMD(evt_type, channel)                                    \
+	SEND_CMD(evt_type, evt_type, channel, station->evt)
+
+static const char *TAG = "RADIO_STATION";
+
+struct radio_station {
+	audio_element_handle_t reader;
+	SemaphoreHandle_t lock;  // Protects link, channel, stats, recording,
+	                         // shifted
+	SemaphoreHandle_t data;  // Given when the stream wrote to the ring
+	SemaphoreHandle_t space; // Given when the decoder read from the ring
+	struct radio_link link;  // The ring, the codec and connecting again
+	volatile bool stopping;  // The stream must not wait for room
+	bool running;            // The stream was resumed with a url
+	int channel;
+	struct radio_station_stats stats;
+	bool recording; // Active with a timeshift, the decoder plays a recording
+	bool shifted;   // Paused or gone back, the ring is moved to the recording
+	esp_timer_handle_t timer; // Resumes the stream after the backoff
+
+	// ICY metadata, parsed in the stream task
+	audio_event_iface_handle_t evt; // Sends the title changes
+	struct radio_icy icy;
+	bool icy_off; // The stream had no metadata, it is not asked for again
+	char title[RADIO_ICY_TITLE_LENGTH];
+};
+
+/**
+ * @brief  Event handler for HTTP stream responsible for handling track and
+ * playlist state, and for asking for the ICY metadata of each connection.
+ * @param  msg: Event message
+ */
+static esp_err_t radio_station_http_event(http_stream_event_msg_t *msg) {
+	struct radio_station *station = msg->user_data;
+	switch (msg->event_id) {
+		case HTTP_STREAM_PRE_REQUEST:
+			// Each connection starts a body, with metadata if it is asked for
+			radio_icy_init(&station->icy, 0);
+#ifdef CONFIG_RADIO_ICY_METADATA
+			if (!station->icy_off)
+				esp_http_client_set_header(msg->http_client, "Icy-MetaData",
+				                           "1");
+#endif
+			break;
+		case HTTP_STREAM_FINISH_TRACK:
+			ESP_LOGI(TAG, "HTTP_STREAM_FINISH_TRACK");
+			return http_stream_next_track(msg->el);
+		case HTTP_STREAM_FINISH_PLAYLIST:
+			ESP_LOGI(TAG, "HTTP_STREAM_FINISH_PLAYLIST");
+			return http_stream_restart(msg->el);
+		default: break;
+	}
+	return ESP_OK;
+}
+
+/*
+ * Recording of the active station on the SD card, the station that is
+ * activated takes it over. Its lock is taken after the lock of the station.
+ */
+static struct {
+	SemaphoreHandle_t lock;
+	struct radio_timeshift shift;
+	struct radio_timeshift_reader reader; // Of the decoder
+	uint32_t playing; // Recording the reader is in, it started again if not
+	sd_storage_handle_t storage;
+	FILE *write;
+	FILE *read;
+	void *ram;
+	void *block;
+	uint64_t *index;
+	uint8_t *bounce[2]; // Of the writes and the reads
+	TaskHandle_t task;  // Writes the full blocks
+	SemaphoreHandle_t task_done;
+	volatile bool stopping;
+} timeshift;
+
+/**
+ * Write the full blocks of the recording to the card, the stream is recorded
+ * on in the other block meanwhile.
+ */
+static void radio_station_writer(void *arg) {
+	struct radio_timeshift *shift = &timeshift.shift;
+	while (!timeshift.stopping) {
+		xSemaphoreTake(timeshift.lock, portMAX_DELAY);
+		bool pending    = radio_timeshift_pending(shift);
+		uint64_t block  = shift->on_file;
+		uint32_t starts = shift->starts;
+		xSemaphoreGive(timeshift.lock);
+		if (!pending) {
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+
+		bool written = radio_timeshift_write(shift, block);
+		xSemaphoreTake(timeshift.lock, portMAX_DELAY);
+		bool current = shift->starts == starts;
+		if (current && written) radio_timeshift_written(shift);
+		else if (current) radio_timeshift_start(shift, shift->codec);
+		xSemaphoreGive(timeshift.lock);
+		if (current && !written)
+			ESP_LOGE(TAG, "Cannot write the timeshift, it starts again");
+	}
+	xSemaphoreGive(timeshift.task_done);
+	vTaskDelete(NULL);
+}
+
+/* Called with the lock of the timeshift after appending to it */
+static void radio_station_notify_writer(void) {
+	if (radio_timeshift_pending(&timeshift.shift))
+		xTaskNotifyGive(timeshift.task);
+}
+
+/**
+ * Record what the decoder read from the ring, it plays at the end of the
+ * recording. Called with the lock of the station.
+ * @return false if the card was too slow and the recording started again
+ */
+static bool radio_station_record(struct radio_station *station,
+                                 const char *data, size_t length) {
+	struct radio_timeshift *shift = &timeshift.shift;
+	xSemaphoreTake(timeshift.lock, portMAX_DELAY);
+	if (shift->codec != station->link.codec)
+		radio_timeshift_start(shift, station->link.codec);
+	bool kept = radio_timeshift_append(shift, data, length) == length;
+	if (!kept) radio_timeshift_start(shift, station->link.codec);
+	timeshift.reader.position = shift->end;
+	timeshift.playing         = shift->starts;
+	radio_station_notify_writer();
+	xSemaphoreGive(timeshift.lock);
+	return kept;
+}
+
+/**
+ * Move the ring into the recording while the decoder plays from it, as far
+ * as the blocks in memory have room. Called with the lock of the station.
+ */
+static void radio_station_drain(struct radio_station *station) {
+	struct radio_ring *ring = &station->link.ring;
+	xSemaphoreTake(timeshift.lock, portMAX_DELAY);
+	while (ring->fill) {
+		size_t length = ring->size - ring->head;
+		if (length > ring->fill) length = ring->fill;
+		size_t moved = radio_timeshift_append(&timeshift.shift,
+		                                      ring->data + ring->head, length);
+		radio_ring_skip(ring, moved);
+		if (moved < length) break;
+	}
+	radio_station_notify_writer();
+	xSemaphoreGive(timeshift.lock);
+}
+
+/**
+ * Play live again from the last seconds of the recording the jitter buffer
+ * would hold, the ring fills with the stream meanwhile. It does not go back.
+ * Called with the lock of the station and of the timeshift.
+ */
+static void radio_station_catch_up(struct radio_station *station) {
+	uint32_t rate = station->link.jitter.rate;
+	if (!rate) rate = RADIO_JITTER_RATE;
+	int seconds = (int)((station->link.jitter.target + rate - 1) / rate) + 1;
+
+	struct radio_timeshift *shift = &timeshift.shift;
+	uint64_t frame;
+	if (!radio_timeshift_seek(shift, shift->end, -seconds, &frame))
+		frame = shift->end;
+	if (frame > timeshift.reader.position) timeshift.reader.position = frame;
+	station->shifted = false;
+}
+
+/**
+ * The reader plays live from a recording that started again. Called with the
+ * lock of the station and of the timeshift.
+ */
+static void radio_station_follow(struct radio_station *station) {
+	if (timeshift.playing == timeshift.shift.starts) return;
+	timeshift.playing         = timeshift.shift.starts;
+	timeshift.reader.position = timeshift.shift.end;
+	station->shifted          = false;
+}
+
+/**
+ * Read the recording where the decoder is behind the stream. Called with the
+ * lock of the station.
+ * @return bytes read, 0 when it plays live or waits for the recording
+ */
+static int radio_station_replay(struct radio_station *station, char *buffer,
+                                int len) {
+	struct radio_timeshift *shift         = &timeshift.shift;
+	struct radio_timeshift_reader *reader = &timeshift.reader;
+	if (station->shifted) radio_station_drain(station);
+
+	xSemaphoreTake(timeshift.lock, portMAX_DELAY);
+	radio_station_follow(station);
+	int n = 0;
+	if (station->shifted || reader->position < shift->end)
+		n = radio_timeshift_read(shift, reader, buffer, len);
+	if (n == RADIO_TIMESHIFT_LOST) {
+		// Paused longer than the file holds
+		uint64_t frame = shift->end;
+		radio_timeshift_seek(shift, 0, 0, &frame);
+		reader->position = frame;
+	} else if (n == RADIO_TIMESHIFT_ERROR) {
+		radio_timeshift_start(shift, station->link.codec);
+		radio_station_follow(station);
+	} else if (!n && station->shifted && !station->link.ring.fill) {
+		station->shifted = false;
+	}
+	xSemaphoreGive(timeshift.lock);
+
+	if (n == RADIO_TIMESHIFT_LOST)
+		ESP_LOGW(TAG, "Timeshift went over the pause, playing its oldest");
+	else if (n == RADIO_TIMESHIFT_ERROR)
+		ESP_LOGE(TAG, "Cannot read the timeshift, playing live");
+	return n > 0 ? n : 0;
+}
+
+/**
+ * Append to the ring. Active, the stream waits for room like it would for its
+ * ringbuffer. On standby it keeps the newest part of the stream. Shifted, the
+ * ring is moved on to the recording.
+ */
+static void radio_station_append(struct radio_station *station,
+                                 const char *buffer, int len) {
+	struct radio_link *link = &station->link;
+	int written             = 0;
+	while (written < len) {
+		xSemaphoreTake(station->lock, portMAX_DELAY);
+		if (link->active && station->shifted) radio_station_drain(station);
+		written += radio_link_append(link, buffer + written, len - written,
+		                             esp_timer_get_time());
+		if (link->active && station->shifted) radio_station_drain(station);
+		xSemaphoreGive(station->lock);
+		xSemaphoreGive(station->data);
+
+		if (written < len) {
+			// Dropped when the stream stops anyway
+			if (station->stopping) break;
+			xSemaphoreTake(station->space,
+			               pdMS_TO_TICKS(RADIO_STATION_WAIT_MS));
+		}
+	}
+}
+
+/**
+ * Tell the codec of the channel from the Content-Type of its stream, which
+ * the http stream keeps in its info, or else from the frames of the stream.
+ */
+static void radio_station_find_codec(struct radio_station *station,
+                                     const uint8_t *data, size_t length) {
+	audio_element_info_t info = { 0 };
+	audio_element_getinfo(station->reader, &info);
+	enum radio_codec codec;
+	switch (info.codec_fmt) {
+		case ESP_CODEC_TYPE_MP3: codec = RADIO_CODEC_MP3; break;
+		case ESP_CODEC_TYPE_AAC: codec = RADIO_CODEC_AAC; break;
+		default: codec = radio_codec_find(data, length); break;
+	}
+	if (!codec) return;
+
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	station->link.codec = codec;
+	int channel    = station->channel;
+	xSemaphoreGive(station->lock);
+
+	ESP_LOGI(TAG, "Channel %d sends %s", channel,
+	         codec == RADIO_CODEC_MP3 ? "MP3" : "AAC");
+	SEND_STATION_CMD(RADIO_CODEC_EVT, channel);
+}
+
+/**
+ * Audio of the http stream, without its metadata. After the connection broke,
+ * the new one is held back until it has a whole frame, which follows the last
+ * whole frame of the old one in the ring.
+ */
+static void radio_station_audio(void *context, const uint8_t *data,
+                                size_t length) {
+	struct radio_station *station = context;
+	// Only the stream sets it while it runs
+	if (!station->link.codec) radio_station_find_codec(station, data, length);
+
+	size_t used, held;
+	if (!radio_link_resync(&station->link, data, length, &used, &held))
+		return;
+	radio_station_append(station, (const char *)station->link.resync.data,
+	                     held);
+	radio_station_append(station, (const char *)data + used, length - used);
+
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	int attempts = radio_link_continued(&station->link, esp_timer_get_time());
+	int ms       = station->link.recover_ms;
+	xSemaphoreGive(station->lock);
+	if (attempts)
+		ESP_LOGI(TAG, "Stream continues after %d ms, %d attempts", ms,
+		         attempts);
+}
+
+/* Keep the title the metadata changed to and tell the radio */
+static void radio_station_title(struct radio_station *station) {
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	memcpy(station->title, station->icy.title, sizeof station->title);
+	station->stats.titles++;
+	int channel = station->channel;
+	xSemaphoreGive(station->lock);
+
+	ESP_LOGI(TAG, "Title of channel %d: %s", channel, station->icy.title);
+	SEND_STATION_CMD(RADIO_TITLE_EVT, channel);
+}
+
+/**
+ * Output of the http stream, the ICY metadata is taken out of it in place.
+ */
+static int radio_station_write(audio_element_handle_t self, char *buffer,
+                               int len, TickType_t ticks_to_wait,
+                               void *context) {
+	struct radio_station *station = context;
+	int64_t now_us                = esp_timer_get_time();
+
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	if (!station->stats.first_us) station->stats.first_us = now_us;
+	station->stats.bytes += len;
+	radio_link_received(&station->link, now_us);
+	xSemaphoreGive(station->lock);
+
+	if (radio_icy_feed(&station->icy, (const uint8_t *)buffer, len,
+	                   radio_station_audio, station))
+		radio_station_title(station);
+	if (station->icy.state == RADIO_ICY_OFF && !station->icy_off) {
+		ESP_LOGW(TAG, "No ICY metadata in the stream, not asking again");
+		station->icy_off = true;
+	}
+	return len;
+}
+
+/**
+ * Connect again once the backoff passed, in the esp_timer task. The stream
+ * connects in its own task.
+ */
+static void radio_station_resume(void *arg) {
+	struct radio_station *station = arg;
+	audio_element_resume(station->reader, 0, 0);
+}
+
+radio_station_handle_t radio_station_create(int ring_size, int jitter_ms,
+                                            audio_event_iface_handle_t evt) {
+	struct radio_station *station = calloc(1, sizeof *station);
+	if (!station) {
+		ESP_LOGE(TAG, "Memory allocation for station failed");
+		return NULL;
+	}
+	station->channel = -1;
+
+	// Large blocks go to PSRAM with CONFIG_SPIRAM_USE_MALLOC
+	void *data     = malloc(ring_size);
+	station->lock  = xSemaphoreCreateMutex();
+	station->data  = xSemaphoreCreateBinary();
+	station->space = xSemaphoreCreateBinary();
+	if (!data || !station->lock || !station->data || !station->space)
+		goto fail;
+	// A quarter of the ring stays free for the stream to arrive in
+	radio_link_init(&station->link, data, ring_size, jitter_ms,
+	                ring_size / 4 * 3);
+
+	const esp_timer_create_args_t timer_cfg = {
+		.callback = radio_station_resume,
+		.arg      = station,
+		.name     = "radio_station",
+	};
+	if (esp_timer_create(&timer_cfg, &station->timer) != ESP_OK) goto fail;
+
+	audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
+	station->evt                    = audio_event_iface_init(&evt_cfg);
+	if (!station->evt) goto fail;
+	audio_event_iface_set_listener(station->evt, evt);
+
+	http_stream_cfg_t http_cfg      = HTTP_STREAM_CFG_DEFAULT();
+	http_cfg.type                   = AUDIO_STREAM_READER;
+	http_cfg.event_handle           = radio_station_http_event;
+	http_cfg.user_data              = station;
+	http_cfg.enable_playlist_parser = true;
+	station->reader                 = http_stream_init(&http_cfg);
+	if (!station->reader) goto fail;
+	audio_element_set_write_cb(station->reader, radio_station_write, station);
+	audio_element_msg_set_listener(station->reader, evt);
+	return station;
+
+fail:
+	ESP_LOGE(TAG, "Memory allocation for station failed");
+	if (station->evt) {
+		audio_event_iface_remove_listener(evt, station->evt);
+		audio_event_iface_destroy(station->evt);
+	}
+	if (station->timer) esp_timer_delete(station->timer);
+	if (station->lock) vSemaphoreDelete(station->lock);
+	if (station->data) vSemaphoreDelete(station->data);
+	if (station->space) vSemaphoreDelete(station->space);
+	free(data);
+	free(station);
+	return NULL;
+}
+
+void radio_station_destroy(radio_station_handle_t station,
+                           audio_event_iface_handle_t evt) {
+	radio_station_stop(station);
+	audio_element_msg_remove_listener(station->reader, evt);
+	audio_element_deinit(station->reader);
+	audio_event_iface_remove_listener(evt, station->evt);
+	audio_event_iface_destroy(station->evt);
+	esp_timer_delete(station->timer);
+	vSemaphoreDelete(station->lock);
+	vSemaphoreDelete(station->data);
+	vSemaphoreDelete(station->space);
+	free(station->link.ring.data);
+	free(station);
+}
+
+/**
+ * Close the connection, the ring keeps what it received.
+ */
+static esp_err_t radio_station_close(radio_station_handle_t station) {
+	if (!station->running) return ESP_OK;
+
+	// Fails when no attempt waits for its backoff
+	esp_timer_stop(station->timer);
+
+	station->stopping = true;
+	xSemaphoreGive(station->space);
+	// Fails when the stream already ended, it is stopped then
+	audio_element_stop(station->reader);
+	ESP_RETURN_ON_ERROR(audio_element_wait_for_stop(station->reader), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_element_reset_state(station->reader), TAG, "");
+	station->stopping = false;
+	station->running  = false;
+	return ESP_OK;
+}
+
+esp_err_t radio_station_tune(radio_station_handle_t station, int channel,
+                             const char *url) {
+	ESP_RETURN_ON_ERROR(radio_station_stop(station), TAG, "");
+
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	station->channel        = channel;
+	station->stats.tuned_us = esp_timer_get_time();
+	xSemaphoreGive(station->lock);
+
+	ESP_RETURN_ON_ERROR(audio_element_set_uri(station->reader, url), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_element_run(station->reader), TAG, "");
+	ESP_RETURN_ON_ERROR(audio_element_resume(station->reader, 0,
+	                                         2000 / portTICK_PERIOD_MS),
+	                    TAG, "Could not start stream of %s", url);
+	station->running = true;
+	return ESP_OK;
+}
+
+esp_err_t radio_station_reconnect(radio_station_handle_t station) {
+	ESP_RETURN_ON_ERROR(radio_station_close(station), TAG, "");
+
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	int wait_ms = radio_link_lost(&station->link, esp_timer_get_time(),
+	                              esp_random());
+	int fill    = station->link.ring.fill;
+	xSemaphoreGive(station->lock);
+
+	ESP_LOGW(TAG, "Connecting again in %d ms, %d KB buffered", wait_ms,
+	         fill / 1024);
+	ESP_RETURN_ON_ERROR(audio_element_run(station->reader), TAG, "");
+	station->running = true;
+	return esp_timer_start_once(station->timer, (uint64_t)wait_ms * 1000);
+}
+
+esp_err_t radio_station_stop(radio_station_handle_t station) {
+	ESP_RETURN_ON_ERROR(radio_station_close(station), TAG, "");
+
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	radio_link_reset(&station->link);
+	memset(&station->stats, 0, sizeof station->stats);
+	station->channel  = -1;
+	station->icy_off  = false;
+	station->title[0] = '\0';
+	station->shifted  = false;
+	xSemaphoreGive(station->lock);
+	return ESP_OK;
+}
+
+enum radio_codec radio_station_get_codec(radio_station_handle_t station) {
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	enum radio_codec codec = station->link.codec;
+	xSemaphoreGive(station->lock);
+	return codec;
+}
+
+int radio_station_get_channel(radio_station_handle_t station) {
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	int channel = station->channel;
+	xSemaphoreGive(station->lock);
+	return channel;
+}
+
+audio_element_handle_t
+radio_station_get_reader(radio_station_handle_t station) {
+	return station->reader;
+}
+
+void radio_station_set_active(radio_station_handle_t station, bool active) {
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	radio_link_set_active(&station->link, active);
+	station->shifted   = false;
+	station->recording = active && timeshift.task;
+	if (station->recording) {
+		xSemaphoreTake(timeshift.lock, portMAX_DELAY);
+		radio_timeshift_start(&timeshift.shift, station->link.codec);
+		timeshift.playing         = timeshift.shift.starts;
+		timeshift.reader.position = 0;
+		xSemaphoreGive(timeshift.lock);
+	}
+	xSemaphoreGive(station->lock);
+	xSemaphoreGive(station->space);
+}
+
+int radio_station_read(radio_station_handle_t station, enum radio_codec codec,
+                       char *buffer, int len, TickType_t ticks_to_wait) {
+	struct radio_link *link = &station->link;
+	TickType_t wait         = pdMS_TO_TICKS(RADIO_STATION_WAIT_MS);
+	if (ticks_to_wait < wait) wait = ticks_to_wait;
+
+	for (int tries = 0; tries < 2; tries++) {
+		xSemaphoreTake(station->lock, portMAX_DELAY);
+		size_t n  = 0;
+		bool kept = true;
+		if (link->codec == codec && station->recording)
+			n = radio_station_replay(station, buffer, len);
+		if (!n && !station->shifted) {
+			n = radio_link_read(link, codec, buffer, len);
+			if (n && station->recording)
+				kept = radio_station_record(station, buffer, n);
+		}
+		// Empty after waiting for the stream, wait for a larger target
+		bool underrun = !n && tries == 1 && radio_link_starved(link, codec);
+		size_t target = link->jitter.target;
+		xSemaphoreGive(station->lock);
+		if (!kept)
+			ESP_LOGW(TAG, "Timeshift starts again, the SD card was too slow");
+		if (n > 0) {
+			xSemaphoreGive(station->space);
+			return n;
+		}
+		if (underrun)
+			ESP_LOGW(TAG, "Underrun, buffering %d KB", (int)(target / 1024));
+		if (tries == 0) xSemaphoreTake(station->data, wait);
+	}
+	return AEL_IO_TIMEOUT;
+}
+
+esp_err_t radio_station_seek(radio_station_handle_t station, int seconds) {
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	if (!station->recording) {
+		xSemaphoreGive(station->lock);
+		return ESP_ERR_INVALID_STATE;
+	}
+	xSemaphoreTake(timeshift.lock, portMAX_DELAY);
+	// The recording takes the codec once the decoder played a part of it
+	enum radio_codec codec = station->link.codec;
+	bool started           = codec && timeshift.shift.codec == codec;
+	if (started) {
+		radio_station_follow(station);
+		uint64_t frame = timeshift.reader.position;
+		if (seconds && !radio_timeshift_seek(&timeshift.shift, frame,
+		                                     seconds, &frame)) {
+			radio_station_catch_up(station);
+		} else {
+			timeshift.reader.position = frame;
+			station->shifted          = true;
+		}
+	}
+	xSemaphoreGive(timeshift.lock);
+	xSemaphoreGive(station->lock);
+	return started ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+void radio_station_live(radio_station_handle_t station) {
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	if (station->recording && station->shifted) {
+		xSemaphoreTake(timeshift.lock, portMAX_DELAY);
+		radio_station_catch_up(station);
+		xSemaphoreGive(timeshift.lock);
+	}
+	xSemaphoreGive(station->lock);
+}
+
+void radio_station_get_title(radio_station_handle_t station, char *title,
+                             size_t size) {
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	snprintf(title, size, "%s", station->title);
+	xSemaphoreGive(station->lock);
+}
+
+void radio_station_get_stats(radio_station_handle_t station,
+                             struct radio_station_stats *stats) {
+	int64_t now_us = esp_timer_get_time();
+	xSemaphoreTake(station->lock, portMAX_DELAY);
+	const struct radio_link *link = &station->link;
+	*stats                        = station->stats;
+	stats->codec                  = link->codec;
+	stats->dropped                = link->dropped;
+	stats->fill                   = link->ring.fill;
+	stats->target                 = link->jitter.target;
+	stats->rate                   = link->jitter.rate;
+	stats->underruns              = link->jitter.underruns;
+	stats->reconnects             = link->reconnects;
+	stats->outages                = link->outages;
+	stats->outage_ms              = link->outage_ms;
+	stats->outage_max_ms          = link->outage_max_ms;
+	stats->recover_ms             = link->recover_ms;
+	stats->recover_max_ms         = link->recover_max_ms;
+	stats->shifted                = station->shifted;
+	if (station->recording) {
+		xSemaphoreTake(timeshift.lock, portMAX_DELAY);
+		const struct radio_timeshift *shift = &timeshift.shift;
+		uint64_t position                   = timeshift.reader.position;
+		if (shift->seconds && timeshift.playing == shift->starts) {
+			uint32_t second   = radio_timeshift_second(shift, position);
+			stats->lag_s      = shift->seconds - 1 - second;
+			stats->recorded_s = radio_timeshift_recorded(shift);
+		}
+		xSemaphoreGive(timeshift.lock);
+	}
+	xSemaphoreGive(station->lock);
+	if (stats->first_us && now_us > stats->first_us)
+		stats->kbps = stats->bytes * 8000 / (now_us - stats->first_us);
+}
+
+/* Free what the timeshift holds, its task stopped */
+static void radio_station_timeshift_free(void) {
+	if (timeshift.write) fclose(timeshift.write);
+	if (timeshift.read) fclose(timeshift.read);
+	if (timeshift.lock) vSemaphoreDelete(timeshift.lock);
+	if (timeshift.task_done) vSemaphoreDelete(timeshift.task_done);
+	free(timeshift.ram);
+	free(timeshift.block);
+	free(timeshift.index);
+	heap_caps_free(timeshift.bounce[0]);
+	heap_caps_free(timeshift.bounce[1]);
+	if (timeshift.storage) sd_storage_release(timeshift.storage);
+	memset(&timeshift, 0, sizeof timeshift);
+}
+
+esp_err_t radio_station_timeshift_init(const char *path, int size_mb) {
+	long size           = (long)size_mb * 1024 * 1024;
+	uint32_t index_size = size / RADIO_STATION_MIN_RATE;
+	ESP_RETURN_ON_ERROR(sd_storage_acquire(&timeshift.storage), TAG,
+	                    "No SD card for the timeshift");
+
+	// Large blocks go to PSRAM with CONFIG_SPIRAM_USE_MALLOC, they are moved
+	// through internal memory the SD host can DMA
+	esp_err_t err       = ESP_ERR_NO_MEM;
+	timeshift.lock      = xSemaphoreCreateMutex();
+	timeshift.task_done = xSemaphoreCreateBinary();
+	timeshift.ram       = malloc(2 * RADIO_TIMESHIFT_BLOCK);
+	timeshift.block     = malloc(RADIO_TIMESHIFT_BLOCK);
+	timeshift.index     = malloc(index_size * sizeof *timeshift.index);
+	for (int i = 0; i < 2; i++)
+		timeshift.bounce[i] = heap_caps_malloc(
+		    RADIO_STATION_BOUNCE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+	if (!timeshift.lock || !timeshift.task_done || !timeshift.ram ||
+	    !timeshift.block || !timeshift.index || !timeshift.bounce[0] ||
+	    !timeshift.bounce[1])
+		goto fail;
+
+	// Made once with its size, so its blocks are only ever written over
+	err             = ESP_FAIL;
+	timeshift.write = fopen(path, "r+b");
+	if (!timeshift.write) timeshift.write = fopen(path, "w+b");
+	timeshift.read = timeshift.write ? fopen(path, "rb") : NULL;
+	if (!timeshift.read) goto fail;
+	// The blocks go to the card at once, not through the buffer of the FILE
+	setvbuf(timeshift.write, NULL, _IONBF, 0);
+	setvbuf(timeshift.read, NULL, _IONBF, 0);
+	if (fseek(timeshift.write, 0, SEEK_END) ||
+	    (ftell(timeshift.write) < size &&
+	     (fseek(timeshift.write, size - 1, SEEK_SET) ||
+	      fputc(0, timeshift.write) == EOF || fflush(timeshift.write))))
+		goto fail;
+	sd_storage_invalidate(timeshift.storage, path);
+
+	radio_timeshift_init(&timeshift.shift, timeshift.write,
+	                     size / RADIO_TIMESHIFT_BLOCK, timeshift.ram,
+	                     timeshift.index, index_size);
+	timeshift.shift.bounce      = timeshift.bounce[0];
+	timeshift.shift.bounce_size = RADIO_STATION_BOUNCE;
+	radio_timeshift_reader_init(&timeshift.reader, timeshift.read,
+	                            timeshift.block);
+	timeshift.reader.bounce      = timeshift.bounce[1];
+	timeshift.reader.bounce_size = RADIO_STATION_BOUNCE;
+
+	if (xTaskCreatePinnedToCore(radio_station_writer, "radio_timeshift",
+	                            RADIO_STATION_TASK_STACK, NULL,
+	                            RADIO_STATION_TASK_PRIO, &timeshift.task,
+	                            0) != pdPASS) {
+		timeshift.task = NULL;
+		goto fail;
+	}
+	ESP_LOGI(TAG, "Timeshift of %d MB in %s", size_mb, path);
+	return ESP_OK;
+
+fail:
+	ESP_LOGE(TAG, "Cannot make the timeshift in %s", path);
+	radio_station_timeshift_free();
+	return err;
+}
+
+void radio_station_timeshift_deinit(void) {
+	if (timeshift.task) {
+		timeshift.stopping = true;
+		xTaskNotifyGive(timeshift.task);
+		xSemaphoreTake(timeshift.task_done, portMAX_DELAY);
+	}
+	radio_station_timeshift_free();
+}
@@ -0,0 +1,220 @@
+#include "radio_timeshift.h"
+
+#include <string.h>
+
+void radio_timeshift_init(struct radio_timeshift *shift, FILE *file,
+                          uint32_t blocks, void *ram, uint64_t *index,
+                          uint32_t index_size) {
+	memset(shift, 0, sizeof *shift);
+	shift->file       = file;
+	shift->blocks     = blocks;
+	shift->ram[0]     = ram;
+	shift->ram[1]     = (uint8_t *)ram + RADIO_TIMESHIFT_BLOCK;
+	shift->index      = index;
+	shift->index_size = index_size;
+	radio_timeshift_start(shift, RADIO_CODEC_NONE);
+}
+
+void radio_timeshift_start(struct radio_timeshift *shift,
+                           enum radio_codec codec) {
+	shift->starts++;
+	shift->end         = 0;
+	shift->on_file     = 0;
+	shift->codec       = codec;
+	shift->header_fill = 0;
+	shift->synced      = false;
+	shift->frame       = 0;
+	shift->skip        = 0;
+	shift->us          = 0;
+	shift->lost        = 0;
+	shift->seconds     = 0;
+}
+
+/*
+ * Follow the frames through the next bytes, which start at shift->end. A
+ * header that is none moves it on by a byte until it finds one.
+ */
+static void radio_timeshift_frames(struct radio_timeshift *shift,
+                                   const uint8_t *data, size_t length) {
+	for (size_t i = 0; i < length;) {
+		if (shift->skip) {
+			size_t part  = shift->skip < length - i ? shift->skip : length - i;
+			shift->skip -= part;
+			i           += part;
+			continue;
+		}
+		if (!shift->header_fill) shift->frame = shift->end + i;
+		shift->header[shift->header_fill++] = data[i++];
+		if (shift->header_fill < RADIO_FRAME_HEADER) continue;
+
+		int frame = radio_frame_length(shift->codec, shift->header);
+		if (!frame) {
+			if (shift->synced) shift->lost++;
+			shift->synced = false;
+			memmove(shift->header, shift->header + 1, RADIO_FRAME_HEADER - 1);
+			shift->header_fill--;
+			shift->frame++;
+			continue;
+		}
+
+		// The seconds up to the one this frame starts in
+		while ((uint64_t)shift->seconds * 1000000 <= shift->us) {
+			shift->index[shift->seconds % shift->index_size] = shift->frame;
+			shift->seconds++;
+		}
+		shift->us         += radio_frame_us(shift->codec, shift->header);
+		shift->skip        = frame - RADIO_FRAME_HEADER;
+		shift->header_fill = 0;
+		shift->synced      = true;
+	}
+}
+
+size_t radio_timeshift_append(struct radio_timeshift *shift, const void *data,
+                              size_t length) {
+	uint64_t room = (shift->on_file + 2) * RADIO_TIMESHIFT_BLOCK - shift->end;
+	if (length > room) length = room;
+	if (shift->codec) radio_timeshift_frames(shift, data, length);
+
+	for (size_t done = 0; done < length;) {
+		size_t offset = shift->end % RADIO_TIMESHIFT_BLOCK;
+		size_t part   = RADIO_TIMESHIFT_BLOCK - offset;
+		if (part > length - done) part = length - done;
+		memcpy(shift->ram[shift->end / RADIO_TIMESHIFT_BLOCK % 2] + offset,
+		       (const uint8_t *)data + done, part);
+		shift->end += part;
+		done       += part;
+	}
+	return length;
+}
+
+/* Move a block between memory and its place in the file */
+static bool radio_timeshift_transfer(FILE *file, long offset, uint8_t *data,
+                                     bool write, uint8_t *bounce,
+                                     size_t bounce_size) {
+	if (fseek(file, offset, SEEK_SET)) return false;
+	size_t piece = bounce ? bounce_size : RADIO_TIMESHIFT_BLOCK;
+	for (size_t done = 0; done < RADIO_TIMESHIFT_BLOCK; done += piece) {
+		if (piece > RADIO_TIMESHIFT_BLOCK - done)
+			piece = RADIO_TIMESHIFT_BLOCK - done;
+		uint8_t *memory = bounce ? bounce : data + done;
+		if (write) {
+			if (bounce) memcpy(bounce, data + done, piece);
+			if (fwrite(memory, piece, 1, file) != 1) return false;
+		} else {
+			if (fread(memory, piece, 1, file) != 1) return false;
+			if (bounce) memcpy(data + done, bounce, piece);
+		}
+	}
+	return !write || !fflush(file);
+}
+
+bool radio_timeshift_write(const struct radio_timeshift *shift,
+                           uint64_t block) {
+	long offset = (long)(block % shift->blocks) * RADIO_TIMESHIFT_BLOCK;
+	return radio_timeshift_transfer(shift->file, offset, shift->ram[block % 2],
+	                                true, shift->bounce, shift->bounce_size);
+}
+
+void radio_timeshift_written(struct radio_timeshift *shift) {
+	shift->on_file++;
+}
+
+uint64_t radio_timeshift_oldest(const struct radio_timeshift *shift) {
+	// The next block that is written goes over the oldest one in the file
+	if (shift->on_file + 1 <= shift->blocks) return 0;
+	return (shift->on_file + 1 - shift->blocks) * RADIO_TIMESHIFT_BLOCK;
+}
+
+void radio_timeshift_reader_init(struct radio_timeshift_reader *reader,
+                                 FILE *file, void *data) {
+	reader->file     = file;
+	reader->data     = data;
+	reader->block    = UINT64_MAX;
+	reader->starts   = 0;
+	reader->position = 0;
+	reader->bounce   = NULL;
+}
+
+/* Read a block that was written from the file */
+static bool radio_timeshift_load(const struct radio_timeshift *shift,
+                                 struct radio_timeshift_reader *reader,
+                                 uint64_t block) {
+	long offset   = (long)(block % shift->blocks) * RADIO_TIMESHIFT_BLOCK;
+	reader->block = UINT64_MAX;
+	if (!radio_timeshift_transfer(reader->file, offset, reader->data, false,
+	                              reader->bounce, reader->bounce_size))
+		return false;
+	reader->block  = block;
+	reader->starts = shift->starts;
+	return true;
+}
+
+int radio_timeshift_read(const struct radio_timeshift *shift,
+                         struct radio_timeshift_reader *reader, void *out,
+                         size_t length) {
+	uint64_t position = reader->position;
+	if (position >= shift->end) return 0;
+	if (position < radio_timeshift_oldest(shift)) return RADIO_TIMESHIFT_LOST;
+
+	uint64_t block      = position / RADIO_TIMESHIFT_BLOCK;
+	const uint8_t *data = shift->ram[block % 2];
+	if (block < shift->on_file) {
+		bool loaded = reader->block == block && reader->starts == shift->starts;
+		if (!loaded && !radio_timeshift_load(shift, reader, block))
+			return RADIO_TIMESHIFT_ERROR;
+		data = reader->data;
+	}
+
+	size_t offset = position % RADIO_TIMESHIFT_BLOCK;
+	size_t part   = RADIO_TIMESHIFT_BLOCK - offset;
+	if (part > length) part = length;
+	if (part > shift->end - position) part = shift->end - position;
+	memcpy(out, data + offset, part);
+	reader->position += part;
+	return (int)part;
+}
+
+/* Oldest second of the index whose frame is still recorded */
+static uint32_t radio_timeshift_first(const struct radio_timeshift *shift) {
+	uint32_t first  = shift->seconds > shift->index_size
+	                      ? shift->seconds - shift->index_size
+	                      : 0;
+	uint32_t last   = shift->seconds;
+	uint64_t oldest = radio_timeshift_oldest(shift);
+	while (first < last) {
+		uint32_t middle = first + (last - first) / 2;
+		if (shift->index[middle % shift->index_size] < oldest)
+			first = middle + 1;
+		else last = middle;
+	}
+	return first;
+}
+
+uint32_t radio_timeshift_second(const struct radio_timeshift *shift,
+                                uint64_t position) {
+	// The last second whose frame is at or before position
+	uint32_t first = radio_timeshift_first(shift);
+	uint32_t last  = shift->seconds;
+	while (first + 1 < last) {
+		uint32_t middle = first + (last - first) / 2;
+		if (shift->index[middle % shift->index_size] <= position)
+			first = middle;
+		else last = middle;
+	}
+	return first;
+}
+
+bool radio_timeshift_seek(const struct radio_timeshift *shift,
+                          uint64_t position, int seconds, uint64_t *frame) {
+	uint32_t first = radio_timeshift_first(shift);
+	int64_t second = (int64_t)radio_timeshift_second(shift, position) +
+	                 seconds;
+	if (first >= shift->seconds || second >= shift->seconds) return false;
+	if (second < first) second = first;
+	*frame = shift->index[second % shift->index_size];
+	return true;
+}
+
+uint32_t radio_timeshift_recorded(const struct radio_timeshift *shift) {
+	return shift->seconds - radio_timeshift_first(shift);
+}
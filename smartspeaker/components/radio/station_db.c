@@ -0,0 +1,375 @@
+#include "station_db.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char *sort_strings; // Of the table whose words are sorted
+
+/**
+ * Lowercase letters and digits, other ASCII separates words. Bytes of UTF-8
+ * sequences are kept as they are.
+ */
+static int fold(unsigned char c) {
+	if (c >= 'A' && c <= 'Z') return c - 'A' + 'a';
+	if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80)
+		return c;
+	return 0;
+}
+
+/* Folded character in the order of the folded bytes, 0 for the end */
+static int bucket_char(int c) {
+	if (!c) return 0;
+	if (c <= '9') return 1 + c - '0';
+	if (c <= 'z') return 11 + c - 'a';
+	return 37;
+}
+
+/* Range of the first two characters, words starting with UTF-8 share one */
+static uint32_t word_bucket(const char *word) {
+	int first = bucket_char(fold(word[0]));
+	if (!first || first == 37) return first * 38;
+	return first * 38 + bucket_char(fold(word[1]));
+}
+
+static int compare_words(const char *a, const char *b) {
+	for (size_t i = 0;; i++) {
+		int ca = fold(a[i]), cb = fold(b[i]);
+		if (ca != cb) return ca - cb;
+		if (!ca) return 0;
+	}
+}
+
+/* Compare the start of a word with a folded prefix */
+static int compare_prefix(const char *word, const char *prefix) {
+	for (size_t i = 0; prefix[i]; i++) {
+		int c = fold(word[i]);
+		if (c != (unsigned char)prefix[i]) return c - (unsigned char)prefix[i];
+	}
+	return 0;
+}
+
+static int compare_station_words(const void *a, const void *b) {
+	const struct station_word *x = a, *y = b;
+	int order =
+	    compare_words(sort_strings + x->offset, sort_strings + y->offset);
+	if (order) return order;
+	return x->station < y->station ? -1 : x->station > y->station;
+}
+
+static bool grow(void **array, uint32_t *capacity, uint32_t needed,
+                 size_t size) {
+	if (needed <= *capacity) return true;
+	uint32_t grown = *capacity ? *capacity * 2 : 64;
+	while (grown < needed) grown *= 2;
+	void *larger = realloc(*array, (size_t)grown * size);
+	if (!larger) return false;
+	*array    = larger;
+	*capacity = grown;
+	return true;
+}
+
+static uint32_t hash_string(const char *string, size_t length) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)string[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static bool grow_intern(struct station_db *db) {
+	uint32_t size  = db->intern_size ? db->intern_size * 2 : 256;
+	uint32_t *slots = calloc(size, sizeof *slots);
+	if (!slots) return false;
+
+	for (uint32_t i = 0; i < db->intern_size; i++) {
+		uint32_t offset = db->intern[i];
+		if (!offset) continue;
+		const char *string = db->strings + offset;
+		uint32_t slot      = hash_string(string, strlen(string)) & (size - 1);
+		while (slots[slot]) slot = (slot + 1) & (size - 1);
+		slots[slot] = offset;
+	}
+	free(db->intern);
+	db->intern      = slots;
+	db->intern_size = size;
+	return true;
+}
+
+/* Store a string once, equal strings get the same offset */
+static bool intern_string(struct station_db *db, const char *string,
+                          size_t length, uint32_t *offset) {
+	if (!length) {
+		*offset = 0;
+		return true;
+	}
+	if ((db->intern_count + 1) * 2 > db->intern_size && !grow_intern(db))
+		return false;
+
+	uint32_t mask = db->intern_size - 1;
+	uint32_t slot = hash_string(string, length) & mask;
+	for (; db->intern[slot]; slot = (slot + 1) & mask) {
+		const char *other = db->strings + db->intern[slot];
+		if (strncmp(other, string, length) == 0 && !other[length]) {
+			*offset = db->intern[slot];
+			return true;
+		}
+	}
+
+	if (!grow((void **)&db->strings, &db->strings_capacity,
+	          db->strings_size + length + 1, 1))
+		return false;
+	*offset = db->strings_size;
+	memcpy(db->strings + db->strings_size, string, length);
+	db->strings[db->strings_size + length] = '\0';
+	db->strings_size                      += length + 1;
+	db->intern[slot]                       = *offset;
+	db->intern_count++;
+	return true;
+}
+
+static bool add_station(struct station_db *db, const char *name,
+                        size_t name_length, const char *url,
+                        size_t url_length) {
+	if (name_length >= STATION_DB_NAME_LENGTH) {
+		name_length = STATION_DB_NAME_LENGTH - 1;
+		// Do not cut a UTF-8 sequence
+		while (name_length && ((unsigned char)name[name_length] & 0xc0) == 0x80)
+			name_length--;
+	}
+
+	struct station station;
+	if (!grow((void **)&db->stations, &db->stations_capacity,
+	          db->nr_stations + 1, sizeof *db->stations) ||
+	    !intern_string(db, name, name_length, &station.name) ||
+	    !intern_string(db, url, url_length, &station.url))
+		return false;
+	db->stations[db->nr_stations++] = station;
+	return true;
+}
+
+/* Cut the blanks at both ends of a part of a line */
+static const char *trim(const char *start, size_t *length) {
+	while (*length && (*start == ' ' || *start == '\t')) {
+		start++;
+		(*length)--;
+	}
+	while (*length && (start[*length - 1] == ' ' || start[*length - 1] == '\t'))
+		(*length)--;
+	return start;
+}
+
+bool station_db_begin(struct station_db *db) {
+	memset(db, 0, sizeof *db);
+	// Offset 0 is the empty string
+	if (!grow((void **)&db->strings, &db->strings_capacity, 1, 1)) return false;
+	db->strings[0]   = '\0';
+	db->strings_size = 1;
+	return true;
+}
+
+bool station_db_add(struct station_db *db, const char *name, const char *url) {
+	return add_station(db, name, strlen(name), url, strlen(url));
+}
+
+bool station_db_add_line(struct station_db *db, const char *line) {
+	size_t length = strcspn(line, "\r\n");
+	line          = trim(line, &length);
+	if (!length) return true;
+
+	if (line[0] == '#') {
+		// "#EXTINF:<duration> <attributes>,<name>" names the next url
+		const char *comma = memchr(line, ',', length);
+		if (strncmp(line, "#EXTINF:", 8) == 0 && comma) {
+			size_t name_length = length - (comma + 1 - line);
+			const char *name   = trim(comma + 1, &name_length);
+			if (name_length >= sizeof db->pending)
+				name_length = sizeof db->pending - 1;
+			memcpy(db->pending, name, name_length);
+			db->pending[name_length] = '\0';
+		}
+		return true;
+	}
+
+	const char *name = line, *url = line;
+	size_t name_length = length, url_length = length;
+	const char *tab    = memchr(line, '\t', length);
+	if (tab) {
+		name_length = tab - line;
+		url_length  = length - name_length - 1;
+		url         = trim(tab + 1, &url_length);
+	} else if (db->pending[0]) {
+		name        = db->pending;
+		name_length = strlen(db->pending);
+	}
+	name = trim(name, &name_length);
+
+	bool added      = !url_length ||
+	             add_station(db, name, name_length, url, url_length);
+	db->pending[0] = '\0';
+	return added;
+}
+
+bool station_db_add_file(struct station_db *db, FILE *f) {
+	char line[STATION_DB_LINE_LENGTH];
+	while (fgets(line, sizeof line, f)) {
+		size_t length = strlen(line);
+		if (length == sizeof line - 1 && line[length - 1] != '\n') {
+			// Skip the rest of a line that does not fit
+			int c;
+			while ((c = fgetc(f)) != EOF && c != '\n') continue;
+			db->skipped++;
+			continue;
+		}
+		if (!station_db_add_line(db, line)) return false;
+	}
+	return !ferror(f);
+}
+
+bool station_db_finish(struct station_db *db) {
+	free(db->intern);
+	db->intern       = NULL;
+	db->intern_size  = 0;
+	db->intern_count = 0;
+
+	// Give back what was grown for more stations
+	if (db->nr_stations) {
+		struct station *stations =
+		    realloc(db->stations, db->nr_stations * sizeof *db->stations);
+		if (stations) db->stations = stations;
+	}
+	char *strings = realloc(db->strings, db->strings_size);
+	if (strings) db->strings = strings;
+	db->stations_capacity = db->nr_stations;
+	db->strings_capacity  = db->strings_size;
+
+	// Every word of every name
+	uint32_t nr_words = 0;
+	for (uint32_t s = 0; s < db->nr_stations; s++) {
+		const char *name = station_db_name(db, s);
+		for (size_t i = 0; name[i]; i++)
+			if (fold(name[i]) && (i == 0 || !fold(name[i - 1]))) nr_words++;
+	}
+	db->buckets = calloc(STATION_DB_BUCKETS + 1, sizeof *db->buckets);
+	db->words   = nr_words ? malloc(nr_words * sizeof *db->words) : NULL;
+	if (!db->buckets || (nr_words && !db->words)) return false;
+	for (uint32_t s = 0; s < db->nr_stations; s++) {
+		const char *name = station_db_name(db, s);
+		for (size_t i = 0; name[i]; i++) {
+			if (!fold(name[i]) || (i > 0 && fold(name[i - 1]))) continue;
+			db->words[db->nr_words].station = s;
+			db->words[db->nr_words].offset  = db->stations[s].name + i;
+			db->nr_words++;
+		}
+	}
+	sort_strings = db->strings;
+	if (db->nr_words)
+		qsort(db->words, db->nr_words, sizeof *db->words,
+		      compare_station_words);
+
+	// buckets[b] is the first word of range b or of a later one
+	for (uint32_t w = 0; w < db->nr_words; w++)
+		db->buckets[word_bucket(db->strings + db->words[w].offset) + 1]++;
+	for (uint32_t b = 0; b < STATION_DB_BUCKETS; b++)
+		db->buckets[b + 1] += db->buckets[b];
+	return true;
+}
+
+void station_db_free(struct station_db *db) {
+	free(db->stations);
+	free(db->strings);
+	free(db->words);
+	free(db->buckets);
+	free(db->intern);
+	memset(db, 0, sizeof *db);
+}
+
+/* Words starting with a folded prefix */
+static void find_words(const struct station_db *db, const char *prefix,
+                       uint32_t *first, uint32_t *last) {
+	int c      = bucket_char((unsigned char)prefix[0]);
+	uint32_t b = c * 38;
+	uint32_t n = 38;
+	if (c != 37 && prefix[1]) {
+		b += bucket_char((unsigned char)prefix[1]);
+		n  = 1;
+	} else if (c == 37) {
+		n = 1;
+	}
+	uint32_t low = db->buckets[b], high = db->buckets[b + n];
+
+	uint32_t lo = low, hi = high;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (compare_prefix(db->strings + db->words[mid].offset, prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*first = lo;
+	for (hi = high; lo < hi;) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (compare_prefix(db->strings + db->words[mid].offset, prefix) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*last = lo;
+}
+
+static bool name_has_prefix(const char *name, const char *prefix) {
+	for (size_t i = 0; name[i]; i++)
+		if ((i == 0 || !fold(name[i - 1])) &&
+		    compare_prefix(name + i, prefix) == 0)
+			return true;
+	return false;
+}
+
+int station_db_search(const struct station_db *db, const char *query,
+                      uint32_t *results, int max) {
+	char words[STATION_DB_QUERY_WORDS][STATION_DB_NAME_LENGTH];
+	int nr_words = 0;
+	for (size_t i = 0; query[i] && nr_words < STATION_DB_QUERY_WORDS; i++) {
+		if (!fold(query[i])) continue;
+		size_t length = 0;
+		for (; fold(query[i]); i++)
+			if (length < STATION_DB_NAME_LENGTH - 1)
+				words[nr_words][length++] = (char)fold(query[i]);
+		words[nr_words++][length] = '\0';
+		if (!query[i]) break;
+	}
+	if (!nr_words || !db->nr_words || max <= 0) return 0;
+
+	// The word with the fewest matches leads, the others are checked
+	int lead = 0;
+	uint32_t first = 0, last = 0;
+	for (int w = 0; w < nr_words; w++) {
+		uint32_t w_first, w_last;
+		find_words(db, words[w], &w_first, &w_last);
+		if (w == 0 || w_last - w_first < last - first) {
+			lead  = w;
+			first = w_first;
+			last  = w_last;
+		}
+	}
+
+	int count = 0;
+	for (uint32_t i = first; i < last && count < max; i++) {
+		uint32_t station = db->words[i].station;
+		bool match       = true;
+		for (int r = 0; r < count && match; r++)
+			if (results[r] == station) match = false;
+		for (int w = 0; w < nr_words && match; w++)
+			if (w != lead && !name_has_prefix(station_db_name(db, station),
+			                                  words[w]))
+				match = false;
+		if (match) results[count++] = station;
+	}
+	return count;
+}
+
+size_t station_db_memory(const struct station_db *db) {
+	return db->nr_stations * sizeof *db->stations + db->strings_size +
+	       db->nr_words * sizeof *db->words +
+	       (db->buckets ? (STATION_DB_BUCKETS + 1) * sizeof *db->buckets : 0);
+}
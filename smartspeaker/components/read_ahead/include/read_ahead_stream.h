@@ -0,0 +1,65 @@
+#ifndef READ_AHEAD_STREAM_H
+#define READ_AHEAD_STREAM_H
+#pragma once
+
+#include "audio_element.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Counters of the file being played, or of the last one.
+ */
+struct read_ahead_stats {
+	uint64_t bytes;       // Read from the card
+	uint32_t reads;       // Blocks read
+	uint64_t read_us;     // Spent waiting for the card
+	uint32_t max_read_us; // Slowest block
+	uint32_t stalls;      // Times the window ran empty before the end
+	uint64_t stall_us;    // Playback waited for the card
+	int min_fill;         // Lowest fill of the window since it was full, 0 if
+	                      // it never was
+};
+
+/**
+ * @brief Configuration of the read-ahead stream
+ */
+typedef struct read_ahead_stream_cfg {
+	int block_size;  // Bytes per read from the card
+	int window_size; // Bytes read ahead, a multiple of block_size
+	int out_rb_size; // Size of the output ringbuffer
+	int task_stack;  // Task stack size
+	int task_core;   // Task running on core, also of the read-ahead task
+	int task_prio;   // Task priority, also of the read-ahead task
+} read_ahead_stream_cfg_t;
+
+#define DEFAULT_READ_AHEAD_STREAM_CONFIG()                                     \
+	{                                                                          \
+		.block_size  = CONFIG_READ_AHEAD_BLOCK_SIZE_KB * 1024,                 \
+		.window_size = CONFIG_READ_AHEAD_WINDOW_KB * 1024,                     \
+		.out_rb_size = 8 * 1024, .task_stack = 3 * 1024, .task_core = 0,       \
+		.task_prio = 5,                                                        \
+	}
+
+/**
+ * @brief Create a source element that plays the file of its uri from a
+ * window that a task keeps filling ahead of the decoder in large blocks.
+ *
+ * Blocks are read into internal memory the SD host transfers into directly
+ * and copied into the window, which is in PSRAM when there is PSRAM. The
+ * file starts at the byte position of the element info, like with the fatfs
+ * stream.
+ */
+audio_element_handle_t
+read_ahead_stream_init(const read_ahead_stream_cfg_t *config);
+
+void read_ahead_stream_get_stats(audio_element_handle_t el,
+                                 struct read_ahead_stats *stats);
+
+/**
+ * @brief Byte of the file the decoder reached. The byte position of the
+ * element info only counts what left the window, this also leaves out what
+ * waits in the output ringbuffer, seconds of a track with a low bitrate.
+ */
+int64_t read_ahead_stream_get_decoded_pos(audio_element_handle_t el);
+
+#endif /* READ_AHEAD_STREAM_H */
@@ -0,0 +1,277 @@
+/**
+ * Read-ahead stream
+ *
+ * A task reads the file in large blocks into a window ahead of the decoder,
+ * so the decoder keeps playing while the card is busy, e.g. with the 1-line
+ * bus or while another file is written. Reads after the first one start on a
+ * block boundary of the file, so they cover whole clusters that the SD host
+ * transfers with one multi-block command.
+ */
+#include "read_ahead_stream.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "ringbuf.h"
+
+// Longest wait for the window before the element checks for commands
+#define READ_AHEAD_TIMEOUT_MS 100
+
+#define READ_AHEAD_TASK_STACK (3 * 1024)
+
+static const char *TAG = "READ_AHEAD";
+
+struct read_ahead {
+	int block_size;
+	int window_size;
+	int task_core;
+	int task_prio;
+	ringbuf_handle_t window;      // Read ahead, in PSRAM when there is PSRAM
+	char *block;                  // Internal memory the SD host can DMA into
+	int fd;                       // -1 if no file is open
+	int64_t start_pos;            // Byte of the file the task started at
+	TaskHandle_t task;            // NULL if no file is being read
+	SemaphoreHandle_t task_done;
+	volatile bool stop;
+	volatile bool failed;         // A read of the task failed
+	bool was_full;                // The window was full since the open
+	bool stalled;                 // The window is empty and playback waits
+	portMUX_TYPE stats_lock;      // Protects stats
+	struct read_ahead_stats stats;
+};
+
+static void read_ahead_task(void *args) {
+	struct read_ahead *ra = args;
+
+	int length = ra->block_size - (int)(ra->start_pos % ra->block_size);
+	while (!ra->stop) {
+		int64_t start = esp_timer_get_time();
+		int n         = read(ra->fd, ra->block, length);
+		uint32_t us   = (uint32_t)(esp_timer_get_time() - start);
+		if (n < 0) {
+			ESP_LOGE(TAG, "Read failed after %llu bytes",
+			         (unsigned long long)ra->stats.bytes);
+			ra->failed = true;
+			break;
+		}
+
+		portENTER_CRITICAL(&ra->stats_lock);
+		ra->stats.bytes   += n;
+		ra->stats.reads++;
+		ra->stats.read_us += us;
+		if (us > ra->stats.max_read_us) ra->stats.max_read_us = us;
+		portEXIT_CRITICAL(&ra->stats_lock);
+
+		// Blocks until the decoder made room, aborted by a close
+		if (n > 0 && rb_write(ra->window, ra->block, n, portMAX_DELAY) != n)
+			break;
+		if (n < length) break;
+		length = ra->block_size;
+	}
+
+	rb_done_write(ra->window);
+	xSemaphoreGive(ra->task_done);
+	vTaskDelete(NULL);
+}
+
+static esp_err_t read_ahead_open(audio_element_handle_t self) {
+	struct read_ahead *ra = audio_element_getdata(self);
+
+	const char *uri = audio_element_get_uri(self);
+	if (!uri) {
+		ESP_LOGE(TAG, "No file to play");
+		return ESP_FAIL;
+	}
+	ra->fd = open(uri, O_RDONLY);
+	if (ra->fd < 0) {
+		ESP_LOGE(TAG, "Cannot open %s", uri);
+		return ESP_FAIL;
+	}
+
+	audio_element_info_t info = { 0 };
+	audio_element_getinfo(self, &info);
+	struct stat st;
+	if (fstat(ra->fd, &st) == 0)
+		audio_element_set_total_bytes(self, st.st_size);
+	if (info.byte_pos > 0 && lseek(ra->fd, info.byte_pos, SEEK_SET) < 0) {
+		ESP_LOGE(TAG, "Cannot seek %s to %lld", uri,
+		         (long long)info.byte_pos);
+		close(ra->fd);
+		ra->fd = -1;
+		return ESP_FAIL;
+	}
+	ra->start_pos = info.byte_pos > 0 ? info.byte_pos : 0;
+
+	rb_reset(ra->window);
+	memset(&ra->stats, 0, sizeof ra->stats);
+	ra->stats.min_fill = ra->window_size;
+	ra->was_full       = false;
+	ra->stalled        = false;
+	ra->stop           = false;
+	ra->failed         = false;
+	if (xTaskCreatePinnedToCore(read_ahead_task, "read_ahead",
+	                            READ_AHEAD_TASK_STACK, ra, ra->task_prio,
+	                            &ra->task, ra->task_core) != pdPASS) {
+		ESP_LOGE(TAG, "Cannot start read-ahead task");
+		ra->task = NULL;
+		close(ra->fd);
+		ra->fd = -1;
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t read_ahead_close(audio_element_handle_t self) {
+	struct read_ahead *ra = audio_element_getdata(self);
+
+	if (ra->task) {
+		ra->stop = true;
+		rb_abort(ra->window);
+		xSemaphoreTake(ra->task_done, portMAX_DELAY);
+		ra->task = NULL;
+	}
+	if (ra->fd >= 0) {
+		close(ra->fd);
+		ra->fd = -1;
+
+		struct read_ahead_stats stats;
+		read_ahead_stream_get_stats(self, &stats);
+		ESP_LOGI(TAG,
+		         "%u KB in %u reads at %u KB/s, slowest %u ms, %u stalls for "
+		         "%u ms, window at least %u KB full",
+		         (unsigned)(stats.bytes / 1024), stats.reads,
+		         stats.read_us ? (unsigned)(stats.bytes * 1000000 /
+		                                    stats.read_us / 1024)
+		                       : 0,
+		         stats.max_read_us / 1000, stats.stalls,
+		         (unsigned)(stats.stall_us / 1000),
+		         (unsigned)stats.min_fill / 1024);
+	}
+
+	// Like the fatfs stream, a stopped file starts from the beginning again
+	if (audio_element_get_state(self) != AEL_STATE_PAUSED) {
+		audio_element_report_pos(self);
+		audio_element_set_byte_pos(self, 0);
+	}
+	return ESP_OK;
+}
+
+static audio_element_err_t read_ahead_process(audio_element_handle_t self,
+                                              char *buffer, int length) {
+	struct read_ahead *ra = audio_element_getdata(self);
+
+	int fill = rb_bytes_filled(ra->window);
+	if (rb_bytes_available(ra->window) < ra->block_size) ra->was_full = true;
+	bool empty = fill == 0;
+
+	int64_t start = esp_timer_get_time();
+	int ret       = rb_read(ra->window, buffer, length,
+	                        READ_AHEAD_TIMEOUT_MS / portTICK_PERIOD_MS);
+	// The task is done when the window is, a failed read ends the stream
+	// with an error instead of as if the file ended there
+	if (ret == RB_DONE) return ra->failed ? AEL_IO_FAIL : AEL_IO_DONE;
+
+	portENTER_CRITICAL(&ra->stats_lock);
+	if (ra->was_full && fill < ra->stats.min_fill) ra->stats.min_fill = fill;
+	if (empty) {
+		// One stall until the window has data again
+		if (!ra->stalled) ra->stats.stalls++;
+		ra->stats.stall_us += esp_timer_get_time() - start;
+	}
+	portEXIT_CRITICAL(&ra->stats_lock);
+	ra->stalled = empty && ret <= 0;
+
+	if (ret == RB_TIMEOUT) return AEL_IO_TIMEOUT;
+	if (ret == RB_ABORT) return AEL_IO_ABORT;
+	if (ret <= 0) return AEL_IO_FAIL;
+
+	ret = audio_element_output(self, buffer, ret);
+	if (ret > 0) audio_element_update_byte_pos(self, ret);
+	return ret;
+}
+
+static esp_err_t read_ahead_destroy(audio_element_handle_t self) {
+	struct read_ahead *ra = audio_element_getdata(self);
+
+	rb_destroy(ra->window);
+	heap_caps_free(ra->block);
+	vSemaphoreDelete(ra->task_done);
+	free(ra);
+	return ESP_OK;
+}
+
+audio_element_handle_t
+read_ahead_stream_init(const read_ahead_stream_cfg_t *config) {
+	struct read_ahead *ra = calloc(1, sizeof *ra);
+	if (!ra) {
+		ESP_LOGE(TAG, "Memory allocation for read-ahead stream failed");
+		return NULL;
+	}
+	ra->block_size  = config->block_size;
+	ra->window_size = config->window_size / config->block_size *
+	                  config->block_size;
+	if (ra->window_size < ra->block_size) ra->window_size = ra->block_size;
+	ra->task_core = config->task_core;
+	ra->task_prio = config->task_prio;
+	ra->fd        = -1;
+	portMUX_INITIALIZE(&ra->stats_lock);
+
+	// The window is allocated like the pipeline ringbuffers, in PSRAM when
+	// there is PSRAM
+	ra->window    = rb_create(ra->block_size, ra->window_size / ra->block_size);
+	ra->block     = heap_caps_malloc(ra->block_size,
+	                                 MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+	ra->task_done = xSemaphoreCreateBinary();
+	if (!ra->window || !ra->block || !ra->task_done) goto fail;
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open                = read_ahead_open;
+	cfg.close               = read_ahead_close;
+	cfg.process             = read_ahead_process;
+	cfg.destroy             = read_ahead_destroy;
+	cfg.out_rb_size         = config->out_rb_size;
+	cfg.task_stack          = config->task_stack;
+	cfg.task_core           = config->task_core;
+	cfg.task_prio           = config->task_prio;
+	cfg.tag                 = "file";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	if (!el) goto fail;
+	audio_element_setdata(el, ra);
+	return el;
+
+fail:
+	ESP_LOGE(TAG, "Memory allocation for read-ahead stream failed");
+	if (ra->window) rb_destroy(ra->window);
+	if (ra->task_done) vSemaphoreDelete(ra->task_done);
+	heap_caps_free(ra->block);
+	free(ra);
+	return NULL;
+}
+
+void read_ahead_stream_get_stats(audio_element_handle_t el,
+                                 struct read_ahead_stats *stats) {
+	struct read_ahead *ra = audio_element_getdata(el);
+
+	portENTER_CRITICAL(&ra->stats_lock);
+	*stats = ra->stats;
+	portEXIT_CRITICAL(&ra->stats_lock);
+	if (!ra->was_full) stats->min_fill = 0;
+}
+
+int64_t read_ahead_stream_get_decoded_pos(audio_element_handle_t el) {
+	audio_element_info_t info = { 0 };
+	audio_element_getinfo(el, &info);
+	ringbuf_handle_t out = audio_element_get_output_ringbuf(el);
+	int64_t pos          = info.byte_pos - (out ? rb_bytes_filled(out) : 0);
+	return pos > 0 ? pos : 0;
+}
@@ -1,14 +1,18 @@
 #include "audio_event_iface.h"
 #include "audio_pipeline.h"
-#include "fatfs_stream.h"
+#include "audio_tee.h"
+#include "audio_tee_tap.h"
 #include "i2s_stream.h"
 #include "lcd.h"
 #include "mp3_decoder.h"
+#include "prompt_cache.h"
+#include "prompt_pack.h"
+#include "prompt_stream.h"
 
 #include "board.h"
 #include "esp_log.h"
 #include "esp_peripherals.h"
-#include "periph_sdcard.h"
+#include "sd_storage.h"
 #include "sys/time.h"
 #include "utils/macro.h"
 
@@ -22,33 +26,153 @@ static audio_event_iface_handle_t evt;
 
 enum sd_play_state {
 	SD_PLAY_PLAYING_NONE = 0,
-	SD_PLAY_PLAYING_CU,
-	SD_PLAY_PLAYING_HOUR,
-	SD_PLAY_PLAYING_MIN,
+	SD_PLAY_PLAYING_CLOCK,
 	SD_PLAY_PLAYING_BT,
 };
 enum sd_play_state cur_play_state = SD_PLAY_PLAYING_NONE;
 
 // linking elements into an audio pipeline
 static audio_pipeline_handle_t pipeline;
-static audio_element_handle_t i2s_stream_writer, mp3_decoder,
-    fatfs_stream_reader;
+static audio_element_handle_t i2s_stream_writer, mp3_decoder, playlist,
+    prompt_recorder, tee;
+static audio_event_iface_handle_t pipeline_listener;
 
-static esp_periph_handle_t sdcard_handle;
+#ifdef CONFIG_PROMPT_CACHE
+// Decoded clips are played from the cache, see sd_play_play_clips
+static audio_element_handle_t prompt_reader;
+static bool linked_prompt_reader;
+#endif
+
+static sd_storage_handle_t storage;
 
 static bool is_sd_init = false;
 
 static const char *TAG = "sdcard";
 
-void sd_play_play_file(char *file_url) {
-	audio_element_set_uri(fatfs_stream_reader, file_url);
+#ifdef CONFIG_PROMPT_CACHE
+/**
+ * Link the pipeline for a cached clip or for a clip that has to be decoded,
+ * only between clips
+ */
+static void sd_play_link(bool cached) {
+	if (cached == linked_prompt_reader) return;
+
+	audio_pipeline_remove_listener(pipeline);
+	audio_pipeline_breakup_elements(pipeline, NULL);
+	if (cached) {
+		// [psram]-->prompt_reader-->tee-->i2s_stream-->[codec_chip]
+		audio_pipeline_relink(pipeline,
+		                      (const char *[]){ "prompt", "tee", "i2s" }, 3);
+	} else {
+		audio_pipeline_relink(
+		    pipeline,
+		    (const char *[]){ "playlist", "mp3", "recorder", "tee", "i2s" },
+		    5);
+	}
+	audio_pipeline_set_listener(pipeline, pipeline_listener);
+	linked_prompt_reader = cached;
+}
+#endif
+
+/**
+ * Play the clips back-to-back in one run of the pipeline, playback is
+ * finished when the i2s stream reports it
+ */
+static void sd_play_play_clips(const char *const urls[], int nr_clips) {
+#ifdef CONFIG_PROMPT_CACHE
+	// Play the PCM if every clip was decoded before, decode all of them
+	// otherwise
+	const prompt_t *prompts[PROMPT_STREAM_MAX_CLIPS];
+	int nr_cached = 0;
+	while (nr_cached < nr_clips && nr_cached < PROMPT_STREAM_MAX_CLIPS &&
+	       (prompts[nr_cached] = prompt_cache_acquire(urls[nr_cached])))
+		nr_cached++;
+
+	bool cached = nr_cached == nr_clips;
+	if (cached) {
+		prompt_reader_set_prompts(prompt_reader, prompts, nr_clips);
+	} else {
+		for (int c = 0; c < nr_cached; c++) prompt_cache_release(prompts[c]);
+		prompt_playlist_set(playlist, urls, nr_clips);
+	}
+#else
+	prompt_playlist_set(playlist, urls, nr_clips);
+#endif
 	audio_pipeline_reset_ringbuffer(pipeline);
 	audio_pipeline_reset_elements(pipeline);
 	audio_pipeline_change_state(pipeline, AEL_STATE_INIT);
+#ifdef CONFIG_PROMPT_CACHE
+	sd_play_link(cached);
+#endif
 
 	audio_pipeline_run(pipeline);
 }
 
+void sd_play_play_file(char *file_url) {
+	sd_play_play_clips((const char *[]){ file_url }, 1);
+}
+
+/**
+ * Pass the format reported by the decoder or the prompt reader on to the
+ * output
+ */
+static void sd_play_follow_music_info(audio_event_iface_msg_t *msg) {
+	if (msg->source_type != AUDIO_ELEMENT_TYPE_ELEMENT ||
+	    msg->cmd != AEL_MSG_CMD_REPORT_MUSIC_INFO)
+		return;
+#ifdef CONFIG_PROMPT_CACHE
+	if (msg->source != (void *)mp3_decoder &&
+	    msg->source != (void *)prompt_reader)
+		return;
+#else
+	if (msg->source != (void *)mp3_decoder) return;
+#endif
+
+	audio_element_info_t music_info = { 0 };
+	audio_element_getinfo(msg->source, &music_info);
+
+	ESP_LOGI(TAG,
+	         "[ * ] Receive music info from %s, "
+	         "sample_rates=%d, bits=%d, ch=%d",
+	         audio_element_get_tag(msg->source), music_info.sample_rates,
+	         music_info.bits, music_info.channels);
+
+	audio_element_set_music_info(tee, music_info.sample_rates,
+	                             music_info.channels, music_info.bits);
+	audio_element_set_music_info(i2s_stream_writer, music_info.sample_rates,
+	                             music_info.channels, music_info.bits);
+	i2s_stream_set_clk(i2s_stream_writer, music_info.sample_rates,
+	                   music_info.bits, music_info.channels);
+}
+
+#ifdef CONFIG_PROMPT_CACHE
+static void sd_play_log_cache_stats(void) {
+	struct prompt_cache_stats stats;
+	prompt_cache_get_stats(&stats);
+	ESP_LOGI(TAG,
+	         "Prompt cache: %u hits, %u misses, %u evictions, %u prompts in "
+	         "%u KB, first sample after %u us cached, %u us decoded",
+	         stats.hits, stats.misses, stats.evictions, stats.prompts,
+	         (unsigned)(stats.bytes / 1024), stats.hit_ttfs_us,
+	         stats.miss_ttfs_us);
+}
+#endif
+
+/**
+ * Path of a clip in the folder layout, "/sdcard/<folder>/<name>.mp3", or of
+ * the same clip in the pack of the folder, "/sdcard/<folder>.pak", when the
+ * card has one
+ */
+static void sd_play_clip_path(char *path, size_t size, const char *folder,
+                              const char *name) {
+	char pack[PROMPT_PATH_LENGTH];
+	snprintf(pack, sizeof pack, "/sdcard/%s.pak", folder);
+	// Answered from memory after the first lookup
+	if (!storage || sd_storage_stat(storage, pack, NULL) != ESP_OK ||
+	    !prompt_pack_clip_path(path, size, pack, prompt_pack_id(name)))
+		snprintf(path, size, "/sdcard/%s/%s.mp3", folder, name);
+}
+
 struct tm *get_cur_time() {
 	struct timeval tv;
 	// TODO: error handling
@@ -65,72 +189,32 @@ esp_err_t sd_play_run(audio_event_iface_msg_t *msg, void *args) {
 	                          msg->cmd == AEL_MSG_CMD_REPORT_STATUS &&
 	                          (((int)msg->data == AEL_STATUS_STATE_STOPPED) ||
 	                           ((int)msg->data == AEL_STATUS_STATE_FINISHED)));
-	char buf[50];
-
-	if (msg->source_type == AUDIO_ELEMENT_TYPE_ELEMENT &&
-	    msg->source == (void *)mp3_decoder &&
-	    msg->cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO) {
-		audio_element_info_t music_info = { 0 };
-		audio_element_getinfo(mp3_decoder, &music_info);
-
-		ESP_LOGI(TAG,
-		         "[ * ] Receive music info from mp3, "
-		         "sample_rates=%d, bits=%d, ch=%d",
-		         music_info.sample_rates, music_info.bits, music_info.channels);
-
-		audio_element_set_music_info(i2s_stream_writer, music_info.sample_rates,
-		                             music_info.channels, music_info.bits);
-		i2s_stream_set_clk(i2s_stream_writer, music_info.sample_rates,
-		                   music_info.bits, music_info.channels);
-	}
+	sd_play_follow_music_info(msg);
 
 	static int language;
 	if (msg->source_type == 6969 && msg->cmd == 6970) {
 		language = (int)((struct ui_cmd_data *)msg->data)->data;
 	}
 
-	if (msg->source_type == AUDIO_ELEMENT_TYPE_ELEMENT &&
-	    msg->source == (void *)mp3_decoder &&
-	    msg->cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO) {
-		audio_element_info_t music_info = { 0 };
-		audio_element_getinfo(mp3_decoder, &music_info);
-
-		ESP_LOGI(TAG,
-		         "[ * ] Receive music info from SD Card, "
-		         "sample_rates=%d, bits=%d, ch=%d",
-		         music_info.sample_rates, music_info.bits, music_info.channels);
-
-		audio_element_set_music_info(i2s_stream_writer, music_info.sample_rates,
-		                             music_info.channels, music_info.bits);
-		i2s_stream_set_clk(i2s_stream_writer, music_info.sample_rates,
-		                   music_info.bits, music_info.channels);
-	}
-
 	if (cur_play_state == SD_PLAY_PLAYING_NONE) {
-		cur_play_state = SD_PLAY_PLAYING_CU;
-		snprintf(buf, 50, "/sdcard/%d/cu.mp3", language);
-		sd_play_play_file(buf);
-	} else if (playback_finished) {
+		// "It is", hour and minute as one sentence without gaps
+		char folder[12], name[12], cu[50], hour[50], min[50];
 		struct tm *tm_handle = get_cur_time();
-		switch (cur_play_state) {
-			case SD_PLAY_PLAYING_CU:
-				cur_play_state = SD_PLAY_PLAYING_HOUR;
-				snprintf(buf, 50, "/sdcard/%d/%d.mp3", language,
-				         tm_handle->tm_hour);
-				sd_play_play_file(buf);
-				break;
-			case SD_PLAY_PLAYING_HOUR:
-				cur_play_state = SD_PLAY_PLAYING_MIN;
-				snprintf(buf, 50, "/sdcard/%d/%d.mp3", language,
-				         tm_handle->tm_min);
-				sd_play_play_file(buf);
-				break;
-			case SD_PLAY_PLAYING_MIN:
-				cur_play_state = SD_PLAY_PLAYING_NONE;
-				SEND_SD_CMD(SDC_CLOCK_DONE);
-				break;
-			default: break;
-		}
+		snprintf(folder, sizeof folder, "%d", language);
+		sd_play_clip_path(cu, 50, folder, "cu");
+		snprintf(name, sizeof name, "%d", tm_handle->tm_hour);
+		sd_play_clip_path(hour, 50, folder, name);
+		snprintf(name, sizeof name, "%d", tm_handle->tm_min);
+		sd_play_clip_path(min, 50, folder, name);
+
+		cur_play_state = SD_PLAY_PLAYING_CLOCK;
+		sd_play_play_clips((const char *[]){ cu, hour, min }, 3);
+	} else if (playback_finished && cur_play_state == SD_PLAY_PLAYING_CLOCK) {
+		cur_play_state = SD_PLAY_PLAYING_NONE;
+#ifdef CONFIG_PROMPT_CACHE
+		sd_play_log_cache_stats();
+#endif
+		SEND_SD_CMD(SDC_CLOCK_DONE);
 	}
 
 	return ESP_OK;
@@ -145,25 +229,12 @@ esp_err_t sd_play_run_bt(audio_event_iface_msg_t *msg, void *args) {
 	                          (((int)msg->data == AEL_STATUS_STATE_STOPPED) ||
 	                           ((int)msg->data == AEL_STATUS_STATE_FINISHED)));
 
-	if (msg->source_type == AUDIO_ELEMENT_TYPE_ELEMENT &&
-	    msg->source == (void *)mp3_decoder &&
-	    msg->cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO) {
-		audio_element_info_t music_info = { 0 };
-		audio_element_getinfo(mp3_decoder, &music_info);
-
-		ESP_LOGI(TAG,
-		         "[ * ] Receive music info from SD Card, "
-		         "sample_rates=%d, bits=%d, ch=%d",
-		         music_info.sample_rates, music_info.bits, music_info.channels);
-
-		audio_element_set_music_info(i2s_stream_writer, music_info.sample_rates,
-		                             music_info.channels, music_info.bits);
-		i2s_stream_set_clk(i2s_stream_writer, music_info.sample_rates,
-		                   music_info.bits, music_info.channels);
-	}
+	sd_play_follow_music_info(msg);
 	if (cur_play_state == SD_PLAY_PLAYING_NONE) {
+		char path[50];
+		sd_play_clip_path(path, sizeof path, "bt", "1");
 		cur_play_state = SD_PLAY_PLAYING_BT;
-		sd_play_play_file("/sdcard/bt/1.mp3");
+		sd_play_play_file(path);
 	} else if (playback_finished) {
 		cur_play_state = SD_PLAY_PLAYING_NONE;
 		SEND_SD_CMD(SDC_BT_DONE);
@@ -173,18 +244,14 @@ esp_err_t sd_play_run_bt(audio_event_iface_msg_t *msg, void *args) {
 }
 
 void play_audio_through_string(char *urlToAudioFile) {
-	audio_element_set_uri(fatfs_stream_reader, urlToAudioFile);
-	audio_pipeline_reset_ringbuffer(pipeline);
-	audio_pipeline_reset_elements(pipeline);
-	audio_pipeline_change_state(pipeline, AEL_STATE_INIT);
-
-	audio_pipeline_run(pipeline);
+	sd_play_play_file(urlToAudioFile);
 	audio_pipeline_wait_for_stop(pipeline);
 }
 
 void play_audio_through_int(int number) {
-	char urlToAudioFile[50];
-	snprintf(urlToAudioFile, 50, "/sdcard/nl/%d.mp3", number);
+	char name[12], urlToAudioFile[50];
+	snprintf(name, sizeof name, "%d", number);
+	sd_play_clip_path(urlToAudioFile, 50, "nl", name);
 
 	play_audio_through_string(urlToAudioFile);
 }
@@ -192,28 +259,10 @@ void play_audio_through_int(int number) {
 esp_err_t sd_play_init(audio_element_handle_t *elems, size_t count,
                        audio_event_iface_handle_t evt_handle,
                        esp_periph_set_handle_t periph_set, void *args) {
-	// mount sdcard
-	periph_sdcard_cfg_t sdcard_cfg = {
-		.root            = "/sdcard",
-		.card_detect_pin = get_sdcard_intr_gpio(), // GPIO_NUM_34
-		.mode            = SD_MODE_1_LINE,
-	};
-
-	sdcard_handle = periph_sdcard_init(&sdcard_cfg);
-	esp_err_t ret = esp_periph_start(periph_set, sdcard_handle);
-
-	int retry_time  = 5;
-	bool mount_flag = false;
-
-	while (retry_time--) {
-		if (periph_sdcard_is_mounted(sdcard_handle)) {
-			mount_flag = true;
-			break;
-		} else {
-			vTaskDelay(500 / portTICK_PERIOD_MS);
-		}
+	// the card stays mounted from startup, this only takes a reference
+	if (sd_storage_acquire(&storage) != ESP_OK) {
+		ESP_LOGI(TAG, "Sdcard mount failed");
 	}
-	if (mount_flag == false) { ESP_LOGI(TAG, "Sdcard mount failed"); }
 
 	// create audio pipeline for playback
 	audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
@@ -229,19 +278,41 @@ esp_err_t sd_play_init(audio_element_handle_t *elems, size_t count,
 	mp3_decoder_cfg_t mp3_cfg = DEFAULT_MP3_DECODER_CONFIG();
 	mp3_decoder               = mp3_decoder_init(&mp3_cfg);
 
-	// create fatfs stream to read data from sdcard
-	fatfs_stream_cfg_t fatfs_cfg = FATFS_STREAM_CFG_DEFAULT();
-	fatfs_cfg.type               = AUDIO_STREAM_READER;
-	fatfs_stream_reader          = fatfs_stream_init(&fatfs_cfg);
+	// create tee to publish the decoded audio for analysis
+	audio_tee_cfg_t tee_cfg = DEFAULT_AUDIO_TEE_CONFIG();
+	tee                     = audio_tee_init(&tee_cfg);
+
+	// create the recorder that cuts the decoded clips apart and trims them,
+	// it also records them when the prompt cache is enabled
+	prompt_recorder = prompt_recorder_init();
+
+	// create playlist to stream the clips from sdcard into the decoder
+	playlist = prompt_playlist_init(prompt_recorder);
+
+#ifdef CONFIG_PROMPT_CACHE
+	// create the reader for decoded clips, the cache itself is kept when the
+	// state is left
+	prompt_cache_init(CONFIG_PROMPT_CACHE_SIZE_KB * 1024);
+	prompt_reader = prompt_reader_init();
+#endif
 
 	// register all elements to audio pipeline
-	audio_pipeline_register(pipeline, fatfs_stream_reader, "file");
+	audio_pipeline_register(pipeline, playlist, "playlist");
 	audio_pipeline_register(pipeline, mp3_decoder, "mp3");
+	audio_pipeline_register(pipeline, prompt_recorder, "recorder");
+	audio_pipeline_register(pipeline, tee, "tee");
 	audio_pipeline_register(pipeline, i2s_stream_writer, "i2s");
+#ifdef CONFIG_PROMPT_CACHE
+	audio_pipeline_register(pipeline, prompt_reader, "prompt");
+	linked_prompt_reader = false;
+#endif
 
 	// link it together
-	// [sdcard]-->fatfs_stream-->music_decoder-->i2s_stream-->[codec_chip]
-	audio_pipeline_link(pipeline, (const char *[]){ "file", "mp3", "i2s" }, 3);
+	// [sdcard]-->playlist-->music_decoder-->prompt_recorder-->tee-->
+	// i2s_stream-->[codec_chip]
+	audio_pipeline_link(
+	    pipeline,
+	    (const char *[]){ "playlist", "mp3", "recorder", "tee", "i2s" }, 5);
 
 	// listening event from all elements of pipeline
 	audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
@@ -252,6 +323,8 @@ esp_err_t sd_play_init(audio_element_handle_t *elems, size_t count,
 
 	audio_event_iface_set_listener(evt, evt_handle);
 	audio_pipeline_set_listener(pipeline, evt_handle);
+	pipeline_listener = evt_handle;
+	audio_tee_set_playback(tee);
 
 	is_sd_init = true;
 
@@ -263,26 +336,33 @@ esp_err_t sd_play_deinit(audio_element_handle_t *elems, size_t count,
                          esp_periph_set_handle_t periph_set, void *args) {
 	audio_event_iface_remove_listener(evt, evt_handle);
 	audio_pipeline_remove_listener(pipeline);
+	audio_tee_set_playback(NULL);
 
 	audio_pipeline_stop(pipeline);
 	audio_pipeline_wait_for_stop(pipeline);
 	audio_pipeline_terminate(pipeline);
 
-	audio_pipeline_unregister(pipeline, fatfs_stream_reader);
+	audio_pipeline_unregister(pipeline, playlist);
 	audio_pipeline_unregister(pipeline, mp3_decoder);
+	audio_pipeline_unregister(pipeline, prompt_recorder);
+	audio_pipeline_unregister(pipeline, tee);
 	audio_pipeline_unregister(pipeline, i2s_stream_writer);
+#ifdef CONFIG_PROMPT_CACHE
+	audio_pipeline_unregister(pipeline, prompt_reader);
+#endif
 
 	audio_pipeline_deinit(pipeline);
-	audio_element_deinit(fatfs_stream_reader);
+	audio_element_deinit(playlist);
 	audio_element_deinit(mp3_decoder);
+	audio_element_deinit(prompt_recorder);
+	audio_element_deinit(tee);
 	audio_element_deinit(i2s_stream_writer);
+#ifdef CONFIG_PROMPT_CACHE
+	audio_element_deinit(prompt_reader);
+#endif
 
-	if (sdcard_handle == NULL) { ESP_LOGE(TAG, "sdcard_handle was null!!1"); }
-	if (periph_set == NULL) { ESP_LOGE(TAG, "periph_set was null!!1"); }
-
-	esp_periph_stop(sdcard_handle);
-	esp_periph_remove_from_set(periph_set, sdcard_handle);
-	esp_periph_destroy(sdcard_handle);
+	sd_storage_release(storage);
+	storage = NULL;
 
 	is_sd_init = false;
 
@@ -0,0 +1,63 @@
+#ifndef SD_STORAGE_H
+#define SD_STORAGE_H
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+
+#define SD_STORAGE_MOUNT_POINT "/sdcard"
+
+/// Longest path that is cached
+#define SD_STORAGE_PATH_LENGTH     48
+/// Files kept open for reading after they were closed
+#define SD_STORAGE_MAX_OPEN_FILES  4
+/// Paths of which the size or absence is remembered
+#define SD_STORAGE_MAX_DIR_ENTRIES 32
+
+typedef struct sd_storage *sd_storage_handle_t;
+
+/**
+ * @brief Get a reference to the mounted card, the first reference mounts it.
+ *
+ * Hold a reference for as long as files on the card are used, the card stays
+ * mounted until the last reference is released.
+ */
+esp_err_t sd_storage_acquire(sd_storage_handle_t *storage);
+
+/**
+ * @brief Release a reference, the last one closes the cached files and
+ * unmounts the card.
+ */
+void sd_storage_release(sd_storage_handle_t storage);
+
+/**
+ * @brief Open a file for reading, a file that was closed recently is handed
+ * out again rewound without looking it up on the card.
+ * @param size set to the size of the file if not NULL
+ * @return file or NULL if it does not exist
+ */
+FILE *sd_storage_open(sd_storage_handle_t storage, const char *path,
+                      size_t *size);
+
+/**
+ * @brief Hand a file from sd_storage_open() back, it stays open for a while.
+ */
+void sd_storage_close(sd_storage_handle_t storage, FILE *file);
+
+/**
+ * @brief Look the size of a file up, a path that was looked up before is
+ * answered from memory, also when it does not exist.
+ * @return ESP_ERR_NOT_FOUND if the file does not exist
+ */
+esp_err_t sd_storage_stat(sd_storage_handle_t storage, const char *path,
+                          size_t *size);
+
+/**
+ * @brief Forget what is known about a path, call it after writing the file.
+ */
+void sd_storage_invalidate(sd_storage_handle_t storage, const char *path);
+
+#endif /* SD_STORAGE_H */
@@ -0,0 +1,259 @@
+#include "driver/sdmmc_host.h"
+#include "esp_check.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_vfs_fat.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdmmc_cmd.h"
+#include <string.h>
+#include <sys/stat.h>
+
+#include "sd_storage.h"
+
+// Files open at the same time: the cached files, a prompt pack, the options
+// file and files opened without the cache
+#define SD_STORAGE_MAX_FILES (SD_STORAGE_MAX_OPEN_FILES + 4)
+
+static const char *TAG = "SD_STORAGE";
+
+struct sd_storage_file {
+	char path[SD_STORAGE_PATH_LENGTH];
+	FILE *file;         // NULL if the slot is free
+	size_t size;
+	bool in_use;        // Handed out by sd_storage_open
+	uint32_t last_used;
+};
+
+struct sd_storage_dir_entry {
+	char path[SD_STORAGE_PATH_LENGTH]; // Empty if the slot is free
+	bool exists;
+	size_t size;
+	uint32_t last_used;
+};
+
+struct sd_storage {
+	SemaphoreHandle_t lock; // Protects everything below
+	int refs;
+	sdmmc_card_t *card;
+	uint32_t uses;          // Counter to order the caches by their last use
+	struct sd_storage_file files[SD_STORAGE_MAX_OPEN_FILES];
+	struct sd_storage_dir_entry entries[SD_STORAGE_MAX_DIR_ENTRIES];
+};
+
+static struct sd_storage sd_storage;
+
+static esp_err_t sd_storage_mount(void) {
+	ESP_LOGI(TAG, "Mounting SD card");
+	esp_vfs_fat_sdmmc_mount_config_t mount_cfg = {
+		.format_if_mount_failed = false,
+		.max_files              = SD_STORAGE_MAX_FILES,
+		.allocation_unit_size   = 16 * 1024,
+	};
+	sdmmc_host_t host            = SDMMC_HOST_DEFAULT();
+	sdmmc_slot_config_t slot_cfg = SDMMC_SLOT_CONFIG_DEFAULT();
+	slot_cfg.width               = 1;
+	slot_cfg.flags              |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
+	ESP_RETURN_ON_ERROR(esp_vfs_fat_sdmmc_mount(SD_STORAGE_MOUNT_POINT, &host,
+	                                            &slot_cfg, &mount_cfg,
+	                                            &sd_storage.card),
+	                    TAG, "Failed to mount SD card");
+	sdmmc_card_print_info(stdout, sd_storage.card);
+
+	return ESP_OK;
+}
+
+static void sd_storage_unmount(void) {
+	for (int f = 0; f < SD_STORAGE_MAX_OPEN_FILES; f++) {
+		if (sd_storage.files[f].file) fclose(sd_storage.files[f].file);
+		sd_storage.files[f].file = NULL;
+	}
+	for (int e = 0; e < SD_STORAGE_MAX_DIR_ENTRIES; e++)
+		sd_storage.entries[e].path[0] = '\0';
+
+	ESP_LOGI(TAG, "Unmounting SD card");
+	esp_vfs_fat_sdcard_unmount(SD_STORAGE_MOUNT_POINT, sd_storage.card);
+	sd_storage.card = NULL;
+}
+
+esp_err_t sd_storage_acquire(sd_storage_handle_t *storage) {
+	// The first reference is taken at startup, before other tasks use it
+	if (!sd_storage.lock) sd_storage.lock = xSemaphoreCreateMutex();
+	if (!sd_storage.lock) return ESP_ERR_NO_MEM;
+
+	xSemaphoreTake(sd_storage.lock, portMAX_DELAY);
+	esp_err_t ret = ESP_OK;
+	if (sd_storage.refs == 0) ret = sd_storage_mount();
+	if (ret == ESP_OK) sd_storage.refs++;
+	xSemaphoreGive(sd_storage.lock);
+
+	*storage = ret == ESP_OK ? &sd_storage : NULL;
+	return ret;
+}
+
+void sd_storage_release(sd_storage_handle_t storage) {
+	if (!storage) return;
+
+	xSemaphoreTake(storage->lock, portMAX_DELAY);
+	if (--storage->refs == 0) sd_storage_unmount();
+	xSemaphoreGive(storage->lock);
+}
+
+static struct sd_storage_dir_entry *
+sd_storage_find_entry(sd_storage_handle_t storage, const char *path) {
+	for (int e = 0; e < SD_STORAGE_MAX_DIR_ENTRIES; e++)
+		if (storage->entries[e].path[0] &&
+		    strcmp(storage->entries[e].path, path) == 0)
+			return &storage->entries[e];
+	return NULL;
+}
+
+/**
+ * Remember whether a file exists and its size, replacing the least recently
+ * used entry
+ */
+static void sd_storage_remember(sd_storage_handle_t storage, const char *path,
+                                bool exists, size_t size) {
+	if (strlen(path) >= SD_STORAGE_PATH_LENGTH) return;
+
+	struct sd_storage_dir_entry *entry = sd_storage_find_entry(storage, path);
+	for (int e = 0; e < SD_STORAGE_MAX_DIR_ENTRIES && !entry; e++)
+		if (!storage->entries[e].path[0]) entry = &storage->entries[e];
+	if (!entry) {
+		entry = &storage->entries[0];
+		for (int e = 1; e < SD_STORAGE_MAX_DIR_ENTRIES; e++)
+			if (storage->uses - storage->entries[e].last_used >
+			    storage->uses - entry->last_used)
+				entry = &storage->entries[e];
+	}
+
+	strcpy(entry->path, path);
+	entry->exists    = exists;
+	entry->size      = size;
+	entry->last_used = ++storage->uses;
+}
+
+/**
+ * Find a slot for a file that was opened, a free one or the least recently
+ * used one that is not handed out
+ */
+static struct sd_storage_file *
+sd_storage_file_slot(sd_storage_handle_t storage) {
+	struct sd_storage_file *slot = NULL;
+	for (int f = 0; f < SD_STORAGE_MAX_OPEN_FILES; f++) {
+		struct sd_storage_file *file = &storage->files[f];
+		if (!file->file) return file;
+		if (file->in_use) continue;
+		if (!slot || storage->uses - file->last_used >
+		                 storage->uses - slot->last_used)
+			slot = file;
+	}
+	if (slot) {
+		fclose(slot->file);
+		slot->file = NULL;
+	}
+	return slot;
+}
+
+FILE *sd_storage_open(sd_storage_handle_t storage, const char *path,
+                      size_t *size) {
+	xSemaphoreTake(storage->lock, portMAX_DELAY);
+	for (int f = 0; f < SD_STORAGE_MAX_OPEN_FILES; f++) {
+		struct sd_storage_file *file = &storage->files[f];
+		if (file->file && !file->in_use && strcmp(file->path, path) == 0) {
+			rewind(file->file);
+			file->in_use    = true;
+			file->last_used = ++storage->uses;
+			if (size) *size = file->size;
+			xSemaphoreGive(storage->lock);
+			return file->file;
+		}
+	}
+
+	struct sd_storage_dir_entry *entry = sd_storage_find_entry(storage, path);
+	if (entry && !entry->exists) {
+		xSemaphoreGive(storage->lock);
+		return NULL;
+	}
+
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		sd_storage_remember(storage, path, false, 0);
+		xSemaphoreGive(storage->lock);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	long length = ftell(f);
+	rewind(f);
+	sd_storage_remember(storage, path, true, length > 0 ? length : 0);
+	if (size) *size = length > 0 ? length : 0;
+
+	struct sd_storage_file *slot = strlen(path) < SD_STORAGE_PATH_LENGTH
+	                                   ? sd_storage_file_slot(storage)
+	                                   : NULL;
+	if (slot) {
+		strcpy(slot->path, path);
+		slot->file      = f;
+		slot->size      = length > 0 ? length : 0;
+		slot->in_use    = true;
+		slot->last_used = ++storage->uses;
+	}
+	xSemaphoreGive(storage->lock);
+	return f;
+}
+
+void sd_storage_close(sd_storage_handle_t storage, FILE *file) {
+	xSemaphoreTake(storage->lock, portMAX_DELAY);
+	for (int f = 0; f < SD_STORAGE_MAX_OPEN_FILES; f++) {
+		if (storage->files[f].file == file) {
+			storage->files[f].in_use = false;
+			xSemaphoreGive(storage->lock);
+			return;
+		}
+	}
+	// All slots were handed out when it was opened
+	fclose(file);
+	xSemaphoreGive(storage->lock);
+}
+
+esp_err_t sd_storage_stat(sd_storage_handle_t storage, const char *path,
+                          size_t *size) {
+	xSemaphoreTake(storage->lock, portMAX_DELAY);
+	struct sd_storage_dir_entry *entry = sd_storage_find_entry(storage, path);
+	if (entry) {
+		entry->last_used = ++storage->uses;
+	} else {
+		struct stat st;
+		bool exists = stat(path, &st) == 0;
+		sd_storage_remember(storage, path, exists, exists ? st.st_size : 0);
+		entry = sd_storage_find_entry(storage, path);
+		if (!entry) {
+			// Too long to remember
+			xSemaphoreGive(storage->lock);
+			if (size && exists) *size = st.st_size;
+			return exists ? ESP_OK : ESP_ERR_NOT_FOUND;
+		}
+	}
+	bool exists = entry->exists;
+	if (size && exists) *size = entry->size;
+	xSemaphoreGive(storage->lock);
+	return exists ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+void sd_storage_invalidate(sd_storage_handle_t storage, const char *path) {
+	xSemaphoreTake(storage->lock, portMAX_DELAY);
+	struct sd_storage_dir_entry *entry = sd_storage_find_entry(storage, path);
+	if (entry) entry->path[0] = '\0';
+	for (int f = 0; f < SD_STORAGE_MAX_OPEN_FILES; f++) {
+		struct sd_storage_file *file = &storage->files[f];
+		if (!file->file || strcmp(file->path, path) != 0) continue;
+		if (file->in_use) {
+			// Not handed out again, closed when it is evicted
+			file->path[0] = '\0';
+		} else {
+			fclose(file->file);
+			file->file = NULL;
+		}
+	}
+	xSemaphoreGive(storage->lock);
+}
@@ -0,0 +1,138 @@
+#include "fft_real.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define Q15_ROUND (1 << 14)
+
+/**
+ * Multiply a work value with a Q15 twiddle
+ */
+static inline int32_t mul_q15(int32_t value, int16_t twiddle) {
+	return (int32_t)(((int64_t)value * twiddle + Q15_ROUND) >> 15);
+}
+
+esp_err_t fft_real_setup(fft_real_t *fft, int size) {
+	if (size < FFT_REAL_MIN_SIZE || size > FFT_REAL_MAX_SIZE ||
+	    (size & (size - 1)))
+		return ESP_ERR_INVALID_ARG;
+
+	int half = size / 2;
+	int bits = 0;
+	while ((1 << bits) < size) bits++;
+
+	fft->size        = size;
+	fft->log2_size   = bits;
+	fft->twiddle     = malloc(sizeof *fft->twiddle * size);
+	fft->bit_reverse = malloc(sizeof *fft->bit_reverse * half);
+	fft->buffer      = malloc(sizeof *fft->buffer * size);
+	if (!fft->twiddle || !fft->bit_reverse || !fft->buffer) {
+		fft_real_free(fft);
+		return ESP_ERR_NO_MEM;
+	}
+
+	for (int k = 0; k < half; k++) {
+		float angle              = 2.0f * M_PI * k / size;
+		fft->twiddle[2 * k]     = (int16_t)lrintf(32767.0f * cosf(angle));
+		fft->twiddle[2 * k + 1] = (int16_t)lrintf(-32767.0f * sinf(angle));
+	}
+
+	// The complex transform has N / 2 points, log2(N) - 1 address bits
+	for (int k = 0; k < half; k++) {
+		int reversed = 0;
+		for (int b = 0; b < bits - 1; b++)
+			if (k & (1 << b)) reversed |= 1 << (bits - 2 - b);
+		fft->bit_reverse[k] = reversed;
+	}
+	return ESP_OK;
+}
+
+void fft_real_free(fft_real_t *fft) {
+	free(fft->twiddle);
+	free(fft->bit_reverse);
+	free(fft->buffer);
+	fft->twiddle     = NULL;
+	fft->bit_reverse = NULL;
+	fft->buffer      = NULL;
+}
+
+/**
+ * In-place radix-2 decimation in time FFT of the N / 2 complex values in the
+ * work buffer, which are already in bit reversed order
+ */
+static void fft_complex(fft_real_t *fft) {
+	int32_t *buffer = fft->buffer;
+	int points      = fft->size / 2;
+
+	for (int length = 2; length <= points; length <<= 1) {
+		int span   = length / 2;
+		int stride = fft->size / length; // W_length^j = W_N^(j * N / length)
+		for (int start = 0; start < points; start += length) {
+			for (int j = 0; j < span; j++) {
+				int16_t w_re = fft->twiddle[2 * j * stride];
+				int16_t w_im = fft->twiddle[2 * j * stride + 1];
+				int32_t *a   = &buffer[2 * (start + j)];
+				int32_t *b   = &buffer[2 * (start + j + span)];
+
+				int32_t t_re = mul_q15(b[0], w_re) - mul_q15(b[1], w_im);
+				int32_t t_im = mul_q15(b[0], w_im) + mul_q15(b[1], w_re);
+				b[0]         = a[0] - t_re;
+				b[1]         = a[1] - t_im;
+				a[0] += t_re;
+				a[1] += t_im;
+			}
+		}
+	}
+}
+
+void fft_real_power(fft_real_t *fft, const int16_t *samples,
+                    const int16_t *window, float *power) {
+	int half        = fft->size / 2;
+	int32_t *buffer = fft->buffer;
+
+	// Pack even samples as real and odd samples as imaginary parts, windowed
+	// and in bit reversed order
+	for (int n = 0; n < half; n++) {
+		int32_t even = samples[2 * n];
+		int32_t odd  = samples[2 * n + 1];
+		if (window) {
+			even = (even * window[2 * n] + Q15_ROUND) >> 15;
+			odd  = (odd * window[2 * n + 1] + Q15_ROUND) >> 15;
+		}
+		int r             = fft->bit_reverse[n];
+		buffer[2 * r]     = even;
+		buffer[2 * r + 1] = odd;
+	}
+
+	fft_complex(fft);
+
+	// X[k] = E[k] + W_N^k O[k] with
+	// E[k] = (Z[k] + Z*[M - k]) / 2 and O[k] = -j (Z[k] - Z*[M - k]) / 2
+	for (int k = 0; k <= half; k++) {
+		int i = k % half;
+		int m = (half - k) % half;
+
+		float z_re  = buffer[2 * i];
+		float z_im  = buffer[2 * i + 1];
+		float zc_re = buffer[2 * m];
+		float zc_im = -buffer[2 * m + 1];
+
+		float e_re = 0.5f * (z_re + zc_re);
+		float e_im = 0.5f * (z_im + zc_im);
+		float o_re = 0.5f * (z_im - zc_im);
+		float o_im = -0.5f * (z_re - zc_re);
+
+		float w_re, w_im;
+		if (k < half) {
+			w_re = fft->twiddle[2 * k] / 32767.0f;
+			w_im = fft->twiddle[2 * k + 1] / 32767.0f;
+		} else {
+			w_re = -1.0f;
+			w_im = 0.0f;
+		}
+
+		float x_re = e_re + w_re * o_re - w_im * o_im;
+		float x_im = e_im + w_re * o_im + w_im * o_re;
+		power[k]   = x_re * x_re + x_im * x_im;
+	}
+}
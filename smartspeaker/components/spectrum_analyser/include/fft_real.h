@@ -0,0 +1,53 @@
+#ifndef FFT_REAL_H
+#define FFT_REAL_H
+#pragma once
+
+#include "esp_err.h"
+#include <stdint.h>
+
+/// Supported transform sizes
+#define FFT_REAL_MIN_SIZE 16
+#define FFT_REAL_MAX_SIZE 4096
+
+/**
+ * @brief Fixed-point FFT of a real signal.
+ *
+ * The N real samples are packed as N/2 complex samples, transformed with an
+ * in-place radix-2 FFT and split into the N/2 + 1 bins of the real spectrum.
+ * Twiddles (Q15) and the bit reversal permutation are calculated once in
+ * fft_real_setup.
+ *
+ * The work buffer holds 32-bit values and the butterflies are not scaled. The
+ * int16 input grows by at most log2(N) - 1 bits, so the transform is exact up
+ * to the rounding of the twiddles (about -80 dB) for every supported size.
+ * The final split into real bins and the power are calculated in float.
+ */
+typedef struct fft_real {
+	int size;               // Number of real samples N
+	int log2_size;          // log2(N)
+	int16_t *twiddle;       // cos and -sin of 2 pi k / N for k < N / 2, Q15
+	uint16_t *bit_reverse;  // Bit reversal permutation of N / 2 entries
+	int32_t *buffer;        // N / 2 complex values, re and im interleaved
+} fft_real_t;
+
+/**
+ * @brief Allocate the tables for a transform of size samples.
+ * @return ESP_ERR_INVALID_ARG if size is not a power of two in
+ * [FFT_REAL_MIN_SIZE, FFT_REAL_MAX_SIZE]
+ */
+esp_err_t fft_real_setup(fft_real_t *fft, int size);
+
+/**
+ * @brief Free the tables.
+ */
+void fft_real_free(fft_real_t *fft);
+
+/**
+ * @brief Transform size samples, optionally multiplied by a Q15 window.
+ * @param window size weights or NULL for a rectangular window
+ * @param power receives |X[k]|^2 for the size / 2 + 1 bins k
+ */
+void fft_real_power(fft_real_t *fft, const int16_t *samples,
+                    const int16_t *window, float *power);
+
+#endif /* FFT_REAL_H */
@@ -0,0 +1,74 @@
+#ifndef SPECTRUM_ANALYSER_H
+#define SPECTRUM_ANALYSER_H
+#pragma once
+
+#include "esp_err.h"
+#include "fft_real.h"
+#include <stdint.h>
+
+/// Maximum number of bands
+#define SPECTRUM_MAX_BANDS 32
+
+/// Band levels are reported in dB above this level relative to full scale
+#define SPECTRUM_FLOOR_DB -96
+
+/**
+ * @brief Band levels as they are shown, e.g. on /spectrum of the web
+ * interface.
+ *
+ * Levels are dB above SPECTRUM_FLOOR_DB, so 0 is silence and 96 is a full
+ * scale sine wave.
+ */
+struct spectrum_bands {
+	int nr_bands;
+	uint8_t level[SPECTRUM_MAX_BANDS]; // Current level, falls with decay
+	uint8_t peak[SPECTRUM_MAX_BANDS];  // Held peak level
+};
+
+/**
+ * @brief Structure containing spectrum analyser configuration data
+ */
+typedef struct spectrum_analyser_cfg {
+	int sample_rate; // Sample rate of the input [Hz]
+	int fft_size;    // Samples per frame, power of two (256 to 1024)
+	int nr_bands;    // Number of log-spaced bands
+	int min_freq;    // Lower edge of the first band [Hz]
+	int max_freq;    // Upper edge of the last band [Hz]
+	float decay_db;  // Fall of levels and peaks per frame [dB]
+	int hold_frames; // Frames a peak is held before it falls
+} spectrum_analyser_cfg_t;
+
+/**
+ * @brief Spectrum analyser state, the bands are updated for every frame.
+ */
+typedef struct spectrum_analyser {
+	fft_real_t fft;
+	int16_t *window;                         // Hann window, Q15
+	float *power;                            // Power of fft_size / 2 + 1 bins
+	float full_scale;                        // Band energy of a full scale sine
+	int nr_bands;
+	int band_start[SPECTRUM_MAX_BANDS + 1];  // First bin of every band
+	float level[SPECTRUM_MAX_BANDS];         // Level in dB above the floor
+	float peak[SPECTRUM_MAX_BANDS];          // Peak in dB above the floor
+	int hold[SPECTRUM_MAX_BANDS];            // Frames the peak is still held
+	float decay_db;
+	int hold_frames;
+	struct spectrum_bands bands;
+} spectrum_analyser_t;
+
+esp_err_t spectrum_analyser_setup(spectrum_analyser_t *analyser,
+                                  const spectrum_analyser_cfg_t *config);
+void spectrum_analyser_free(spectrum_analyser_t *analyser);
+
+/**
+ * @brief Analyse one frame of fft_size samples and update analyser->bands.
+ */
+void spectrum_analyser_process(spectrum_analyser_t *analyser,
+                               const int16_t *samples);
+
+/**
+ * @brief Update analyser->bands for a silent frame, without an FFT.
+ */
+void spectrum_analyser_decay(spectrum_analyser_t *analyser);
+
+#endif /* SPECTRUM_ANALYSER_H */
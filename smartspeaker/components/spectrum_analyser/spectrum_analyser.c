@@ -0,0 +1,124 @@
+#include "spectrum_analyser.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Mean of the squared Hann window
+#define HANN_POWER_GAIN 0.375f
+
+esp_err_t spectrum_analyser_setup(spectrum_analyser_t *analyser,
+                                  const spectrum_analyser_cfg_t *config) {
+	int size = config->fft_size;
+	if (config->nr_bands < 1 || config->nr_bands > SPECTRUM_MAX_BANDS ||
+	    config->min_freq <= 0 || config->max_freq <= config->min_freq ||
+	    2 * config->max_freq > config->sample_rate)
+		return ESP_ERR_INVALID_ARG;
+
+	memset(analyser, 0, sizeof *analyser);
+	esp_err_t err = fft_real_setup(&analyser->fft, size);
+	if (err != ESP_OK) return err;
+
+	analyser->window = malloc(sizeof *analyser->window * size);
+	analyser->power  = malloc(sizeof *analyser->power * (size / 2 + 1));
+	if (!analyser->window || !analyser->power) {
+		spectrum_analyser_free(analyser);
+		return ESP_ERR_NO_MEM;
+	}
+
+	for (int n = 0; n < size; n++)
+		analyser->window[n] = (int16_t)lrintf(
+		    32767.0f * 0.5f * (1.0f - cosf(2.0f * M_PI * n / size)));
+
+	// Parseval: the one-sided spectrum of a windowed sine of amplitude A holds
+	// N^2 * A^2 * mean(w^2) / 4
+	analyser->full_scale =
+	    (float)size * size * 32767.0f * 32767.0f * HANN_POWER_GAIN / 4.0f;
+
+	// Log-spaced band edges, every band at least one bin wide
+	float ratio = (float)config->max_freq / config->min_freq;
+	int last    = 0;
+	for (int b = 0; b <= config->nr_bands; b++) {
+		float exponent = (float)b / config->nr_bands;
+		float freq     = config->min_freq * powf(ratio, exponent);
+		int bin        = (int)lrintf(freq * size / config->sample_rate);
+		if (b > 0 && bin <= last) bin = last + 1;
+		if (bin > size / 2 + 1) bin = size / 2 + 1;
+		analyser->band_start[b] = bin;
+		last                    = bin;
+	}
+
+	analyser->nr_bands       = config->nr_bands;
+	analyser->decay_db       = config->decay_db;
+	analyser->hold_frames    = config->hold_frames;
+	analyser->bands.nr_bands = config->nr_bands;
+	return ESP_OK;
+}
+
+void spectrum_analyser_free(spectrum_analyser_t *analyser) {
+	fft_real_free(&analyser->fft);
+	free(analyser->window);
+	free(analyser->power);
+	analyser->window = NULL;
+	analyser->power  = NULL;
+}
+
+/**
+ * Convert a level in dB above the floor to the published range
+ */
+static uint8_t to_band_level(float level) {
+	if (level <= 0.0f) return 0;
+	if (level >= -SPECTRUM_FLOOR_DB) return -SPECTRUM_FLOOR_DB;
+	return (uint8_t)level;
+}
+
+/**
+ * Convert the energy of a band to its level in dB above the floor
+ */
+static float band_level(const spectrum_analyser_t *analyser, float energy) {
+	return 10.0f * log10f(energy / analyser->full_scale + 1e-12f) -
+	       SPECTRUM_FLOOR_DB;
+}
+
+/**
+ * Let band b follow the level of the latest frame
+ */
+static void update_band(spectrum_analyser_t *analyser, int b, float level) {
+	// Levels fall at most decay_db per frame
+	float fallen = analyser->level[b] - analyser->decay_db;
+	analyser->level[b] = level > fallen ? level : fallen;
+
+	// Peaks are held for hold_frames and then fall as well
+	if (level >= analyser->peak[b]) {
+		analyser->peak[b] = level;
+		analyser->hold[b] = analyser->hold_frames;
+	} else if (analyser->hold[b] > 0) {
+		analyser->hold[b]--;
+	} else {
+		analyser->peak[b] -= analyser->decay_db;
+		if (analyser->peak[b] < analyser->level[b])
+			analyser->peak[b] = analyser->level[b];
+	}
+
+	analyser->bands.level[b] = to_band_level(analyser->level[b]);
+	analyser->bands.peak[b]  = to_band_level(analyser->peak[b]);
+}
+
+void spectrum_analyser_process(spectrum_analyser_t *analyser,
+                               const int16_t *samples) {
+	fft_real_power(&analyser->fft, samples, analyser->window, analyser->power);
+
+	for (int b = 0; b < analyser->nr_bands; b++) {
+		float energy = 0.0f;
+		for (int k = analyser->band_start[b]; k < analyser->band_start[b + 1];
+		     k++)
+			energy += analyser->power[k];
+		update_band(analyser, b, band_level(analyser, energy));
+	}
+}
+
+void spectrum_analyser_decay(spectrum_analyser_t *analyser) {
+	float silence = band_level(analyser, 0.0f);
+	for (int b = 0; b < analyser->nr_bands; b++)
+		update_band(analyser, b, silence);
+}
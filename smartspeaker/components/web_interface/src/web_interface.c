@@ -37,9 +37,16 @@
 /* TODO: this dependency is kind of stupid, refactor */
 #include "lcd.h"
 
+#include "audio_analyser.h"
 #include "audio_event_iface.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "radio.h"
+#include "spectrum_analyser.h"
 
+#include <ctype.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 static httpd_handle_t server = NULL;
@@ -59,10 +66,20 @@ struct str_cmd_map_item str_cmd_map[] = {
 	{ UIC_PARTY_MODE_ON, "party-mode-on" },
 	{ UIC_PARTY_MODE_OFF, "party-mode-off" },
 	{ UIC_ASK_CLOCK_TIME, "ask-clock-time" },
+	{ UIC_MUSIC, "music" },
+	{ UIC_MUSIC_SHUFFLE, "shuffle" },
+	{ UIC_MUSIC_NEXT_FOLDER, "next-folder" },
+	{ UIC_SEEK_FORWARD, "seek-forward" },
+	{ UIC_SEEK_BACKWARD, "seek-backward" },
+	{ UIC_MUSIC_RESCAN, "rescan-music" },
+	{ UIC_PAUSE, "pause" },
+	{ UIC_LIVE, "live" },
 };
 
 static audio_event_iface_handle_t evt_ptr;
 #define SEND_UI_CMD(command) SEND_CMD(6969, 6969, command, evt_ptr)
+#define SEND_TUNE(channel)   SEND_CMD(8005, 8005, channel, evt_ptr)
+#define SEND_REWIND(seconds) SEND_CMD(8008, 8008, seconds, evt_ptr)
 
 /* Our URI handler function to be called during GET /uri request */
 #define RESP_LEN 100
@@ -91,6 +108,237 @@ httpd_uri_t uri_get = { .uri      = "/cmd/*",
 	                    .handler  = get_handler,
 	                    .user_ctx = NULL };
 
+/* GET /spectrum returns the latest band levels as JSON */
+#define SPECTRUM_RESP_LEN (32 + 2 * 4 * SPECTRUM_MAX_BANDS)
+esp_err_t spectrum_handler(httpd_req_t *req) {
+	struct spectrum_bands bands;
+	audio_analyser_get_spectrum(&bands);
+
+	char resp[SPECTRUM_RESP_LEN];
+	int len = snprintf(resp, sizeof resp, "{\"level\":[");
+	for (int b = 0; b < bands.nr_bands; b++)
+		len += snprintf(resp + len, sizeof resp - len, "%s%d", b ? "," : "",
+		                bands.level[b]);
+	len += snprintf(resp + len, sizeof resp - len, "],\"peak\":[");
+	for (int b = 0; b < bands.nr_bands; b++)
+		len += snprintf(resp + len, sizeof resp - len, "%s%d", b ? "," : "",
+		                bands.peak[b]);
+	snprintf(resp + len, sizeof resp - len, "]}\n");
+
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+	return ESP_OK;
+}
+
+httpd_uri_t uri_spectrum = { .uri      = "/spectrum",
+	                         .method   = HTTP_GET,
+	                         .handler  = spectrum_handler,
+	                         .user_ctx = NULL };
+
+/* Decode %xx and + of a query value in place */
+static void url_decode(char *s) {
+	char *out = s;
+	for (; *s; s++) {
+		if (*s == '+') {
+			*out++ = ' ';
+		} else if (*s == '%' && isxdigit((unsigned char)s[1]) &&
+		           isxdigit((unsigned char)s[2])) {
+			char hex[3] = { s[1], s[2], '\0' };
+			*out++      = (char)strtol(hex, NULL, 16);
+			s          += 2;
+		} else {
+			*out++ = *s;
+		}
+	}
+	*out = '\0';
+}
+
+/* Copy a string into a JSON string, cut if it does not fit */
+static int json_escape(char *out, size_t size, const char *in) {
+	size_t len = 0;
+	for (; *in && len + 7 < size; in++) {
+		unsigned char c = *in;
+		if (c == '"' || c == '\\') {
+			out[len++] = '\\';
+			out[len++] = c;
+		} else if (c < 0x20) {
+			len += snprintf(out + len, size - len, "\\u%04x", c);
+		} else {
+			out[len++] = c;
+		}
+	}
+	out[len] = '\0';
+	return len;
+}
+
+/*
+ * GET /stations?q=<words>&max=<n> returns the channels with a word starting
+ * with each word of the query as JSON, one chunk per station.
+ */
+#define STATIONS_QUERY_LEN 160
+#define STATIONS_MAX       20
+#define STATIONS_LIMIT     100
+esp_err_t stations_handler(httpd_req_t *req) {
+	char query[STATIONS_QUERY_LEN] = "", search[STATIONS_QUERY_LEN] = "";
+	char value[8];
+	int max    = STATIONS_MAX;
+	size_t len = httpd_req_get_url_query_len(req) + 1;
+	if (len > 1 && len <= sizeof query &&
+	    httpd_req_get_url_query_str(req, query, len) == ESP_OK) {
+		if (httpd_query_key_value(query, "q", search, sizeof search) == ESP_OK)
+			url_decode(search);
+		if (httpd_query_key_value(query, "max", value, sizeof value) == ESP_OK)
+			max = atoi(value);
+	}
+	if (max < 1 || max > STATIONS_LIMIT) max = STATIONS_LIMIT;
+
+	uint32_t channels[STATIONS_LIMIT];
+	int64_t start_us = esp_timer_get_time();
+	int found        = radio_search(search, channels, max);
+	int64_t took_us  = esp_timer_get_time() - start_us;
+	ESP_LOGI(TAG, "Search \"%s\" found %d in %lld us", search, found,
+	         (long long)took_us);
+
+	char item[32 + 6 * 96];
+	httpd_resp_set_type(req, "application/json");
+	snprintf(item, sizeof item, "{\"search_us\":%lld,\"stations\":[",
+	         (long long)took_us);
+	httpd_resp_sendstr_chunk(req, item);
+	for (int i = 0; i < found; i++) {
+		int n = snprintf(item, sizeof item, "%s{\"channel\":%u,\"name\":\"",
+		                 i ? "," : "", (unsigned)channels[i]);
+		n    += json_escape(item + n, sizeof item - n - 3,
+		                    radio_channel_name(channels[i]));
+		snprintf(item + n, sizeof item - n, "\"}");
+		httpd_resp_sendstr_chunk(req, item);
+	}
+	httpd_resp_sendstr_chunk(req, "]}\n");
+	return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+httpd_uri_t uri_stations = { .uri      = "/stations",
+	                         .method   = HTTP_GET,
+	                         .handler  = stations_handler,
+	                         .user_ctx = NULL };
+
+/* GET /radio returns the channel that plays and its stream counters */
+esp_err_t radio_handler(httpd_req_t *req) {
+	struct radio_station_stats stats;
+	if (radio_get_stats(&stats) != ESP_OK) {
+		httpd_resp_set_status(req, HTTPD_400);
+		httpd_resp_sendstr(req, "The radio does not play\n");
+		return ESP_OK;
+	}
+
+	static const char *codecs[] = { [RADIO_CODEC_NONE] = "",
+		                            [RADIO_CODEC_MP3]  = "mp3",
+		                            [RADIO_CODEC_AAC]  = "aac" };
+	// In chunks like /stations, the httpd task has a small stack
+	char item[6 * RADIO_ICY_TITLE_LENGTH];
+	char raw[RADIO_ICY_TITLE_LENGTH] = "";
+	httpd_resp_set_type(req, "application/json");
+	snprintf(item, sizeof item, "{\"channel\":%d,\"name\":\"",
+	         radio_get_channel());
+	httpd_resp_sendstr_chunk(req, item);
+	json_escape(item, sizeof item, radio_channel_name(radio_get_channel()));
+	httpd_resp_sendstr_chunk(req, item);
+	httpd_resp_sendstr_chunk(req, "\",\"title\":\"");
+	radio_get_title(raw, sizeof raw);
+	json_escape(item, sizeof item, raw);
+	httpd_resp_sendstr_chunk(req, item);
+	snprintf(item, sizeof item,
+	         "\",\"titles\":%u,\"codec\":\"%s\",\"kbps\":%u,"
+	         "\"decoder_load\":%d,\"depth\":%d,\"target\":%d,"
+	         "\"rate\":%u,\"underruns\":%u,\"reconnects\":%u,"
+	         "\"outages\":%u,\"outage_ms\":%d,\"outage_max_ms\":%d,"
+	         "\"recover_ms\":%d,\"recover_max_ms\":%d,\"bytes\":%llu,"
+	         "\"shifted\":%s,\"lag_s\":%d,\"recorded_s\":%d}\n",
+	         (unsigned)stats.titles, codecs[stats.codec], (unsigned)stats.kbps,
+	         radio_get_decoder_load(), stats.fill, stats.target,
+	         (unsigned)stats.rate, (unsigned)stats.underruns,
+	         (unsigned)stats.reconnects, (unsigned)stats.outages,
+	         stats.outage_ms, stats.outage_max_ms, stats.recover_ms,
+	         stats.recover_max_ms, (unsigned long long)stats.bytes,
+	         stats.shifted ? "true" : "false", stats.lag_s, stats.recorded_s);
+	httpd_resp_sendstr_chunk(req, item);
+	return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+httpd_uri_t uri_radio = { .uri      = "/radio",
+	                      .method   = HTTP_GET,
+	                      .handler  = radio_handler,
+	                      .user_ctx = NULL };
+
+/* GET /title returns the channel that plays and the title of its stream */
+esp_err_t title_handler(httpd_req_t *req) {
+	char title[RADIO_ICY_TITLE_LENGTH] = "";
+	if (radio_get_title(title, sizeof title) != ESP_OK) {
+		httpd_resp_set_status(req, HTTPD_400);
+		httpd_resp_sendstr(req, "The radio does not play\n");
+		return ESP_OK;
+	}
+
+	char resp[96 + sizeof title + 3];
+	snprintf(resp, sizeof resp, "%s: %s\n",
+	         radio_channel_name(radio_get_channel()), title);
+	httpd_resp_set_type(req, "text/plain");
+	httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+	return ESP_OK;
+}
+
+httpd_uri_t uri_title = { .uri      = "/title",
+	                      .method   = HTTP_GET,
+	                      .handler  = title_handler,
+	                      .user_ctx = NULL };
+
+/* GET /tune/<channel> switches to a channel, the radio starts if it is off */
+esp_err_t tune_handler(httpd_req_t *req) {
+	char resp[RESP_LEN];
+	char *end;
+	long channel = strtol(req->uri + 6, &end, 10);
+	if (end == req->uri + 6 || *end || channel < 0 ||
+	    channel >= radio_nr_channels()) {
+		httpd_resp_set_status(req, HTTPD_400);
+		snprintf(resp, RESP_LEN, "Invalid channel: %s\n", req->uri + 6);
+		httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+		return ESP_OK;
+	}
+
+	SEND_TUNE(channel);
+	snprintf(resp, RESP_LEN, "Tuned to %ld: %s\n", channel,
+	         radio_channel_name(channel));
+	httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+	return ESP_OK;
+}
+
+httpd_uri_t uri_tune = { .uri      = "/tune/*",
+	                     .method   = HTTP_GET,
+	                     .handler  = tune_handler,
+	                     .user_ctx = NULL };
+
+/* GET /rewind/<seconds> goes back on the radio, see radio_seek() */
+esp_err_t rewind_handler(httpd_req_t *req) {
+	char resp[RESP_LEN];
+	char *end;
+	long seconds = strtol(req->uri + 8, &end, 10);
+	if (end == req->uri + 8 || *end || seconds <= 0 || seconds > 86400) {
+		httpd_resp_set_status(req, HTTPD_400);
+		snprintf(resp, RESP_LEN, "Invalid seconds: %s\n", req->uri + 8);
+		httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+		return ESP_OK;
+	}
+
+	SEND_REWIND(seconds);
+	snprintf(resp, RESP_LEN, "Rewinding %ld s\n", seconds);
+	httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+	return ESP_OK;
+}
+
+httpd_uri_t uri_rewind = { .uri      = "/rewind/*",
+	                       .method   = HTTP_GET,
+	                       .handler  = rewind_handler,
+	                       .user_ctx = NULL };
+
 esp_err_t wi_init(audio_event_iface_handle_t evt) {
 	audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
 	evt_cfg.queue_set_size          = 20;
@@ -109,6 +357,18 @@ esp_err_t wi_init(audio_event_iface_handle_t evt) {
 
 	ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &uri_get), TAG,
 	                    "httpd_register_uri_handler failed");
+	ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &uri_spectrum), TAG,
+	                    "httpd_register_uri_handler failed");
+	ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &uri_stations), TAG,
+	                    "httpd_register_uri_handler failed");
+	ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &uri_tune), TAG,
+	                    "httpd_register_uri_handler failed");
+	ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &uri_radio), TAG,
+	                    "httpd_register_uri_handler failed");
+	ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &uri_title), TAG,
+	                    "httpd_register_uri_handler failed");
+	ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &uri_rewind), TAG,
+	                    "httpd_register_uri_handler failed");
 	/*ESP_RETURN_ON_ERROR(httpd_register_uri_handler(server, &uri_post), TAG);*/
 	return ESP_OK;
 }
@@ -3,9 +3,11 @@
 #include "bt_sink.h"
 #include "lcd.h"
 #include "led_controller_commands.h"
+#include "music_library.h"
 #include "radio.h"
 #include "sd_io.h"
 #include "sd_play.h"
+#include "sd_storage.h"
 #include "sntp-mod.h"
 #include "utils/macro.h"
 #include "web_interface.h"
@@ -46,6 +48,7 @@ static const char *TAG = "MAIN";
 static audio_board_handle_t board_handle;
 static esp_periph_set_handle_t periph_set;
 static audio_event_iface_handle_t evt;
+static sd_storage_handle_t storage;
 
 static int player_volume;
 static bool set_opts_on_tone_detect = true;
@@ -67,7 +70,11 @@ struct state speaker_states[SPEAKER_STATE_MAX] = {
 	{ .enter     = sd_play_init,
 	  .run       = sd_play_run_bt,
 	  .exit      = sd_play_deinit,
-	  .can_enter = NULL } /* BT_PAIRING */
+	  .can_enter = NULL }, /* BT_PAIRING */
+	{ .enter     = music_library_init,
+	  .run       = music_library_run,
+	  .exit      = music_library_deinit,
+	  .can_enter = NULL } /* MUSIC */
 };
 enum speaker_state speaker_state_index     = SPEAKER_STATE_NONE;
 enum speaker_state speaker_state_index_old = SPEAKER_STATE_NONE;
@@ -104,6 +111,16 @@ static void app_init(void) {
 	esp_periph_config_t periph_cfg = DEFAULT_ESP_PERIPH_SET_CONFIG();
 	periph_set                     = esp_periph_set_init(&periph_cfg);
 
+	/* Mount the SD card once, the clock and the options take references */
+	ESP_LOGI(TAG, "Mount SD card");
+	if (sd_storage_acquire(&storage) != ESP_OK)
+		ESP_LOGW(TAG, "No SD card, the clock and startup options fail");
+
+	/* Before the web interface and the LCD search them */
+	ESP_LOGI(TAG, "Load radio stations");
+	if (radio_load_stations() != ESP_OK)
+		ESP_LOGW(TAG, "No radio stations, the radio does not start");
+
 	ESP_LOGI(TAG, "Initialise touch peripheral");
 	audio_board_key_init(periph_set);
 
@@ -135,7 +152,11 @@ static void app_init(void) {
 	wi_init(evt);
 
 	ESP_LOGI(TAG, "Initialise audio analyser");
-	audio_analyser_init(evt);
+#ifdef CONFIG_AUDIO_ANALYSER_SOURCE_PLAYBACK
+	audio_analyser_init(evt, AUDIO_ANALYSER_SOURCE_PLAYBACK);
+#else
+	audio_analyser_init(evt, AUDIO_ANALYSER_SOURCE_MICROPHONE);
+#endif
 
 #ifdef CONFIG_LCD_ENABLED
 	xTaskCreate(&lcd1602_task, "lcd1602_task", 3000, evt, 5, NULL);
@@ -167,6 +188,9 @@ static void app_free(void) {
 	esp_periph_set_stop_all(periph_set);
 	esp_periph_set_destroy(periph_set);
 
+	ESP_LOGI(TAG, "Unmount SD card");
+	sd_storage_release(storage);
+
 	ESP_LOGI(TAG, "Deinitialise audio board");
 	audio_hal_ctrl_codec(board_handle->audio_hal, AUDIO_HAL_CODEC_MODE_BOTH,
 	                     AUDIO_HAL_CTRL_STOP);
@@ -228,6 +252,112 @@ static void handle_touch_input(audio_event_iface_msg_t *msg) {
 	}
 }
 
+/**
+ * Stop waiting for the startup tone. The analyser keeps running when it decodes
+ * DTMF keys or analyses the playback.
+ */
+static void stop_tone_detect(void) {
+	set_opts_on_tone_detect = false;
+#if !defined(CONFIG_AUDIO_ANALYSER_DTMF) &&                                    \
+    !defined(CONFIG_AUDIO_ANALYSER_SOURCE_PLAYBACK)
+	audio_analyser_deinit(&detect_task);
+#endif
+}
+
+static void run_ui_command(enum ui_cmd ui_command) {
+	switch (ui_command) {
+		case UIC_SWITCH_OUTPUT:
+			if (set_opts_on_tone_detect) stop_tone_detect();
+			if (speaker_state_index == SPEAKER_STATE_RADIO) {
+				if (bt_connected == 0) {
+					switch_state(SPEAKER_STATE_BT_PAIRING, NULL);
+				} else {
+					switch_state(SPEAKER_STATE_BLUETOOTH, NULL);
+				}
+			} else switch_state(SPEAKER_STATE_RADIO, NULL);
+			break;
+		case UIC_VOLUME_UP: set_volume(player_volume + 10); break;
+		case UIC_VOLUME_DOWN: set_volume(player_volume - 10); break;
+		case UIC_CHANNEL_UP:
+			if (speaker_state_index == SPEAKER_STATE_RADIO) channel_up();
+			else if (speaker_state_index == SPEAKER_STATE_MUSIC)
+				music_library_next();
+			break;
+		case UIC_CHANNEL_DOWN:
+			if (speaker_state_index == SPEAKER_STATE_RADIO) channel_down();
+			else if (speaker_state_index == SPEAKER_STATE_MUSIC)
+				music_library_prev();
+			break;
+		case UIC_PARTY_MODE_ON: set_party_mode(SC_RAINBOW_FLASH); break;
+		case UIC_PARTY_MODE_OFF: set_party_mode(SC_OFF); break;
+		case UIC_ASK_CLOCK_TIME:
+			// struct timeval tv;
+			// int ret = gettimeofday(&tv, NULL);
+			// if (ret != 0) goto time_err;
+
+			// struct tm *tm = localtime(&tv.tv_sec);
+			// if (!tm) goto time_err;
+			//  ESP_LOGI(TAG, "%d", tm->tm_min);
+			//  ESP_LOGI(TAG, "%d", tm->tm_hour);
+
+			switch_state(SPEAKER_STATE_CLOCK, NULL);
+
+			// play_audio_through_string("/sdcard/nl/cu.mp3");
+			// play_audio_through_int(tm->tm_hour);
+			// play_audio_through_int(tm->tm_min);
+
+			// ESP_ERROR_CHECK(sd_play_deinit_sdcard_clock(evt,
+			// periph_set));
+
+			// ESP_ERROR_CHECK(init_radio(NULL, 0, evt));
+			break;
+		case UIC_SET_STARTUP_OPTS:
+			sd_io_init();
+			// TODO: impl party mode in feature
+			if (sd_io_save_opts((struct sd_io_startup_opts){
+			        speaker_state_index, player_volume, false }) == ESP_OK)
+				ESP_LOGI(TAG,
+				         "Saved startup options to SD card successfully");
+			sd_io_deinit();
+			break;
+		case UIC_MUSIC:
+			if (set_opts_on_tone_detect) stop_tone_detect();
+			if (speaker_state_index == SPEAKER_STATE_MUSIC)
+				switch_state(SPEAKER_STATE_RADIO, NULL);
+			else switch_state(SPEAKER_STATE_MUSIC, NULL);
+			break;
+		case UIC_MUSIC_SHUFFLE:
+			music_library_set_shuffle(!music_library_get_shuffle());
+			break;
+		case UIC_MUSIC_NEXT_FOLDER: music_library_next_folder(); break;
+		case UIC_SEEK_FORWARD:
+#ifdef CONFIG_RADIO_TIMESHIFT
+			if (speaker_state_index == SPEAKER_STATE_RADIO) {
+				radio_seek(CONFIG_RADIO_TIMESHIFT_SEEK_SECONDS);
+				break;
+			}
+#endif
+			music_library_seek(CONFIG_MUSIC_LIBRARY_SEEK_SECONDS);
+			break;
+		case UIC_SEEK_BACKWARD:
+#ifdef CONFIG_RADIO_TIMESHIFT
+			if (speaker_state_index == SPEAKER_STATE_RADIO) {
+				radio_seek(-CONFIG_RADIO_TIMESHIFT_SEEK_SECONDS);
+				break;
+			}
+#endif
+			music_library_seek(-CONFIG_MUSIC_LIBRARY_SEEK_SECONDS);
+			break;
+		case UIC_MUSIC_RESCAN: music_library_rescan(); break;
+		case UIC_PAUSE:
+			if (speaker_state_index == SPEAKER_STATE_RADIO) radio_pause();
+			break;
+		case UIC_LIVE:
+			if (speaker_state_index == SPEAKER_STATE_RADIO) radio_live();
+			break;
+	}
+}
+
 static void handle_ui_input(audio_event_iface_msg_t *msg) {
 	// Event from LCD buttons/UI
 	if (msg->source_type == 6969) {
@@ -238,61 +368,7 @@ static void handle_ui_input(audio_event_iface_msg_t *msg) {
 		else return;
 
 		ESP_LOGI(TAG, "Received ui event: %d", ui_command);
-
-		switch (ui_command) {
-			case UIC_SWITCH_OUTPUT:
-				if (set_opts_on_tone_detect) {
-					set_opts_on_tone_detect = false;
-					audio_analyser_deinit(&detect_task);
-				}
-				if (speaker_state_index == SPEAKER_STATE_RADIO) {
-					if (bt_connected == 0) {
-						switch_state(SPEAKER_STATE_BT_PAIRING, NULL);
-					} else {
-						switch_state(SPEAKER_STATE_BLUETOOTH, NULL);
-					}
-				} else switch_state(SPEAKER_STATE_RADIO, NULL);
-				break;
-			case UIC_VOLUME_UP: set_volume(player_volume + 10); break;
-			case UIC_VOLUME_DOWN: set_volume(player_volume - 10); break;
-			case UIC_CHANNEL_UP:
-				if (speaker_state_index == SPEAKER_STATE_RADIO) channel_up();
-				break;
-			case UIC_CHANNEL_DOWN:
-				if (speaker_state_index == SPEAKER_STATE_RADIO) channel_down();
-				break;
-			case UIC_PARTY_MODE_ON: set_party_mode(SC_RAINBOW_FLASH); break;
-			case UIC_PARTY_MODE_OFF: set_party_mode(SC_OFF); break;
-			case UIC_ASK_CLOCK_TIME:
-				// struct timeval tv;
-				// int ret = gettimeofday(&tv, NULL);
-				// if (ret != 0) goto time_err;
-
-				// struct tm *tm = localtime(&tv.tv_sec);
-				// if (!tm) goto time_err;
-				//  ESP_LOGI(TAG, "%d", tm->tm_min);
-				//  ESP_LOGI(TAG, "%d", tm->tm_hour);
-
-				switch_state(SPEAKER_STATE_CLOCK, NULL);
-
-				// play_audio_through_string("/sdcard/nl/cu.mp3");
-				// play_audio_through_int(tm->tm_hour);
-				// play_audio_through_int(tm->tm_min);
-
-				// ESP_ERROR_CHECK(sd_play_deinit_sdcard_clock(evt,
-				// periph_set));
-
-				// ESP_ERROR_CHECK(init_radio(NULL, 0, evt));
-				break;
-			case UIC_SET_STARTUP_OPTS:
-				sd_io_init();
-				// TODO: impl party mode in feature
-				if (sd_io_save_opts((struct sd_io_startup_opts){
-				        speaker_state_index, player_volume, false }) == ESP_OK)
-					ESP_LOGI(TAG,
-					         "Saved startup options to SD card successfully");
-				sd_io_deinit();
-		}
+		run_ui_command(ui_command);
 	} else if (msg->cmd == 6970 && msg->source_type == 6970 &&
 	           (int)msg->data == SDC_CLOCK_DONE) {
 		switch_state(speaker_state_index_old, NULL);
@@ -302,13 +378,10 @@ static void handle_ui_input(audio_event_iface_msg_t *msg) {
 	}
 }
 
-void handle_detect_input(audio_event_iface_msg_t *msg) {
-	if (!set_opts_on_tone_detect || msg->cmd != 8000 ||
-	    msg->source_type != 8000)
-		return;
-
-	ESP_LOGI(TAG, "Detect event received");
-
+/**
+ * Load the startup options from the SD card and start the saved state.
+ */
+static void apply_startup_opts(void) {
 	struct sd_io_startup_opts opts;
 	sd_io_init();
 	if (sd_io_load_opts(&opts) == ESP_OK) {
@@ -325,8 +398,70 @@ void handle_detect_input(audio_event_iface_msg_t *msg) {
 		set_party_mode(SC_OFF);
 	}
 	sd_io_deinit();
-	set_opts_on_tone_detect = false;
-	audio_analyser_deinit(&detect_task);
+	stop_tone_detect();
+}
+
+void handle_detect_input(audio_event_iface_msg_t *msg) {
+	if (!set_opts_on_tone_detect || msg->cmd != 8000 ||
+	    msg->source_type != 8000)
+		return;
+
+	ESP_LOGI(TAG, "Detect event received");
+	apply_startup_opts();
+}
+
+/**
+ * Keypad layout for DTMF remote control:
+ *   2/8 volume up/down, 4/6 channel down/up, 5 switch output, 0 clock,
+ *   * party mode on, # party mode off
+ */
+static void handle_dtmf_input(audio_event_iface_msg_t *msg) {
+	if (msg->source_type != 8001) return;
+
+	char digit = (char)(int)msg->data;
+	ESP_LOGI(TAG, "DTMF digit received: %c", digit);
+
+	switch (digit) {
+		case '2': run_ui_command(UIC_VOLUME_UP); break;
+		case '8': run_ui_command(UIC_VOLUME_DOWN); break;
+		case '4': run_ui_command(UIC_CHANNEL_DOWN); break;
+		case '6': run_ui_command(UIC_CHANNEL_UP); break;
+		case '5': run_ui_command(UIC_SWITCH_OUTPUT); break;
+		case '0': run_ui_command(UIC_ASK_CLOCK_TIME); break;
+		case '*': run_ui_command(UIC_PARTY_MODE_ON); break;
+		case '#': run_ui_command(UIC_PARTY_MODE_OFF); break;
+		default: break;
+	}
+}
+
+/**
+ * Beats of the radio pace the party mode effect on the LED strip.
+ */
+static void handle_beat_input(audio_event_iface_msg_t *msg) {
+	if (msg->cmd != 8003 || msg->source_type != 8003) return;
+
+	ESP_LOGD(TAG, "Beat at %d BPM", (int)msg->data);
+	led_controller_beat();
+}
+
+/**
+ * A channel picked from a search on the web interface or the LCD, the radio
+ * starts with it if it did not play.
+ */
+static void handle_tune_input(audio_event_iface_msg_t *msg) {
+	if (msg->cmd != 8005 || msg->source_type != 8005) return;
+
+	if (tune_radio((int)msg->data) != ESP_OK) return;
+	if (speaker_state_index != SPEAKER_STATE_RADIO)
+		switch_state(SPEAKER_STATE_RADIO, NULL);
+}
+
+/* Seconds to go back on the radio, from the web interface */
+static void handle_rewind_input(audio_event_iface_msg_t *msg) {
+	if (msg->cmd != 8008 || msg->source_type != 8008) return;
+
+	if (speaker_state_index == SPEAKER_STATE_RADIO)
+		radio_seek(-(int)msg->data);
 }
 
 void app_main() {
@@ -343,9 +478,14 @@ void app_main() {
 	hue_enable(true);
 #endif
 
+#ifdef CONFIG_AUDIO_ANALYSER_SOURCE_PLAYBACK
+	/* The analyser listens to the playback, there is no startup tone. */
+	apply_startup_opts();
+#else
 	/* Cannot start this because the tone detection task is still running. */
 	// wifi_wait(portMAX_DELAY);
 	// switch_state(SPEAKER_STATE_RADIO, NULL);
+#endif
 
 	/* Main eventloop */
 	ESP_LOGI(TAG, "Entering main eventloop");
@@ -354,12 +494,19 @@ void app_main() {
 		ESP_GOTO_ON_ERROR(audio_event_iface_listen(evt, &msg, portMAX_DELAY),
 		                  exit, TAG, "Event listening failed");
 
-		ESP_LOGI(TAG, "Received event with cmd: %d, source_type %d and data %p",
-		         msg.cmd, msg.source_type, msg.data);
+		// Beats arrive several times per second, do not log them
+		if (msg.source_type != 8003)
+			ESP_LOGI(TAG,
+			         "Received event with cmd: %d, source_type %d and data %p",
+			         msg.cmd, msg.source_type, msg.data);
 
 		handle_ui_input(&msg);
 		handle_touch_input(&msg);
 		handle_detect_input(&msg);
+		handle_dtmf_input(&msg);
+		handle_beat_input(&msg);
+		handle_tune_input(&msg);
+		handle_rewind_input(&msg);
 
 		struct state *current_state = speaker_states + speaker_state_index;
 		if (current_state->run && current_state->run(&msg, NULL) != ESP_OK)
@@ -31,6 +31,7 @@ enum speaker_state {
 	SPEAKER_STATE_BLUETOOTH,
 	SPEAKER_STATE_CLOCK,
 	SPEAKER_STATE_BT_PAIRING,
+	SPEAKER_STATE_MUSIC,
 	SPEAKER_STATE_NONE,
 	SPEAKER_STATE_MAX,
 };
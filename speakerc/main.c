@@ -32,6 +32,7 @@
 #include <curl/curl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static CURL *curl;
 static char err_buff[CURL_ERROR_SIZE];
@@ -39,6 +40,7 @@ static char *network_interface = NULL;
 static char *network_address   = NULL;
 static int interactive         = 0;
 static char *command           = NULL;
+static char *argument          = NULL;
 
 static int init(void) {
 	CURLcode res;
@@ -83,6 +85,11 @@ static int check_argc(int argc, char **argv, int i) {
 
 static void help(void) {
 	printf("Usage: speakerc [options...] <command>\n");
+	printf("       speakerc [options...] search <words>\n");
+	printf("       speakerc [options...] tune <channel>\n");
+	printf("       speakerc [options...] rewind <seconds>\n");
+	printf("       speakerc [options...] radio\n");
+	printf("       speakerc [options...] title\n");
 	printf("  -h Show help\n");
 	printf("  -n Specify network interface\n");
 	printf("  -a Specify speaker address\n");
@@ -113,6 +120,7 @@ int main(int argc, char **argv) {
 			continue;
 		}
 		if (!command) command = argv[i];
+		else if (!argument) argument = argv[i];
 	}
 
 	if (init()) return EXIT_FAILURE;
@@ -130,11 +138,35 @@ int main(int argc, char **argv) {
 		return EXIT_FAILURE;
 	}
 
-	char *url = NULL;
-	int url_size =
-	    snprintf(url, 0, "http://%s/cmd/%s", network_address, command) + 1;
-	url = malloc(url_size);
-	snprintf(url, url_size, "http://%s/cmd/%s", network_address, command);
+	/* Searches, tunes and rewinds take an argument, the others do not */
+	const char *format = "http://%s/cmd/%s";
+	char *escaped      = NULL;
+	if (strcmp(command, "radio") == 0 || strcmp(command, "title") == 0) {
+		/* The counters or the song title of the stream that plays */
+		format = "http://%s/%s";
+	} else if (strcmp(command, "search") == 0 || strcmp(command, "tune") == 0 ||
+	           strcmp(command, "rewind") == 0) {
+		if (!argument) {
+			fprintf(stderr, "missing argument for command: %s\n", command);
+			help();
+			return EXIT_FAILURE;
+		}
+		escaped = curl_easy_escape(curl, argument, 0);
+		if (!escaped) {
+			fprintf(stderr, "curl_easy_escape error\n");
+			return EXIT_FAILURE;
+		}
+		if (*command == 's') format = "http://%s/stations?q=%s";
+		else if (*command == 't') format = "http://%s/tune/%s";
+		else format = "http://%s/rewind/%s";
+		command = escaped;
+	}
+
+	char *url    = NULL;
+	int url_size = snprintf(url, 0, format, network_address, command) + 1;
+	url          = malloc(url_size);
+	snprintf(url, url_size, format, network_address, command);
+	curl_free(escaped);
 
 	res = curl_easy_setopt(curl, CURLOPT_URL, url);
 	if (res != CURLE_OK) {
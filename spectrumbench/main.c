@@ -0,0 +1,343 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks the fixed-point FFT and the spectrum analyser of the firmware on the
+ * host. For every size from 256 to 1024 the power of the bins must match a
+ * double precision DFT of the same windowed samples, and the bands must show
+ * a sine at its level in the band it falls in. After the sine stops, the
+ * levels must fall by the decay per frame and the peaks must be held first.
+ *
+ * The time the analyser takes for 40 frames per second is scaled by how much
+ * slower the ESP32 is than the host, which must leave it below 5% of one core.
+ */
+
+#include "fft_real.h"
+#include "spectrum_analyser.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLE_RATE 8000
+#define NR_BANDS    16
+#define MIN_FREQ    60
+#define MAX_FREQ    (SAMPLE_RATE / 2)
+#define FRAME_RATE  40
+
+static int trials    = 20;
+static int max_error = -70;
+static int decay_db  = 3;
+static int hold      = 4;
+static int slowdown  = 30;
+static int seconds   = 60;
+
+static const int sizes[] = { 256, 512, 1024 };
+
+static uint32_t seed = 1;
+
+static int64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t random_next(void) {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static double random_unit(void) {
+	return random_next() / (double)(1 << 24);
+}
+
+static int16_t clip(double x) {
+	return (int16_t)(x > 32767 ? 32767 : x < -32768 ? -32768 : x);
+}
+
+/* A sine of amplitude level with a random phase */
+static void make_sine(int16_t *samples, int size, double freq, double level) {
+	double phase = 2 * M_PI * random_unit();
+	for (int n = 0; n < size; n++)
+		samples[n] =
+		    clip(level * sin(2 * M_PI * freq * n / SAMPLE_RATE + phase));
+}
+
+/* Two tones in noise, near full scale */
+static void make_mix(int16_t *samples, int size) {
+	double f1 = SAMPLE_RATE / 2 * random_unit();
+	double f2 = SAMPLE_RATE / 2 * random_unit();
+	for (int n = 0; n < size; n++)
+		samples[n] = clip(16000 * sin(2 * M_PI * f1 * n / SAMPLE_RATE) +
+		                  8000 * sin(2 * M_PI * f2 * n / SAMPLE_RATE) +
+		                  8000 * (random_unit() - 0.5));
+}
+
+/*
+ * Largest error of the magnitudes of the bins against a DFT in double
+ * precision of the same windowed samples, in dB of a full scale sine
+ */
+static int run_accuracy(int size) {
+	fft_real_t fft;
+	if (fft_real_setup(&fft, size) != ESP_OK) return 1;
+
+	int16_t *samples = malloc(sizeof *samples * size);
+	int16_t *window  = malloc(sizeof *window * size);
+	float *power     = malloc(sizeof *power * (size / 2 + 1));
+	if (!samples || !window || !power) return 1;
+	for (int n = 0; n < size; n++)
+		window[n] = (int16_t)lrint(32767.0 * 0.5 *
+		                           (1.0 - cos(2 * M_PI * n / size)));
+
+	double full_scale = size / 2.0 * 32767.0;
+	double worst      = 0.0;
+	for (int t = 0; t < 2 * trials; t++) {
+		const int16_t *w = t % 2 ? window : NULL;
+		make_mix(samples, size);
+		fft_real_power(&fft, samples, w, power);
+
+		for (int k = 0; k <= size / 2; k++) {
+			double re = 0.0;
+			double im = 0.0;
+			for (int n = 0; n < size; n++) {
+				// The window as the FFT applies it, rounded to an integer
+				double x = w ? (double)((samples[n] * w[n] + (1 << 14)) >> 15)
+				             : samples[n];
+				re += x * cos(2 * M_PI * k * n / size);
+				im -= x * sin(2 * M_PI * k * n / size);
+			}
+			double error = fabs(sqrt(power[k]) - sqrt(re * re + im * im));
+			if (error > worst) worst = error;
+		}
+	}
+	double error_db = 20 * log10(worst / full_scale + 1e-12);
+
+	bool ok = error_db <= max_error;
+	printf("fft %d: %s, largest error %.1f dB of full scale\n", size,
+	       ok ? "ok" : "FAILED", error_db);
+	free(samples);
+	free(window);
+	free(power);
+	fft_real_free(&fft);
+	return !ok;
+}
+
+static bool analyser_setup(spectrum_analyser_t *analyser, int size) {
+	spectrum_analyser_cfg_t cfg = {
+		.sample_rate = SAMPLE_RATE,
+		.fft_size    = size,
+		.nr_bands    = NR_BANDS,
+		.min_freq    = MIN_FREQ,
+		.max_freq    = MAX_FREQ,
+		.decay_db    = decay_db,
+		.hold_frames = hold,
+	};
+	return spectrum_analyser_setup(analyser, &cfg) == ESP_OK;
+}
+
+/* Centre of a band on the log scale [Hz] */
+static double band_centre(int b) {
+	return MIN_FREQ * pow((double)MAX_FREQ / MIN_FREQ, (b + 0.5) / NR_BANDS);
+}
+
+/*
+ * A sine in the centre of every band at full scale and 40 dB below, the band
+ * must show it within 1 dB and the bands two away at least 30 dB lower. The
+ * lowest bands are narrower than a bin at the smaller sizes and are skipped.
+ */
+static int run_bands(int size) {
+	spectrum_analyser_t analyser;
+	int16_t *samples = malloc(sizeof *samples * size);
+	if (!samples || !analyser_setup(&analyser, size)) return 1;
+
+	double bin   = (double)SAMPLE_RATE / size;
+	int checked  = 0;
+	double error = 0.0;        // Largest level error of the band of the sine
+	double leak  = -INFINITY; // Loudest band two away, relative to the sine
+	for (int b = 0; b < NR_BANDS; b++) {
+		double low  = MIN_FREQ * pow((double)MAX_FREQ / MIN_FREQ,
+		                             (double)b / NR_BANDS);
+		double high = MIN_FREQ * pow((double)MAX_FREQ / MIN_FREQ,
+		                             (double)(b + 1) / NR_BANDS);
+		if (high - low < 4 * bin) continue;
+		checked++;
+
+		for (int l = 0; l < 2; l++) {
+			double level = l ? 327.67 : 32767.0;
+			make_sine(samples, size, band_centre(b), level);
+			spectrum_analyser_free(&analyser);
+			analyser_setup(&analyser, size);
+			spectrum_analyser_process(&analyser, samples);
+
+			double expect = -SPECTRUM_FLOOR_DB - (l ? 40 : 0);
+			if (fabs(analyser.level[b] - expect) > error)
+				error = fabs(analyser.level[b] - expect);
+			for (int o = 0; o < NR_BANDS; o++)
+				if (abs(o - b) >= 2 && analyser.level[o] - expect > leak)
+					leak = analyser.level[o] - expect;
+		}
+	}
+
+	bool ok = error <= 1.0 && leak <= -30.0;
+	printf("bands %d: %s, %d of %d bands checked, levels within %.2f dB, "
+	       "leakage %.1f dB\n",
+	       size, ok ? "ok" : "FAILED", checked, NR_BANDS, error, leak);
+	free(samples);
+	spectrum_analyser_free(&analyser);
+	return !ok;
+}
+
+/*
+ * A full scale sine for a frame, then silence: the level falls by decay_db
+ * every frame, the peak stays for hold frames and falls after that. The
+ * silence is either analysed or skipped like a frame below the energy gate.
+ */
+static int run_decay(bool skipped) {
+	const int size = 256;
+	spectrum_analyser_t analyser;
+	int16_t *samples = malloc(sizeof *samples * size);
+	if (!samples || !analyser_setup(&analyser, size)) return 1;
+
+	int b = NR_BANDS / 2;
+	make_sine(samples, size, band_centre(b), 32767.0);
+	spectrum_analyser_process(&analyser, samples);
+	float top = analyser.level[b];
+
+	memset(samples, 0, sizeof *samples * size);
+	bool ok = true;
+	for (int f = 1; f <= hold + 5; f++) {
+		if (skipped) spectrum_analyser_decay(&analyser);
+		else spectrum_analyser_process(&analyser, samples);
+		float level = top - f * decay_db;
+		float peak  = f <= hold ? top : top - (f - hold) * decay_db;
+		if (level < 0) level = 0;
+		if (fabsf(analyser.level[b] - level) > 0.01f ||
+		    fabsf(analyser.peak[b] - peak) > 0.01f)
+			ok = false;
+	}
+
+	printf("decay %s: %s, level fell from %.1f to %.1f dB and the peak to "
+	       "%.1f dB in %d frames\n",
+	       skipped ? "skipped" : "silence", ok ? "ok" : "FAILED", top,
+	       analyser.level[b], analyser.peak[b], hold + 5);
+	free(samples);
+	spectrum_analyser_free(&analyser);
+	return !ok;
+}
+
+/* Share of one core the analyser takes on the ESP32 at 40 frames per second */
+static int run_load(int size) {
+	spectrum_analyser_t analyser;
+	int16_t *samples = malloc(sizeof *samples * size);
+	if (!samples || !analyser_setup(&analyser, size)) return 1;
+	make_mix(samples, size);
+
+	int frames    = seconds * FRAME_RATE;
+	int64_t start = now_us();
+	for (int f = 0; f < frames; f++)
+		spectrum_analyser_process(&analyser, samples);
+	double us   = (now_us() - start) / (double)frames;
+	double load = us * FRAME_RATE / 1e6;
+
+	// Only an optimised build runs like the firmware
+#ifdef NDEBUG
+	const char *result = load * slowdown < 0.05 ? "ok" : "FAILED";
+#else
+	const char *result = "not checked in a debug build";
+#endif
+	printf("load %d: %s, %.1f us per frame, %.0f frames per second, %.2f%% "
+	       "at %d per second on an ESP32 %dx as slow\n",
+	       size, result, us, 1e6 / us, load * slowdown * 100, FRAME_RATE,
+	       slowdown);
+	free(samples);
+	spectrum_analyser_free(&analyser);
+	return !strcmp(result, "FAILED");
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: spectrumbench [options...]\n");
+	printf("  Checks the FFT and the spectrum analyser of the firmware\n");
+	printf("  -h Show help\n");
+	printf("  -t Specify frames per size for the accuracy (default 20)\n");
+	printf("  -e Specify largest error in dB of full scale (default -70)\n");
+	printf("  -d Specify decay per frame in dB (default 3)\n");
+	printf("  -p Specify frames a peak is held (default 4)\n");
+	printf("  -x Specify times the ESP32 is slower than the host (default "
+	       "30)\n");
+	printf("  -s Specify seconds of frames for the load (default 60)\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		int *value = NULL;
+		switch (argv[i][0] == '-' ? argv[i][1] : 0) {
+			case 't': value = &trials; break;
+			case 'e': value = &max_error; break;
+			case 'd': value = &decay_db; break;
+			case 'p': value = &hold; break;
+			case 'x': value = &slowdown; break;
+			case 's': value = &seconds; break;
+			case 'h': help(); return EXIT_SUCCESS;
+			default:
+				fprintf(stderr, "Unknown option: %s\n", argv[i]);
+				return EXIT_FAILURE;
+		}
+		if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+		*value = atoi(argv[++i]);
+	}
+	if (trials < 1) trials = 1;
+	if (decay_db < 1) decay_db = 1;
+	if (hold < 0) hold = 0;
+	if (slowdown < 1) slowdown = 1;
+	if (seconds < 1) seconds = 1;
+
+	int failed = 0;
+	for (size_t s = 0; s < sizeof sizes / sizeof *sizes; s++) {
+		failed |= run_accuracy(sizes[s]);
+		failed |= run_bands(sizes[s]);
+	}
+	failed |= run_decay(false);
+	failed |= run_decay(true);
+	for (size_t s = 0; s < sizeof sizes / sizeof *sizes; s++)
+		failed |= run_load(sizes[s]);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
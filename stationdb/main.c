@@ -0,0 +1,269 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Loads a station list the way the radio does and measures the search on it.
+ * Without a list it generates one, tab separated like the list on the SD
+ * card, and streams it from a temporary file so the loader is measured as
+ * well. Each search is a prefix of one to four characters of the words of a
+ * random station, against a scan of all names for comparison.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "station_db.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int generate    = 10000;
+static int rounds      = 10000;
+static int max_results = 20;
+static char *query     = NULL;
+static char *path      = NULL;
+
+static const char *words[] = {
+	"radio",  "fm",     "classic", "rock",   "jazz",   "news",  "hits",
+	"dance",  "country", "talk",   "gold",   "smooth", "chill", "lounge",
+	"metal",  "indie",  "sport",   "kids",   "retro",  "disco", "soul",
+	"blues",  "reggae", "latin",   "techno", "house",  "folk",  "opera",
+	"öffentlich", "música", "répertoire", "nieuws",
+};
+
+static const char *places[] = {
+	"Amsterdam", "Berlin", "Paris",  "London", "Madrid",  "Rome",
+	"Vienna",    "Prague", "Warsaw", "Oslo",   "Helsinki", "Lisbon",
+	"Dublin",    "Athens", "Sofia",  "Zagreb", "Riga",     "Tallinn",
+};
+
+#define NR_WORDS  (sizeof words / sizeof *words)
+#define NR_PLACES (sizeof places / sizeof *places)
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void print_times(const char *what, double *us, int count) {
+	qsort(us, count, sizeof *us, compare_doubles);
+	printf("%s: median %.2f us, 99%% %.2f us, max %.2f us\n", what,
+	       us[count / 2], us[count * 99 / 100], us[count - 1]);
+}
+
+/* A list like the curated ones, names of two to four words and a place */
+static FILE *make_list(void) {
+	FILE *f = tmpfile();
+	if (!f) return NULL;
+	fprintf(f, "#EXTM3U\n");
+	for (int s = 0; s < generate; s++) {
+		int nr_words = 2 + rand() % 3;
+		if (s % 10 == 0) fprintf(f, "#EXTINF:-1,");
+		for (int w = 0; w < nr_words; w++)
+			fprintf(f, "%s%s", w ? " " : "", words[rand() % NR_WORDS]);
+		fprintf(f, " %s", places[rand() % NR_PLACES]);
+		if (s % 7 == 0) fprintf(f, " %d", 80 + rand() % 30);
+		// Every tenth station as extended M3U, the others tab separated
+		if (s % 10 == 0) fprintf(f, "\nhttp://stream%d.example.org/live\n", s);
+		else fprintf(f, "\thttp://stream%d.example.org/live\n", s);
+	}
+	rewind(f);
+	return f;
+}
+
+/* What a search without the index costs, every name is read */
+static int scan(const struct station_db *db, const char *prefix,
+                uint32_t *results, int max) {
+	size_t length = strlen(prefix);
+	int count     = 0;
+	for (uint32_t s = 0; s < db->nr_stations && count < max; s++) {
+		const char *name = station_db_name(db, s);
+		for (size_t i = 0; name[i]; i++) {
+			unsigned char before = i > 0 ? name[i - 1] : ' ';
+			if (isalnum(before) || before >= 0x80) continue;
+			size_t c = 0;
+			while (c < length &&
+			       tolower((unsigned char)name[i + c]) == prefix[c])
+				c++;
+			if (c == length) {
+				results[count++] = s;
+				break;
+			}
+		}
+	}
+	return count;
+}
+
+/* A prefix of a word of a station, lowercase */
+static void random_prefix(const struct station_db *db, char *prefix) {
+	const char *name = station_db_name(db, rand() % db->nr_stations);
+	size_t length    = 1 + rand() % 4;
+	size_t start     = 0;
+	for (int skip = rand() % 3; skip > 0; skip--) {
+		const char *space = strchr(name + start, ' ');
+		if (!space) break;
+		start = space + 1 - name;
+	}
+	size_t i = 0;
+	for (; i < length && isalnum((unsigned char)name[start + i]); i++)
+		prefix[i] = tolower((unsigned char)name[start + i]);
+	if (!i) prefix[i++] = 'r';
+	prefix[i] = '\0';
+}
+
+static int run(FILE *f) {
+	struct station_db db;
+	double start = now_us();
+	if (!station_db_begin(&db) || !station_db_add_file(&db, f) ||
+	    !station_db_finish(&db)) {
+		fprintf(stderr, "cannot load the stations\n");
+		station_db_free(&db);
+		return 1;
+	}
+	double load_us = now_us() - start;
+	printf("loaded %u stations, %u words in %.1f ms, %u lines skipped\n",
+	       db.nr_stations, db.nr_words, load_us / 1e3, db.skipped);
+	printf("memory: %zu bytes, %.1f per station, of which strings %u\n",
+	       station_db_memory(&db),
+	       db.nr_stations ? (double)station_db_memory(&db) / db.nr_stations
+	                      : 0.0,
+	       db.strings_size);
+
+	uint32_t *results = malloc(max_results * sizeof *results);
+	uint32_t *scanned = malloc(max_results * sizeof *scanned);
+	double *indexed   = malloc(rounds * sizeof *indexed);
+	double *linear    = malloc(rounds * sizeof *linear);
+	int failed        = !results || !scanned || !indexed || !linear;
+
+	if (!failed && query) {
+		int found = station_db_search(&db, query, results, max_results);
+		printf("\"%s\": %d stations\n", query, found);
+		for (int i = 0; i < found; i++)
+			printf("  %u %s\t%s\n", results[i],
+			       station_db_name(&db, results[i]),
+			       station_db_url(&db, results[i]));
+	} else if (!failed && db.nr_stations) {
+		long total = 0;
+		for (int r = 0; r < rounds; r++) {
+			char prefix[8];
+			random_prefix(&db, prefix);
+			start      = now_us();
+			int found  = station_db_search(&db, prefix, results, max_results);
+			indexed[r] = now_us() - start;
+			start      = now_us();
+			int count  = scan(&db, prefix, scanned, max_results);
+			linear[r]  = now_us() - start;
+			total     += found;
+			// The index lists stations in the order of their words
+			if (found != count) {
+				fprintf(stderr, "\"%s\": index %d, scan %d stations\n",
+				        prefix, found, count);
+				failed = 1;
+			}
+		}
+		printf("%d searches for up to %d stations, %.1f found on average\n",
+		       rounds, max_results, (double)total / rounds);
+		print_times("index", indexed, rounds);
+		print_times("scan", linear, rounds);
+	}
+
+	free(results);
+	free(scanned);
+	free(indexed);
+	free(linear);
+	station_db_free(&db);
+	return failed;
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: stationdb [options...] [station list]\n");
+	printf("  Loads a station list, \"name<TAB>url\" lines or extended M3U,\n");
+	printf("  and measures the search, on a generated list without one,\n");
+	printf("  e.g. stationdb -q \"jazz par\" stations.tsv\n");
+	printf("  -h Show help\n");
+	printf("  -g Specify stations to generate (default 10000)\n");
+	printf("  -n Specify searches (default 10000)\n");
+	printf("  -m Specify results of a search (default 20)\n");
+	printf("  -q Specify a search to run and print\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		if (*argv[i] == '-') {
+			int *value = NULL;
+			switch (argv[i][1]) {
+				case 'g': value = &generate; break;
+				case 'n': value = &rounds; break;
+				case 'm': value = &max_results; break;
+				case 'q':
+					if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+					query = argv[++i];
+					break;
+				case 'h': help(); return EXIT_SUCCESS;
+			}
+			if (value) {
+				if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+				*value = atoi(argv[++i]);
+			}
+			continue;
+		}
+		if (!path) path = argv[i];
+	}
+	if (generate < 1) generate = 1;
+	if (rounds < 1) rounds = 1;
+	if (max_results < 1) max_results = 1;
+
+	FILE *f = path ? fopen(path, "r") : make_list();
+	if (!f) {
+		fprintf(stderr, "cannot open %s\n", path ? path : "a temporary file");
+		return EXIT_FAILURE;
+	}
+	int failed = run(f);
+	fclose(f);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,365 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runs the audio tee of the firmware between stub elements: a source, and a
+ * sink that takes the blocks at the pace of playback. A fast and a slow
+ * consumer subscribe to it. Playback must get every byte in order, every
+ * block a consumer gets must hold the audio of its sequence number until it is
+ * released, and the slow consumer may only make itself drop blocks, not the
+ * fast one. Then taps follow the playback while it switches between two tees
+ * that play at the same time, like the states of the speaker do.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "audio_tee.h"
+#include "audio_tee_tap.h"
+#include "esp_timer.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int block_size = 2048;
+static int nr_blocks  = 8;
+static int nr_played  = 4000;
+static int period_us  = 1000;
+static int fast_us    = 50;
+static int slow_us    = 10000;
+static int switches   = 200;
+
+/* A tee with its stub source and playback sink, run by a thread */
+struct player {
+	audio_element_handle_t tee;
+	int seed;
+	int64_t read;      // Bytes the source gave
+	int64_t played;    // Bytes playback got
+	int64_t blocks;    // Up to nr_played, 0 to play until stopped
+	bool wrong;        // Playback got other bytes
+	volatile bool stop;
+	int64_t max_us;    // Longest process of the tee, playback excluded
+	int64_t output_us; // Playback of the process that is running
+};
+
+struct consumer {
+	const char *name;
+	int work_us;
+	audio_tee_consumer_handle_t handle;
+	audio_tee_tap_handle_t tap;
+	struct player *players[2];
+	volatile bool stop;
+	uint32_t blocks;
+	uint32_t wrong;     // Blocks that did not hold their audio
+	uint32_t unordered; // Blocks that came before an earlier one
+};
+
+static void sleep_us(int us) {
+	struct timespec ts = { us / 1000000, (long)(us % 1000000) * 1000 };
+	nanosleep(&ts, NULL);
+}
+
+static uint8_t pattern(int seed, int64_t position) {
+	return (uint8_t)((position >> 8) * 131 + position * 7 + seed * 50);
+}
+
+static bool holds(const char *data, int length, int seed, int64_t position) {
+	for (int i = 0; i < length; i++)
+		if ((uint8_t)data[i] != pattern(seed, position + i)) return false;
+	return true;
+}
+
+static audio_element_err_t source_read(audio_element_handle_t self,
+                                       char *buffer, int length,
+                                       TickType_t ticks_to_wait,
+                                       void *context) {
+	struct player *player = context;
+	(void)self, (void)ticks_to_wait;
+	if (player->blocks && player->read >= player->blocks * block_size)
+		return AEL_IO_DONE;
+	for (int i = 0; i < length; i++)
+		buffer[i] = (char)pattern(player->seed, player->read + i);
+	player->read += length;
+	return length;
+}
+
+/* Playback takes a block per period, like the I2S DMA buffers would */
+static audio_element_err_t sink_write(audio_element_handle_t self,
+                                      char *buffer, int length,
+                                      TickType_t ticks_to_wait,
+                                      void *context) {
+	struct player *player = context;
+	int64_t start         = esp_timer_get_time();
+	(void)self, (void)ticks_to_wait;
+	if (!holds(buffer, length, player->seed, player->played))
+		player->wrong = true;
+	player->played += length;
+	sleep_us(period_us);
+	player->output_us += esp_timer_get_time() - start;
+	return length;
+}
+
+static void *play(void *args) {
+	struct player *player = args;
+	while (!player->stop) {
+		int64_t start     = esp_timer_get_time();
+		player->output_us = 0;
+		audio_element_err_t ret = audio_element_process(player->tee);
+		int64_t us = esp_timer_get_time() - start - player->output_us;
+		if (ret <= 0) break;
+		if (us > player->max_us) player->max_us = us;
+	}
+	return NULL;
+}
+
+static int make_player(struct player *player) {
+	audio_tee_cfg_t cfg = DEFAULT_AUDIO_TEE_CONFIG();
+	cfg.block_size      = block_size;
+	cfg.nr_blocks       = nr_blocks;
+	player->tee         = audio_tee_init(&cfg);
+	if (!player->tee) return 0;
+	audio_element_set_read_cb(player->tee, source_read, player);
+	audio_element_set_write_cb(player->tee, sink_write, player);
+	return 1;
+}
+
+/*
+ * Check a block now and after the work on it, before it is released. The
+ * blocks of a tee come in order, last is the sequence of the one before, -1
+ * for none.
+ */
+static void consume(struct consumer *consumer, audio_tee_block_t *block,
+                    int seed, int64_t *last) {
+	int64_t position = (int64_t)block->sequence * block_size;
+	bool ok          = holds(block->data, block->length, seed, position);
+	sleep_us(consumer->work_us);
+	ok = ok && holds(block->data, block->length, seed, position);
+	consumer->wrong     += !ok;
+	consumer->unordered += (int64_t)block->sequence <= *last;
+	*last                = block->sequence;
+	consumer->blocks++;
+}
+
+static void *subscriber(void *args) {
+	struct consumer *consumer = args;
+	int64_t last              = -1;
+	while (!consumer->stop) {
+		audio_tee_block_t *block =
+		    audio_tee_receive(consumer->handle, pdMS_TO_TICKS(50));
+		if (!block) continue;
+		consume(consumer, block, consumer->players[0]->seed, &last);
+		audio_tee_release(consumer->handle, block);
+	}
+	return NULL;
+}
+
+/* The seed of a block is that of the player whose tee it came from */
+static void *tap_reader(void *args) {
+	struct consumer *consumer = args;
+	int64_t last[2]           = { -1, -1 };
+	while (!consumer->stop) {
+		audio_tee_block_t *block =
+		    audio_tee_tap_receive(consumer->tap, pdMS_TO_TICKS(50));
+		if (!block) continue;
+		int64_t position = (int64_t)block->sequence * block_size;
+		int p = holds(block->data, 1, consumer->players[0]->seed, position)
+		            ? 0
+		            : 1;
+		consume(consumer, block, consumer->players[p]->seed, &last[p]);
+		audio_tee_tap_release(consumer->tap, block);
+	}
+	return NULL;
+}
+
+static void report(const struct consumer *consumer,
+                   const struct audio_tee_consumer_stats *stats) {
+	printf("  %s: %u blocks", consumer->name, (unsigned)consumer->blocks);
+	if (stats)
+		printf(", %u dropped, most waiting %u", (unsigned)stats->dropped,
+		       (unsigned)stats->max_lag);
+	printf(", %u wrong, %u out of order\n", (unsigned)consumer->wrong,
+	       (unsigned)consumer->unordered);
+}
+
+/* A fast and a slow consumer of one tee */
+static int run_consumers(void) {
+	struct player player = { .seed = 1, .blocks = nr_played };
+	struct consumer fast = { .name = "fast consumer", .work_us = fast_us };
+	struct consumer slow = { .name = "slow consumer", .work_us = slow_us };
+	struct consumer *consumers[] = { &fast, &slow };
+	struct audio_tee_consumer_stats stats[2];
+	pthread_t player_thread, threads[2];
+
+	// Every block that plays is published to both, their queues could take
+	// all of the pool
+	if (!make_player(&player)) return 1;
+	for (int c = 0; c < 2; c++) {
+		consumers[c]->players[0] = &player;
+		consumers[c]->handle = audio_tee_subscribe(player.tee, nr_blocks);
+		pthread_create(&threads[c], NULL, subscriber, consumers[c]);
+	}
+	pthread_create(&player_thread, NULL, play, &player);
+	pthread_join(player_thread, NULL);
+	sleep_us(slow_us + 100000);
+	for (int c = 0; c < 2; c++) {
+		consumers[c]->stop = true;
+		pthread_join(threads[c], NULL);
+		audio_tee_get_stats(consumers[c]->handle, &stats[c]);
+		audio_tee_unsubscribe(consumers[c]->handle);
+	}
+	audio_element_deinit(player.tee);
+
+	int64_t published = player.played / block_size;
+	bool ok           = !player.wrong && published == nr_played;
+	printf("tee: %s, %lld blocks played, longest process without playback "
+	       "%lld us\n",
+	       ok ? "ok" : "FAILED", (long long)published,
+	       (long long)player.max_us);
+	int failed = !ok;
+	for (int c = 0; c < 2; c++) {
+		report(consumers[c], &stats[c]);
+		failed |= consumers[c]->wrong || consumers[c]->unordered ||
+		          stats[c].received != consumers[c]->blocks ||
+		          stats[c].received + stats[c].dropped != published;
+	}
+	// The slow consumer holds its share of the pool at most, the fast one
+	// only drops when the host does not run it for a few periods
+	bool shared = fast.blocks * 100 >= published * 99 && slow.blocks > 0;
+	printf("  share of the pool: %s\n", shared ? "ok" : "FAILED");
+	return failed || !shared;
+}
+
+/* Taps follow the playback while it switches between two tees */
+static int run_taps(void) {
+	struct player players[2] = { { .seed = 2 }, { .seed = 3 } };
+	struct consumer fast = { .name = "fast tap", .work_us = fast_us };
+	struct consumer slow = { .name = "slow tap", .work_us = slow_us };
+	struct consumer *consumers[] = { &fast, &slow };
+	pthread_t player_threads[2], threads[2];
+	int64_t max_switch_us = 0;
+	int started           = 0;
+
+	while (started < 2 && make_player(&players[started]) &&
+	       !pthread_create(&player_threads[started], NULL, play,
+	                       &players[started]))
+		started++;
+	for (int c = 0; c < 2 && started == 2; c++) {
+		consumers[c]->players[0] = &players[0];
+		consumers[c]->players[1] = &players[1];
+		consumers[c]->tap        = audio_tee_tap_create(nr_blocks);
+		pthread_create(&threads[c], NULL, tap_reader, consumers[c]);
+	}
+	for (int s = 0; s < switches && started == 2; s++) {
+		// Now and then nothing plays, like between two states
+		audio_element_handle_t tee = s % 5 == 4 ? NULL : players[s % 2].tee;
+		int64_t start              = esp_timer_get_time();
+		audio_tee_set_playback(tee);
+		int64_t us = esp_timer_get_time() - start;
+		if (us > max_switch_us) max_switch_us = us;
+		sleep_us(period_us * 10);
+	}
+	audio_tee_set_playback(NULL);
+
+	int failed = started < 2;
+	for (int p = 0; p < started; p++) {
+		players[p].stop = true;
+		pthread_join(player_threads[p], NULL);
+		audio_element_deinit(players[p].tee);
+		failed |= players[p].wrong;
+	}
+	for (int c = 0; c < 2 && started == 2; c++) {
+		consumers[c]->stop = true;
+		pthread_join(threads[c], NULL);
+		audio_tee_tap_destroy(consumers[c]->tap);
+		failed |= consumers[c]->wrong || consumers[c]->unordered ||
+		          !consumers[c]->blocks;
+	}
+	printf("taps: %s, %d switches, longest switch %lld us\n",
+	       failed ? "FAILED" : "ok", switches, (long long)max_switch_us);
+	for (int c = 0; c < 2 && started == 2; c++) report(consumers[c], NULL);
+	return failed;
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: teebench [options...]\n");
+	printf("  Runs the audio tee and its taps between stub elements with a\n");
+	printf("  fast and a slow consumer\n");
+	printf("  -h Show help\n");
+	printf("  -b Specify block size (default 2048)\n");
+	printf("  -n Specify blocks in the pool (default 8)\n");
+	printf("  -c Specify blocks to play (default 4000)\n");
+	printf("  -p Specify period of playback per block in us (default 1000)\n");
+	printf("  -f Specify work of the fast consumer in us (default 50)\n");
+	printf("  -s Specify work of the slow consumer in us (default 10000)\n");
+	printf("  -w Specify switches of the playback (default 200)\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		int *value = NULL;
+		switch (argv[i][0] == '-' ? argv[i][1] : 0) {
+			case 'b': value = &block_size; break;
+			case 'n': value = &nr_blocks; break;
+			case 'c': value = &nr_played; break;
+			case 'p': value = &period_us; break;
+			case 'f': value = &fast_us; break;
+			case 's': value = &slow_us; break;
+			case 'w': value = &switches; break;
+			case 'h': help(); return EXIT_SUCCESS;
+			default:
+				fprintf(stderr, "Unknown option: %s\n", argv[i]);
+				return EXIT_FAILURE;
+		}
+		if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+		*value = atoi(argv[++i]);
+	}
+	if (block_size < 1) block_size = 1;
+	if (nr_blocks < 3) nr_blocks = 3;
+	if (nr_played < 1) nr_played = 1;
+	if (period_us < 0) period_us = 0;
+	if (fast_us < 0) fast_us = 0;
+	if (slow_us < 0) slow_us = 0;
+
+	int failed = run_consumers();
+	failed    |= run_taps();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,654 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024 Meindert Kempe
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks the timeshift recording of the radio, the ring file and the index of
+ * its frames, on a generated MP3 and AAC stream with a few bytes of garbage
+ * between the frames every 100 seconds, like a stream that connected again.
+ *
+ * The stream is recorded in pieces of random size to a file of a few blocks,
+ * so it goes round many times, and the blocks are written late now and then,
+ * so the recording has to wait for them. Every byte that is read back at a
+ * random position must be the byte of the stream, or be reported lost once
+ * the file went over it. Each second of the index must point at the first
+ * frame that starts in it.
+ *
+ * A listener then plays the stream as it arrives, pauses, goes back and
+ * forward and catches up again, like the buttons of the radio do. What it
+ * plays must be the stream from a frame on, and how far it is behind must be
+ * what it paused and went back, up to what the file holds.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "radio_ring.h"
+#include "radio_timeshift.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Seconds of audio between the breaks in the generated stream */
+#define BREAK_SECONDS 100
+/* Garbage in each break */
+#define BREAK_BYTES   100
+/* The listener's clock */
+#define TICK_MS       100
+
+static int stream_s   = 600;
+static int nr_blocks  = 64;
+static int mp3_kbps   = 128;
+static int aac_kbps   = 64;
+static int chunk_size = 1460;
+static int nr_reads   = 20000;
+static int rounds     = 5;
+static int bounce     = 8192;
+static const char *path;
+
+/* A generated stream and where its frames start */
+struct stream {
+	enum radio_codec codec;
+	const char *name;
+	int kbps;
+	uint8_t *data;
+	size_t size;
+	uint64_t *frames;
+	uint64_t *frame_us; /* Audio before the frame, as the radio counts it */
+	size_t nr_frames;
+	uint32_t breaks;
+};
+
+/* The recording with its file open for writing and for reading */
+struct recorder {
+	struct radio_timeshift shift;
+	struct radio_timeshift_reader reader;
+	FILE *write;
+	FILE *read;
+	void *ram;
+	void *block;
+	void *bounce[2]; /* Of the writes and the reads, like the SD card needs */
+	uint64_t *index;
+	uint64_t writes;
+	uint32_t out_of_order; /* Writes that did not follow the last one */
+};
+
+/* A step of the listener at a second of the stream */
+struct step {
+	int at;
+	const char *what;
+	int seconds;
+};
+
+static const struct step steps[] = {
+	{ 60, "pause", 90 },  { 180, "rewind", 45 }, { 200, "forward", 20 },
+	{ 230, "live", 0 },   { 250, "pause", 30 },  { 300, "forward", 60 },
+	{ 320, "rewind", 20 }, { 340, "pause", 250 },
+};
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint32_t next_random(uint32_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static void free_stream(struct stream *stream) {
+	free(stream->data);
+	free(stream->frames);
+	free(stream->frame_us);
+}
+
+/* Header of frame f of 44100 Hz at the bitrate of the stream */
+static size_t make_header(const struct stream *stream, size_t f,
+                          uint8_t *frame) {
+	static const int bitrates[] = { 32,  40,  48,  56,  64,  80,  96,
+		                            112, 128, 160, 192, 224, 256, 320 };
+	if (stream->codec == RADIO_CODEC_MP3) {
+		int index = 0;
+		for (int b = 0; b < 14; ++b)
+			if (bitrates[b] == stream->kbps) index = b + 1;
+		double size   = 144.0 * stream->kbps * 1000 / 44100;
+		size_t length = (size_t)((f + 1) * size) - (size_t)(f * size);
+		frame[0]      = 0xff;
+		frame[1]      = 0xfb; /* MPEG-1 Layer III without CRC */
+		frame[2]      = (uint8_t)(index << 4 | (length > (size_t)size) << 1);
+		frame[3]      = 0x44;
+		return length;
+	}
+	double size    = stream->kbps * 1000 / 8.0 * 1024 / 44100;
+	size_t length  = (size_t)((f + 1) * size) - (size_t)(f * size);
+	frame[0]       = 0xff;
+	frame[1]       = 0xf1; /* MPEG-4 without CRC */
+	frame[2]       = 0x50; /* AAC-LC, 44100 Hz */
+	frame[3]       = (uint8_t)(0x80 | length >> 11); /* Stereo */
+	frame[4]       = (uint8_t)(length >> 3);
+	frame[5]       = (uint8_t)(length << 5 | 0x1f);
+	frame[6]       = 0xfc;
+	return length;
+}
+
+/* Frames with random contents for stream_s seconds, with the breaks */
+static int make_stream(struct stream *stream) {
+	size_t max = (size_t)stream_s * 50 + 50;
+	stream->data =
+	    malloc((size_t)stream_s * stream->kbps * 125 + max * 8 +
+	           (stream_s / BREAK_SECONDS + 1) * BREAK_BYTES);
+	stream->frames   = malloc(max * sizeof *stream->frames);
+	stream->frame_us = malloc(max * sizeof *stream->frame_us);
+	if (!stream->data || !stream->frames || !stream->frame_us) return 0;
+
+	uint32_t random = 4321;
+	uint64_t us = 0, next_break = BREAK_SECONDS * 1000000ULL;
+	for (size_t f = 0; us < stream_s * 1000000ULL; f++) {
+		if (us >= next_break) {
+			memset(stream->data + stream->size, 0, BREAK_BYTES);
+			stream->size += BREAK_BYTES;
+			stream->breaks++;
+			next_break += BREAK_SECONDS * 1000000ULL;
+		}
+		uint8_t *frame = stream->data + stream->size;
+		size_t length  = make_header(stream, f, frame);
+		size_t header  = stream->codec == RADIO_CODEC_MP3 ? 4 : 7;
+		if (length < RADIO_FRAME_HEADER ||
+		    (int)length != radio_frame_length(stream->codec, frame)) {
+			fprintf(stderr, "no %s frames at %d kbps\n", stream->name,
+			        stream->kbps);
+			return 0;
+		}
+		for (size_t i = header; i < length; i++)
+			frame[i] = (uint8_t)next_random(&random);
+
+		stream->frames[stream->nr_frames]     = stream->size;
+		stream->frame_us[stream->nr_frames++] = us;
+		us           += radio_frame_us(stream->codec, frame);
+		stream->size += length;
+	}
+	return 1;
+}
+
+/* Index of the frame at position, -1 if no frame starts there */
+static long find_frame(const struct stream *stream, uint64_t position) {
+	size_t first = 0, last = stream->nr_frames;
+	while (first < last) {
+		size_t middle = first + (last - first) / 2;
+		if (stream->frames[middle] < position) first = middle + 1;
+		else last = middle;
+	}
+	if (first < stream->nr_frames && stream->frames[first] == position)
+		return (long)first;
+	return -1;
+}
+
+static void close_recorder(struct recorder *recorder) {
+	if (recorder->write) fclose(recorder->write);
+	if (recorder->read) fclose(recorder->read);
+	free(recorder->ram);
+	free(recorder->block);
+	free(recorder->bounce[0]);
+	free(recorder->bounce[1]);
+	free(recorder->index);
+	memset(recorder, 0, sizeof *recorder);
+}
+
+/*
+ * Open the file twice like the radio does, sized once so the blocks are only
+ * ever written over, with an index of a second per 4000 bytes of file
+ */
+static int open_recorder(struct recorder *recorder, enum radio_codec codec) {
+	long size                 = (long)nr_blocks * RADIO_TIMESHIFT_BLOCK;
+	uint32_t index_size       = (uint32_t)(size / 4000);
+	memset(recorder, 0, sizeof *recorder);
+	recorder->write = fopen(path, "w+b");
+	recorder->read  = fopen(path, "rb");
+	recorder->ram   = malloc(2 * RADIO_TIMESHIFT_BLOCK);
+	recorder->block = malloc(RADIO_TIMESHIFT_BLOCK);
+	recorder->index = malloc(index_size * sizeof *recorder->index);
+	for (int i = 0; i < 2 && bounce; i++)
+		recorder->bounce[i] = malloc((size_t)bounce);
+	if (!recorder->write || !recorder->read || !recorder->ram ||
+	    !recorder->block || !recorder->index ||
+	    (bounce && (!recorder->bounce[0] || !recorder->bounce[1])) ||
+	    fseek(recorder->write, size - 1, SEEK_SET) ||
+	    fputc(0, recorder->write) == EOF || fflush(recorder->write)) {
+		fprintf(stderr, "cannot make %s\n", path);
+		close_recorder(recorder);
+		return 0;
+	}
+	radio_timeshift_init(&recorder->shift, recorder->write, nr_blocks,
+	                     recorder->ram, recorder->index, index_size);
+	radio_timeshift_start(&recorder->shift, codec);
+	radio_timeshift_reader_init(&recorder->reader, recorder->read,
+	                            recorder->block);
+	recorder->shift.bounce       = recorder->bounce[0];
+	recorder->shift.bounce_size  = (size_t)bounce;
+	recorder->reader.bounce      = recorder->bounce[1];
+	recorder->reader.bounce_size = (size_t)bounce;
+	return 1;
+}
+
+/* Write the full blocks, like the task of the radio that writes them */
+static int flush(struct recorder *recorder) {
+	while (radio_timeshift_pending(&recorder->shift)) {
+		uint64_t block = recorder->shift.on_file;
+		if (!radio_timeshift_write(&recorder->shift, block)) {
+			fprintf(stderr, "cannot write %s\n", path);
+			return 0;
+		}
+		if (block != recorder->writes) recorder->out_of_order++;
+		radio_timeshift_written(&recorder->shift);
+		recorder->writes++;
+	}
+	return 1;
+}
+
+/* Record all of data, the blocks are written when the recording waits */
+static int record(struct recorder *recorder, const uint8_t *data,
+                  size_t length, uint32_t *waits) {
+	while (length) {
+		size_t n = radio_timeshift_append(&recorder->shift, data, length);
+		data    += n;
+		length  -= n;
+		if (!length) break;
+		++*waits;
+		if (!flush(recorder)) return 0;
+	}
+	return 1;
+}
+
+/* Read at a random position, it must be the stream or lost */
+static int check_read(struct recorder *recorder,
+                      const struct stream *stream, uint32_t *random,
+                      uint32_t *lost) {
+	const struct radio_timeshift *shift = &recorder->shift;
+	uint8_t out[4096];
+	uint64_t position = next_random(random) % shift->end;
+	size_t length     = 1 + next_random(random) % sizeof out;
+	recorder->reader.position = position;
+	int n = radio_timeshift_read(shift, &recorder->reader, out, length);
+	if (n == RADIO_TIMESHIFT_LOST) {
+		++*lost;
+		return position < radio_timeshift_oldest(shift);
+	}
+	return n > 0 && position >= radio_timeshift_oldest(shift) &&
+	       recorder->reader.position == position + n &&
+	       !memcmp(out, stream->data + position, n);
+}
+
+/* Read from the oldest position to the end, it must be the stream */
+static int check_all(struct recorder *recorder, const struct stream *stream) {
+	uint8_t out[3000];
+	recorder->reader.position = radio_timeshift_oldest(&recorder->shift);
+	for (;;) {
+		uint64_t position = recorder->reader.position;
+		int n = radio_timeshift_read(&recorder->shift, &recorder->reader, out,
+		                             sizeof out);
+		if (n == 0) return position == recorder->shift.end;
+		if (n < 0 || memcmp(out, stream->data + position, n)) return 0;
+	}
+}
+
+/*
+ * Each second of the index is at the first frame that starts in it, the
+ * frames of the stream start at the positions the seconds tell and going back
+ * and forward moves by those seconds
+ */
+static int check_index(const struct recorder *recorder,
+                       const struct stream *stream, uint32_t *random) {
+	const struct radio_timeshift *shift = &recorder->shift;
+	uint32_t first = shift->seconds - radio_timeshift_recorded(shift);
+	if (shift->seconds < (uint32_t)stream_s - 1 || first >= shift->seconds)
+		return 0;
+	for (uint32_t s = first; s < shift->seconds; s++) {
+		long f = find_frame(stream, shift->index[s % shift->index_size]);
+		if (f < 0 || stream->frame_us[f] < s * 1000000ULL ||
+		    (f > 0 && stream->frame_us[f - 1] >= s * 1000000ULL) ||
+		    stream->frames[f] < radio_timeshift_oldest(shift))
+			return 0;
+	}
+
+	for (int r = 0; r < 1000; r++) {
+		uint64_t position = stream->frames[next_random(random) %
+		                                   stream->nr_frames];
+		uint32_t second   = radio_timeshift_second(shift, position);
+		if (position >= shift->index[first % shift->index_size] &&
+		    (shift->index[second % shift->index_size] > position ||
+		     (second + 1 < shift->seconds &&
+		      shift->index[(second + 1) % shift->index_size] <= position)))
+			return 0;
+
+		int seconds = (int)(next_random(random) % 200) - 100;
+		uint64_t frame;
+		int64_t to  = (int64_t)second + seconds;
+		bool found  = radio_timeshift_seek(shift, position, seconds, &frame);
+		if (found != (to < shift->seconds)) return 0;
+		if (to < first) to = first;
+		if (found && frame != shift->index[to % shift->index_size]) return 0;
+	}
+	return 1;
+}
+
+static int run_recording(struct stream *stream) {
+	struct recorder recorder;
+	if (!open_recorder(&recorder, stream->codec)) return 0;
+
+	uint32_t random = 99, waits = 0, lost = 0, reads = 0;
+	int ok          = 1;
+	for (size_t offset = 0; offset < stream->size && ok;) {
+		size_t length = 1 + next_random(&random) % (2 * chunk_size);
+		if (length > stream->size - offset) length = stream->size - offset;
+		ok      = record(&recorder, stream->data + offset, length, &waits);
+		offset += length;
+
+		/* The blocks are written late now and then */
+		if (next_random(&random) % 64 == 0) ok = ok && flush(&recorder);
+		if (reads < (uint32_t)nr_reads) {
+			ok = ok && check_read(&recorder, stream, &random, &lost);
+			reads++;
+		}
+	}
+	ok = ok && flush(&recorder) && check_all(&recorder, stream);
+	bool in_order = ok && !recorder.out_of_order;
+	printf("%s %d kbps: recording %s, %.1f MB in %llu writes of %d KB %s, "
+	       "%.1f times round the file, %u waits for a write\n",
+	       stream->name, stream->kbps, ok ? "ok" : "FAILED",
+	       stream->size / (1024.0 * 1024.0),
+	       (unsigned long long)recorder.writes, RADIO_TIMESHIFT_BLOCK / 1024,
+	       in_order ? "in file order" : "OUT OF ORDER",
+	       (double)recorder.writes / nr_blocks, (unsigned)waits);
+	printf("  %u random reads, %u of them lost as the file went over them\n",
+	       (unsigned)reads, (unsigned)lost);
+
+	bool indexed = check_index(&recorder, stream, &random);
+	bool synced  = recorder.shift.lost == stream->breaks;
+	printf("  index %s, %u seconds of %u recorded, found the frames again "
+	       "after %u of %u breaks\n",
+	       indexed ? "ok" : "FAILED", radio_timeshift_recorded(&recorder.shift),
+	       (unsigned)recorder.shift.seconds, (unsigned)recorder.shift.lost,
+	       (unsigned)stream->breaks);
+	close_recorder(&recorder);
+	return ok && in_order && indexed && synced;
+}
+
+/* Seconds the listener plays behind the newest second */
+static int lag(const struct recorder *recorder) {
+	const struct radio_timeshift *shift = &recorder->shift;
+	return (int)shift->seconds - 1 -
+	       (int)radio_timeshift_second(shift, recorder->reader.position);
+}
+
+/*
+ * Play what was read, it continues the stream from where the listener was,
+ * which is a frame after a jump
+ */
+static int play(struct recorder *recorder, const struct stream *stream,
+                size_t length, uint32_t *lost) {
+	uint8_t out[4096];
+	while (length) {
+		uint64_t position = recorder->reader.position;
+		int n = radio_timeshift_read(&recorder->shift, &recorder->reader, out,
+		                             length < sizeof out ? length : sizeof out);
+		if (n == 0) return 1;
+		if (n == RADIO_TIMESHIFT_LOST) {
+			/* Paused for longer than the file holds, play the oldest */
+			++*lost;
+			uint64_t frame;
+			if (!radio_timeshift_seek(&recorder->shift, 0, 0, &frame))
+				return 0;
+			recorder->reader.position = frame;
+			continue;
+		}
+		if (n < 0 || memcmp(out, stream->data + position, n)) return 0;
+		length -= n;
+	}
+	return 1;
+}
+
+static int run_listener(struct stream *stream) {
+	struct recorder recorder;
+	if (!open_recorder(&recorder, stream->codec)) return 0;
+
+	size_t per_tick = stream->size * TICK_MS / 1000 / stream_s;
+	uint32_t random = 7, waits = 0, lost = 0;
+	size_t arrived = 0, next = 0;
+	int expected = 0, failed = 0, paused_until = 0;
+	bool live = true;
+	for (int tick = 1; tick <= stream_s * 1000 / TICK_MS && !failed; tick++) {
+		/* The stream arrives in pieces, the blocks are written each tick */
+		size_t until = stream->size * tick / (stream_s * 1000 / TICK_MS);
+		while (arrived < until && !failed) {
+			size_t length = 1 + next_random(&random) % (2 * chunk_size);
+			if (length > until - arrived) length = until - arrived;
+			failed   = !record(&recorder, stream->data + arrived, length,
+			                   &waits);
+			arrived += length;
+		}
+		failed = failed || !flush(&recorder);
+
+		int second = tick * TICK_MS / 1000;
+		if (tick * TICK_MS % 1000 == 0 && next < sizeof steps / sizeof *steps &&
+		    steps[next].at == second) {
+			const struct step *step = &steps[next++];
+			uint64_t frame, position = recorder.reader.position;
+			int recorded = (int)radio_timeshift_recorded(&recorder.shift);
+			int before   = lag(&recorder);
+			if (!strcmp(step->what, "pause")) {
+				paused_until = second + step->seconds;
+				expected     = before + step->seconds;
+			} else if (!strcmp(step->what, "live")) {
+				/* A second behind, the jitter buffer of the radio */
+				radio_timeshift_seek(&recorder.shift, recorder.shift.end, -1,
+				                     &frame);
+				recorder.reader.position = frame;
+				expected                 = 1;
+			} else {
+				int seconds = *step->what == 'r' ? -step->seconds
+				                                 : step->seconds;
+				expected    = before - seconds;
+				if (expected > recorded) expected = recorded;
+				if (radio_timeshift_seek(&recorder.shift, position, seconds,
+				                         &frame))
+					recorder.reader.position = frame;
+				else expected = 1;
+				if (expected <= 1) {
+					radio_timeshift_seek(&recorder.shift, recorder.shift.end,
+					                     -1, &recorder.reader.position);
+					expected = 1;
+				}
+			}
+			live = false;
+			if (find_frame(stream, recorder.reader.position) < 0 &&
+			    strcmp(step->what, "pause"))
+				failed = 1;
+			if (!strcmp(step->what, "pause")) continue;
+			int now = lag(&recorder);
+			bool ok = now >= expected - 1 && now <= expected + 1;
+			printf("  %s %d s at %d s: %d s behind, expected %d, %s\n",
+			       step->what, step->seconds, step->at, now, expected,
+			       ok ? "ok" : "FAILED");
+			failed = failed || !ok;
+		}
+
+		if (paused_until && second < paused_until) continue;
+		if (paused_until) {
+			int recorded = (int)radio_timeshift_recorded(&recorder.shift);
+			if (expected > recorded) expected = recorded;
+			int now = lag(&recorder);
+			bool ok = now >= expected - 1 && now <= expected + 1;
+			printf("  pause until %d s: %d s behind, expected %d, %s\n",
+			       paused_until, now, expected, ok ? "ok" : "FAILED");
+			failed       = failed || !ok;
+			paused_until = 0;
+		}
+		/* Live it plays what arrived, else at the pace of the stream */
+		failed = failed || !play(&recorder, stream,
+		                         live ? stream->size : per_tick, &lost);
+	}
+	printf("  listener %s, %u times paused longer than the file holds\n",
+	       failed ? "FAILED" : "ok", (unsigned)lost);
+	close_recorder(&recorder);
+	return !failed;
+}
+
+/* Time the recording against copying the stream into a ring once */
+static void measure(const struct stream *stream) {
+	struct recorder recorder;
+	uint8_t *copy   = malloc(chunk_size);
+	double shift_us = 0, copy_us = 0;
+	size_t sum      = 0;
+	for (int r = 0; r < rounds && copy; r++) {
+		if (!open_recorder(&recorder, stream->codec)) break;
+		/* Without the writes, which are the card's */
+		recorder.shift.blocks = UINT32_MAX;
+		double start          = now_us();
+		for (size_t offset = 0; offset < stream->size; offset += chunk_size) {
+			size_t length = stream->size - offset < (size_t)chunk_size
+			                    ? stream->size - offset
+			                    : (size_t)chunk_size;
+			radio_timeshift_append(&recorder.shift, stream->data + offset,
+			                       length);
+			if (radio_timeshift_pending(&recorder.shift))
+				radio_timeshift_written(&recorder.shift);
+		}
+		shift_us += now_us() - start;
+		close_recorder(&recorder);
+
+		start = now_us();
+		for (size_t offset = 0; offset < stream->size; offset += chunk_size) {
+			size_t length = stream->size - offset < (size_t)chunk_size
+			                    ? stream->size - offset
+			                    : (size_t)chunk_size;
+			memcpy(copy, stream->data + offset, length);
+			sum += copy[length - 1];
+		}
+		copy_us += now_us() - start;
+	}
+	free(copy);
+
+	double mb = stream->size / (1024.0 * 1024.0) * rounds;
+	printf("  recording: %.1f us/MB in %d byte pieces, copying it once "
+	       "%.1f us/MB (%zu)\n",
+	       shift_us / mb, chunk_size, copy_us / mb, sum & 1);
+}
+
+static int check_argc(int argc, char **argv, int i) {
+	if (i >= argc - 1) {
+		fprintf(stderr, "Missing argument for option: %s\n", argv[i]);
+		return 0;
+	}
+	return 1;
+}
+
+static void help(void) {
+	printf("Usage: timeshift [options...]\n");
+	printf("  Checks the timeshift recording of the radio and its index on\n");
+	printf("  a generated MP3 and AAC stream\n");
+	printf("  -h Show help\n");
+	printf("  -s Specify seconds of the streams (default 600)\n");
+	printf("  -b Specify blocks of 32 KB in the file (default 64)\n");
+	printf("  -k Specify bitrate of the MP3 stream in kbps (default 128)\n");
+	printf("  -a Specify bitrate of the AAC stream in kbps (default 64)\n");
+	printf("  -c Specify piece the stream arrives in (default 1460)\n");
+	printf("  -r Specify random reads (default 20000)\n");
+	printf("  -n Specify rounds to measure (default 5)\n");
+	printf("  -d Specify bounce buffer of the file (default 8192, 0 none)\n");
+	printf("  -f Specify file to record to (default a temporary one)\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		if (*argv[i] != '-') continue;
+		int *value = NULL;
+		switch (argv[i][1]) {
+			case 's': value = &stream_s; break;
+			case 'b': value = &nr_blocks; break;
+			case 'k': value = &mp3_kbps; break;
+			case 'a': value = &aac_kbps; break;
+			case 'c': value = &chunk_size; break;
+			case 'r': value = &nr_reads; break;
+			case 'n': value = &rounds; break;
+			case 'd': value = &bounce; break;
+			case 'f':
+				if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+				path = argv[++i];
+				break;
+			case 'h': help(); return EXIT_SUCCESS;
+		}
+		if (value) {
+			if (!check_argc(argc, argv, i)) return EXIT_FAILURE;
+			*value = atoi(argv[++i]);
+		}
+	}
+	/* The listener's steps take ten minutes */
+	if (stream_s < 600) stream_s = 600;
+	if (nr_blocks < 2) nr_blocks = 2;
+	if (chunk_size < 1) chunk_size = 1;
+	if (rounds < 1) rounds = 1;
+	if (bounce < 0) bounce = 0;
+
+	char temporary[] = "/tmp/timeshiftXXXXXX";
+	if (!path) {
+		int fd = mkstemp(temporary);
+		if (fd < 0) {
+			fprintf(stderr, "cannot make a temporary file\n");
+			return EXIT_FAILURE;
+		}
+		close(fd);
+		path = temporary;
+	}
+
+	struct stream streams[] = {
+		{ .codec = RADIO_CODEC_MP3, .name = "mp3", .kbps = mp3_kbps },
+		{ .codec = RADIO_CODEC_AAC, .name = "aac", .kbps = aac_kbps },
+	};
+	int failed = 0;
+	for (size_t s = 0; s < sizeof streams / sizeof *streams; s++) {
+		struct stream *stream = &streams[s];
+		if (!make_stream(stream)) {
+			failed = 1;
+		} else {
+			failed |= !run_recording(stream);
+			failed |= !run_listener(stream);
+			measure(stream);
+		}
+		free_stream(stream);
+	}
+	if (path == temporary) unlink(temporary);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}